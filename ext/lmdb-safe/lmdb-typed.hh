@@ -225,7 +225,7 @@ public:
       if((*d_parent.d_txn)->get(d_parent.d_parent->d_main, id, data))
         return false;
       
-      serFromString(data.get<std::string>(), t);
+      serFromString(data.get<string_view>(), t);
       return true;
     }
 
@@ -286,10 +286,10 @@ public:
         if(d_on_index) {
           if((*d_parent->d_txn)->get(d_parent->d_parent->d_main, d_id, d_data))
             throw std::runtime_error("Missing id in constructor");
-          serFromString(d_data.get<std::string>(), d_t);
+          serFromString(d_data.get<string_view>(), d_t);
         }
         else
-          serFromString(d_id.get<std::string>(), d_t);
+          serFromString(d_id.get<string_view>(), d_t);
       }
 
       explicit iter_t(Parent* parent, typename Parent::cursor_t&& cursor, const std::string& prefix) :
@@ -311,10 +311,10 @@ public:
         if(d_on_index) {
           if((*d_parent->d_txn)->get(d_parent->d_parent->d_main, d_id, d_data))
             throw std::runtime_error("Missing id in constructor");
-          serFromString(d_data.get<std::string>(), d_t);
+          serFromString(d_data.get<string_view>(), d_t);
         }
         else
-          serFromString(d_id.get<std::string>(), d_t);
+          serFromString(d_id.get<string_view>(), d_t);
       }
 
       
@@ -367,13 +367,13 @@ public:
             if(filter && !filter(data))
               goto next;
             
-            serFromString(data.get<std::string>(), d_t);
+            serFromString(data.get<string_view>(), d_t);
           }
           else {
             if(filter && !filter(data))
               goto next;
                         
-            serFromString(d_id.get<std::string>(), d_t);
+            serFromString(d_id.get<string_view>(), d_t);
           }
         }
         return *this;
@@ -639,7 +639,7 @@ public:
       while(!cursor.get(key, data, first ? MDB_FIRST : MDB_NEXT)) {
         first = false;
         T t;
-        serFromString(data.get<std::string>(), t);
+        serFromString(data.get<string_view>(), t);
         clearIndex(key.get<uint32_t>(), t);
         cursor.del();
       }
@@ -710,6 +710,12 @@ public:
   {
     return d_env;
   }
+
+  //! The main table, holding the serialized items, for raw access
+  MDBDbi& getMainDBI()
+  {
+    return d_main;
+  }
   
 private:
   std::shared_ptr<MDBEnv> d_env;
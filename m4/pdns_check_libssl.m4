@@ -0,0 +1,9 @@
+AC_DEFUN([PDNS_CHECK_LIBSSL], [
+  AS_IF([test -n "$HAVE_LIBSSL"], [ : ], [
+    PKG_CHECK_MODULES([LIBSSL], [libssl], [
+      HAVE_LIBSSL=y
+      AC_DEFINE([HAVE_LIBSSL], [1], [Define to 1 if you have OpenSSL libssl])
+    ], [ HAVE_LIBSSL=n ])
+  ])
+  AM_CONDITIONAL([HAVE_LIBSSL], [test "$HAVE_LIBSSL" = "y"])
+])
@@ -35,6 +35,9 @@
 #include <boost/algorithm/string.hpp>
 #include <system_error>
 #include <unordered_map>
+#include <condition_variable>
+#include <functional>
+#include <thread>
 #include <unordered_set>
 
 #include "pdns/dnsseckeeper.hh"
@@ -54,6 +57,9 @@
 #include "pdns/dynlistener.hh"
 #include "pdns/lock.hh"
 #include "pdns/namespaces.hh"
+#include "pdns/statbag.hh"
+
+extern StatBag S;
 
 /* 
    All instances of this backend share one s_state, which is indexed by zone name and zone id.
@@ -82,6 +88,11 @@ pthread_mutex_t Bind2Backend::s_supermaster_config_lock=PTHREAD_MUTEX_INITIALIZE
 pthread_mutex_t Bind2Backend::s_startup_lock=PTHREAD_MUTEX_INITIALIZER;
 string Bind2Backend::s_binddirectory;  
 
+std::atomic<uint64_t> Bind2Backend::s_zonesPending(0);
+std::atomic<uint64_t> Bind2Backend::s_zonesParsed(0);
+std::atomic<uint64_t> Bind2Backend::s_zonesRejected(0);
+std::atomic<uint64_t> Bind2Backend::s_zonesUnchanged(0);
+
 template <typename T>
 std::mutex LookButDontTouch<T>::s_lock;
 
@@ -132,6 +143,8 @@ void BB2DomainInfo::setCtime()
   if(stat(d_filename.c_str(),&buf)<0)
     return; 
   d_ctime=buf.st_ctime;
+  d_dev=buf.st_dev;
+  d_ino=buf.st_ino;
 }
 
 bool Bind2Backend::safeGetBBDomainInfo(int id, BB2DomainInfo* bbd)
@@ -485,6 +498,12 @@ void Bind2Backend::parseZoneFile(BB2DomainInfo *bbd)
   } else
     nsec3zone=getNSEC3PARAM(bbd->d_name, &ns3pr);
 
+  parseZoneFile(bbd, nsec3zone, ns3pr);
+}
+
+// does not touch the DNSSEC database, so it can be called from several threads at once
+void Bind2Backend::parseZoneFile(BB2DomainInfo *bbd, bool nsec3zone, const NSEC3PARAMRecordContent& ns3pr)
+{
   auto records = std::make_shared<recordstorage_t>();
   ZoneParserTNG zpt(bbd->d_filename, bbd->d_name, s_binddirectory);
   zpt.setMaxGenerateSteps(::arg().asNum("max-generate-steps"));
@@ -722,6 +741,7 @@ Bind2Backend::Bind2Backend(const string &suffix, bool loadZones)
   d_getTSIGKeysQuery_stmt = NULL;
 
   setArgPrefix("bind"+suffix);
+  d_suffix=suffix;
   d_logprefix="[bind"+suffix+"backend]";
   d_hybrid=mustDo("hybrid");
   d_transaction_id=0;
@@ -738,7 +758,7 @@ Bind2Backend::Bind2Backend(const string &suffix, bool loadZones)
   }
   
   if(loadZones) {
-    loadConfig();
+    loadConfig(nullptr, mustDo("background-load"));
     s_first=0;
   }
   
@@ -859,7 +879,160 @@ void Bind2Backend::doEmptyNonTerminals(std::shared_ptr<recordstorage_t>& records
   }
 }
 
-void Bind2Backend::loadConfig(string* status)
+/* Only one (re)load of the configuration at a time, as the initial one might still
+   be running in the background when a rediscover comes in. An instance of this
+   class is held for as long as a load is in progress. */
+class LoadInProgress
+{
+public:
+  LoadInProgress()
+  {
+    std::unique_lock<std::mutex> lock(s_lock);
+    s_cond.wait(lock, []() { return !s_inProgress; });
+    s_inProgress=true;
+  }
+
+  ~LoadInProgress()
+  {
+    std::lock_guard<std::mutex> lock(s_lock);
+    s_inProgress=false;
+    s_cond.notify_all();
+  }
+
+private:
+  static std::mutex s_lock;
+  static std::condition_variable s_cond;
+  static bool s_inProgress;
+};
+
+std::mutex LoadInProgress::s_lock;
+std::condition_variable LoadInProgress::s_cond;
+bool LoadInProgress::s_inProgress{false};
+
+/* The thread doing a load in the background. It is joined when the process exits,
+   after having been told to skip the zones it has not started parsing yet. */
+class BackgroundLoader
+{
+public:
+  ~BackgroundLoader()
+  {
+    s_stop=true;
+    join();
+  }
+
+  void start(std::function<void()> func)
+  {
+    // a previous load is over since the caller holds a LoadInProgress, reap its thread
+    join();
+    std::lock_guard<std::mutex> lock(d_lock);
+    d_thread=std::thread(std::move(func));
+  }
+
+  static bool mustStop()
+  {
+    return s_stop;
+  }
+
+private:
+  void join()
+  {
+    std::lock_guard<std::mutex> lock(d_lock);
+    if(d_thread.joinable()) {
+      d_thread.join();
+    }
+  }
+
+  std::mutex d_lock;
+  std::thread d_thread;
+  static std::atomic<bool> s_stop;
+};
+
+std::atomic<bool> BackgroundLoader::s_stop{false};
+static BackgroundLoader s_backgroundLoader;
+
+struct Bind2Backend::ZoneToLoad
+{
+  BB2DomainInfo bbd;
+  string type;
+  bool isNew{false};
+  bool rejected{false};
+};
+
+/* Parses these zones using up to 'threads' threads, the current one included.
+   Every zone is stored into s_state as soon as it has been parsed, so that
+   it can be served without waiting for the remaining ones. */
+void Bind2Backend::loadZones(std::vector<ZoneToLoad>& zones, size_t threads)
+{
+  std::atomic<size_t> next(0);
+  std::mutex dnssecdbLock; // d_dnssecdb can't be used by several threads at once
+
+  auto worker = [this,&zones,&next,&dnssecdbLock]() {
+    for (size_t idx = next++; idx < zones.size(); idx = next++) {
+      if (BackgroundLoader::mustStop()) {
+        break;
+      }
+      ZoneToLoad& zone = zones.at(idx);
+      BB2DomainInfo& bbd = zone.bbd;
+      g_log<<Logger::Info<<d_logprefix<<" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"'"<<endl;
+
+      try {
+        NSEC3PARAMRecordContent ns3pr;
+        bool nsec3zone;
+        if (d_hybrid) {
+          DNSSECKeeper dk;
+          nsec3zone=dk.getNSEC3PARAM(bbd.d_name, &ns3pr);
+        }
+        else {
+          std::lock_guard<std::mutex> lock(dnssecdbLock);
+          nsec3zone=getNSEC3PARAM(bbd.d_name, &ns3pr);
+        }
+        parseZoneFile(&bbd, nsec3zone, ns3pr);
+      }
+      catch(PDNSException &ae) {
+        ostringstream msg;
+        msg<<" error at "+nowTime()+" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"': "<<ae.reason;
+        bbd.d_status=msg.str();
+        zone.rejected=true;
+      }
+      catch(std::system_error &ae) {
+        ostringstream msg;
+        if (ae.code().value() == ENOENT && zone.isNew && zone.type == "slave")
+          msg<<" error at "+nowTime()<<" no file found for new slave domain '"<<bbd.d_name<<"'. Has not been AXFR'd yet";
+        else
+          msg<<" error at "+nowTime()+" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"': "<<ae.what();
+        bbd.d_status=msg.str();
+        zone.rejected=true;
+      }
+      catch(std::exception &ae) {
+        ostringstream msg;
+        msg<<" error at "+nowTime()+" parsing '"<<bbd.d_name<<"' from file '"<<bbd.d_filename<<"': "<<ae.what();
+        bbd.d_status=msg.str();
+        zone.rejected=true;
+      }
+
+      if (zone.rejected) {
+        g_log<<Logger::Warning<<d_logprefix<<bbd.d_status<<endl;
+        s_zonesRejected++;
+      }
+      else {
+        s_zonesParsed++;
+      }
+      safePutBBDomainInfo(bbd);
+      s_zonesPending--;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t idx = 1; idx < threads && idx < zones.size(); idx++) {
+    workers.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : workers) {
+    thread.join();
+  }
+}
+
+void Bind2Backend::loadConfig(string* status, bool inBackground)
 {
   static int domain_id=1;
 
@@ -872,7 +1045,8 @@ void Bind2Backend::loadConfig(string* status)
       g_log<<Logger::Error<<"Error parsing bind configuration: "<<ae.reason<<endl;
       throw;
     }
-      
+
+    auto loading = std::make_shared<LoadInProgress>();
     vector<BindDomainInfo> domains=BP.getDomains();
     this->alsoNotify = BP.getAlsoNotify();
 
@@ -890,6 +1064,7 @@ void Bind2Backend::loadConfig(string* status)
     }
     int rejected=0;
     int newdomains=0;
+    auto zones = std::make_shared<std::vector<ZoneToLoad>>();
 
     struct stat st;
       
@@ -898,6 +1073,7 @@ void Bind2Backend::loadConfig(string* status)
       if(stat(i->filename.c_str(), &st) == 0) {
         i->d_dev = st.st_dev;
         i->d_ino = st.st_ino;
+        i->d_ctime = st.st_ctime;
       }
     }
 
@@ -945,49 +1121,21 @@ void Bind2Backend::loadConfig(string* status)
           bbd.d_kind = DomainInfo::Slave;
 
         newnames.insert(bbd.d_name);
-        if(filenameChanged || !bbd.d_loaded || !bbd.current()) {
-          g_log<<Logger::Info<<d_logprefix<<" parsing '"<<i->name<<"' from file '"<<i->filename<<"'"<<endl;
-
-          try {
-            parseZoneFile(&bbd);
+        // a file that has been replaced or modified since we last parsed it
+        bool fileChanged = i->d_ino != 0 && (bbd.d_dev != i->d_dev || bbd.d_ino != i->d_ino || bbd.d_ctime != i->d_ctime);
+        if(filenameChanged || !bbd.d_loaded || fileChanged || !bbd.current()) {
+          if(inBackground) {
+            bbd.d_status="queued for parsing";
+            safePutBBDomainInfo(bbd);
           }
-          catch(PDNSException &ae) {
-            ostringstream msg;
-            msg<<" error at "+nowTime()+" parsing '"<<i->name<<"' from file '"<<i->filename<<"': "<<ae.reason;
-
-            if(status)
-              *status+=msg.str();
-	    bbd.d_status=msg.str();
-
-            g_log<<Logger::Warning<<d_logprefix<<msg.str()<<endl;
-            rejected++;
-          }
-          catch(std::system_error &ae) {
-            ostringstream msg;
-            if (ae.code().value() == ENOENT && isNew && i->type == "slave")
-              msg<<" error at "+nowTime()<<" no file found for new slave domain '"<<i->name<<"'. Has not been AXFR'd yet";
-            else
-              msg<<" error at "+nowTime()+" parsing '"<<i->name<<"' from file '"<<i->filename<<"': "<<ae.what();
-
-            if(status)
-              *status+=msg.str();
-            bbd.d_status=msg.str();
-            g_log<<Logger::Warning<<d_logprefix<<msg.str()<<endl;
-            rejected++;
-          }
-          catch(std::exception &ae) {
-            ostringstream msg;
-            msg<<" error at "+nowTime()+" parsing '"<<i->name<<"' from file '"<<i->filename<<"': "<<ae.what();
-
-            if(status)
-              *status+=msg.str();
-            bbd.d_status=msg.str();
-
-            g_log<<Logger::Warning<<d_logprefix<<msg.str()<<endl;
-            rejected++;
-          }
-	  safePutBBDomainInfo(bbd);
-	  
+          ZoneToLoad zone;
+          zone.bbd=bbd;
+          zone.type=i->type;
+          zone.isNew=isNew;
+          zones->push_back(std::move(zone));
+        }
+        else {
+          s_zonesUnchanged++;
         }
       }
     vector<DNSName> diff;
@@ -1004,12 +1152,48 @@ void Bind2Backend::loadConfig(string* status)
     set_difference(newnames.begin(), newnames.end(), oldnames.begin(), oldnames.end(), back_inserter(diff));
     newdomains=diff.size();
 
-    ostringstream msg;
-    msg<<" Done parsing domains, "<<rejected<<" rejected, "<<newdomains<<" new, "<<remdomains<<" removed"; 
-    if(status)
-      *status=msg.str();
+    s_zonesPending+=zones->size();
+    size_t threads=std::max(getArgAsNum("load-threads"), 1);
 
-    g_log<<Logger::Error<<d_logprefix<<msg.str()<<endl;
+    auto report = [zones,rejected,newdomains,remdomains](const Bind2Backend& backend, string* status) {
+      int total=rejected;
+      for(const auto& zone : *zones) {
+        if(zone.rejected) {
+          total++;
+          if(status)
+            *status+=zone.bbd.d_status;
+        }
+      }
+
+      ostringstream msg;
+      msg<<" Done parsing domains, "<<total<<" rejected, "<<newdomains<<" new, "<<remdomains<<" removed"; 
+      if(status)
+        *status=msg.str();
+
+      g_log<<Logger::Error<<backend.d_logprefix<<msg.str()<<endl;
+    };
+
+    if(inBackground) {
+      g_log<<Logger::Warning<<d_logprefix<<" Parsing "<<zones->size()<<" zone file(s) in the background, zones will be served as soon as they are parsed"<<endl;
+      // the load is over once this thread releases 'loading'
+      s_backgroundLoader.start([loading,zones,threads,report,suffix=d_suffix]() {
+        try {
+          Bind2Backend bb2(suffix, false); // with our own DNSSEC database handle, as we might outlive the current backend
+          bb2.loadZones(*zones, threads);
+          report(bb2, nullptr);
+        }
+        catch(const PDNSException& e) {
+          g_log<<Logger::Error<<"[bind2backend] Error while parsing zones in the background: "<<e.reason<<endl;
+        }
+        catch(const std::exception& e) {
+          g_log<<Logger::Error<<"[bind2backend] Error while parsing zones in the background: "<<e.what()<<endl;
+        }
+      });
+      return;
+    }
+
+    loadZones(*zones, threads);
+    report(*this, status);
   }
 }
 
@@ -1224,6 +1408,33 @@ bool Bind2Backend::get(DNSResourceRecord &r)
   return true;
 }
 
+bool Bind2Backend::get(DNSZoneRecord &zr)
+{
+  if(!d_handle.d_records) {
+    if(d_handle.mustlog)
+      g_log<<Logger::Warning<<"There were no answers"<<endl;
+    return false;
+  }
+
+  try {
+    if(!d_handle.get(zr)) {
+      if(d_handle.mustlog)
+        g_log<<Logger::Warning<<"End of answers"<<endl;
+
+      d_handle.reset();
+
+      return false;
+    }
+  }
+  catch(...) {
+    d_handle.reset();
+    throw;
+  }
+  if(d_handle.mustlog)
+    g_log<<Logger::Warning<<"Returning: '"<<QType(zr.dr.d_type).getName()<<"' of '"<<zr.dr.d_name<<"', content: '"<<zr.dr.d_content->getZoneRepresentation()<<"'"<<endl;
+  return true;
+}
+
 bool Bind2Backend::handle::get(DNSResourceRecord &r)
 {
   if(d_list)
@@ -1240,13 +1451,13 @@ void Bind2Backend::handle::reset()
 }
 
 //#define DLOG(x) x
-bool Bind2Backend::handle::get_normal(DNSResourceRecord &r)
+const Bind2DNSRecord* Bind2Backend::handle::next_normal()
 {
   DLOG(g_log << "Bind2Backend get() was called for "<<qtype.getName() << " record for '"<<
        qname<<"' - "<<d_records->size()<<" available in total!"<<endl);
   
   if(d_iter==d_end_iter) {
-    return false;
+    return nullptr;
   }
 
   while(d_iter!=d_end_iter && !(qtype.getCode()==QType::ANY || (d_iter)->qtype==qtype.getCode())) {
@@ -1254,22 +1465,32 @@ bool Bind2Backend::handle::get_normal(DNSResourceRecord &r)
     d_iter++;
   }
   if(d_iter==d_end_iter) {
-    return false;
+    return nullptr;
   }
   DLOG(g_log << "Bind2Backend get() returning a rr with a "<<QType(d_iter->qtype).getCode()<<endl);
 
+  const Bind2DNSRecord* record = &*d_iter;
+  d_iter++;
+  return record;
+}
+
+bool Bind2Backend::handle::get_normal(DNSResourceRecord &r)
+{
+  const Bind2DNSRecord* record = next_normal();
+  if(record == nullptr) {
+    return false;
+  }
+
   r.qname=qname.empty() ? domain : (qname+domain);
   r.domain_id=id;
-  r.content=(d_iter)->content;
+  r.content=record->content;
   //  r.domain_id=(d_iter)->domain_id;
-  r.qtype=(d_iter)->qtype;
-  r.ttl=(d_iter)->ttl;
+  r.qtype=record->qtype;
+  r.ttl=record->ttl;
 
   //if(!d_iter->auth && r.qtype.getCode() != QType::A && r.qtype.getCode()!=QType::AAAA && r.qtype.getCode() != QType::NS)
   //  cerr<<"Warning! Unauth response for qtype "<< r.qtype.getName() << " for '"<<r.qname<<"'"<<endl;
-  r.auth = d_iter->auth;
-
-  d_iter++;
+  r.auth = record->auth;
 
   return true;
 }
@@ -1294,19 +1515,75 @@ bool Bind2Backend::list(const DNSName& target, int id, bool include_disabled)
   return true;
 }
 
-bool Bind2Backend::handle::get_list(DNSResourceRecord &r)
+const Bind2DNSRecord* Bind2Backend::handle::next_list()
 {
   if(d_qname_iter!=d_qname_end) {
-    r.qname=d_qname_iter->qname.empty() ? domain : (d_qname_iter->qname+domain);
-    r.domain_id=id;
-    r.content=(d_qname_iter)->content;
-    r.qtype=(d_qname_iter)->qtype;
-    r.ttl=(d_qname_iter)->ttl;
-    r.auth = d_qname_iter->auth;
+    const Bind2DNSRecord* record = &*d_qname_iter;
     d_qname_iter++;
-    return true;
+    return record;
   }
-  return false;
+  return nullptr;
+}
+
+bool Bind2Backend::handle::get_list(DNSResourceRecord &r)
+{
+  const Bind2DNSRecord* record = next_list();
+  if(record == nullptr) {
+    return false;
+  }
+
+  r.qname=record->qname.empty() ? domain : (record->qname+domain);
+  r.domain_id=id;
+  r.content=record->content;
+  r.qtype=record->qtype;
+  r.ttl=record->ttl;
+  r.auth = record->auth;
+  return true;
+}
+
+/* Serves the parsed content of a record, parsing its text form the first time it is served only */
+bool Bind2Backend::handle::get(DNSZoneRecord &zr)
+{
+  const Bind2DNSRecord* record = d_list ? next_list() : next_normal();
+  if(record == nullptr) {
+    return false;
+  }
+
+  if(d_list) {
+    zr.dr.d_name=record->qname.empty() ? domain : (record->qname+domain);
+  }
+  else {
+    zr.dr.d_name=qname.empty() ? domain : (qname+domain);
+  }
+  zr.dr.d_type=record->qtype;
+  zr.dr.d_class=QClass::IN;
+  zr.dr.d_ttl=record->ttl;
+  zr.dr.d_clen=0;
+  zr.dr.d_place=DNSResourceRecord::ANSWER;
+  zr.domain_id=id;
+  zr.auth=record->auth;
+  zr.scopeMask=0;
+
+  // the records are shared between all threads serving this zone
+  auto drc = std::atomic_load(&record->drc);
+  if(drc) {
+    zr.dr.d_content=std::move(drc);
+  }
+  else {
+    DNSResourceRecord rr;
+    rr.qname=zr.dr.d_name;
+    rr.qtype=record->qtype;
+    rr.content=record->content;
+    rr.ttl=record->ttl;
+    rr.auth=record->auth;
+    rr.domain_id=id;
+    DNSBackend::toZoneRecord(rr, zr);
+    if(record->qtype != 0) { // empty non-terminals have no content
+      std::atomic_store(&record->drc, zr.dr.d_content);
+    }
+  }
+
+  return true;
 }
 
 bool Bind2Backend::superMasterBackend(const string &ip, const DNSName& domain, const vector<DNSResourceRecord>&nsset, string *nameserver, string *account, DNSBackend **db)
@@ -1454,6 +1731,15 @@ class Bind2Factory : public BackendFactory
          declare(suffix,"dnssec-db","Filename to store & access our DNSSEC metadatabase, empty for none", "");         
          declare(suffix,"dnssec-db-journal-mode","SQLite3 journal mode", "WAL");
          declare(suffix,"hybrid","Store DNSSEC metadata in other backend","no");
+         declare(suffix,"load-threads","Number of threads parsing zone files","1");
+         declare(suffix,"background-load","Start serving before all zones have been parsed at startup","no");
+
+         // called for every bind entry in launch=, before any thread has been started: declaring again replaces the same entries.
+         // Not done in Bind2Loader, which may run before S has been constructed when the module is linked in
+         S.declare("bind-zones-pending", "Number of zones waiting to be parsed by the BIND backend", [](const std::string&) { return Bind2Backend::s_zonesPending.load(); });
+         S.declare("bind-zones-parsed", "Number of zones parsed by the BIND backend while loading its configuration", [](const std::string&) { return Bind2Backend::s_zonesParsed.load(); });
+         S.declare("bind-zones-rejected", "Number of zones the BIND backend failed to parse while loading its configuration", [](const std::string&) { return Bind2Backend::s_zonesRejected.load(); });
+         S.declare("bind-zones-unchanged", "Number of zones not parsed again because their file had not changed", [](const std::string&) { return Bind2Backend::s_zonesUnchanged.load(); });
       }
 
       DNSBackend *make(const string &suffix="")
@@ -20,6 +20,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #pragma once
+#include <atomic>
 #include <string>
 #include <map>
 #include <set>
@@ -57,6 +58,8 @@ struct Bind2DNSRecord
 {
   DNSName qname;
   string content;
+  //! content parsed the first time get(DNSZoneRecord&) serves this record, then shared. Never set for empty non-terminals or broken records
+  mutable std::shared_ptr<DNSRecordContent> drc;
   string nsec3hash;
   uint32_t ttl;
   uint16_t qtype;
@@ -152,6 +155,8 @@ public:
   set<string> d_also_notify; //!< IP list of hosts to also notify
   LookButDontTouch<recordstorage_t> d_records;  //!< the actual records belonging to this domain
   time_t d_ctime{0};  //!< last known ctime of the file on disk
+  dev_t d_dev{0}; //!< device of the file on disk when it was last parsed
+  ino_t d_ino{0}; //!< inode of the file on disk when it was last parsed
   time_t d_lastcheck{0}; //!< last time domain was checked for freshness
   uint32_t d_lastnotified{0}; //!< Last serial number we notified our slaves of
   unsigned int d_id;  //!< internal id of the domain
@@ -184,6 +189,7 @@ public:
   void lookup(const QType &, const DNSName &qdomain, int zoneId, DNSPacket *p=nullptr) override;
   bool list(const DNSName &target, int id, bool include_disabled=false) override;
   bool get(DNSResourceRecord &) override;
+  bool get(DNSZoneRecord &) override;
   void getAllDomains(vector<DomainInfo> *domains, bool include_disabled=false) override;
 
   static DNSBackend *maker();
@@ -226,6 +232,11 @@ public:
   void parseZoneFile(BB2DomainInfo *bbd);
   void rediscover(string *status=nullptr) override;
 
+  // load progress, exported as statistics
+  static std::atomic<uint64_t> s_zonesPending;
+  static std::atomic<uint64_t> s_zonesParsed;
+  static std::atomic<uint64_t> s_zonesRejected;
+  static std::atomic<uint64_t> s_zonesUnchanged;
 
   // for supermaster support
   bool superMasterBackend(const string &ip, const DNSName &domain, const vector<DNSResourceRecord>&nsset, string *nameserver, string *account, DNSBackend **db) override;
@@ -246,6 +257,7 @@ private:
   {
   public:
     bool get(DNSResourceRecord &);
+    bool get(DNSZoneRecord &);
     void reset();
     
     handle();
@@ -266,6 +278,8 @@ private:
   private:
     bool get_normal(DNSResourceRecord &);
     bool get_list(DNSResourceRecord &);
+    const Bind2DNSRecord* next_normal();
+    const Bind2DNSRecord* next_list();
 
     void operator=(const handle& ); // don't go copying this
     handle(const handle &);
@@ -289,6 +303,7 @@ private:
   unique_ptr<SSqlStatement> d_getTSIGKeysQuery_stmt;
 
   string d_transaction_tmpname;
+  string d_suffix;
   string d_logprefix;
   set<string> alsoNotify; //!< this is used to store the also-notify list of interested peers.
   std::unique_ptr<ofstream> d_of;
@@ -312,5 +327,8 @@ private:
   static string DLAddDomainHandler(const vector<string>&parts, Utility::pid_t ppid);
   static void fixupOrderAndAuth(std::shared_ptr<recordstorage_t>& records, const DNSName& zoneName, bool nsec3zone, NSEC3PARAMRecordContent ns3pr);
   static void doEmptyNonTerminals(std::shared_ptr<recordstorage_t>& records, const DNSName& zoneName, bool nsec3zone, NSEC3PARAMRecordContent ns3pr);
-  void loadConfig(string *status=nullptr);
+  struct ZoneToLoad;
+  void loadZones(std::vector<ZoneToLoad>& zones, size_t threads);
+  static void parseZoneFile(BB2DomainInfo *bbd, bool nsec3zone, const NSEC3PARAMRecordContent& ns3pr);
+  void loadConfig(string *status=nullptr, bool inBackground=false);
 };
@@ -91,6 +91,7 @@ public:
     declare(suffix, "id-query", "Basic with ID query", record_query+" disabled=0 and type=? and name=? and domain_id=?");
     declare(suffix, "any-query", "Any query", record_query+" disabled=0 and name=?");
     declare(suffix, "any-id-query", "Any with ID query", record_query+" disabled=0 and name=? and domain_id=?");
+    declare(suffix, "lookup-names-query", "Lookup of all the records of up to 8 names in a zone", record_query+" disabled=0 and domain_id=? and name IN (?,?,?,?,?,?,?,?)");
 
     declare(suffix, "list-query", "AXFR query", record_query+" (disabled=0 OR ?) and domain_id=? order by name, type");
     declare(suffix, "list-subzone-query", "Subzone listing", record_query+" disabled=0 and (name=? OR name like ?) and domain_id=?");
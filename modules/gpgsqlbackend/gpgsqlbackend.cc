@@ -96,6 +96,7 @@ public:
     declare(suffix, "id-query", "Basic with ID query", record_query+" disabled=false and type=$1 and name=$2 and domain_id=$3");
     declare(suffix, "any-query", "Any query", record_query+" disabled=false and name=$1");
     declare(suffix, "any-id-query", "Any with ID query", record_query+" disabled=false and name=$1 and domain_id=$2");
+    declare(suffix, "lookup-names-query", "Lookup of all the records of up to 8 names in a zone", record_query+" disabled=false and domain_id=$1 and name IN ($2,$3,$4,$5,$6,$7,$8,$9)");
 
     declare(suffix, "list-query", "AXFR query", record_query+" (disabled=false OR $1) and domain_id=$2 order by name, type");
     declare(suffix, "list-subzone-query", "Subzone listing", record_query+" disabled=false and (name=$1 OR name like $2) and domain_id=$3");
@@ -46,8 +46,8 @@
 
 #include "lmdbbackend.hh"
 
-#define SCHEMAVERSION 2
-#define SCHEMAVERSION_TEXT "2"
+#define SCHEMAVERSION 3
+#define SCHEMAVERSION_TEXT "3"
 // List the class version here. Default is 0
 BOOST_CLASS_VERSION(LMDBBackend::KeyDataDB, 1)
 
@@ -81,11 +81,8 @@ LMDBBackend::LMDBBackend(const std::string& suffix)
     schemaversion = _schemaversion.get<uint32_t>();
   }
 
-  if (schemaversion != SCHEMAVERSION) {
-    if (getArgAsNum("schema-version") != SCHEMAVERSION) {
-      throw std::runtime_error("Expected LMDB schema version "+std::to_string(SCHEMAVERSION)+" but got "+std::to_string(schemaversion));
-    }
-    txn->put(pdnsdbi, "schemaversion", SCHEMAVERSION);
+  if (schemaversion != SCHEMAVERSION && getArgAsNum("schema-version") != SCHEMAVERSION) {
+    throw std::runtime_error("Expected LMDB schema version "+std::to_string(SCHEMAVERSION)+" but got "+std::to_string(schemaversion));
   }
 
   MDBOutVal shards;
@@ -100,8 +97,15 @@ LMDBBackend::LMDBBackend(const std::string& suffix)
     d_shards = atoi(getArg("shards").c_str());
     txn->put(pdnsdbi, "shards", d_shards);
   }
-  txn->commit();
   d_trecords.resize(d_shards);
+
+  if (schemaversion != SCHEMAVERSION) {
+    if (schemaversion < 3) {
+      upgradeToSchema3(txn);
+    }
+    txn->put(pdnsdbi, "schemaversion", SCHEMAVERSION);
+  }
+  txn->commit();
   d_dolog = ::arg().mustDo("query-logging");
 }
 
@@ -201,33 +205,182 @@ BOOST_SERIALIZATION_SPLIT_FREE(QType);
 BOOST_SERIALIZATION_SPLIT_FREE(LMDBBackend::KeyDataDB);
 BOOST_IS_BITWISE_SERIALIZABLE(ComboAddress);
 
+/* Records are stored, since schema version 3, as the TTL and a byte of flags
+   followed by the content in wire format, up to the end of the value.
+   Everything is at a fixed offset so that lookups can read records in place,
+   from the memory map. Only content, ttl, auth and disabled are stored, the
+   rest is in the key. */
+static const size_t s_recordFlagsOffset = sizeof(uint32_t);
+static const size_t s_recordContentOffset = s_recordFlagsOffset + 1;
+static const uint8_t s_recordAuthFlag = 0x01;
+static const uint8_t s_recordDisabledFlag = 0x02;
+
 template<>
 std::string serToString(const DNSResourceRecord& rr)
 {
-  // only does content, ttl, auth
   std::string ret;
-  uint16_t len = rr.content.length();
-  ret.reserve(2+len+8);
-  
-  ret.assign((const char*)&len, 2);
-  ret += rr.content;
-  ret.append((const char*)&rr.ttl, 4);
-  ret.append(1, (char)rr.auth);
-  ret.append(1, (char)false);
-  ret.append(1, (char)rr.disabled);
+  ret.reserve(s_recordContentOffset + rr.content.size());
+  ret.assign(reinterpret_cast<const char*>(&rr.ttl), sizeof(rr.ttl));
+  uint8_t flags = (rr.auth ? s_recordAuthFlag : 0) | (rr.disabled ? s_recordDisabledFlag : 0);
+  ret.append(1, static_cast<char>(flags));
+  ret.append(rr.content);
   return ret;
 }
 
 template<>
 void serFromString(const string_view& str, DNSResourceRecord& rr)
 {
-  uint16_t len;
-  memcpy(&len, &str[0], 2);
-  rr.content.assign(&str[2], len);    // len bytes
-  memcpy(&rr.ttl, &str[2] + len, 4);
+  if(str.size() < s_recordContentOffset) {
+    throw std::runtime_error("Invalid LMDB record value of "+std::to_string(str.size())+" bytes");
+  }
+  memcpy(&rr.ttl, str.data(), sizeof(rr.ttl));
+  rr.auth = str[s_recordFlagsOffset] & s_recordAuthFlag;
+  rr.disabled = str[s_recordFlagsOffset] & s_recordDisabledFlag;
+  rr.content.assign(str.data() + s_recordContentOffset, str.size() - s_recordContentOffset);
+  rr.wildcardname.clear();
+}
+
+/* Before schema version 3: the length of the content on two bytes, the
+   content, the TTL, then the auth, (unused) ordername and disabled flags */
+static std::string convertRecordFromSchema2(const string_view& str)
+{
+  uint16_t len = 0;
+  if(str.size() >= sizeof(len)) {
+    memcpy(&len, str.data(), sizeof(len));
+  }
+  if(str.size() != sizeof(len) + len + sizeof(uint32_t) + 3) {
+    throw std::runtime_error("Invalid LMDB schema 2 record value of "+std::to_string(str.size())+" bytes");
+  }
+  DNSResourceRecord rr;
+  rr.content.assign(str.data() + sizeof(len), len);
+  memcpy(&rr.ttl, str.data() + sizeof(len) + len, sizeof(rr.ttl));
   rr.auth = str[str.size()-3];
   rr.disabled = str[str.size()-1];
-  rr.wildcardname.clear();
+  return serToString(rr);
+}
+
+/* DomainInfo entries are stored, since schema version 3, in a compact format
+   that is a lot cheaper to read than a boost archive, since lookups need it:
+   id, notified serial, last check and kind, then the zone, the account and
+   the masters (family, raw address, scope id for IPv6, and port). */
+template<typename T>
+static void appendRaw(std::string& out, T value)
+{
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void appendString(std::string& out, const std::string& value)
+{
+  appendRaw(out, static_cast<uint32_t>(value.size()));
+  out.append(value);
+}
+
+template<>
+std::string serToString(const DomainInfo& di)
+{
+  std::string ret;
+  appendRaw(ret, di.id);
+  appendRaw(ret, di.notified_serial);
+  appendRaw(ret, static_cast<int64_t>(di.last_check));
+  appendRaw(ret, static_cast<uint8_t>(di.kind));
+  appendString(ret, di.zone.empty() ? std::string() : di.zone.toDNSStringLC());
+  appendString(ret, di.account);
+  appendRaw(ret, static_cast<uint32_t>(di.masters.size()));
+  for(const auto& master : di.masters) {
+    if(master.sin4.sin_family == AF_INET) {
+      appendRaw(ret, static_cast<uint8_t>(4));
+      ret.append(reinterpret_cast<const char*>(&master.sin4.sin_addr.s_addr), sizeof(master.sin4.sin_addr.s_addr));
+    }
+    else {
+      appendRaw(ret, static_cast<uint8_t>(6));
+      ret.append(reinterpret_cast<const char*>(&master.sin6.sin6_addr.s6_addr), sizeof(master.sin6.sin6_addr.s6_addr));
+      appendRaw(ret, master.sin6.sin6_scope_id);
+    }
+    appendRaw(ret, master.sin4.sin_port);
+  }
+  return ret;
+}
+
+class LMDBValueReader
+{
+public:
+  LMDBValueReader(const string_view& str): d_str(str)
+  {
+  }
+
+  const char* getBytes(size_t len)
+  {
+    if(len > d_str.size() - d_pos) {
+      throw std::runtime_error("Truncated LMDB value of "+std::to_string(d_str.size())+" bytes");
+    }
+    const char* ret = d_str.data() + d_pos;
+    d_pos += len;
+    return ret;
+  }
+
+  template<typename T> T get()
+  {
+    T value;
+    memcpy(&value, getBytes(sizeof(value)), sizeof(value));
+    return value;
+  }
+
+  string_view getString()
+  {
+    auto len = get<uint32_t>();
+    return string_view(getBytes(len), len);
+  }
+
+private:
+  const string_view& d_str;
+  size_t d_pos{0};
+};
+
+template<>
+void serFromString(const string_view& str, DomainInfo& di)
+{
+  di = DomainInfo();
+  LMDBValueReader reader(str);
+  di.id = reader.get<uint32_t>();
+  di.notified_serial = reader.get<uint32_t>();
+  di.last_check = reader.get<int64_t>();
+  di.kind = static_cast<DomainInfo::DomainKind>(reader.get<uint8_t>());
+  auto zone = reader.getString();
+  if(!zone.empty()) {
+    di.zone = DNSName(zone.data(), zone.size(), 0, false);
+  }
+  auto account = reader.getString();
+  di.account.assign(account.data(), account.size());
+  auto count = reader.get<uint32_t>();
+  for(uint32_t idx = 0; idx < count; idx++) {
+    ComboAddress master;
+    auto family = reader.get<uint8_t>();
+    if(family == 4) {
+      master.sin4.sin_family = AF_INET;
+      memcpy(&master.sin4.sin_addr.s_addr, reader.getBytes(sizeof(master.sin4.sin_addr.s_addr)), sizeof(master.sin4.sin_addr.s_addr));
+    }
+    else if(family == 6) {
+      master.sin6.sin6_family = AF_INET6;
+      memcpy(&master.sin6.sin6_addr.s6_addr, reader.getBytes(sizeof(master.sin6.sin6_addr.s6_addr)), sizeof(master.sin6.sin6_addr.s6_addr));
+      master.sin6.sin6_scope_id = reader.get<uint32_t>();
+    }
+    else {
+      throw std::runtime_error("Invalid address family "+std::to_string(family)+" in LMDB domain entry");
+    }
+    master.sin4.sin_port = reader.get<in_port_t>();
+    di.masters.push_back(master);
+  }
+}
+
+/* Before schema version 3, DomainInfo entries were boost archives */
+static DomainInfo convertDomainInfoFromSchema2(const string_view& str)
+{
+  DomainInfo di;
+  boost::iostreams::array_source source(str.data(), str.size());
+  boost::iostreams::stream<boost::iostreams::array_source> stream(source);
+  boost::archive::binary_iarchive in_archive(stream, boost::archive::no_header|boost::archive::no_codecvt);
+  in_archive >> di;
+  return di;
 }
 
 
@@ -237,12 +390,20 @@ static std::string serializeContent(uint16_t qtype, const DNSName& domain, const
   return drc->serialize(domain, false);
 }
 
-static std::shared_ptr<DNSRecordContent> deserializeContentZR(uint16_t qtype, const DNSName& qname, const std::string& content)
+static std::shared_ptr<DNSRecordContent> deserializeContentZR(uint16_t qtype, const DNSName& qname, const char* content, size_t len)
 {
-  if(qtype == QType::A && content.size() == 4) {
-    return std::make_shared<ARecordContent>(*((uint32_t*)content.c_str()));
-  }
-  return DNSRecordContent::deserialize(qname, qtype, content);
+  if(qtype == QType::A && len == 4) {
+    uint32_t ip;
+    memcpy(&ip, content, sizeof(ip));
+    return std::make_shared<ARecordContent>(ip);
+  }
+  if(qtype == QType::AAAA && len == 16) {
+    ComboAddress ca;
+    ca.sin6.sin6_family = AF_INET6;
+    memcpy(&ca.sin6.sin6_addr.s6_addr, content, len);
+    return std::make_shared<AAAARecordContent>(ca);
+  }
+  return DNSRecordContent::deserialize(qname, qtype, std::string(content, len));
 }
 
 
@@ -493,6 +654,58 @@ std::shared_ptr<LMDBBackend::RecordsROTransaction> LMDBBackend::getRecordsROTran
 }
 
 
+/* rewrites the domains to the schema version 3 format, in the transaction that will update the schema version.
+   Each shard of records is rewritten in its own transaction, which also records the shard's own schema version,
+   so that shards that were already converted by an interrupted upgrade are not converted a second time. */
+void LMDBBackend::upgradeToSchema3(MDBRWTransaction& txn)
+{
+  size_t count = 0;
+  {
+    auto cursor = txn->getRWCursor(d_tdomains->getMainDBI());
+    MDBOutVal key, val;
+    for(int rc = cursor.first(key, val); rc == 0; rc = cursor.next(key, val)) {
+      cursor.put(key, serToString(convertDomainInfoFromSchema2(val.get<string_view>())));
+      count++;
+    }
+  }
+  if(count > 0) {
+    g_log<<Logger::Warning<<"Upgraded "<<count<<" domain"<<addS(count)<<" to LMDB schema version 3"<<endl;
+  }
+
+  for(int shard = 0; shard < d_shards; shard++) {
+    if(access((getArg("filename")+"-"+std::to_string(shard)).c_str(), F_OK) != 0) {
+      continue;
+    }
+
+    auto rwtxn = getRecordsRWTransaction(shard);
+    auto pdnsdbi = rwtxn->txn->openDB("pdns", MDB_CREATE);
+    MDBOutVal shardversion;
+    if(!rwtxn->txn->get(pdnsdbi, "schemaversion", shardversion) && shardversion.get<uint32_t>() >= 3) {
+      g_log<<Logger::Warning<<"Shard "<<shard<<" is already at LMDB schema version "<<shardversion.get<uint32_t>()<<", skipping"<<endl;
+      rwtxn->txn->abort();
+      continue;
+    }
+
+    /* the records with the same key are sorted on their value, so we can't
+       update them in place and insert them back once they have all been removed */
+    std::vector<std::pair<std::string, std::string>> records;
+    {
+      auto cursor = rwtxn->txn->getRWCursor(rwtxn->db->dbi);
+      MDBOutVal key, val;
+      for(int rc = cursor.first(key, val); rc == 0; rc = cursor.next(key, val)) {
+        records.emplace_back(key.get<std::string>(), convertRecordFromSchema2(val.get<string_view>()));
+        cursor.del();
+      }
+    }
+    for(const auto& record : records) {
+      rwtxn->txn->put(rwtxn->db->dbi, record.first, record.second);
+    }
+    rwtxn->txn->put(pdnsdbi, "schemaversion", 3U);
+    rwtxn->txn->commit();
+    g_log<<Logger::Warning<<"Upgraded "<<records.size()<<" record"<<addS(records)<<" of shard "<<shard<<" to LMDB schema version 3"<<endl;
+  }
+}
+
 bool LMDBBackend::deleteDomain(const DNSName &domain)
 {
   auto doms = d_tdomains->getRWTransaction();
@@ -635,9 +848,6 @@ bool LMDBBackend::get(DNSZoneRecord& rr)
     MDBOutVal keyv, val;
     d_getcursor->current(keyv, val);
 
-    DNSResourceRecord drr;
-    serFromString(val.get<string>(), drr);
-
     auto key = keyv.get<string_view>();
     rr.dr.d_type = compoundOrdername::getQType(key).getCode();
 
@@ -652,9 +862,14 @@ bool LMDBBackend::get(DNSZoneRecord& rr)
 
     rr.dr.d_name = compoundOrdername::getQName(key) + d_lookupdomain;
     rr.domain_id = compoundOrdername::getDomainID(key);
-    rr.dr.d_ttl = drr.ttl;
-    rr.dr.d_content = deserializeContentZR(rr.dr.d_type, rr.dr.d_name, drr.content);
-    rr.auth = drr.auth;
+    /* read the serialized record in place, see serToString(), instead of copying it into a DNSResourceRecord first */
+    auto value = val.get<string_view>();
+    if(value.size() < s_recordContentOffset) {
+      throw std::runtime_error("Invalid LMDB record value of "+std::to_string(value.size())+" bytes");
+    }
+    memcpy(&rr.dr.d_ttl, value.data(), sizeof(rr.dr.d_ttl));
+    rr.auth = value[s_recordFlagsOffset] & s_recordAuthFlag;
+    rr.dr.d_content = deserializeContentZR(rr.dr.d_type, rr.dr.d_name, value.data() + s_recordContentOffset, value.size() - s_recordContentOffset);
 
     if(d_getcursor->next(keyv, val) || keyv.get<StringView>().rfind(d_matchkey, 0) != 0) {
       d_getcursor.reset();
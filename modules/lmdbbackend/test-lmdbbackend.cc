@@ -0,0 +1,310 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE unit
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/utility.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+
+#include "pdns/arguments.hh"
+#include "pdns/dnsrecords.hh"
+#include "pdns/misc.hh"
+#include "pdns/statbag.hh"
+#include "pdns/auth-packetcache.hh"
+#include "pdns/auth-querycache.hh"
+#include "pdns/auth-zonecache.hh"
+#include "lmdbbackend.hh"
+
+StatBag S;
+AuthPacketCache PC;
+AuthQueryCache QC;
+AuthZoneCache g_zoneCache;
+ArgvMap &arg()
+{
+  static ArgvMap arg;
+  return arg;
+}
+
+/* The schema version 2 layout of the DomainInfo entries, to build databases to upgrade */
+namespace boost {
+namespace serialization {
+
+template<class Archive>
+void save(Archive & ar, const DNSName& g, const unsigned int version)
+{
+  if(!g.empty()) {
+    std::string tmp = g.toDNSStringLC(); // g++ 4.8 woes
+    ar & tmp;
+  }
+  else
+    ar & "";
+}
+
+template<class Archive>
+void load(Archive & ar, DNSName& g, const unsigned int version)
+{
+  string tmp;
+  ar & tmp;
+  if(tmp.empty())
+    g = DNSName();
+  else
+    g = DNSName(tmp.c_str(), tmp.size(), 0, false);
+}
+
+template<class Archive>
+void serialize(Archive & ar, DomainInfo& g, const unsigned int version)
+{
+  ar & g.zone;
+  ar & g.last_check;
+  ar & g.account;
+  ar & g.masters;
+  ar & g.id;
+  ar & g.notified_serial;
+  ar & g.kind;
+}
+
+} // namespace serialization
+} // namespace boost
+
+BOOST_SERIALIZATION_SPLIT_FREE(DNSName);
+BOOST_IS_BITWISE_SERIALIZABLE(ComboAddress);
+
+static std::string serializeDomainInfoSchema2(const DomainInfo& di)
+{
+  std::string serial_str;
+  boost::iostreams::back_insert_device<std::string> inserter(serial_str);
+  boost::iostreams::stream<boost::iostreams::back_insert_device<std::string> > s(inserter);
+  boost::archive::binary_oarchive oa(s, boost::archive::no_header | boost::archive::no_codecvt);
+  oa << di;
+  s.flush();
+  return serial_str;
+}
+
+/* schema 3 record: TTL, flags, content. Schema 2: length of the content on two bytes, content, TTL, auth, ordername, disabled */
+static std::string convertRecordToSchema2(const string_view& str)
+{
+  BOOST_REQUIRE_GE(str.size(), sizeof(uint32_t) + 1);
+  uint32_t ttl;
+  memcpy(&ttl, str.data(), sizeof(ttl));
+  uint8_t flags = str[sizeof(ttl)];
+  std::string content(str.data() + sizeof(ttl) + 1, str.size() - sizeof(ttl) - 1);
+
+  std::string ret;
+  uint16_t len = content.size();
+  ret.append(reinterpret_cast<const char*>(&len), sizeof(len));
+  ret.append(content);
+  ret.append(reinterpret_cast<const char*>(&ttl), sizeof(ttl));
+  ret.append(1, static_cast<char>((flags & 0x01) ? 1 : 0));
+  ret.append(1, 0);
+  ret.append(1, static_cast<char>((flags & 0x02) ? 1 : 0));
+  return ret;
+}
+
+static const int s_shards = 2;
+static const std::vector<DNSName> s_zones = { DNSName("example.com."), DNSName("example.net.") };
+
+static std::string setupBackend()
+{
+  char dir[] = "/tmp/test-lmdbbackend.XXXXXX";
+  BOOST_REQUIRE(mkdtemp(dir) != nullptr);
+  std::string filename = std::string(dir) + "/pdns.lmdb";
+
+  ::arg().set("lmdb-filename", "Filename for lmdb") = filename;
+  ::arg().set("lmdb-sync-mode", "Synchronisation mode") = "sync";
+  ::arg().set("lmdb-shards", "Number of shards") = std::to_string(s_shards);
+  ::arg().set("lmdb-schema-version", "Maximum allowed schema version") = "3";
+  ::arg().set("query-logging", "Log all queries") = "no";
+  return filename;
+}
+
+static void addRecord(LMDBBackend& backend, const DNSName& zone, int domainId, const std::string& name, uint16_t qtype, const std::string& content)
+{
+  DNSResourceRecord rr;
+  rr.qname = DNSName(name) + zone;
+  rr.qtype = qtype;
+  rr.content = content;
+  rr.ttl = 3600 + qtype;
+  rr.auth = qtype != QType::A || name != "glue.delegated";
+  rr.domain_id = domainId;
+  backend.feedRecord(rr, DNSName());
+}
+
+static std::vector<std::string> getContent(LMDBBackend& backend)
+{
+  std::vector<std::string> ret;
+  for (const auto& zone : s_zones) {
+    DomainInfo di;
+    BOOST_REQUIRE(backend.getDomainInfo(zone, di));
+    std::string domain = di.zone.toString() + " " + std::to_string(di.id) + " " + di.getKindString() + " " + di.account;
+    for (const auto& master : di.masters) {
+      domain += " " + master.toStringWithPort();
+    }
+    ret.push_back(domain);
+    BOOST_REQUIRE(backend.list(zone, di.id, true));
+    DNSResourceRecord rr;
+    while (backend.get(rr)) {
+      ret.push_back(rr.qname.toString() + " " + std::to_string(rr.ttl) + " " + rr.qtype.getName() + " " + rr.content + " " + std::to_string(rr.auth) + " " + std::to_string(rr.disabled));
+    }
+  }
+  return ret;
+}
+
+/* creates the zones, and returns their content as listed by the backend */
+static std::vector<std::string> populate()
+{
+  LMDBBackend backend;
+  for (const auto& zone : s_zones) {
+    BOOST_REQUIRE(backend.createDomain(zone, "slave", "192.0.2.1,[2001:db8::1]:5300,[fe80::1%1]:5301", "account"));
+    DomainInfo di;
+    BOOST_REQUIRE(backend.getDomainInfo(zone, di));
+    BOOST_REQUIRE_EQUAL(di.masters.size(), 3U);
+    BOOST_CHECK_EQUAL(di.masters.at(2).sin6.sin6_scope_id, 1U);
+    BOOST_CHECK_EQUAL(ntohs(di.masters.at(2).sin6.sin6_port), 5301);
+    BOOST_REQUIRE(backend.startTransaction(zone, di.id));
+    addRecord(backend, zone, di.id, "", QType::SOA, "ns1." + zone.toString() + " hostmaster." + zone.toString() + " 1 3600 600 604800 3600");
+    addRecord(backend, zone, di.id, "", QType::NS, "ns1." + zone.toString());
+    addRecord(backend, zone, di.id, "ns1", QType::A, "192.0.2.53");
+    addRecord(backend, zone, di.id, "ns1", QType::AAAA, "2001:db8::53");
+    addRecord(backend, zone, di.id, "", QType::MX, "10 mx." + zone.toString());
+    addRecord(backend, zone, di.id, "", QType::TXT, "\"v=spf1 -all\"");
+    addRecord(backend, zone, di.id, "delegated", QType::NS, "glue.delegated." + zone.toString());
+    addRecord(backend, zone, di.id, "glue.delegated", QType::A, "192.0.2.54");
+    BOOST_REQUIRE(backend.commitTransaction());
+  }
+
+  return getContent(backend);
+}
+
+/* rewrites a schema 3 database into the schema 2 layout. The records of 'convertedShard', if any,
+   are left as they are, as an upgrade interrupted right after converting this shard would have */
+static void downgradeToSchema2(const std::string& filename, const std::vector<DomainInfo>& domains, int convertedShard = -1)
+{
+  for (int shard = 0; shard < s_shards; shard++) {
+    auto env = getMDBEnv((filename + "-" + std::to_string(shard)).c_str(), MDB_NOSUBDIR, 0600);
+    auto txn = env->getRWTransaction();
+    auto dbi = txn->openDB("records", MDB_CREATE | MDB_DUPSORT);
+    auto pdnsdbi = txn->openDB("pdns", MDB_CREATE);
+    if (shard == convertedShard) {
+      txn->put(pdnsdbi, "schemaversion", 3U);
+      txn->commit();
+      continue;
+    }
+
+    std::vector<std::pair<std::string, std::string>> records;
+    {
+      auto cursor = txn->getRWCursor(dbi);
+      MDBOutVal key, val;
+      for (int rc = cursor.first(key, val); rc == 0; rc = cursor.next(key, val)) {
+        records.emplace_back(key.get<std::string>(), convertRecordToSchema2(val.get<string_view>()));
+        cursor.del();
+      }
+    }
+    for (const auto& record : records) {
+      txn->put(dbi, record.first, record.second);
+    }
+    txn->commit();
+  }
+
+  auto env = getMDBEnv(filename.c_str(), MDB_NOSUBDIR, 0600);
+  auto txn = env->getRWTransaction();
+  auto dbi = txn->openDB("domains", MDB_CREATE | MDB_INTEGERKEY);
+  for (const auto& di : domains) {
+    txn->put(dbi, di.id, serializeDomainInfoSchema2(di));
+  }
+  auto pdnsdbi = txn->openDB("pdns", MDB_CREATE);
+  txn->put(pdnsdbi, "schemaversion", 2U);
+  txn->commit();
+}
+
+static std::vector<DomainInfo> getDomains()
+{
+  LMDBBackend backend;
+  std::vector<DomainInfo> domains;
+  for (const auto& zone : s_zones) {
+    DomainInfo di;
+    BOOST_REQUIRE(backend.getDomainInfo(zone, di));
+    di.backend = nullptr;
+    domains.push_back(di);
+  }
+  return domains;
+}
+
+static uint32_t getSchemaVersion(const std::string& filename)
+{
+  auto env = getMDBEnv(filename.c_str(), MDB_NOSUBDIR, 0600);
+  auto txn = env->getRWTransaction();
+  auto pdnsdbi = txn->openDB("pdns", MDB_CREATE);
+  MDBOutVal version;
+  BOOST_REQUIRE_EQUAL(txn->get(pdnsdbi, "schemaversion", version), 0);
+  auto ret = version.get<uint32_t>();
+  txn->abort();
+  return ret;
+}
+
+BOOST_AUTO_TEST_SUITE(lmdbbackend_cc)
+
+BOOST_AUTO_TEST_CASE(test_upgrade_from_schema2) {
+  reportAllTypes();
+  const auto filename = setupBackend();
+  const auto expected = populate();
+  BOOST_REQUIRE_EQUAL(expected.size(), s_zones.size() * 9);
+
+  downgradeToSchema2(filename, getDomains());
+  BOOST_CHECK_EQUAL(getSchemaVersion(filename), 2U);
+
+  {
+    LMDBBackend backend;
+    BOOST_CHECK(getContent(backend) == expected);
+  }
+  BOOST_CHECK_EQUAL(getSchemaVersion(filename), 3U);
+
+  /* the upgrade is not done again */
+  LMDBBackend backend;
+  BOOST_CHECK(getContent(backend) == expected);
+}
+
+BOOST_AUTO_TEST_CASE(test_interrupted_upgrade_from_schema2) {
+  reportAllTypes();
+  const auto filename = setupBackend();
+  const auto expected = populate();
+  const auto domains = getDomains();
+  /* the shards holding the records of both zones */
+  BOOST_REQUIRE_NE(domains.at(0).id % s_shards, domains.at(1).id % s_shards);
+
+  /* the first shard has been converted, then we died before updating the schema version */
+  downgradeToSchema2(filename, domains, domains.at(0).id % s_shards);
+  BOOST_CHECK_EQUAL(getSchemaVersion(filename), 2U);
+
+  LMDBBackend backend;
+  BOOST_CHECK_EQUAL(getSchemaVersion(filename), 3U);
+  BOOST_CHECK(getContent(backend) == expected);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
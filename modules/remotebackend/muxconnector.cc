@@ -0,0 +1,640 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+
+#include "remotebackend.hh"
+
+/* The multiplexing connector sends requests over a small number of UNIX
+   socket connections, shared by all the remotebackend instances using the
+   same connection string. Each request gets an 'id' member that the remote
+   end copies into its reply, so that many requests can be in flight on the
+   same connection and be answered in any order.
+   Every message is preceded by its length, as a 32-bit integer in network
+   byte order, and is encoded either as JSON or as CBOR (RFC 7049). */
+
+/* Larger messages are considered to be a framing error */
+static const uint32_t s_maxMessageSize = 128 * 1024 * 1024;
+
+static void cborAppendHead(std::string& out, uint8_t major, uint64_t value)
+{
+  major <<= 5;
+  size_t len;
+  if (value < 24) {
+    out.append(1, static_cast<char>(major | value));
+    return;
+  }
+  else if (value <= 0xff) {
+    out.append(1, static_cast<char>(major | 24));
+    len = 1;
+  }
+  else if (value <= 0xffff) {
+    out.append(1, static_cast<char>(major | 25));
+    len = 2;
+  }
+  else if (value <= 0xffffffff) {
+    out.append(1, static_cast<char>(major | 26));
+    len = 4;
+  }
+  else {
+    out.append(1, static_cast<char>(major | 27));
+    len = 8;
+  }
+  for (size_t idx = len; idx > 0; idx--) {
+    out.append(1, static_cast<char>((value >> ((idx - 1) * 8)) & 0xff));
+  }
+}
+
+static void cborEncode(const Json& value, std::string& out)
+{
+  switch (value.type()) {
+  case Json::NUL:
+    out.append(1, static_cast<char>(0xf6));
+    break;
+  case Json::BOOL:
+    out.append(1, static_cast<char>(value.bool_value() ? 0xf5 : 0xf4));
+    break;
+  case Json::NUMBER: {
+    /* json11 only knows about doubles, but most of our numbers are integers
+       and are much shorter when encoded as such */
+    const double number = value.number_value();
+    if (std::isfinite(number) && number == std::trunc(number) && std::fabs(number) <= 9007199254740992.0) {
+      if (number >= 0) {
+        cborAppendHead(out, 0, static_cast<uint64_t>(number));
+      }
+      else {
+        cborAppendHead(out, 1, static_cast<uint64_t>(-1 - number));
+      }
+    }
+    else {
+      uint64_t bits;
+      static_assert(sizeof(bits) == sizeof(number), "doubles are expected to be 64-bit wide");
+      memcpy(&bits, &number, sizeof(bits));
+      out.append(1, static_cast<char>(0xfb));
+      for (size_t idx = sizeof(bits); idx > 0; idx--) {
+        out.append(1, static_cast<char>((bits >> ((idx - 1) * 8)) & 0xff));
+      }
+    }
+    break;
+  }
+  case Json::STRING:
+    cborAppendHead(out, 3, value.string_value().size());
+    out.append(value.string_value());
+    break;
+  case Json::ARRAY:
+    cborAppendHead(out, 4, value.array_items().size());
+    for (const auto& item : value.array_items()) {
+      cborEncode(item, out);
+    }
+    break;
+  case Json::OBJECT:
+    cborAppendHead(out, 5, value.object_items().size());
+    for (const auto& item : value.object_items()) {
+      cborAppendHead(out, 3, item.first.size());
+      out.append(item.first);
+      cborEncode(item.second, out);
+    }
+    break;
+  }
+}
+
+class CBORDecoder
+{
+public:
+  CBORDecoder(const std::string& data): d_data(data)
+  {
+  }
+
+  Json decode()
+  {
+    Json result = decodeItem(0);
+    if (d_pos != d_data.size()) {
+      throw JsonException("Trailing data after CBOR message");
+    }
+    return result;
+  }
+
+private:
+  uint8_t getByte()
+  {
+    if (d_pos >= d_data.size()) {
+      throw JsonException("Truncated CBOR message");
+    }
+    return static_cast<uint8_t>(d_data.at(d_pos++));
+  }
+
+  uint64_t getUInt(size_t len)
+  {
+    uint64_t value = 0;
+    for (size_t idx = 0; idx < len; idx++) {
+      value = (value << 8) | getByte();
+    }
+    return value;
+  }
+
+  uint64_t getArgument(uint8_t additional)
+  {
+    if (additional < 24) {
+      return additional;
+    }
+    switch (additional) {
+    case 24:
+      return getUInt(1);
+    case 25:
+      return getUInt(2);
+    case 26:
+      return getUInt(4);
+    case 27:
+      return getUInt(8);
+    }
+    throw JsonException("Unsupported CBOR length encoding " + std::to_string(additional));
+  }
+
+  std::string getString(uint64_t len)
+  {
+    if (len > d_data.size() - d_pos) {
+      throw JsonException("Truncated CBOR message");
+    }
+    std::string result = d_data.substr(d_pos, len);
+    d_pos += len;
+    return result;
+  }
+
+  static double decodeHalf(uint16_t half)
+  {
+    const int exponent = (half >> 10) & 0x1f;
+    const int mantissa = half & 0x3ff;
+    double value;
+    if (exponent == 0) {
+      value = std::ldexp(mantissa, -24);
+    }
+    else if (exponent != 31) {
+      value = std::ldexp(mantissa + 1024, exponent - 25);
+    }
+    else {
+      value = mantissa == 0 ? INFINITY : NAN;
+    }
+    return (half & 0x8000) ? -value : value;
+  }
+
+  Json decodeItem(size_t depth)
+  {
+    if (depth > s_maxDepth) {
+      throw JsonException("CBOR message is nested too deeply");
+    }
+
+    const uint8_t initial = getByte();
+    const uint8_t major = initial >> 5;
+    const uint8_t additional = initial & 0x1f;
+
+    if (major == 7) {
+      switch (additional) {
+      case 20:
+        return Json(false);
+      case 21:
+        return Json(true);
+      case 22:
+      case 23:
+        return Json();
+      case 25:
+        return Json(decodeHalf(static_cast<uint16_t>(getUInt(2))));
+      case 26: {
+        uint32_t bits = static_cast<uint32_t>(getUInt(4));
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return Json(static_cast<double>(value));
+      }
+      case 27: {
+        uint64_t bits = getUInt(8);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return Json(value);
+      }
+      }
+      throw JsonException("Unsupported CBOR simple value " + std::to_string(additional));
+    }
+
+    const uint64_t argument = getArgument(additional);
+    switch (major) {
+    case 0:
+      return Json(static_cast<double>(argument));
+    case 1:
+      return Json(-1 - static_cast<double>(argument));
+    case 2:
+    case 3:
+      return Json(getString(argument));
+    case 4: {
+      Json::array items;
+      for (uint64_t idx = 0; idx < argument; idx++) {
+        items.push_back(decodeItem(depth + 1));
+      }
+      return Json(items);
+    }
+    case 5: {
+      Json::object items;
+      for (uint64_t idx = 0; idx < argument; idx++) {
+        Json key = decodeItem(depth + 1);
+        if (!key.is_string()) {
+          throw JsonException("CBOR map keys should be strings");
+        }
+        items[key.string_value()] = decodeItem(depth + 1);
+      }
+      return Json(items);
+    }
+    default:
+      /* tags, just look at the tagged item */
+      return decodeItem(depth + 1);
+    }
+  }
+
+  static const size_t s_maxDepth = 64;
+  const std::string& d_data;
+  size_t d_pos{0};
+};
+
+struct MultiplexPendingRequest
+{
+  std::mutex d_lock;
+  std::condition_variable d_cv;
+  Json d_reply;
+  uint64_t d_id{0};
+  bool d_done{false};
+};
+
+class MultiplexConnection: public std::enable_shared_from_this<MultiplexConnection>
+{
+public:
+  MultiplexConnection(const std::string& path, bool cbor): d_path(path), d_cbor(cbor)
+  {
+  }
+
+  ~MultiplexConnection()
+  {
+    if (d_fd >= 0) {
+      close(d_fd);
+    }
+  }
+
+  /* connects, starts the thread reading the replies then sends 'initialize' */
+  bool connect(const std::map<std::string,std::string>& options, int timeout)
+  {
+    struct sockaddr_un sock;
+    if (makeUNsockaddr(d_path, &sock)) {
+      g_log<<Logger::Error<<"Unable to create UNIX domain socket: Path '"<<d_path<<"' is not a valid UNIX socket path."<<std::endl;
+      return false;
+    }
+
+    d_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (d_fd < 0) {
+      g_log<<Logger::Error<<"Cannot create socket: "<<stringerror()<<std::endl;
+      return false;
+    }
+    setCloseOnExec(d_fd);
+
+    if (::connect(d_fd, reinterpret_cast<struct sockaddr*>(&sock), sizeof(sock)) != 0) {
+      g_log<<Logger::Error<<"Cannot connect to socket: "<<stringerror()<<std::endl;
+      return false;
+    }
+
+    d_alive = true;
+    std::thread reader(&MultiplexConnection::readReplies, shared_from_this());
+    reader.detach();
+
+    Json msg = Json(Json::object{
+      { "method", "initialize" },
+      { "parameters", Json(options) },
+    });
+    auto pending = send(msg);
+    if (!pending || !wait(pending, timeout) || pending->d_reply["result"] == Json() || pending->d_reply["result"] == Json(false)) {
+      g_log<<Logger::Warning<<"Failed to initialize backend"<<std::endl;
+      fail();
+      return false;
+    }
+    return true;
+  }
+
+  std::shared_ptr<MultiplexPendingRequest> send(const Json& input)
+  {
+    auto pending = std::make_shared<MultiplexPendingRequest>();
+    Json::object request = input.object_items();
+    {
+      std::lock_guard<std::mutex> lock(d_pendingLock);
+      pending->d_id = d_nextId++;
+      d_pending[pending->d_id] = pending;
+    }
+    request["id"] = Json(static_cast<double>(pending->d_id));
+
+    std::string message(sizeof(uint32_t), 0);
+    if (d_cbor) {
+      cborEncode(Json(request), message);
+    }
+    else {
+      message.append(Json(request).dump());
+    }
+    const uint32_t len = htonl(message.size() - sizeof(uint32_t));
+    memcpy(&message.at(0), &len, sizeof(len));
+
+    try {
+      std::lock_guard<std::mutex> lock(d_writeLock);
+      if (!d_alive) {
+        throw std::runtime_error("connection is closed");
+      }
+      writen2(d_fd, message);
+    }
+    catch (const std::exception& e) {
+      g_log<<Logger::Error<<"Error while sending to the remote backend over "<<d_path<<": "<<e.what()<<std::endl;
+      fail();
+      return nullptr;
+    }
+    return pending;
+  }
+
+  /* waits for the reply to a request sent with send(), returns false if none came within 'timeout' milliseconds */
+  bool wait(std::shared_ptr<MultiplexPendingRequest>& pending, int timeout)
+  {
+    {
+      std::unique_lock<std::mutex> lock(pending->d_lock);
+      if (pending->d_cv.wait_for(lock, std::chrono::milliseconds(timeout), [&pending]() { return pending->d_done; })) {
+        return pending->d_reply != Json();
+      }
+    }
+
+    /* a late reply will be ignored */
+    std::lock_guard<std::mutex> lock(d_pendingLock);
+    d_pending.erase(pending->d_id);
+    return false;
+  }
+
+  bool isAlive() const
+  {
+    return d_alive;
+  }
+
+  void disconnect()
+  {
+    fail();
+  }
+
+private:
+  /* the reader thread keeps a reference to the connection until it fails */
+  static void readReplies(std::shared_ptr<MultiplexConnection> conn)
+  {
+    try {
+      std::string payload;
+      for (;;) {
+        uint32_t len;
+        readn2(conn->d_fd, &len, sizeof(len));
+        len = ntohl(len);
+        if (len > s_maxMessageSize) {
+          throw std::runtime_error("message of " + std::to_string(len) + " bytes is too large");
+        }
+        payload.resize(len);
+        if (len > 0) {
+          readn2(conn->d_fd, &payload.at(0), len);
+        }
+
+        Json reply;
+        if (conn->d_cbor) {
+          reply = CBORDecoder(payload).decode();
+        }
+        else {
+          std::string err;
+          reply = Json::parse(payload, err);
+          if (reply == nullptr) {
+            throw std::runtime_error("unable to parse reply: " + err);
+          }
+        }
+
+        if (!reply["id"].is_number()) {
+          throw std::runtime_error("reply without a valid 'id'");
+        }
+        const uint64_t id = static_cast<uint64_t>(reply["id"].number_value());
+        std::shared_ptr<MultiplexPendingRequest> pending;
+        {
+          std::lock_guard<std::mutex> lock(conn->d_pendingLock);
+          auto it = conn->d_pending.find(id);
+          if (it != conn->d_pending.end()) {
+            pending = it->second;
+            conn->d_pending.erase(it);
+          }
+        }
+        if (!pending) {
+          g_log<<Logger::Info<<"Received a reply from the remote backend over "<<conn->d_path<<" for an unknown or expired request "<<id<<std::endl;
+          continue;
+        }
+        {
+          std::lock_guard<std::mutex> lock(pending->d_lock);
+          pending->d_reply = std::move(reply);
+          pending->d_done = true;
+        }
+        pending->d_cv.notify_one();
+      }
+    }
+    catch (const std::exception& e) {
+      if (conn->d_alive) {
+        g_log<<Logger::Error<<"Error while reading from the remote backend over "<<conn->d_path<<": "<<e.what()<<std::endl;
+      }
+    }
+    catch (const PDNSException& e) {
+      if (conn->d_alive) {
+        g_log<<Logger::Error<<"Error while reading from the remote backend over "<<conn->d_path<<": "<<e.reason<<std::endl;
+      }
+    }
+    conn->fail();
+  }
+
+  /* marks the connection as dead and wakes up everyone waiting on it */
+  void fail()
+  {
+    {
+      std::lock_guard<std::mutex> lock(d_writeLock);
+      if (d_alive) {
+        d_alive = false;
+        shutdown(d_fd, SHUT_RDWR);
+      }
+    }
+
+    std::map<uint64_t, std::shared_ptr<MultiplexPendingRequest>> pending;
+    {
+      std::lock_guard<std::mutex> lock(d_pendingLock);
+      pending.swap(d_pending);
+    }
+    for (auto& entry : pending) {
+      {
+        std::lock_guard<std::mutex> lock(entry.second->d_lock);
+        entry.second->d_done = true;
+      }
+      entry.second->d_cv.notify_one();
+    }
+  }
+
+  std::map<uint64_t, std::shared_ptr<MultiplexPendingRequest>> d_pending;
+  std::mutex d_pendingLock;
+  std::mutex d_writeLock;
+  const std::string d_path;
+  uint64_t d_nextId{1};
+  int d_fd{-1};
+  std::atomic<bool> d_alive{false};
+  const bool d_cbor;
+};
+
+/* the connections shared by all the connectors using the same connection string */
+class MultiplexConnectionPool
+{
+public:
+  MultiplexConnectionPool(size_t count): d_connections(count)
+  {
+  }
+
+  size_t assignSlot()
+  {
+    std::lock_guard<std::mutex> lock(d_lock);
+    return d_nextSlot++ % d_connections.size();
+  }
+
+  std::shared_ptr<MultiplexConnection> get(size_t slot, const std::string& path, bool cbor, const std::map<std::string,std::string>& options, int timeout)
+  {
+    {
+      std::lock_guard<std::mutex> lock(d_lock);
+      const auto& conn = d_connections.at(slot);
+      if (conn && conn->isAlive()) {
+        return conn;
+      }
+    }
+
+    /* connecting waits for the 'initialize' round-trip, which should not block the users of the other slots */
+    g_log<<Logger::Info<<"Reconnecting to backend"<<std::endl;
+    auto conn = std::make_shared<MultiplexConnection>(path, cbor);
+    if (!conn->connect(options, timeout)) {
+      return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(d_lock);
+    auto& current = d_connections.at(slot);
+    if (current && current->isAlive()) {
+      /* another backend sharing this slot reconnected it in the meantime */
+      conn->disconnect();
+      return current;
+    }
+    current = conn;
+    return conn;
+  }
+
+private:
+  std::vector<std::shared_ptr<MultiplexConnection>> d_connections;
+  std::mutex d_lock;
+  size_t d_nextSlot{0};
+};
+
+static std::mutex s_poolsLock;
+static std::map<std::string, std::shared_ptr<MultiplexConnectionPool>> s_pools;
+
+MultiplexConnector::MultiplexConnector(std::map<std::string,std::string> optionsMap): d_options(optionsMap)
+{
+  if (optionsMap.count("path") == 0) {
+    g_log<<Logger::Error<<"Cannot find 'path' option in connection string"<<endl;
+    throw PDNSException();
+  }
+  d_path = optionsMap.find("path")->second;
+
+  d_timeout = 2000;
+  if (optionsMap.find("timeout") != optionsMap.end()) {
+    d_timeout = std::stoi(optionsMap.find("timeout")->second);
+  }
+
+  size_t connections = 2;
+  if (optionsMap.find("connections") != optionsMap.end()) {
+    connections = std::stoul(optionsMap.find("connections")->second);
+    if (connections == 0) {
+      throw PDNSException("Invalid connection string: 'connections' should be at least 1");
+    }
+  }
+
+  d_cbor = false;
+  if (optionsMap.find("encoding") != optionsMap.end()) {
+    const auto& encoding = optionsMap.find("encoding")->second;
+    if (encoding == "cbor") {
+      d_cbor = true;
+    }
+    else if (encoding != "json") {
+      throw PDNSException("Invalid connection string: unknown encoding '" + encoding + "'");
+    }
+  }
+
+  std::string key;
+  for (const auto& option : optionsMap) {
+    key += option.first + "=" + option.second + ",";
+  }
+
+  std::lock_guard<std::mutex> lock(s_poolsLock);
+  auto& pool = s_pools[key];
+  if (!pool) {
+    pool = std::make_shared<MultiplexConnectionPool>(connections);
+  }
+  d_pool = pool;
+  /* all the requests of a given backend go over the same connection, so that
+     the remote end sees them in order */
+  d_slot = d_pool->assignSlot();
+}
+
+MultiplexConnector::~MultiplexConnector()
+{
+}
+
+int MultiplexConnector::send_message(const Json& input)
+{
+  d_pending.reset();
+  auto conn = d_pool->get(d_slot, d_path, d_cbor, d_options, d_timeout);
+  if (!conn) {
+    return -1;
+  }
+
+  d_pending = conn->send(input);
+  if (!d_pending) {
+    return -1;
+  }
+  d_connection = conn;
+  return 1;
+}
+
+int MultiplexConnector::recv_message(Json& output)
+{
+  if (!d_pending) {
+    return -1;
+  }
+
+  auto pending = std::move(d_pending);
+  if (!d_connection->wait(pending, d_timeout)) {
+    return -1;
+  }
+  output = std::move(pending->d_reply);
+  return 1;
+}
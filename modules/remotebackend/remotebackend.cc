@@ -102,7 +102,7 @@ bool RemoteBackend::recv(Json& value) {
 
 /**
  * Builds connector based on options
- * Currently supports unix,pipe and http
+ * Currently supports unix, mux, pipe, http and zeromq
  */
 int RemoteBackend::build() {
       std::vector<std::string> parts;
@@ -144,6 +144,8 @@ int RemoteBackend::build() {
       // connectors know what they are doing
       if (type == "unix") {
         this->connector = std::unique_ptr<Connector>(new UnixsocketConnector(options));
+      } else if (type == "mux") {
+        this->connector = std::unique_ptr<Connector>(new MultiplexConnector(options));
       } else if (type == "http") {
         this->connector = std::unique_ptr<Connector>(new HTTPConnector(options));
       } else if (type == "zeromq") {
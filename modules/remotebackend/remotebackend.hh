@@ -125,6 +125,27 @@ class ZeroMQConnector: public Connector {
 };
 #endif
 
+class MultiplexConnectionPool;
+struct MultiplexPendingRequest;
+class MultiplexConnection;
+
+class MultiplexConnector: public Connector {
+  public:
+    MultiplexConnector(std::map<std::string,std::string> options);
+    virtual ~MultiplexConnector();
+    virtual int send_message(const Json &input);
+    virtual int recv_message(Json &output);
+  private:
+    std::map<std::string,std::string> d_options;
+    std::string d_path;
+    std::shared_ptr<MultiplexConnectionPool> d_pool;
+    std::shared_ptr<MultiplexConnection> d_connection;
+    std::shared_ptr<MultiplexPendingRequest> d_pending;
+    size_t d_slot;
+    int d_timeout;
+    bool d_cbor;
+};
+
 class PipeConnector: public Connector {
   public:
 
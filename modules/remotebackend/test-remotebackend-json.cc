@@ -33,10 +33,12 @@
 #include "pdns/statbag.hh"
 #include "pdns/auth-packetcache.hh"
 #include "pdns/auth-querycache.hh"
+#include "pdns/auth-zonecache.hh"
 
 StatBag S;
 AuthPacketCache PC;
 AuthQueryCache QC;
+AuthZoneCache g_zoneCache;
 ArgvMap &arg()
 {
   static ArgvMap arg;
@@ -19,6 +19,7 @@ done
 webrick_pid=""
 socat_pid=""
 zeromq_pid=""
+mux_pid=""
 socat=$(which socat)
 
 function start_web() {
@@ -209,6 +210,67 @@ function stop_unix() {
   fi
 }
 
+function start_mux() {
+  local encoding="$1"
+  local socket="$2"
+  local service_logfile="${mode%\.test}_server.log"
+
+  ./unittest_mux.rb ${encoding} ${socket} >> ${service_logfile} 2>&1 &
+  mux_pid=$!
+
+  local timeout=0
+  while [ ${timeout} -lt 5 ]; do
+    if [ -S "${socket}" ]; then
+      # service is up and running
+      return 0
+    fi
+
+    sleep 1
+    let timeout=timeout+1
+  done
+
+  if kill -0 ${mux_pid} 2>/dev/null; then
+    echo >&2 "WARNING: Timeout (${timeout}s) reached: \"multiplexing\" test service process is running but status check failed"
+    kill -KILL ${mux_pid} 2>/dev/null
+  fi
+
+  echo >&2 "ERROR: A timeout (${timeout}s) was reached while waiting for \"multiplexing\" test service to start!"
+  echo >&2 "       See \"modules/remotebackend/${service_logfile}\" for more details."
+  exit 69
+}
+
+function stop_mux() {
+  if [ -z "${mux_pid}" ]; then
+    # should never happen - why was stop_mux() called?
+    echo >&2 "ERROR: Unable to stop \"multiplexing\" test service: Did we ever start the service?"
+    exit 99
+  fi
+
+  if ! kill -0 ${mux_pid} 2>/dev/null; then
+    # should never happen - did the test crashed the service?
+    echo >&2 "ERROR: Unable to stop \"multiplexing\" test service: service (${mux_pid}) not running"
+    exit 69
+  fi
+
+  kill -TERM ${mux_pid}
+  local timeout=0
+  while [ ${timeout} -lt 5 ]; do
+    if ! kill -0 ${mux_pid} 2>/dev/null; then
+      # service was stopped
+      return 0
+    fi
+
+    sleep 1
+    let timeout=timeout+1
+  done
+
+  if kill -0 ${mux_pid} 2>/dev/null; then
+    echo >&2 "WARNING: Timeout (${timeout}s) reached - killing \"multiplexing\" test service ..."
+    kill -KILL ${mux_pid} 2>/dev/null
+    return $?
+  fi
+}
+
 function run_test() {
  if [ $new_api -eq 0 ]; then
    ./$mode
@@ -228,6 +290,16 @@ case "$mode" in
     run_test
     stop_unix
   ;;
+  remotebackend_mux.test)
+    start_mux "cbor" "/tmp/remotebackend-mux.sock"
+    run_test
+    stop_mux
+  ;;
+  remotebackend_mux_json.test)
+    start_mux "json" "/tmp/remotebackend-mux-json.sock"
+    run_test
+    stop_mux
+  ;;
   remotebackend_http.test)
     start_web "http"
     run_test
@@ -249,7 +321,7 @@ case "$mode" in
     stop_zeromq
   ;;
   *)
-    echo "Usage: $0 remotebackend_(pipe|unix|http|post|json|zeromq).test"
+    echo "Usage: $0 remotebackend_(pipe|unix|mux|mux_json|http|post|json|zeromq).test"
     exit 1
   ;;
 esac
@@ -0,0 +1,149 @@
+#!/usr/bin/env ruby
+
+require 'rubygems'
+require 'bundler/setup'
+require 'json'
+require 'socket'
+require './unittest'
+
+# Minimal CBOR support, enough for the types used by the remotebackend
+module MiniCBOR
+  def self.head(major, value)
+    major <<= 5
+    if value < 24
+      [major | value].pack("C")
+    elsif value <= 0xff
+      [major | 24, value].pack("CC")
+    elsif value <= 0xffff
+      [major | 25, value].pack("Cn")
+    elsif value <= 0xffffffff
+      [major | 26, value].pack("CN")
+    else
+      [major | 27, value].pack("CQ>")
+    end
+  end
+
+  def self.encode(value)
+    case value
+    when nil then "\xf6".b
+    when false then "\xf4".b
+    when true then "\xf5".b
+    when Integer then value >= 0 ? head(0, value) : head(1, -1 - value)
+    when Float then [0xfb, value].pack("CG")
+    when String, Symbol
+      str = value.to_s.b
+      head(3, str.bytesize) + str
+    when Array then value.inject(head(4, value.size)) { |out, item| out + encode(item) }
+    when Hash then value.inject(head(5, value.size)) { |out, (k, v)| out + encode(k.to_s) + encode(v) }
+    else encode(value.to_s)
+    end
+  end
+
+  def self.decode(data)
+    value, pos = decode_item(data.b, 0)
+    raise "trailing data" unless pos == data.bytesize
+    value
+  end
+
+  def self.decode_item(data, pos)
+    initial = data.getbyte(pos)
+    raise "truncated" if initial.nil?
+    pos += 1
+    major = initial >> 5
+    additional = initial & 0x1f
+    if major == 7
+      case additional
+      when 20 then return false, pos
+      when 21 then return true, pos
+      when 22, 23 then return nil, pos
+      when 26 then return data.byteslice(pos, 4).unpack1("g"), pos + 4
+      when 27 then return data.byteslice(pos, 8).unpack1("G"), pos + 8
+      end
+      raise "unsupported simple value #{additional}"
+    end
+    arg = additional
+    if additional >= 24
+      len = { 24 => 1, 25 => 2, 26 => 4, 27 => 8 }[additional]
+      raise "unsupported length #{additional}" if len.nil?
+      arg = data.byteslice(pos, len).bytes.inject(0) { |acc, b| (acc << 8) | b }
+      pos += len
+    end
+    case major
+    when 0 then return arg, pos
+    when 1 then return -1 - arg, pos
+    when 2, 3 then return data.byteslice(pos, arg).force_encoding("UTF-8"), pos + arg
+    when 4
+      ret = []
+      arg.times { item, pos = decode_item(data, pos); ret << item }
+      return ret, pos
+    when 5
+      ret = {}
+      arg.times do
+        key, pos = decode_item(data, pos)
+        ret[key], pos = decode_item(data, pos)
+      end
+      return ret, pos
+    end
+    decode_item(data, pos)
+  end
+end
+
+encoding = ARGV[0] || "json"
+path = ARGV[1] || "/tmp/remotebackend-mux.sock"
+
+h = Handler.new()
+handler_lock = Mutex.new
+f = File.open "/tmp/remotebackend.txt.#{$$}","a"
+f.sync = true
+
+File.unlink(path) if File.exist?(path)
+server = UNIXServer.new(path)
+
+print "[#{Time.now.to_s}] Multiplexing unit test responder running (#{encoding})\n"
+
+trap('INT') { server.close; exit }
+trap('TERM') { server.close; exit }
+
+begin
+  loop do
+    client = server.accept
+    Thread.new(client) do |conn|
+      write_lock = Mutex.new
+      begin
+        loop do
+          len = conn.read(4)
+          break if len.nil? or len.bytesize < 4
+          payload = conn.read(len.unpack1("N"))
+          # every request is answered from its own thread, so that replies
+          # can come back in a different order than the requests
+          Thread.new(payload) do |data|
+            input = encoding == "cbor" ? MiniCBOR.decode(data) : JSON.parse(data)
+            f.puts "#{Time.now.to_f}: [mux] #{input.to_json}"
+            method = "do_#{input["method"].downcase}"
+            args = input["parameters"] || []
+
+            res, log = handler_lock.synchronize do
+              if h.respond_to?(method.to_sym) == false
+                false
+              elsif args.size > 0
+                h.send(method,args)
+              else
+                h.send(method)
+              end
+            end
+            reply = {:id => input["id"], :result => res, :log => log}
+            f.puts "#{Time.now.to_f} [mux]: #{reply.to_json}"
+            out = encoding == "cbor" ? MiniCBOR.encode(reply) : reply.to_json.b
+            write_lock.synchronize { conn.write([out.bytesize].pack("N") + out) }
+          end
+        end
+      rescue IOError, SystemCallError
+      ensure
+        conn.close unless conn.closed?
+      end
+    end
+  end
+rescue SystemExit, Interrupt, IOError
+end
+
+print "[#{Time.now.to_s}] Multiplexing unit test responder ended\n"
@@ -23,6 +23,7 @@
 #include "auth-caches.hh"
 #include "auth-querycache.hh"
 #include "auth-packetcache.hh"
+#include "auth-nsec3cache.hh"
 
 extern AuthPacketCache PC;
 extern AuthQueryCache QC;
@@ -33,6 +34,7 @@ uint64_t purgeAuthCaches()
   uint64_t ret = 0;
   ret += PC.purge();
   ret += QC.purge();
+  g_nsec3Cache.purge();
   return ret;
 }
 
@@ -42,6 +44,7 @@ uint64_t purgeAuthCaches(const std::string& match)
   uint64_t ret = 0;
   ret += PC.purge(match);
   ret += QC.purge(match);
+  g_nsec3Cache.purge(match);
   return ret;
 }
 
@@ -51,6 +54,7 @@ uint64_t purgeAuthCachesExact(const DNSName& qname)
   uint64_t ret = 0;
   ret += PC.purgeExact(qname);
   ret += QC.purgeExact(qname);
+  g_nsec3Cache.purgeExact(qname);
   return ret;
 }
 
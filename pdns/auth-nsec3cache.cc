@@ -0,0 +1,230 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "auth-nsec3cache.hh"
+#include "dnssecinfra.hh"
+#include "statbag.hh"
+extern StatBag S;
+
+AuthNSEC3Cache::AuthNSEC3Cache(size_t mapsCount): d_hashes(mapsCount)
+{
+  pthread_rwlock_init(&d_lock, nullptr);
+
+  S.declare("nsec3-hash-cache-hit", "Number of NSEC3 hashes found in the NSEC3 cache");
+  S.declare("nsec3-hash-cache-miss", "Number of NSEC3 hashes that had to be computed");
+  S.declare("nsec3-range-cache-hit", "Number of NSEC3 records whose owner names were found in the NSEC3 cache");
+  S.declare("nsec3-range-cache-miss", "Number of NSEC3 records whose owner names had to be retrieved from the backend");
+
+  d_statnumhashhit = S.getPointer("nsec3-hash-cache-hit");
+  d_statnumhashmiss = S.getPointer("nsec3-hash-cache-miss");
+  d_statnumrangehit = S.getPointer("nsec3-range-cache-hit");
+  d_statnumrangemiss = S.getPointer("nsec3-range-cache-miss");
+}
+
+AuthNSEC3Cache::~AuthNSEC3Cache()
+{
+  pthread_rwlock_destroy(&d_lock);
+}
+
+void AuthNSEC3Cache::setMaxEntries(uint64_t maxEntries)
+{
+  d_maxEntries = maxEntries;
+}
+
+std::string AuthNSEC3Cache::getHash(const NSEC3PARAMRecordContent& ns3prc, const DNSName& qname)
+{
+  if (d_maxEntries == 0) {
+    return hashQNameWithSalt(ns3prc, qname);
+  }
+
+  auto& shard = d_hashes[qname.hash() % d_hashes.size()];
+  auto& sequence = shard.d_map.get<1>();
+  {
+    std::lock_guard<std::mutex> lock(shard.d_mutex);
+    auto it = shard.d_map.find(boost::make_tuple(qname, ns3prc.d_salt, ns3prc.d_iterations));
+    if (it != shard.d_map.end()) {
+      sequence.relocate(sequence.end(), shard.d_map.project<1>(it));
+      (*d_statnumhashhit)++;
+      return it->hash;
+    }
+  }
+
+  (*d_statnumhashmiss)++;
+  /* hashing is the expensive part, don't hold the lock while doing it */
+  std::string hash = hashQNameWithSalt(ns3prc, qname);
+
+  const size_t maxPerShard = std::max(d_maxEntries / d_hashes.size(), static_cast<uint64_t>(1));
+  std::lock_guard<std::mutex> lock(shard.d_mutex);
+  shard.d_map.insert(HashEntry{qname, ns3prc.d_salt, hash, ns3prc.d_iterations});
+  while (shard.d_map.size() > maxPerShard) {
+    sequence.pop_front();
+  }
+  return hash;
+}
+
+bool AuthNSEC3Cache::isCovered(const std::string& start, const std::string& after, const std::string& hashed)
+{
+  if (start < after) {
+    return start <= hashed && hashed < after;
+  }
+  /* the range of the last hashed owner wraps around to the first one */
+  return start <= hashed || hashed < after;
+}
+
+bool AuthNSEC3Cache::getRange(const DNSName& zone, int zoneId, uint32_t serial, const NSEC3PARAMRecordContent& ns3prc, const std::string& hashed, std::string& before, std::string& after, DNSName& unhashed)
+{
+  if (d_ttl == 0) {
+    return false;
+  }
+
+  time_t now = time(nullptr);
+  {
+    ReadLock rl(&d_lock);
+    auto zoneIt = d_zones.find(zone);
+    if (zoneIt != d_zones.end() && zoneIt->second.matches(zoneId, serial, ns3prc, now) && !zoneIt->second.ranges.empty()) {
+      const auto& ranges = zoneIt->second.ranges;
+      auto it = ranges.upper_bound(hashed);
+      if (it == ranges.begin()) {
+        /* only a range wrapping around can cover a hash smaller than every known owner */
+        it = ranges.end();
+      }
+      --it;
+      if (isCovered(it->first, it->second.after, hashed)) {
+        before = it->first;
+        after = it->second.after;
+        unhashed = it->second.unhashed;
+        (*d_statnumrangehit)++;
+        return true;
+      }
+    }
+  }
+
+  (*d_statnumrangemiss)++;
+  return false;
+}
+
+void AuthNSEC3Cache::insertRange(const DNSName& zone, int zoneId, uint32_t serial, const NSEC3PARAMRecordContent& ns3prc, const std::string& before, const std::string& after, const DNSName& unhashed)
+{
+  /* we only know how to compare hashes */
+  if (d_ttl == 0 || before.empty() || before.size() != after.size()) {
+    return;
+  }
+
+  time_t now = time(nullptr);
+  WriteLock wl(&d_lock);
+  auto& entry = d_zones[zone];
+  if (!entry.matches(zoneId, serial, ns3prc, now)) {
+    d_rangesCount -= entry.ranges.size();
+    entry.ranges.clear();
+    entry.zoneId = zoneId;
+    entry.serial = serial;
+    entry.salt = ns3prc.d_salt;
+    entry.iterations = ns3prc.d_iterations;
+    entry.ttd = now + d_ttl;
+
+    /* get rid of the zones that expired while we are at it */
+    for (auto it = d_zones.begin(); it != d_zones.end(); ) {
+      if (it->second.ttd < now) {
+        d_rangesCount -= it->second.ranges.size();
+        it = d_zones.erase(it);
+      }
+      else {
+        ++it;
+      }
+    }
+  }
+
+  if (d_rangesCount >= d_maxEntries) {
+    return;
+  }
+
+  if (entry.ranges.emplace(before, Range{after, unhashed}).second) {
+    d_rangesCount++;
+  }
+}
+
+uint64_t AuthNSEC3Cache::purgeZonesLocked(const std::function<bool(const DNSName&)>& mustPurge)
+{
+  uint64_t delcount = 0;
+  for (auto it = d_zones.begin(); it != d_zones.end(); ) {
+    if (mustPurge(it->first)) {
+      delcount += it->second.ranges.size();
+      d_rangesCount -= it->second.ranges.size();
+      it = d_zones.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+  return delcount;
+}
+
+uint64_t AuthNSEC3Cache::purge()
+{
+  uint64_t delcount = 0;
+  for (auto& shard : d_hashes) {
+    std::lock_guard<std::mutex> lock(shard.d_mutex);
+    delcount += shard.d_map.size();
+    shard.d_map.clear();
+  }
+
+  WriteLock wl(&d_lock);
+  delcount += purgeZonesLocked([](const DNSName&) { return true; });
+  return delcount;
+}
+
+/* drops the ranges of the zones that might be affected by a change of the names matching 'match'. If match ends on a $, it is treated as a suffix */
+uint64_t AuthNSEC3Cache::purge(const std::string& match)
+{
+  if (!ends_with(match, "$")) {
+    return purgeExact(DNSName(match));
+  }
+
+  DNSName suffix(match.substr(0, match.size() - 1));
+  WriteLock wl(&d_lock);
+  return purgeZonesLocked([&suffix](const DNSName& zone) { return zone.isPartOf(suffix) || suffix.isPartOf(zone); });
+}
+
+uint64_t AuthNSEC3Cache::purgeExact(const DNSName& qname)
+{
+  WriteLock wl(&d_lock);
+  return purgeZonesLocked([&qname](const DNSName& zone) { return qname.isPartOf(zone); });
+}
+
+size_t AuthNSEC3Cache::size()
+{
+  size_t count = 0;
+  for (auto& shard : d_hashes) {
+    std::lock_guard<std::mutex> lock(shard.d_mutex);
+    count += shard.d_map.size();
+  }
+  return count;
+}
+
+size_t AuthNSEC3Cache::getRangesCount()
+{
+  ReadLock rl(&d_lock);
+  return d_rangesCount;
+}
@@ -0,0 +1,141 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/utility.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/composite_key.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+
+#include "dnsname.hh"
+#include "dnsrecords.hh"
+#include "lock.hh"
+#include "misc.hh"
+
+/* Speeds up the NSEC3 denial of existence proofs.
+   The hashes of names are kept in a LRU, so that closest encloser and wildcard
+   names are not hashed again for every query.
+   For each NSEC3 zone, the ranges between two consecutive hashed owner names
+   returned by the backend are kept in a sorted map, so that any other hash falling
+   in a known range is answered from memory. Zones are dropped when their serial or
+   NSEC3 parameters change, when they are purged from the caches, and after
+   'nsec3-cache-ttl' seconds. */
+class AuthNSEC3Cache : public boost::noncopyable
+{
+public:
+  AuthNSEC3Cache(size_t mapsCount=64);
+  ~AuthNSEC3Cache();
+
+  //! returns the hash of qname, computing it on a miss
+  std::string getHash(const NSEC3PARAMRecordContent& ns3prc, const DNSName& qname);
+
+  //! finds the known range of 'zone' that covers 'hashed', returns false if there is none
+  bool getRange(const DNSName& zone, int zoneId, uint32_t serial, const NSEC3PARAMRecordContent& ns3prc, const std::string& hashed, std::string& before, std::string& after, DNSName& unhashed);
+  //! records that there is no hashed owner in 'zone' between 'before' (named 'unhashed') and 'after'
+  void insertRange(const DNSName& zone, int zoneId, uint32_t serial, const NSEC3PARAMRecordContent& ns3prc, const std::string& before, const std::string& after, const DNSName& unhashed);
+
+  uint64_t purge();
+  uint64_t purge(const std::string& match); // could be $ terminated. Is not a dnsname!
+  uint64_t purgeExact(const DNSName& qname); // drops the zones containing qname
+
+  void setMaxEntries(uint64_t maxEntries);
+  void setTTL(uint32_t ttl)
+  {
+    d_ttl = ttl;
+  }
+
+  size_t size(); //!< number of hashes in the cache
+  size_t getRangesCount();
+
+private:
+  struct HashEntry
+  {
+    DNSName qname;
+    std::string salt;
+    std::string hash;
+    unsigned int iterations;
+  };
+
+  typedef boost::multi_index_container<
+    HashEntry,
+    boost::multi_index::indexed_by <
+      boost::multi_index::hashed_unique<boost::multi_index::composite_key<HashEntry,
+                                                                          boost::multi_index::member<HashEntry,DNSName,&HashEntry::qname>,
+                                                                          boost::multi_index::member<HashEntry,std::string,&HashEntry::salt>,
+                                                                          boost::multi_index::member<HashEntry,unsigned int,&HashEntry::iterations> > >,
+      boost::multi_index::sequenced<>
+      >
+    > hashes_t;
+
+  struct HashShard
+  {
+    std::mutex d_mutex;
+    hashes_t d_map;
+  };
+
+  struct Range
+  {
+    std::string after;
+    DNSName unhashed;
+  };
+
+  struct ZoneRanges
+  {
+    /* keyed by the hashed owner starting the range */
+    std::map<std::string, Range> ranges;
+    std::string salt;
+    time_t ttd{0};
+    int zoneId{-1};
+    uint32_t serial{0};
+    unsigned int iterations{0};
+
+    bool matches(int zoneId_, uint32_t serial_, const NSEC3PARAMRecordContent& ns3prc, time_t now) const
+    {
+      return zoneId == zoneId_ && serial == serial_ && iterations == ns3prc.d_iterations && salt == ns3prc.d_salt && ttd >= now;
+    }
+  };
+
+  static bool isCovered(const std::string& start, const std::string& after, const std::string& hashed);
+  uint64_t purgeZonesLocked(const std::function<bool(const DNSName&)>& mustPurge);
+
+  std::vector<HashShard> d_hashes;
+  pthread_rwlock_t d_lock;
+  std::map<DNSName, ZoneRanges> d_zones;
+  size_t d_rangesCount{0};
+
+  uint64_t d_maxEntries{100000};
+  uint32_t d_ttl{60};
+
+  AtomicCounter *d_statnumhashhit;
+  AtomicCounter *d_statnumhashmiss;
+  AtomicCounter *d_statnumrangehit;
+  AtomicCounter *d_statnumrangemiss;
+};
+
+extern AuthNSEC3Cache g_nsec3Cache;
@@ -0,0 +1,149 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "auth-zonecache.hh"
+#include "statbag.hh"
+extern StatBag S;
+
+AuthZoneCache::AuthZoneCache(): d_tree(std::unique_ptr<tree_t>(new tree_t()))
+{
+  pthread_rwlock_init(&d_lock, nullptr);
+
+  S.declare("zone-cache-hit", "Number of zone cache hits");
+  S.declare("zone-cache-miss", "Number of zone cache misses");
+  S.declare("zone-cache-size", "Number of entries in the zone cache");
+
+  d_statnumhit = S.getPointer("zone-cache-hit");
+  d_statnummiss = S.getPointer("zone-cache-miss");
+  d_statnumentries = S.getPointer("zone-cache-size");
+}
+
+AuthZoneCache::~AuthZoneCache()
+{
+  pthread_rwlock_destroy(&d_lock);
+}
+
+bool AuthZoneCache::hasZone(const tree_t& tree, const DNSName& zone)
+{
+  const auto* found = tree.lookup(zone);
+  return found != nullptr && found->zone == zone;
+}
+
+bool AuthZoneCache::getBestMatch(const DNSName& name, ZoneInfo& zone)
+{
+  if (!d_enabled) {
+    return false;
+  }
+
+  {
+    ReadLock rl(&d_lock);
+    const auto* found = d_tree->lookup(name);
+    if (found != nullptr) {
+      zone = *found;
+      (*d_statnumhit)++;
+      return true;
+    }
+  }
+
+  (*d_statnummiss)++;
+  return false;
+}
+
+void AuthZoneCache::replace(const zones_t& zones)
+{
+  /* build the new tree without holding the lock, lookups keep using the current one */
+  std::unique_ptr<tree_t> newTree(new tree_t());
+  size_t count = 0;
+  for (const auto& zone : zones) {
+    /* when several backends have the same zone, the first one wins */
+    if (!hasZone(*newTree, zone.zone)) {
+      newTree->add(zone.zone, zone);
+      count++;
+    }
+  }
+
+  WriteLock wl(&d_lock);
+  d_tree.swap(newTree);
+  *d_statnumentries = count;
+
+  /* replay the changes that happened since the list of zones was retrieved */
+  if (d_replacePending) {
+    for (const auto& change : d_pendingChanges) {
+      if (change.second) {
+        addLocked(change.first);
+      }
+      else {
+        removeLocked(change.first.zone);
+      }
+    }
+    d_pendingChanges.clear();
+    d_replacePending = false;
+  }
+
+  d_enabled = true;
+}
+
+void AuthZoneCache::setReplacePending()
+{
+  WriteLock wl(&d_lock);
+  d_replacePending = true;
+  d_pendingChanges.clear();
+}
+
+void AuthZoneCache::add(const ZoneInfo& zone)
+{
+  WriteLock wl(&d_lock);
+  addLocked(zone);
+  if (d_replacePending) {
+    d_pendingChanges.push_back({zone, true});
+  }
+}
+
+void AuthZoneCache::remove(const DNSName& zone)
+{
+  WriteLock wl(&d_lock);
+  removeLocked(zone);
+  if (d_replacePending) {
+    ZoneInfo zi;
+    zi.zone = zone;
+    d_pendingChanges.push_back({zi, false});
+  }
+}
+
+void AuthZoneCache::addLocked(const ZoneInfo& zone)
+{
+  if (!hasZone(*d_tree, zone.zone)) {
+    (*d_statnumentries)++;
+  }
+  d_tree->add(zone.zone, zone);
+}
+
+void AuthZoneCache::removeLocked(const DNSName& zone)
+{
+  if (hasZone(*d_tree, zone)) {
+    (*d_statnumentries)--;
+    d_tree->remove(zone);
+  }
+}
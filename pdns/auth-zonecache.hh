@@ -0,0 +1,102 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <boost/utility.hpp>
+
+#include "dnsname.hh"
+#include "lock.hh"
+#include "misc.hh"
+
+/* Knows every zone we are authoritative for, along with the backend serving it
+   (its position in UeberBackend::backends, which is the same for every instance)
+   and its id in that backend, so that the closest enclosing zone of a name can be
+   found without asking the backends.
+   The content is loaded from getAllDomains() at startup then periodically refreshed,
+   zones created or deleted in the meantime are added or removed as they go. */
+class AuthZoneCache : public boost::noncopyable
+{
+public:
+  struct ZoneInfo
+  {
+    DNSName zone;
+    int zoneId{-1};
+    size_t backendIndex{0};
+  };
+  typedef std::vector<ZoneInfo> zones_t;
+
+  AuthZoneCache();
+  ~AuthZoneCache();
+
+  //! replaces the whole content of the cache, enabling it the first time
+  void replace(const zones_t& zones);
+  void add(const ZoneInfo& zone);
+  void remove(const DNSName& zone);
+  //! to be called before retrieving the list of zones that will be passed to replace(), so that zones added or removed in the meantime are not lost
+  void setReplacePending();
+
+  //! finds the closest zone that 'name' is part of, returns false if there is none
+  bool getBestMatch(const DNSName& name, ZoneInfo& zone);
+
+  size_t size()
+  {
+    return *d_statnumentries;
+  }
+
+  bool isEnabled() const
+  {
+    return d_enabled;
+  }
+
+  void setRefreshInterval(uint32_t interval)
+  {
+    d_refreshInterval = interval;
+  }
+
+  uint32_t getRefreshInterval() const
+  {
+    return d_refreshInterval;
+  }
+
+private:
+  typedef SuffixMatchTree<ZoneInfo> tree_t;
+
+  static bool hasZone(const tree_t& tree, const DNSName& zone);
+  void addLocked(const ZoneInfo& zone);
+  void removeLocked(const DNSName& zone);
+
+  pthread_rwlock_t d_lock;
+  std::unique_ptr<tree_t> d_tree;
+  /* zones added (true) or removed (false) while a replace is pending */
+  std::vector<std::pair<ZoneInfo, bool>> d_pendingChanges;
+  bool d_replacePending{false};
+  std::atomic<bool> d_enabled{false};
+  uint32_t d_refreshInterval{0};
+
+  AtomicCounter *d_statnumhit;
+  AtomicCounter *d_statnummiss;
+  AtomicCounter *d_statnumentries;
+};
+
+extern AuthZoneCache g_zoneCache;
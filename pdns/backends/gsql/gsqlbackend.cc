@@ -57,6 +57,7 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   d_IdQuery=getArg("id-query");
   d_ANYNoIdQuery=getArg("any-query");
   d_ANYIdQuery=getArg("any-id-query");
+  d_LookupNamesQuery=getArg("lookup-names-query");
 
   d_listQuery=getArg("list-query");
   d_listSubZoneQuery=getArg("list-subzone-query");
@@ -128,6 +129,7 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   d_IdQuery_stmt = NULL;
   d_ANYNoIdQuery_stmt = NULL;
   d_ANYIdQuery_stmt = NULL;
+  d_LookupNamesQuery_stmt = NULL;
   d_listQuery_stmt = NULL;
   d_listSubZoneQuery_stmt = NULL;
   d_InfoOfDomainsZoneQuery_stmt = NULL;
@@ -1132,6 +1134,58 @@ void GSQLBackend::lookup(const QType &qtype,const DNSName &qname, int domain_id,
   d_qname=qname;
 }
 
+bool GSQLBackend::lookupNames(const std::vector<DNSName>& names, int zoneId, std::vector<DNSResourceRecord>& records)
+{
+  if(d_LookupNamesQuery.empty() || zoneId < 0)
+    return false;
+
+  /* extractRecord() uses the name from the row when d_qname is empty,
+     preserve it in case a regular lookup is in progress */
+  DNSName savedQName;
+  std::swap(savedQName, d_qname);
+
+  try {
+    reconnectIfNeeded();
+
+    SSqlStatement::row_t row;
+    for(size_t start = 0; start < names.size(); start += s_lookupNamesBatchSize) {
+      d_LookupNamesQuery_stmt->
+        bind("domain_id", zoneId);
+      /* the query has a fixed number of placeholders, pad with a name we already look for */
+      for(size_t idx = 0; idx < s_lookupNamesBatchSize; idx++) {
+        const DNSName& name = start + idx < names.size() ? names.at(start + idx) : names.at(start);
+        d_LookupNamesQuery_stmt->
+          bind("qname" + std::to_string(idx + 1), name);
+      }
+      d_LookupNamesQuery_stmt->
+        execute();
+
+      while(d_LookupNamesQuery_stmt->hasNextRow()) {
+        d_LookupNamesQuery_stmt->nextRow(row);
+        ASSERT_ROW_COLUMNS("lookup-names-query", row, 8);
+        DNSResourceRecord rr;
+        try {
+          extractRecord(row, rr);
+        }
+        catch(...) {
+          continue;
+        }
+        records.push_back(std::move(rr));
+      }
+
+      d_LookupNamesQuery_stmt->
+        reset();
+    }
+  }
+  catch(SSqlException &e) {
+    std::swap(savedQName, d_qname);
+    throw PDNSException("GSQLBackend unable to lookup names in zone with id " + std::to_string(zoneId) + ": " + e.txtReason());
+  }
+
+  std::swap(savedQName, d_qname);
+  return true;
+}
+
 bool GSQLBackend::list(const DNSName &target, int domain_id, bool include_disabled)
 {
   DLOG(g_log<<"GSQLBackend constructing handle for list of domain id '"<<domain_id<<"'"<<endl);
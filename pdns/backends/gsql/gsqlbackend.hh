@@ -59,6 +59,9 @@ public:
       d_IdQuery_stmt = d_db->prepare(d_IdQuery, 3);
       d_ANYNoIdQuery_stmt = d_db->prepare(d_ANYNoIdQuery, 1);
       d_ANYIdQuery_stmt = d_db->prepare(d_ANYIdQuery, 2);
+      if (!d_LookupNamesQuery.empty()) {
+        d_LookupNamesQuery_stmt = d_db->prepare(d_LookupNamesQuery, 1 + s_lookupNamesBatchSize);
+      }
       d_listQuery_stmt = d_db->prepare(d_listQuery, 2);
       d_listSubZoneQuery_stmt = d_db->prepare(d_listSubZoneQuery, 3);
       d_MasterOfDomainsZoneQuery_stmt = d_db->prepare(d_MasterOfDomainsZoneQuery, 1);
@@ -122,6 +125,7 @@ public:
     d_IdQuery_stmt.reset();
     d_ANYNoIdQuery_stmt.reset();
     d_ANYIdQuery_stmt.reset();
+    d_LookupNamesQuery_stmt.reset();
     d_listQuery_stmt.reset();
     d_listSubZoneQuery_stmt.reset();
     d_MasterOfDomainsZoneQuery_stmt.reset();
@@ -180,6 +184,7 @@ public:
   }
 
   void lookup(const QType &, const DNSName &qdomain, int zoneId, DNSPacket *p=nullptr) override;
+  bool lookupNames(const std::vector<DNSName>& names, int zoneId, std::vector<DNSResourceRecord>& records) override;
   bool list(const DNSName &target, int domain_id, bool include_disabled=false) override;
   bool get(DNSResourceRecord &r) override;
   void getAllDomains(vector<DomainInfo> *domains, bool include_disabled=false) override;
@@ -272,6 +277,7 @@ private:
   string d_IdQuery;
   string d_ANYNoIdQuery;
   string d_ANYIdQuery;
+  string d_LookupNamesQuery;
 
   string d_listQuery;
   string d_listSubZoneQuery;
@@ -348,6 +354,7 @@ private:
   unique_ptr<SSqlStatement> d_IdQuery_stmt;
   unique_ptr<SSqlStatement> d_ANYNoIdQuery_stmt;
   unique_ptr<SSqlStatement> d_ANYIdQuery_stmt;
+  unique_ptr<SSqlStatement> d_LookupNamesQuery_stmt;
   unique_ptr<SSqlStatement> d_listQuery_stmt;
   unique_ptr<SSqlStatement> d_listSubZoneQuery_stmt;
   unique_ptr<SSqlStatement> d_MasterOfDomainsZoneQuery_stmt;
@@ -405,6 +412,9 @@ private:
   unique_ptr<SSqlStatement> d_SearchCommentsQuery_stmt;
 
 protected:
+  /* number of names looked up at once by lookup-names-query, which has one placeholder per name */
+  static const size_t s_lookupNamesBatchSize = 8;
+
   std::unique_ptr<SSql> d_db{nullptr};
   bool d_dnssecQueries;
   bool d_inTransaction{false};
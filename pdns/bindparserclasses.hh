@@ -32,7 +32,7 @@
 class BindDomainInfo 
 {
 public:
-  BindDomainInfo() : hadFileDirective(false), d_dev(0), d_ino(0)
+  BindDomainInfo() : hadFileDirective(false), d_dev(0), d_ino(0), d_ctime(0)
   {}
 
   void clear() 
@@ -43,6 +43,7 @@ public:
     alsoNotify.clear();
     d_dev=0;
     d_ino=0;
+    d_ctime=0;
   }
   DNSName name;
   string viewName;
@@ -54,6 +55,7 @@ public:
     
   dev_t d_dev;
   ino_t d_ino;
+  time_t d_ctime;
 
   bool operator<(const BindDomainInfo& b) const
   {
@@ -23,8 +23,12 @@
 
 #ifdef HAVE_EBPF
 
+#include <net/if.h>
 #include <sys/syscall.h>
 #include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #include "ext/libbpf/libbpf.h"
 
@@ -212,6 +216,172 @@ void BPFFilter::removeSocket(int sock)
   }
 }
 
+/* attaches (or detaches, with a progFD of -1) an XDP program to an interface via rtnetlink */
+static void setXDPProgram(int ifIndex, int progFD, uint32_t flags)
+{
+  struct {
+    struct nlmsghdr header;
+    struct ifinfomsg ifinfo;
+    char attributes[64];
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+  request.header.nlmsg_type = RTM_SETLINK;
+  request.ifinfo.ifi_family = AF_UNSPEC;
+  request.ifinfo.ifi_index = ifIndex;
+
+  struct rtattr* nest = reinterpret_cast<struct rtattr*>(reinterpret_cast<char*>(&request) + NLMSG_ALIGN(request.header.nlmsg_len));
+  nest->rta_type = NLA_F_NESTED | IFLA_XDP;
+  nest->rta_len = RTA_LENGTH(0);
+
+  struct rtattr* attr = reinterpret_cast<struct rtattr*>(reinterpret_cast<char*>(nest) + nest->rta_len);
+  attr->rta_type = IFLA_XDP_FD;
+  attr->rta_len = RTA_LENGTH(sizeof(progFD));
+  memcpy(RTA_DATA(attr), &progFD, sizeof(progFD));
+  nest->rta_len += RTA_ALIGN(attr->rta_len);
+
+  if (flags != 0) {
+    attr = reinterpret_cast<struct rtattr*>(reinterpret_cast<char*>(nest) + nest->rta_len);
+    attr->rta_type = IFLA_XDP_FLAGS;
+    attr->rta_len = RTA_LENGTH(sizeof(flags));
+    memcpy(RTA_DATA(attr), &flags, sizeof(flags));
+    nest->rta_len += RTA_ALIGN(attr->rta_len);
+  }
+  request.header.nlmsg_len = NLMSG_ALIGN(request.header.nlmsg_len) + nest->rta_len;
+
+  int sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (sock < 0) {
+    throw std::runtime_error("Error creating a netlink socket: " + stringerror());
+  }
+
+  struct sockaddr_nl local;
+  memset(&local, 0, sizeof(local));
+  local.nl_family = AF_NETLINK;
+  if (bind(sock, reinterpret_cast<struct sockaddr*>(&local), sizeof(local)) != 0 ||
+      send(sock, &request, request.header.nlmsg_len, 0) < 0) {
+    int err = errno;
+    close(sock);
+    throw std::runtime_error("Error sending a netlink request: " + stringerror(err));
+  }
+
+  char answer[4096];
+  ssize_t got = recv(sock, answer, sizeof(answer), 0);
+  int err = errno;
+  close(sock);
+  if (got < 0) {
+    throw std::runtime_error("Error reading the netlink answer: " + stringerror(err));
+  }
+
+  for (struct nlmsghdr* header = reinterpret_cast<struct nlmsghdr*>(answer); NLMSG_OK(header, static_cast<size_t>(got)); header = NLMSG_NEXT(header, got)) {
+    if (header->nlmsg_type == NLMSG_ERROR) {
+      const struct nlmsgerr* nlerr = reinterpret_cast<const struct nlmsgerr*>(NLMSG_DATA(header));
+      if (nlerr->error != 0) {
+        throw std::runtime_error(stringerror(-nlerr->error));
+      }
+      return;
+    }
+  }
+}
+
+void BPFFilter::addInterface(const std::string& interface, const std::vector<uint16_t>& ports, XDPMode mode)
+{
+  int ifIndex = if_nametoindex(interface.c_str());
+  if (ifIndex == 0) {
+    throw std::runtime_error("Unable to find the index of interface " + interface + ": " + stringerror());
+  }
+
+  std::unique_lock<std::mutex> lock(d_mutex);
+
+  /* only loaded on demand, since XDP requires a more recent kernel than socket filters */
+  if (d_xdpportsmap.fd == -1) {
+    d_xdpportsmap.fd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(uint16_t), sizeof(uint8_t), 1024);
+    if (d_xdpportsmap.fd == -1) {
+      throw std::runtime_error("Error creating a BPF ports map: " + stringerror());
+    }
+  }
+
+  if (d_xdpfilter.fd == -1) {
+    struct bpf_insn xdp_filter[] = {
+#include "bpf-filter.xdp.ebpf"
+    };
+
+    d_xdpfilter.fd = bpf_prog_load(BPF_PROG_TYPE_XDP,
+                                   xdp_filter,
+                                   sizeof(xdp_filter),
+                                   "GPL",
+                                   0);
+    if (d_xdpfilter.fd == -1) {
+      throw std::runtime_error("Error loading BPF XDP filter: " + stringerror());
+    }
+  }
+
+  for (const auto port : ports) {
+    uint16_t key = htons(port);
+    uint8_t value = 1;
+    if (bpf_update_elem(d_xdpportsmap.fd, &key, &value, BPF_ANY) != 0) {
+      throw std::runtime_error("Error adding port " + std::to_string(port) + " to the BPF ports map: " + stringerror());
+    }
+  }
+
+  if (d_xdpInterfaces.count(ifIndex) != 0) {
+    /* already attached, only the ports needed updating */
+    return;
+  }
+
+  uint32_t flags = 0;
+  if (mode == XDPMode::Generic) {
+    flags = XDP_FLAGS_SKB_MODE;
+  }
+  else if (mode == XDPMode::Native) {
+    flags = XDP_FLAGS_DRV_MODE;
+  }
+
+  try {
+    /* never replace an XDP program that someone else attached to this interface */
+    setXDPProgram(ifIndex, d_xdpfilter.fd, flags | XDP_FLAGS_UPDATE_IF_NOEXIST);
+  }
+  catch (const std::exception& e) {
+    throw std::runtime_error("Error attaching the XDP filter to interface " + interface + ": " + e.what());
+  }
+  d_xdpInterfaces[ifIndex] = flags;
+}
+
+void BPFFilter::removeInterface(const std::string& interface)
+{
+  int ifIndex = if_nametoindex(interface.c_str());
+  if (ifIndex == 0) {
+    throw std::runtime_error("Unable to find the index of interface " + interface + ": " + stringerror());
+  }
+
+  std::unique_lock<std::mutex> lock(d_mutex);
+  const auto it = d_xdpInterfaces.find(ifIndex);
+  if (it == d_xdpInterfaces.end()) {
+    throw std::runtime_error("The XDP filter is not attached to interface " + interface);
+  }
+
+  try {
+    setXDPProgram(ifIndex, -1, it->second);
+  }
+  catch (const std::exception& e) {
+    throw std::runtime_error("Error detaching the XDP filter from interface " + interface + ": " + e.what());
+  }
+  d_xdpInterfaces.erase(it);
+}
+
+BPFFilter::~BPFFilter()
+{
+  for (const auto& entry : d_xdpInterfaces) {
+    try {
+      setXDPProgram(entry.first, -1, entry.second);
+    }
+    catch (...) {
+      /* nothing we can do here, the program will stay attached until
+         the interface goes away or it is removed by hand */
+    }
+  }
+}
+
 void BPFFilter::block(const ComboAddress& addr)
 {
   std::unique_lock<std::mutex> lock(d_mutex);
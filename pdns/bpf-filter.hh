@@ -22,6 +22,7 @@
 #pragma once
 #include "config.h"
 
+#include <map>
 #include <mutex>
 
 #include "iputils.hh"
@@ -31,9 +32,17 @@
 class BPFFilter
 {
 public:
+  enum class XDPMode : uint8_t { Auto, Generic, Native };
+
   BPFFilter(uint32_t maxV4Addresses, uint32_t maxV6Addresses, uint32_t maxQNames);
+  ~BPFFilter();
   void addSocket(int sock);
   void removeSocket(int sock);
+  /* attach the XDP version of the filter to this interface, dropping the UDP and TCP
+     traffic sent to one of the listed ports before it reaches the network stack.
+     Fails if a different XDP program is already attached to that interface */
+  void addInterface(const std::string& interface, const std::vector<uint16_t>& ports, XDPMode mode);
+  void removeInterface(const std::string& interface);
   void block(const ComboAddress& addr);
   void block(const DNSName& qname, uint16_t qtype=255);
   void unblock(const ComboAddress& addr);
@@ -64,6 +73,10 @@ private:
   FDWrapper d_filtermap;
   FDWrapper d_mainfilter;
   FDWrapper d_qnamefilter;
+  FDWrapper d_xdpportsmap;
+  FDWrapper d_xdpfilter;
+  /* interface index -> XDP flags used when attaching */
+  std::map<int, uint32_t> d_xdpInterfaces;
 };
 
 #endif /* HAVE_EBPF */
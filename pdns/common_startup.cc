@@ -52,6 +52,8 @@ ArgvMap theArg;
 StatBag S;  //!< Statistics are gathered across PDNS via the StatBag class S
 AuthPacketCache PC; //!< This is the main PacketCache, shared across all threads
 AuthQueryCache QC;
+AuthZoneCache g_zoneCache;
+AuthNSEC3Cache g_nsec3Cache;
 std::unique_ptr<DNSProxy> DP{nullptr};
 std::unique_ptr<DynListener> dl{nullptr};
 CommunicatorClass Communicator;
@@ -155,6 +157,8 @@ void declareArguments()
   ::arg().set("webserver-allow-from","Webserver/API access is only allowed from these subnets")="127.0.0.1,::1";
   ::arg().set("webserver-loglevel", "Amount of logging in the webserver (none, normal, detailed)") = "normal";
   ::arg().set("webserver-max-bodysize","Webserver/API maximum request/response body size in megabytes")="2";
+  ::arg().set("webserver-threads","Number of threads serving the connections of the webserver/API")="2";
+  ::arg().set("webserver-idle-timeout","Number of seconds an idle webserver/API connection is kept open")="5";
 
   ::arg().setSwitch("do-ipv6-additional-processing", "Do AAAA additional processing")="yes";
   ::arg().setSwitch("query-logging","Hint backends that queries should be logged")="no";
@@ -168,6 +172,8 @@ void declareArguments()
   ::arg().set("cache-ttl","Seconds to store packets in the PacketCache")="20";
   ::arg().set("negquery-cache-ttl","Seconds to store negative query results in the QueryCache")="60";
   ::arg().set("query-cache-ttl","Seconds to store query results in the QueryCache")="20";
+  ::arg().set("nsec3-cache-ttl","Seconds to keep the NSEC3 hashed owner names of a zone learned from the backend, 0 to disable")="60";
+  ::arg().set("zone-cache-refresh-interval","Seconds between two reloads of the list of known zones, 0 to disable the zone cache")="0";
   ::arg().set("soa-minimum-ttl","Default SOA minimum ttl")="3600";
   ::arg().set("server-id", "Returned when queried for 'id.server' TXT or NSID, defaults to hostname - disabled or custom")="";
   ::arg().set("soa-refresh-default","Default SOA refresh")="10800";
@@ -196,6 +202,7 @@ void declareArguments()
 
   ::arg().set("max-cache-entries", "Maximum number of entries in the query cache")="1000000";
   ::arg().set("max-packet-cache-entries", "Maximum number of entries in the packet cache")="1000000";
+  ::arg().set("max-nsec3-cache-entries", "Maximum number of NSEC3 hashes, and of NSEC3 hashed owner ranges, to keep in the NSEC3 cache")="100000";
   ::arg().set("max-signature-cache-entries", "Maximum number of signatures cache entries")="";
   ::arg().set("max-ent-entries", "Maximum number of empty non-terminals in a zone")="100000";
   ::arg().set("entropy-source", "If set, read entropy from this file")="/dev/urandom";
@@ -226,6 +233,7 @@ void declareArguments()
   ::arg().set("lua-health-checks-interval", "LUA records health checks monitoring interval in seconds")="5";
 #endif
   ::arg().setSwitch("axfr-lower-serial", "Also AXFR a zone from a master with a lower serial")="no";
+  ::arg().setSwitch("batched-lookups", "Retrieve the records of a queried name, its ancestors and the matching wildcards in as few backend queries as possible")="no";
 
   ::arg().set("lua-axfr-script", "Script to be used to edit incoming AXFRs")="";
   ::arg().set("xfr-max-received-mbytes", "Maximum number of megabytes received from an incoming XFR")="100";
@@ -333,6 +341,7 @@ void declareStats(void)
   S.declare("dnsupdate-changes", "DNS update changes to records in total.");
 
   S.declare("incoming-notifications", "NOTIFY packets received.");
+  S.declare("incoming-xfr-peak-memory-usage", "Highest memory usage in bytes (approx) seen while processing an incoming zone transfer");
 
   S.declare("uptime", "Uptime of process in seconds", uptimeOfProcess);
   S.declare("real-memory-usage", "Actual unique use of memory in bytes (approx)", getRealMemoryUsage);
@@ -520,6 +529,24 @@ static void triggerLoadOfLibraries()
   pthread_join(tid, &res);
 }
 
+static void zoneCacheRefreshThread()
+{
+  setThreadName("pdns/zone-cache");
+  for(;;) {
+    sleep(g_zoneCache.getRefreshInterval());
+    try {
+      UeberBackend B;
+      B.updateZoneCache();
+    }
+    catch(const PDNSException& e) {
+      g_log<<Logger::Error<<"Error while refreshing the zone cache: "<<e.reason<<endl;
+    }
+    catch(const std::exception& e) {
+      g_log<<Logger::Error<<"Error while refreshing the zone cache: "<<e.what()<<endl;
+    }
+  }
+}
+
 void mainthread()
 {
    Utility::srandom();
@@ -548,6 +575,8 @@ void mainthread()
    PC.setMaxEntries(::arg().asNum("max-packet-cache-entries"));
    QC.setMaxEntries(::arg().asNum("max-cache-entries"));
    DNSSECKeeper::setMaxEntries(::arg().asNum("max-cache-entries"));
+   g_nsec3Cache.setMaxEntries(::arg().asNum("max-nsec3-cache-entries"));
+   g_nsec3Cache.setTTL(::arg().asNum("nsec3-cache-ttl"));
 
    if (!PC.enabled() && ::arg().mustDo("log-dns-queries")) {
      g_log<<Logger::Warning<<"Packet cache disabled, logging queries without HIT/MISS"<<endl;
@@ -628,6 +657,21 @@ void mainthread()
     }
   }
 
+  if(::arg().asNum("zone-cache-refresh-interval") > 0) {
+    g_zoneCache.setRefreshInterval(::arg().asNum("zone-cache-refresh-interval"));
+    try {
+      UeberBackend B;
+      B.updateZoneCache();
+      g_log<<Logger::Warning<<"Loaded "<<g_zoneCache.size()<<" zones into the zone cache"<<endl;
+    }
+    catch(const PDNSException& e) {
+      g_log<<Logger::Error<<"Unable to load the zone cache, zones will be looked up from the backends until the next refresh: "<<e.reason<<endl;
+    }
+    catch(const std::exception& e) {
+      g_log<<Logger::Error<<"Unable to load the zone cache, zones will be looked up from the backends until the next refresh: "<<e.what()<<endl;
+    }
+  }
+
   // NOW SAFE TO CREATE THREADS!
   dl->go();
 
@@ -648,6 +692,11 @@ void mainthread()
 
   std::thread carbonThread(carbonDumpThread); // runs even w/o carbon, might change @ runtime    
 
+  if(g_zoneCache.getRefreshInterval() > 0) {
+    std::thread zoneCacheThread(zoneCacheRefreshThread);
+    zoneCacheThread.detach();
+  }
+
 #ifdef HAVE_SYSTEMD
   /* If we are here, notify systemd that we are ay-ok! This might have some
    * timing issues with the backend-threads. e.g. if the initial MySQL connection
@@ -262,6 +262,18 @@ bool DNSBackend::get(DNSZoneRecord& dzr)
   DNSResourceRecord rr;
   if(!this->get(rr))
     return false;
+  try {
+    toZoneRecord(rr, dzr);
+  }
+  catch(...) {
+    while(this->get(rr));
+    throw;
+  }
+  return true;
+}
+
+void DNSBackend::toZoneRecord(DNSResourceRecord& rr, DNSZoneRecord& dzr)
+{
   dzr.auth = rr.auth;
   dzr.domain_id = rr.domain_id;
   dzr.scopeMask = rr.scopeMask;
@@ -291,15 +303,8 @@ bool DNSBackend::get(DNSZoneRecord& dzr)
     }
   }
   else {
-    try {
-      dzr.dr = DNSRecord(rr);
-    }
-    catch(...) {
-      while(this->get(rr));
-      throw;
-    }
+    dzr.dr = DNSRecord(rr);
   }
-  return true;
 }
 
 bool DNSBackend::getBeforeAndAfterNames(uint32_t id, const DNSName& zonename, const DNSName& qname, DNSName& before, DNSName& after)
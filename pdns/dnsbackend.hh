@@ -124,6 +124,19 @@ public:
   virtual bool get(DNSResourceRecord &)=0; //!< retrieves one DNSResource record, returns false if no more were available
   virtual bool get(DNSZoneRecord &r);
 
+  //! lookupNames() retrieves all the records of several names of the same zone at once
+  /** Backends that can do this in fewer round trips than one ANY lookup() per name should implement it.
+      The records are appended to 'records', names without any record are simply not present.
+      Returns false if the backend does not support it, in which case lookup() has to be used instead.
+  */
+  virtual bool lookupNames(const std::vector<DNSName>& names, int zoneId, std::vector<DNSResourceRecord>& records)
+  {
+    return false;
+  }
+
+  //! Converts a record retrieved from a backend to a DNSZoneRecord, as get(DNSZoneRecord&) does. Throws if the content is invalid.
+  static void toZoneRecord(DNSResourceRecord& rr, DNSZoneRecord& dzr);
+
   //! Initiates a list of the specified domain
   /** Once initiated, DNSResourceRecord objects can be retrieved using get(). Should return false
       if the backend does not consider itself responsible for the id passed.
@@ -21,7 +21,13 @@
  */
 #include "config.h"
 #ifdef HAVE_DNSCRYPT
+#include <array>
+#include <atomic>
 #include <fstream>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
 #include "dolog.hh"
 #include "dnscrypt.hh"
 #include "dnswriter.hh"
@@ -69,7 +75,121 @@ DNSCryptExchangeVersion DNSCryptQuery::getVersion() const
   return DNSCryptContext::getExchangeVersion(d_pair->cert);
 }
 
+static std::atomic<size_t> s_sharedKeysCacheSize{0};
+static std::atomic<uint64_t> s_sharedKeysCacheHits{0};
+static std::atomic<uint64_t> s_sharedKeysCacheMisses{0};
+
+void DNSCryptQuery::setSharedKeysCacheSize(size_t size)
+{
+  s_sharedKeysCacheSize.store(size);
+}
+
+uint64_t DNSCryptQuery::getSharedKeysCacheHits()
+{
+  return s_sharedKeysCacheHits.load();
+}
+
+uint64_t DNSCryptQuery::getSharedKeysCacheMisses()
+{
+  return s_sharedKeysCacheMisses.load();
+}
+
 #ifdef HAVE_CRYPTO_BOX_EASY_AFTERNM
+/* LRU cache of the shared keys computed for a given client public key, resolver key and exchange version,
+   so that a returning client does not cost us a new key exchange for every query. There is one cache per
+   thread so no locking is needed. */
+class DNSCryptSharedKeysCache
+{
+public:
+  typedef std::array<unsigned char, DNSCRYPT_PUBLIC_KEY_SIZE * 2 + 1> key_t;
+
+  DNSCryptSharedKeysCache()
+  {
+    /* the client public keys are chosen by the clients, so use a keyed hash */
+    randombytes_buf(d_hashKey, sizeof(d_hashKey));
+  }
+
+  ~DNSCryptSharedKeysCache()
+  {
+    while (!d_entries.empty()) {
+      eraseOldest();
+    }
+  }
+
+  bool get(const key_t& key, unsigned char* sharedKey)
+  {
+    auto& idx = d_entries.get<HashedTag>();
+    auto range = idx.equal_range(hash(key));
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->d_key != key) {
+        continue;
+      }
+
+      memcpy(sharedKey, it->d_sharedKey, sizeof(it->d_sharedKey));
+      auto& sidx = d_entries.get<SequencedTag>();
+      sidx.relocate(sidx.end(), d_entries.project<SequencedTag>(it));
+      return true;
+    }
+
+    return false;
+  }
+
+  void insert(const key_t& key, const unsigned char* sharedKey, size_t maxEntries)
+  {
+    while (!d_entries.empty() && d_entries.size() >= maxEntries) {
+      eraseOldest();
+    }
+
+    auto& sidx = d_entries.get<SequencedTag>();
+    auto res = sidx.push_back(Entry(key, hash(key)));
+    sodium_mlock(res.first->d_sharedKey, sizeof(res.first->d_sharedKey));
+    memcpy(res.first->d_sharedKey, sharedKey, sizeof(res.first->d_sharedKey));
+  }
+
+private:
+  struct HashedTag {};
+  struct SequencedTag {};
+  struct Entry
+  {
+    Entry(const key_t& key, uint64_t hash): d_key(key), d_hash(hash)
+    {
+    }
+
+    key_t d_key;
+    uint64_t d_hash;
+    mutable unsigned char d_sharedKey[DNSCRYPT_BEFORENM_SIZE];
+  };
+
+  uint64_t hash(const key_t& key) const
+  {
+    uint64_t result;
+    static_assert(sizeof(result) == crypto_shorthash_BYTES, "crypto_shorthash() should return a 64-bit value");
+    crypto_shorthash(reinterpret_cast<unsigned char*>(&result), key.data(), key.size(), d_hashKey);
+    return result;
+  }
+
+  void eraseOldest()
+  {
+    auto& sidx = d_entries.get<SequencedTag>();
+    /* this also zeroes the key */
+    sodium_munlock(sidx.front().d_sharedKey, sizeof(sidx.front().d_sharedKey));
+    sidx.pop_front();
+  }
+
+  typedef boost::multi_index::multi_index_container<
+    Entry,
+    boost::multi_index::indexed_by <
+      boost::multi_index::hashed_non_unique<boost::multi_index::tag<HashedTag>, boost::multi_index::member<Entry, uint64_t, &Entry::d_hash> >,
+      boost::multi_index::sequenced<boost::multi_index::tag<SequencedTag> >
+      >
+    > entries_t;
+
+  entries_t d_entries;
+  unsigned char d_hashKey[crypto_shorthash_KEYBYTES];
+};
+
+static thread_local DNSCryptSharedKeysCache t_sharedKeysCache;
+
 DNSCryptQuery::~DNSCryptQuery()
 {
   if (d_sharedKeyComputed) {
@@ -91,6 +211,22 @@ int DNSCryptQuery::computeSharedKey()
 
   sodium_mlock(d_sharedKey, sizeof(d_sharedKey));
 
+  const size_t cacheSize = s_sharedKeysCacheSize.load();
+  DNSCryptSharedKeysCache::key_t cacheKey;
+  if (cacheSize > 0) {
+    static_assert(sizeof(d_header.clientPK) + sizeof(d_pair->publicKey) + 1 == std::tuple_size<DNSCryptSharedKeysCache::key_t>::value, "The shared keys cache key should hold both public keys and the version");
+    memcpy(cacheKey.data(), d_header.clientPK, sizeof(d_header.clientPK));
+    memcpy(cacheKey.data() + sizeof(d_header.clientPK), d_pair->publicKey, sizeof(d_pair->publicKey));
+    cacheKey.back() = static_cast<unsigned char>(version);
+
+    if (t_sharedKeysCache.get(cacheKey, d_sharedKey)) {
+      ++s_sharedKeysCacheHits;
+      d_sharedKeyComputed = true;
+      return res;
+    }
+    ++s_sharedKeysCacheMisses;
+  }
+
   if (version == DNSCryptExchangeVersion::VERSION1) {
     res = crypto_box_beforenm(d_sharedKey,
                               d_header.clientPK,
@@ -114,6 +250,10 @@ int DNSCryptQuery::computeSharedKey()
     return res;
   }
 
+  if (cacheSize > 0) {
+    t_sharedKeysCache.insert(cacheKey, d_sharedKey, cacheSize);
+  }
+
   d_sharedKeyComputed = true;
   return res;
 }
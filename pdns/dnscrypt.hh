@@ -213,6 +213,12 @@ public:
 
   static const size_t s_minUDPLength = 256;
 
+  /* Set the maximum number of shared keys kept by each thread for the clients it has seen recently,
+     0 disabling the cache. */
+  static void setSharedKeysCacheSize(size_t size);
+  static uint64_t getSharedKeysCacheHits();
+  static uint64_t getSharedKeysCacheMisses();
+
 private:
   DNSCryptExchangeVersion getVersion() const;
 #ifdef HAVE_CRYPTO_BOX_EASY_AFTERNM
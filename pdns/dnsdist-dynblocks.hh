@@ -24,6 +24,7 @@
 #include <unordered_set>
 
 #include "dolog.hh"
+#include "dnsdist-dynbpf.hh"
 #include "dnsdist-rings.hh"
 #include "statnode.hh"
 
@@ -314,6 +315,15 @@ public:
     d_beQuiet = quiet;
   }
 
+#ifdef HAVE_EBPF
+  /* addresses blocked with a Drop action are also inserted into this filter,
+     so that their queries are dropped by the kernel */
+  void setDynBPFFilter(std::shared_ptr<DynBPFFilter> dynbpf)
+  {
+    d_dynBPFFilter = dynbpf;
+  }
+#endif /* HAVE_EBPF */
+
 private:
 
   bool checkIfQueryTypeMatches(const Rings::Query& query);
@@ -364,5 +374,8 @@ private:
   SuffixMatchNode d_excludedDomains;
   smtVisitor_t d_smtVisitor;
   dnsdist_ffi_stat_node_visitor_t d_smtVisitorFFI;
+#ifdef HAVE_EBPF
+  std::shared_ptr<DynBPFFilter> d_dynBPFFilter{nullptr};
+#endif /* HAVE_EBPF */
   bool d_beQuiet{false};
 };
@@ -587,6 +587,24 @@ bool handleEDNSClientSubnet(char* const packet, const size_t packetSize, const u
   const struct dnsheader* dh = reinterpret_cast<const struct dnsheader*>(packet);
 
   if (ntohs(dh->ancount) != 0 || ntohs(dh->nscount) != 0 || (ntohs(dh->arcount) != 0 && ntohs(dh->arcount) != 1)) {
+    /* try to edit the existing OPT RR in place first, only rebuilding the whole query if we can't parse it */
+    ednsAdded = false;
+    /* the in-place edit keeps whatever follows the records, so drop it first unless we have been asked to preserve it,
+       as the full rewrite below would */
+    uint16_t newLen = preserveTrailingData ? *len : getDNSPacketLength(packet, *len);
+    int res = setEDNSOptionInPlace(packet, packetSize, &newLen, newECSOption, overrideExisting, ecsAdded);
+    if (res == 0) {
+      *len = newLen;
+      return true;
+    }
+    else if (res == ENOENT) {
+      return addEDNSWithECS(packet, packetSize, len, newECSOption, ednsAdded, ecsAdded, preserveTrailingData);
+    }
+    else if (res == ENOSPC) {
+      ecsAdded = false;
+      return false;
+    }
+
     vector<uint8_t> newContent;
     newContent.reserve(packetSize);
 
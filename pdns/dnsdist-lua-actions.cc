@@ -979,6 +979,17 @@ private:
 };
 
 
+/* Without an alteration function, nobody will ever see the message object, so the log actions
+   encode their message straight into a buffer reused by the thread instead of building that object */
+template<typename T>
+static void queueEncodedMessage(const std::shared_ptr<RemoteLoggerInterface>& logger, const T& encode)
+{
+  static thread_local std::string data;
+  data.clear();
+  encode(data);
+  logger->queueData(data);
+}
+
 class DnstapLogAction : public DNSAction, public boost::noncopyable
 {
 public:
@@ -988,6 +999,13 @@ public:
   DNSAction::Action operator()(DNSQuestion* dq, std::string* ruleresult) const override
   {
 #ifdef HAVE_PROTOBUF
+    if (!d_alterFunc) {
+      queueEncodedMessage(d_logger, [this, dq](std::string& data) {
+        encodeDnstapMessage(data, d_identity, dq->remote, dq->local, dq->tcp, reinterpret_cast<const char*>(dq->dh), dq->len, dq->queryTime, nullptr);
+      });
+      return Action::None;
+    }
+
     DnstapMessage message(d_identity, dq->remote, dq->local, dq->tcp, reinterpret_cast<const char*>(dq->dh), dq->len, dq->queryTime, nullptr);
     {
       if (d_alterFunc) {
@@ -1024,6 +1042,17 @@ public:
       dq->uniqueId = getUniqueID();
     }
 
+    if (!d_alterFunc) {
+      queueEncodedMessage(d_logger, [this, dq](std::string& data) {
+#if HAVE_LIBCRYPTO
+        encodeDNSDistProtoBufMessage(data, *dq, d_ipEncryptKey.empty() ? *dq->remote : encryptCA(*dq->remote, d_ipEncryptKey), d_serverID);
+#else
+        encodeDNSDistProtoBufMessage(data, *dq, *dq->remote, d_serverID);
+#endif /* HAVE_LIBCRYPTO */
+      });
+      return Action::None;
+    }
+
     DNSDistProtoBufMessage message(*dq);
     if (!d_serverID.empty()) {
       message.setServerIdentity(d_serverID);
@@ -1116,6 +1145,13 @@ public:
 #ifdef HAVE_PROTOBUF
     struct timespec now;
     gettime(&now, true);
+    if (!d_alterFunc) {
+      queueEncodedMessage(d_logger, [this, dr, &now](std::string& data) {
+        encodeDnstapMessage(data, d_identity, dr->remote, dr->local, dr->tcp, reinterpret_cast<const char*>(dr->dh), dr->len, dr->queryTime, &now);
+      });
+      return Action::None;
+    }
+
     DnstapMessage message(d_identity, dr->remote, dr->local, dr->tcp, reinterpret_cast<const char*>(dr->dh), dr->len, dr->queryTime, &now);
     {
       if (d_alterFunc) {
@@ -1152,6 +1188,17 @@ public:
       dr->uniqueId = getUniqueID();
     }
 
+    if (!d_alterFunc) {
+      queueEncodedMessage(d_logger, [this, dr](std::string& data) {
+#if HAVE_LIBCRYPTO
+        encodeDNSDistProtoBufMessage(data, *dr, d_ipEncryptKey.empty() ? *dr->remote : encryptCA(*dr->remote, d_ipEncryptKey), d_serverID, d_includeCNAME);
+#else
+        encodeDNSDistProtoBufMessage(data, *dr, *dr->remote, d_serverID, d_includeCNAME);
+#endif /* HAVE_LIBCRYPTO */
+      });
+      return Action::None;
+    }
+
     DNSDistProtoBufMessage message(*dr, d_includeCNAME);
     if (!d_serverID.empty()) {
       message.setServerIdentity(d_serverID);
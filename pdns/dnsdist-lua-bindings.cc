@@ -71,6 +71,7 @@ void setupLuaBindings(bool client)
   g_lua.writeVariable("whashed", ServerPolicy{"whashed", whashed, false});
   g_lua.writeVariable("chashed", ServerPolicy{"chashed", chashed, false});
   g_lua.writeVariable("leastOutstanding", ServerPolicy{"leastOutstanding", leastOutstanding, false});
+  g_lua.writeVariable("latencyAware", ServerPolicy{"latencyAware", latencyAware, false});
 
   /* ServerPool */
   g_lua.registerFunction<void(std::shared_ptr<ServerPool>::*)(std::shared_ptr<DNSDistPacketCache>)>("setCache", [](std::shared_ptr<ServerPool> pool, std::shared_ptr<DNSDistPacketCache> cache) {
@@ -419,6 +420,46 @@ void setupLuaBindings(bool client)
       }
     });
 
+  g_lua.registerFunction<void(std::shared_ptr<BPFFilter>::*)(const std::string&, boost::optional<boost::variant<uint16_t, std::vector<std::pair<int, uint16_t>>>>, boost::optional<std::string>)>("attachToInterface", [](std::shared_ptr<BPFFilter> bpf, const std::string& interface, boost::optional<boost::variant<uint16_t, std::vector<std::pair<int, uint16_t>>>> ports, boost::optional<std::string> mode) {
+      if (!bpf) {
+        return;
+      }
+
+      std::vector<uint16_t> portsList;
+      if (!ports) {
+        portsList.push_back(53);
+      }
+      else if (ports->type() == typeid(uint16_t)) {
+        portsList.push_back(boost::get<uint16_t>(*ports));
+      }
+      else {
+        for (const auto& port : boost::get<std::vector<std::pair<int, uint16_t>>>(*ports)) {
+          portsList.push_back(port.second);
+        }
+      }
+
+      BPFFilter::XDPMode xdpMode = BPFFilter::XDPMode::Auto;
+      if (mode) {
+        if (*mode == "generic") {
+          xdpMode = BPFFilter::XDPMode::Generic;
+        }
+        else if (*mode == "native") {
+          xdpMode = BPFFilter::XDPMode::Native;
+        }
+        else if (*mode != "auto") {
+          throw std::runtime_error("Unsupported XDP mode '" + *mode + "', valid values are 'auto', 'generic' and 'native'");
+        }
+      }
+
+      bpf->addInterface(interface, portsList, xdpMode);
+    });
+
+  g_lua.registerFunction<void(std::shared_ptr<BPFFilter>::*)(const std::string&)>("detachFromInterface", [](std::shared_ptr<BPFFilter> bpf, const std::string& interface) {
+      if (bpf) {
+        bpf->removeInterface(interface);
+      }
+    });
+
     g_lua.writeFunction("newDynBPFFilter", [client](std::shared_ptr<BPFFilter> bpf) {
         if (client) {
           return std::shared_ptr<DynBPFFilter>(nullptr);
@@ -26,12 +26,20 @@
 
 #include "statnode.hh"
 
-static std::unordered_map<unsigned int, vector<boost::variant<string,double>>> getGenResponses(unsigned int top, boost::optional<int> labels, std::function<bool(const Rings::Response&)> pred)
+static std::unordered_map<unsigned int, vector<boost::variant<string,double>>> getGenResponses(unsigned int top, boost::optional<int> labels, boost::optional<uint8_t> rcode, std::function<bool(const Rings::Response&)> pred)
 {
   setLuaNoSideEffect();
   map<DNSName, unsigned int> counts;
   unsigned int total=0;
-  {
+  Rings::NamesSummary::counts_t summarized;
+  uint64_t summarizedTotal = 0;
+  if (rcode && g_rings.getSummarizedNames(rcode, labels ? boost::optional<unsigned int>(*labels) : boost::none, 0, summarized, summarizedTotal)) {
+    for (const auto& entry : summarized) {
+      counts[entry.first] += entry.second;
+    }
+    total = summarizedTotal;
+  }
+  else {
     for (const auto& shard : g_rings.d_shards) {
       std::lock_guard<std::mutex> rl(shard->respLock);
       if(!labels) {
@@ -68,12 +76,13 @@ static std::unordered_map<unsigned int, vector<boost::variant<string,double>>> g
        });
 
   std::unordered_map<unsigned int, vector<boost::variant<string,double>>> ret;
-  unsigned int count=1, rest=0;
+  /* the summaries do not track every name, so compute the rest from the total */
+  unsigned int count=1, rest=total;
   for(const auto& rc : rcounts) {
     if(count==top+1)
-      rest+=rc.first;
-    else
-      ret.insert({count++, {rc.second.toString(), rc.first, 100.0*rc.first/total}});
+      break;
+    ret.insert({count++, {rc.second.toString(), rc.first, 100.0*rc.first/total}});
+    rest -= std::min(rest, rc.first);
   }
   ret.insert({count, {"Rest", rest, total > 0 ? 100.0*rest/total : 100.0}});
   return ret;
@@ -206,8 +215,33 @@ static counts_t exceedQueryGen(unsigned int rate, int seconds, std::function<voi
 }
 
 
+/* Use the summaries instead of walking the rings when they are enabled and cover the requested period */
+static bool exceedSummarized(Rings::ClientsSummaryType type, uint8_t rcode, unsigned int rate, int seconds, counts_t& ret)
+{
+  Rings::ClientsSummary::counts_t counts;
+  uint64_t total = 0;
+  if (seconds < 0 || !g_rings.getSummarizedClients(type, rcode, seconds, counts, total)) {
+    return false;
+  }
+
+  double delta = seconds ? seconds : g_rings.getSummariesWindow();
+  double lim = delta*rate;
+  for (const auto& c : counts) {
+    if (c.second > lim) {
+      ret[c.first] = c.second;
+    }
+  }
+
+  return true;
+}
+
 static counts_t exceedRCode(unsigned int rate, int seconds, int rcode)
 {
+  counts_t summarized;
+  if (exceedSummarized(Rings::ClientsSummaryType::RCode, rcode, rate, seconds, summarized)) {
+    return summarized;
+  }
+
   return exceedRespGen(rate, seconds, [rcode](counts_t& counts, const Rings::Response& r)
 		   {
 		     if(r.dh.rcode == rcode)
@@ -217,6 +251,11 @@ static counts_t exceedRCode(unsigned int rate, int seconds, int rcode)
 
 static counts_t exceedRespByterate(unsigned int rate, int seconds)
 {
+  counts_t summarized;
+  if (exceedSummarized(Rings::ClientsSummaryType::ResponseBytes, 0, rate, seconds, summarized)) {
+    return summarized;
+  }
+
   return exceedRespGen(rate, seconds, [](counts_t& counts, const Rings::Response& r)
 		   {
 		     counts[r.requestor]+=r.size;
@@ -230,7 +269,15 @@ void setupLuaInspection()
       auto top = top_.get_value_or(10);
       map<ComboAddress, unsigned int,ComboAddress::addressOnlyLessThan > counts;
       unsigned int total=0;
-      {
+      Rings::ClientsSummary::counts_t summarized;
+      uint64_t summarizedTotal = 0;
+      if (g_rings.getSummarizedClients(Rings::ClientsSummaryType::Queries, 0, 0, summarized, summarizedTotal)) {
+        for (const auto& entry : summarized) {
+          counts[entry.first] += entry.second;
+        }
+        total = summarizedTotal;
+      }
+      else {
         for (const auto& shard : g_rings.d_shards) {
           std::lock_guard<std::mutex> rl(shard->queryLock);
           for(const auto& c : shard->queryRing) {
@@ -248,13 +295,13 @@ void setupLuaInspection()
 					      const decltype(rcounts)::value_type& b) {
 	     return b.first < a.first;
 	   });
-      unsigned int count=1, rest=0;
+      unsigned int count=1, rest=total;
       boost::format fmt("%4d  %-40s %4d %4.1f%%\n");
       for(const auto& rc : rcounts) {
 	if(count==top+1)
-	  rest+=rc.first;
-	else
-	  g_outputBuffer += (fmt % (count++) % rc.second.toString() % rc.first % (100.0*rc.first/total)).str();
+	  break;
+	g_outputBuffer += (fmt % (count++) % rc.second.toString() % rc.first % (100.0*rc.first/total)).str();
+	rest -= std::min(rest, rc.first);
       }
       g_outputBuffer += (fmt % (count) % "Rest" % rest % (total > 0 ? 100.0*rest/total : 100.0)).str();
     });
@@ -263,7 +310,15 @@ void setupLuaInspection()
       setLuaNoSideEffect();
       map<DNSName, unsigned int> counts;
       unsigned int total=0;
-      if(!labels) {
+      Rings::NamesSummary::counts_t summarized;
+      uint64_t summarizedTotal = 0;
+      if (g_rings.getSummarizedNames(boost::none, labels ? boost::optional<unsigned int>(*labels) : boost::none, 0, summarized, summarizedTotal)) {
+        for (const auto& entry : summarized) {
+          counts[entry.first] += entry.second;
+        }
+        total = summarizedTotal;
+      }
+      else if(!labels) {
         for (const auto& shard : g_rings.d_shards) {
           std::lock_guard<std::mutex> rl(shard->queryLock);
           for(const auto& a : shard->queryRing) {
@@ -295,12 +350,12 @@ void setupLuaInspection()
 	   });
 
       std::unordered_map<unsigned int, vector<boost::variant<string,double>>> ret;
-      unsigned int count=1, rest=0;
+      unsigned int count=1, rest=total;
       for(const auto& rc : rcounts) {
 	if(count==top+1)
-	  rest+=rc.first;
-	else
-	  ret.insert({count++, {rc.second.toString(), rc.first, 100.0*rc.first/total}});
+	  break;
+	ret.insert({count++, {rc.second.toString(), rc.first, 100.0*rc.first/total}});
+	rest -= std::min(rest, rc.first);
       }
       ret.insert({count, {"Rest", rest, total > 0 ? 100.0*rest/total : 100.0}});
       return ret;
@@ -337,14 +392,14 @@ void setupLuaInspection()
     });
 
   g_lua.writeFunction("getTopResponses", [](unsigned int top, unsigned int kind, boost::optional<int> labels) {
-      return getGenResponses(top, labels, [kind](const Rings::Response& r) { return r.dh.rcode == kind; });
+      return getGenResponses(top, labels, kind <= 0xF ? boost::optional<uint8_t>(kind) : boost::none, [kind](const Rings::Response& r) { return r.dh.rcode == kind; });
     });
 
   g_lua.executeCode(R"(function topResponses(top, kind, labels) top = top or 10; kind = kind or 0; for k,v in ipairs(getTopResponses(top, kind, labels)) do show(string.format("%4d  %-40s %4d %4.1f%%",k,v[1],v[2],v[3])) end end)");
 
 
   g_lua.writeFunction("getSlowResponses", [](unsigned int top, unsigned int msec, boost::optional<int> labels) {
-      return getGenResponses(top, labels, [msec](const Rings::Response& r) { return r.usec > msec*1000; });
+      return getGenResponses(top, labels, boost::none, [msec](const Rings::Response& r) { return r.usec > msec*1000; });
     });
 
 
@@ -689,6 +744,10 @@ void setupLuaInspection()
 
   g_lua.writeFunction("exceedQRate", [](unsigned int rate, int seconds) {
       setLuaNoSideEffect();
+      counts_t summarized;
+      if (exceedSummarized(Rings::ClientsSummaryType::Queries, 0, rate, seconds, summarized)) {
+        return summarized;
+      }
       return exceedQueryGen(rate, seconds, [](counts_t& counts, const Rings::Query& q) {
           counts[q.requestor]++;
 	});
@@ -785,5 +844,8 @@ void setupLuaInspection()
     group->apply();
   });
   g_lua.registerFunction("setQuiet", &DynBlockRulesGroup::setQuiet);
+#ifdef HAVE_EBPF
+  g_lua.registerFunction("setDynBPFFilter", &DynBlockRulesGroup::setDynBPFFilter);
+#endif /* HAVE_EBPF */
   g_lua.registerFunction("toString", &DynBlockRulesGroup::toString);
 }
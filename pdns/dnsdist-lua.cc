@@ -40,6 +40,7 @@
 #include "dnsdist-lua-ffi.hh"
 #endif /* LUAJIT_VERSION */
 #include "dnsdist-rings.hh"
+#include "dnsdist-rule-chain.hh"
 #include "dnsdist-secpoll.hh"
 
 #include "base64.hh"
@@ -97,7 +98,7 @@ void resetLuaSideEffect()
 
 typedef std::unordered_map<std::string, boost::variant<bool, int, std::string, std::vector<std::pair<int,int> >, std::vector<std::pair<int, std::string> >, std::map<std::string,std::string>  > > localbind_t;
 
-static void parseLocalBindVars(boost::optional<localbind_t> vars, bool& reusePort, int& tcpFastOpenQueueSize, std::string& interface, std::set<int>& cpus, int& tcpListenQueueSize)
+static void parseLocalBindVars(boost::optional<localbind_t> vars, bool& reusePort, int& tcpFastOpenQueueSize, std::string& interface, std::set<int>& cpus, int& tcpListenQueueSize, int& maxInFlightQueriesPerConnection)
 {
   if (vars) {
     if (vars->count("reusePort")) {
@@ -109,6 +110,9 @@ static void parseLocalBindVars(boost::optional<localbind_t> vars, bool& reusePor
     if (vars->count("tcpListenQueueSize")) {
       tcpListenQueueSize = boost::get<int>((*vars)["tcpListenQueueSize"]);
     }
+    if (vars->count("maxInFlight")) {
+      maxInFlightQueriesPerConnection = boost::get<int>((*vars)["maxInFlight"]);
+    }
     if (vars->count("interface")) {
       interface = boost::get<std::string>((*vars)["interface"]);
     }
@@ -377,6 +381,10 @@ static void setupLuaConfig(bool client, bool configCheck)
         ret->checkInterval=static_cast<unsigned int>(std::stoul(boost::get<string>(vars["checkInterval"])));
       }
 
+      if(vars.count("maxCheckInterval")) {
+        ret->maxCheckInterval=static_cast<unsigned int>(std::stoul(boost::get<string>(vars["maxCheckInterval"])));
+      }
+
       if(vars.count("tcpConnectTimeout")) {
         ret->tcpConnectTimeout=std::stoi(boost::get<string>(vars["tcpConnectTimeout"]));
       }
@@ -432,6 +440,10 @@ static void setupLuaConfig(bool client, bool configCheck)
         ret->setCD=boost::get<bool>(vars["setCD"]);
       }
 
+      if(vars.count("checkTCP")) {
+        ret->checkTCP=boost::get<bool>(vars["checkTCP"]);
+      }
+
       if(vars.count("mustResolve")) {
         ret->mustResolve=boost::get<bool>(vars["mustResolve"]);
       }
@@ -579,10 +591,11 @@ static void setupLuaConfig(bool client, bool configCheck)
       bool reusePort = false;
       int tcpFastOpenQueueSize = 0;
       int tcpListenQueueSize = 0;
+      int maxInFlightQueriesPerConn = 0;
       std::string interface;
       std::set<int> cpus;
 
-      parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize);
+      parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize, maxInFlightQueriesPerConn);
 
       try {
 	ComboAddress loc(addr, 53);
@@ -602,6 +615,9 @@ static void setupLuaConfig(bool client, bool configCheck)
         if (tcpListenQueueSize > 0) {
           tcpCS->tcpListenQueueSize = tcpListenQueueSize;
         }
+        if (maxInFlightQueriesPerConn > 0) {
+          tcpCS->tcpMaxInFlightQueriesPerConn = maxInFlightQueriesPerConn;
+        }
         g_frontends.push_back(std::move(tcpCS));
       }
       catch(const std::exception& e) {
@@ -620,10 +636,11 @@ static void setupLuaConfig(bool client, bool configCheck)
       bool reusePort = false;
       int tcpFastOpenQueueSize = 0;
       int tcpListenQueueSize = 0;
+      int maxInFlightQueriesPerConn = 0;
       std::string interface;
       std::set<int> cpus;
 
-      parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize);
+      parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize, maxInFlightQueriesPerConn);
 
       try {
 	ComboAddress loc(addr, 53);
@@ -633,6 +650,9 @@ static void setupLuaConfig(bool client, bool configCheck)
         if (tcpListenQueueSize > 0) {
           tcpCS->tcpListenQueueSize = tcpListenQueueSize;
         }
+        if (maxInFlightQueriesPerConn > 0) {
+          tcpCS->tcpMaxInFlightQueriesPerConn = maxInFlightQueriesPerConn;
+        }
         g_frontends.push_back(std::move(tcpCS));
       }
       catch(std::exception& e) {
@@ -1226,11 +1246,12 @@ static void setupLuaConfig(bool client, bool configCheck)
       bool reusePort = false;
       int tcpFastOpenQueueSize = 0;
       int tcpListenQueueSize = 0;
+      int maxInFlightQueriesPerConn = 0;
       std::string interface;
       std::set<int> cpus;
       std::vector<DNSCryptContext::CertKeyPaths> certKeys;
 
-      parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize);
+      parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize, maxInFlightQueriesPerConn);
 
       if (certFiles.type() == typeid(std::string) && keyFiles.type() == typeid(std::string)) {
         auto certFile = boost::get<std::string>(certFiles);
@@ -1272,6 +1293,9 @@ static void setupLuaConfig(bool client, bool configCheck)
         if (tcpListenQueueSize > 0) {
           cs->tcpListenQueueSize = tcpListenQueueSize;
         }
+        if (maxInFlightQueriesPerConn > 0) {
+          cs->tcpMaxInFlightQueriesPerConn = maxInFlightQueriesPerConn;
+        }
 
         g_frontends.push_back(std::move(cs));
       }
@@ -1387,6 +1411,15 @@ static void setupLuaConfig(bool client, bool configCheck)
 #endif
     });
 
+  g_lua.writeFunction("setDNSCryptSharedKeysCacheSize", [](size_t size) {
+      setLuaSideEffect();
+#ifdef HAVE_DNSCRYPT
+      DNSCryptQuery::setSharedKeysCacheSize(size);
+#else
+      g_outputBuffer="Error: DNSCrypt support is not enabled.\n";
+#endif
+    });
+
 #ifdef HAVE_DNSCRYPT
   g_lua.writeFunction("generateDNSCryptCertificate", [client](const std::string& providerPrivateKeyFile, const std::string& certificateFile, const std::string privateKeyFile, uint32_t serial, time_t begin, time_t end, boost::optional<DNSCryptExchangeVersion> version) {
       setLuaNoSideEffect();
@@ -1513,7 +1546,7 @@ static void setupLuaConfig(bool client, bool configCheck)
 
   g_lua.writeFunction("showSecurityStatus", []() {
       setLuaNoSideEffect();
-      g_outputBuffer = std::to_string(g_stats.securityStatus) + "\n";
+      g_outputBuffer = std::to_string(g_stats.securityStatus.load()) + "\n";
     });
 
 #ifdef HAVE_EBPF
@@ -1657,6 +1690,11 @@ static void setupLuaConfig(bool client, bool configCheck)
       g_servFailOnNoPolicy = servfail;
     });
 
+  g_lua.writeFunction("setQueryRulesCompilation", [](bool compile) {
+      setLuaSideEffect();
+      g_compileQueryRules = compile;
+    });
+
   g_lua.writeFunction("setRoundRobinFailOnNoServer", [](bool fail) {
       setLuaSideEffect();
       g_roundrobinFailOnNoServer = fail;
@@ -1696,6 +1734,34 @@ static void setupLuaConfig(bool client, bool configCheck)
       g_rings.setCapacity(capacity, numberOfShards ? *numberOfShards : 1);
     });
 
+  g_lua.writeFunction("setRingBuffersSummaries", [](size_t capacity, boost::optional<std::unordered_map<std::string, unsigned int>> vars) {
+      setLuaSideEffect();
+      if (g_configurationDone) {
+        errlog("setRingBuffersSummaries() cannot be used at runtime!");
+        g_outputBuffer="setRingBuffersSummaries() cannot be used at runtime!\n";
+        return;
+      }
+      Rings::SummariesSettings settings;
+      settings.capacity = capacity;
+      if (vars) {
+        if (vars->count("window")) {
+          settings.window = vars->at("window");
+        }
+        if (vars->count("granularity")) {
+          settings.granularity = vars->at("granularity");
+        }
+        if (vars->count("suffixLabels")) {
+          settings.suffixLabels = vars->at("suffixLabels");
+        }
+      }
+      if (settings.window == 0 || settings.granularity == 0 || settings.granularity > settings.window) {
+        errlog("Invalid window or granularity passed to setRingBuffersSummaries()!");
+        g_outputBuffer="Invalid window or granularity passed to setRingBuffersSummaries()!\n";
+        return;
+      }
+      g_rings.setSummaries(settings);
+    });
+
   g_lua.writeFunction("setRingBuffersLockRetries", [](size_t retries) {
       setLuaSideEffect();
       g_rings.setNumberOfLockRetries(retries);
@@ -1907,11 +1973,12 @@ static void setupLuaConfig(bool client, bool configCheck)
     bool reusePort = false;
     int tcpFastOpenQueueSize = 0;
     int tcpListenQueueSize = 0;
+    int maxInFlightQueriesPerConn = 0;
     std::string interface;
     std::set<int> cpus;
 
     if (vars) {
-      parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize);
+      parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize, maxInFlightQueriesPerConn);
 
       if (vars->count("idleTimeout")) {
         frontend->d_idleTimeout = boost::get<int>((*vars)["idleTimeout"]);
@@ -2089,11 +2156,12 @@ static void setupLuaConfig(bool client, bool configCheck)
         bool reusePort = false;
         int tcpFastOpenQueueSize = 0;
         int tcpListenQueueSize = 0;
+        int maxInFlightQueriesPerConn = 0;
         std::string interface;
         std::set<int> cpus;
 
         if (vars) {
-          parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize);
+          parseLocalBindVars(vars, reusePort, tcpFastOpenQueueSize, interface, cpus, tcpListenQueueSize, maxInFlightQueriesPerConn);
 
           if (vars->count("provider")) {
             frontend->d_provider = boost::get<const string>((*vars)["provider"]);
@@ -2101,6 +2169,10 @@ static void setupLuaConfig(bool client, bool configCheck)
           }
 
           parseTLSConfig(frontend->d_tlsConfig, "addTLSLocal", vars);
+
+          if (vars->count("ktls")) {
+            frontend->d_tlsConfig.d_enableKTLS = boost::get<bool>((*vars)["ktls"]);
+          }
         }
 
         try {
@@ -2121,6 +2193,9 @@ static void setupLuaConfig(bool client, bool configCheck)
           if (tcpListenQueueSize > 0) {
             cs->tcpListenQueueSize = tcpListenQueueSize;
           }
+          if (maxInFlightQueriesPerConn > 0) {
+            cs->tcpMaxInFlightQueriesPerConn = maxInFlightQueriesPerConn;
+          }
           g_tlslocals.push_back(cs->tlsFrontend);
           g_frontends.push_back(std::move(cs));
         }
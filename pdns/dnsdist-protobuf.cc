@@ -24,6 +24,7 @@
 #include "dnsdist.hh"
 
 #include "dnsdist-protobuf.hh"
+#include "uuid-utils.hh"
 
 #ifdef HAVE_PROTOBUF
 #include "dnsmessage.pb.h"
@@ -41,3 +42,45 @@ DNSDistProtoBufMessage::DNSDistProtoBufMessage(const DNSResponse& dr, bool inclu
 };
 
 #endif /* HAVE_PROTOBUF */
+
+static void encodeDNSDistProtoBufMessage(DNSProtoBufEncoder& encoder, DNSProtoBufMessage::DNSProtoBufMessageType type, const DNSQuestion& dq, const ComboAddress& requestor, const std::string& serverID)
+{
+  encoder.setType(type);
+  encoder.setUUID(dq.uniqueId ? *dq.uniqueId : getUniqueID());
+  if (!serverID.empty()) {
+    encoder.setServerIdentity(serverID);
+  }
+  encoder.setSocket(dq.remote, dq.local, dq.tcp);
+  encoder.setRequestor(requestor);
+  encoder.setResponder(*dq.local);
+  encoder.setBytes(dq.len);
+  struct timespec ts;
+  gettime(&ts, true);
+  encoder.setTime(ts.tv_sec, ts.tv_nsec / 1000);
+  encoder.setId(dq.dh->id);
+  encoder.setQuestion(*dq.qname, dq.qtype, dq.qclass);
+}
+
+void encodeDNSDistProtoBufMessage(std::string& buffer, const DNSQuestion& dq, const ComboAddress& requestor, const std::string& serverID)
+{
+  DNSProtoBufEncoder encoder(buffer);
+  encodeDNSDistProtoBufMessage(encoder, DNSProtoBufMessage::Query, dq, requestor, serverID);
+  encoder.startResponse();
+  encoder.setQueryTime(dq.queryTime->tv_sec, dq.queryTime->tv_nsec / 1000);
+  encoder.endResponse();
+  encoder.setRequestorPort(dq.remote->getPort());
+  encoder.setResponderPort(dq.local->getPort());
+}
+
+void encodeDNSDistProtoBufMessage(std::string& buffer, const DNSResponse& dr, const ComboAddress& requestor, const std::string& serverID, bool includeCNAME)
+{
+  DNSProtoBufEncoder encoder(buffer);
+  encodeDNSDistProtoBufMessage(encoder, DNSProtoBufMessage::Response, dr, requestor, serverID);
+  encoder.startResponse();
+  encoder.setResponseCode(dr.dh->rcode);
+  encoder.addRRsFromPacket(reinterpret_cast<const char*>(dr.dh), dr.len, includeCNAME);
+  encoder.setQueryTime(dr.queryTime->tv_sec, dr.queryTime->tv_nsec / 1000);
+  encoder.endResponse();
+  encoder.setRequestorPort(dr.remote->getPort());
+  encoder.setResponderPort(dr.local->getPort());
+}
@@ -29,3 +29,9 @@ public:
   DNSDistProtoBufMessage(const DNSQuestion& dq);
   DNSDistProtoBufMessage(const DNSResponse& dr, bool includeCNAME);
 };
+
+/* Serialize the same content than DNSDistProtoBufMessage (plus the server identity, if not empty)
+   straight into 'buffer', without going through libprotobuf. 'requestor' is the address to
+   export, which might be different from dq.remote if it has been encrypted. */
+void encodeDNSDistProtoBufMessage(std::string& buffer, const DNSQuestion& dq, const ComboAddress& requestor, const std::string& serverID);
+void encodeDNSDistProtoBufMessage(std::string& buffer, const DNSResponse& dr, const ComboAddress& requestor, const std::string& serverID, bool includeCNAME);
@@ -21,6 +21,7 @@
  */
 
 #include "dnsdist-rings.hh"
+#include "gettime.hh"
 
 size_t Rings::numDistinctRequestors()
 {
@@ -38,19 +39,27 @@ std::unordered_map<int, vector<boost::variant<string,double>>> Rings::getTopBand
 {
   map<ComboAddress, unsigned int, ComboAddress::addressOnlyLessThan> counts;
   uint64_t total=0;
-  for (const auto& shard : d_shards) {
-    {
-      std::lock_guard<std::mutex> rl(shard->queryLock);
-      for(const auto& q : shard->queryRing) {
-        counts[q.requestor]+=q.size;
-        total+=q.size;
-      }
+  ClientsSummary::counts_t summarized;
+  if (getSummarizedClients(ClientsSummaryType::Bandwidth, 0, 0, summarized, total)) {
+    for (const auto& entry : summarized) {
+      counts[entry.first] += entry.second;
     }
-    {
-      std::lock_guard<std::mutex> rl(shard->respLock);
-      for(const auto& r : shard->respRing) {
-        counts[r.requestor]+=r.size;
-        total+=r.size;
+  }
+  else {
+    for (const auto& shard : d_shards) {
+      {
+        std::lock_guard<std::mutex> rl(shard->queryLock);
+        for(const auto& q : shard->queryRing) {
+          counts[q.requestor]+=q.size;
+          total+=q.size;
+        }
+      }
+      {
+        std::lock_guard<std::mutex> rl(shard->respLock);
+        for(const auto& r : shard->respRing) {
+          counts[r.requestor]+=r.size;
+          total+=r.size;
+        }
       }
     }
   }
@@ -66,16 +75,112 @@ std::unordered_map<int, vector<boost::variant<string,double>>> Rings::getTopBand
 		 return(b.first < a.first);
 	       });
   std::unordered_map<int, vector<boost::variant<string,double>>> ret;
-  uint64_t rest = 0;
+  /* the summaries do not track every client, so compute the rest from the total */
+  uint64_t rest = total;
   unsigned int count = 1;
   for(const auto& rc : rcounts) {
     if(count==numentries+1) {
-      rest+=rc.first;
-    }
-    else {
-      ret.insert({count++, {rc.second.toString(), rc.first, 100.0*rc.first/total}});
+      break;
     }
+    ret.insert({count++, {rc.second.toString(), rc.first, 100.0*rc.first/total}});
+    rest -= std::min(rest, static_cast<uint64_t>(rc.first));
   }
   ret.insert({count, {"Rest", rest, total > 0 ? 100.0*rest/total : 100.0}});
   return ret;
 }
+
+bool Rings::getSummarizedClients(ClientsSummaryType type, uint8_t rcode, unsigned int seconds, ClientsSummary::counts_t& counts, uint64_t& total)
+{
+  if (!hasSummaries() || seconds > getSummariesWindow()) {
+    return false;
+  }
+
+  struct timespec now;
+  gettime(&now);
+  total = 0;
+
+  for (const auto& shard : d_shards) {
+    if (type == ClientsSummaryType::Queries || type == ClientsSummaryType::Bandwidth) {
+      std::lock_guard<std::mutex> rl(shard->queryLock);
+      if (!shard->querySummaries) {
+        return false;
+      }
+      if (type == ClientsSummaryType::Queries) {
+        total += shard->querySummaries->clients.collect(now.tv_sec, seconds, counts);
+      }
+      else {
+        total += shard->querySummaries->bytes.collect(now.tv_sec, seconds, counts);
+      }
+    }
+
+    if (type == ClientsSummaryType::Bandwidth || type == ClientsSummaryType::ResponseBytes || type == ClientsSummaryType::RCode) {
+      std::lock_guard<std::mutex> rl(shard->respLock);
+      if (!shard->respSummaries) {
+        return false;
+      }
+      if (type == ClientsSummaryType::RCode) {
+        const auto& perRCode = shard->respSummaries->rcodes.at(rcode & 0xF);
+        if (perRCode) {
+          total += perRCode->clients.collect(now.tv_sec, seconds, counts);
+        }
+      }
+      else {
+        total += shard->respSummaries->bytes.collect(now.tv_sec, seconds, counts);
+      }
+    }
+  }
+
+  return true;
+}
+
+bool Rings::getSummarizedNames(boost::optional<uint8_t> rcode, boost::optional<unsigned int> labels, unsigned int seconds, NamesSummary::counts_t& counts, uint64_t& total)
+{
+  if (!hasSummaries() || seconds > getSummariesWindow()) {
+    return false;
+  }
+
+  if (labels && *labels > d_summariesSettings.suffixLabels) {
+    return false;
+  }
+
+  struct timespec now;
+  gettime(&now);
+  total = 0;
+
+  NamesSummary::counts_t collected;
+  for (const auto& shard : d_shards) {
+    if (!rcode) {
+      std::lock_guard<std::mutex> rl(shard->queryLock);
+      if (!shard->querySummaries) {
+        return false;
+      }
+      total += (labels ? shard->querySummaries->suffixes : shard->querySummaries->names).collect(now.tv_sec, seconds, collected);
+    }
+    else {
+      std::lock_guard<std::mutex> rl(shard->respLock);
+      if (!shard->respSummaries) {
+        return false;
+      }
+      const auto& perRCode = shard->respSummaries->rcodes.at(*rcode & 0xF);
+      if (perRCode) {
+        total += (labels ? perRCode->suffixes : perRCode->names).collect(now.tv_sec, seconds, collected);
+      }
+    }
+  }
+
+  if (labels && *labels < d_summariesSettings.suffixLabels) {
+    /* we keep more labels than requested, aggregate further */
+    for (const auto& entry : collected) {
+      DNSName name(entry.first);
+      name.trimToLabels(*labels);
+      counts[name] += entry.second;
+    }
+  }
+  else {
+    for (const auto& entry : collected) {
+      counts[entry.first] += entry.second;
+    }
+  }
+
+  return true;
+}
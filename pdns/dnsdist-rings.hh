@@ -21,13 +21,16 @@
  */
 #pragma once
 
+#include <array>
 #include <mutex>
 #include <time.h>
 #include <unordered_map>
 
+#include <boost/optional.hpp>
 #include <boost/variant.hpp>
 
 #include "circular_buffer.hh"
+#include "dnsdist-topn.hh"
 #include "dnsname.hh"
 #include "iputils.hh"
 
@@ -54,14 +57,88 @@ struct Rings {
     ComboAddress ds; // who handled it
   };
 
+  typedef WindowedSpaceSavingSummary<ComboAddress, ComboAddress::addressOnlyHash, ComboAddress::addressOnlyEqual> ClientsSummary;
+  typedef WindowedSpaceSavingSummary<DNSName> NamesSummary;
+
+  /* The summaries are continuously maintained, approximate top-N views of the
+     traffic, so that the console does not need to walk the rings to answer
+     the most common questions. They are disabled (capacity of 0) by default. */
+  struct SummariesSettings
+  {
+    size_t capacity{0};
+    unsigned int window{60};
+    unsigned int granularity{5};
+    unsigned int suffixLabels{2};
+  };
+
+  struct QuerySummaries
+  {
+    QuerySummaries(const SummariesSettings& settings): clients(settings.capacity, settings.window, settings.granularity), bytes(settings.capacity, settings.window, settings.granularity), names(settings.capacity, settings.window, settings.granularity), suffixes(settings.capacity, settings.window, settings.granularity)
+    {
+    }
+
+    /* 'suffix' is empty when the name does not have more labels than the suffixes summary keeps */
+    void add(time_t now, const ComboAddress& requestor, const DNSName& name, const DNSName& suffix, uint16_t size)
+    {
+      clients.add(now, requestor);
+      bytes.add(now, requestor, size);
+      names.add(now, name);
+      suffixes.add(now, suffix.empty() ? name : suffix);
+    }
+
+    ClientsSummary clients;
+    ClientsSummary bytes;
+    NamesSummary names;
+    NamesSummary suffixes;
+  };
+
+  struct RCodeSummaries
+  {
+    RCodeSummaries(const SummariesSettings& settings): clients(settings.capacity, settings.window, settings.granularity), names(settings.capacity, settings.window, settings.granularity), suffixes(settings.capacity, settings.window, settings.granularity)
+    {
+    }
+
+    ClientsSummary clients;
+    NamesSummary names;
+    NamesSummary suffixes;
+  };
+
+  struct ResponseSummaries
+  {
+    ResponseSummaries(const SummariesSettings& settings): bytes(settings.capacity, settings.window, settings.granularity)
+    {
+    }
+
+    void add(const SummariesSettings& settings, time_t now, const ComboAddress& requestor, const DNSName& name, const DNSName& suffix, unsigned int size, uint8_t rcode)
+    {
+      bytes.add(now, requestor, size);
+
+      /* the rcode-specific summaries are only allocated once we have seen that rcode */
+      auto& perRCode = rcodes.at(rcode & 0xF);
+      if (!perRCode) {
+        perRCode = std::unique_ptr<RCodeSummaries>(new RCodeSummaries(settings));
+      }
+      perRCode->clients.add(now, requestor);
+      perRCode->names.add(now, name);
+      perRCode->suffixes.add(now, suffix.empty() ? name : suffix);
+    }
+
+    ClientsSummary bytes;
+    std::array<std::unique_ptr<RCodeSummaries>, 16> rcodes;
+  };
+
   struct Shard
   {
     boost::circular_buffer<Query> queryRing;
     boost::circular_buffer<Response> respRing;
+    std::unique_ptr<QuerySummaries> querySummaries{nullptr};
+    std::unique_ptr<ResponseSummaries> respSummaries{nullptr};
     std::mutex queryLock;
     std::mutex respLock;
   };
 
+  enum class ClientsSummaryType : uint8_t { Queries, Bandwidth, ResponseBytes, RCode };
+
   Rings(size_t capacity=10000, size_t numberOfShards=1, size_t nbLockTries=5, bool keepLockingStats=false): d_blockingQueryInserts(0), d_blockingResponseInserts(0), d_deferredQueryInserts(0), d_deferredResponseInserts(0), d_nbQueryEntries(0), d_nbResponseEntries(0), d_currentShardId(0), d_numberOfShards(numberOfShards), d_nbLockTries(nbLockTries), d_keepLockingStats(keepLockingStats)
   {
     setCapacity(capacity, numberOfShards);
@@ -71,6 +148,36 @@ struct Rings {
   }
   std::unordered_map<int, vector<boost::variant<string,double> > > getTopBandwidth(unsigned int numentries);
   size_t numDistinctRequestors();
+  /* Fill 'counts' with the approximate per-client counts seen over the last 'seconds' seconds (0 meaning the whole window),
+     return false if the summaries are not enabled or do not cover that period */
+  bool getSummarizedClients(ClientsSummaryType type, uint8_t rcode, unsigned int seconds, ClientsSummary::counts_t& counts, uint64_t& total);
+  /* Same for names, over queries if 'rcode' is not set and over responses with that rcode otherwise, also returning false
+     if the summaries do not keep enough labels */
+  bool getSummarizedNames(boost::optional<uint8_t> rcode, boost::optional<unsigned int> labels, unsigned int seconds, NamesSummary::counts_t& counts, uint64_t& total);
+
+  /* This function should only be called at configuration time before any query or response has been inserted */
+  void setSummaries(const SummariesSettings& settings)
+  {
+    d_summariesSettings = settings;
+    for (auto& shard : d_shards) {
+      {
+        std::lock_guard<std::mutex> wl(shard->queryLock);
+        setupSummaries(shard);
+      }
+    }
+  }
+
+  bool hasSummaries() const
+  {
+    return d_summariesSettings.capacity > 0;
+  }
+
+  /* the number of seconds covered by the summaries */
+  unsigned int getSummariesWindow() const
+  {
+    return hasSummaries() ? ((d_summariesSettings.window + d_summariesSettings.granularity - 1) / d_summariesSettings.granularity) * d_summariesSettings.granularity : 0;
+  }
+
   /* This function should only be called at configuration time before any query or response has been inserted */
   void setCapacity(size_t newCapacity, size_t numberOfShards)
   {
@@ -87,6 +194,7 @@ struct Rings {
       {
         std::lock_guard<std::mutex> wl(shard->queryLock);
         shard->queryRing.set_capacity(newCapacity / numberOfShards);
+        setupSummaries(shard);
       }
       {
         std::lock_guard<std::mutex> wl(shard->respLock);
@@ -125,11 +233,12 @@ struct Rings {
 
   void insertQuery(const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, uint16_t size, const struct dnsheader& dh)
   {
+    const auto suffix = getSummarySuffix(name);
     for (size_t idx = 0; idx < d_nbLockTries; idx++) {
       auto& shard = getOneShard();
       std::unique_lock<std::mutex> wl(shard->queryLock, std::try_to_lock);
       if (wl.owns_lock()) {
-        insertQueryLocked(shard, when, requestor, name, qtype, size, dh);
+        insertQueryLocked(shard, when, requestor, name, suffix, qtype, size, dh);
         return;
       }
       if (d_keepLockingStats) {
@@ -143,16 +252,17 @@ struct Rings {
     }
     auto& shard = getOneShard();
     std::lock_guard<std::mutex> wl(shard->queryLock);
-    insertQueryLocked(shard, when, requestor, name, qtype, size, dh);
+    insertQueryLocked(shard, when, requestor, name, suffix, qtype, size, dh);
   }
 
   void insertResponse(const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, unsigned int usec, unsigned int size, const struct dnsheader& dh, const ComboAddress& backend)
   {
+    const auto suffix = getSummarySuffix(name);
     for (size_t idx = 0; idx < d_nbLockTries; idx++) {
       auto& shard = getOneShard();
       std::unique_lock<std::mutex> wl(shard->respLock, std::try_to_lock);
       if (wl.owns_lock()) {
-        insertResponseLocked(shard, when, requestor, name, qtype, usec, size, dh, backend);
+        insertResponseLocked(shard, when, requestor, name, suffix, qtype, usec, size, dh, backend);
         return;
       }
       if (d_keepLockingStats) {
@@ -166,7 +276,7 @@ struct Rings {
     }
     auto& shard = getOneShard();
     std::lock_guard<std::mutex> wl(shard->respLock);
-    insertResponseLocked(shard, when, requestor, name, qtype, usec, size, dh, backend);
+    insertResponseLocked(shard, when, requestor, name, suffix, qtype, usec, size, dh, backend);
   }
 
   void clear()
@@ -175,10 +285,16 @@ struct Rings {
       {
         std::lock_guard<std::mutex> wl(shard->queryLock);
         shard->queryRing.clear();
+        if (shard->querySummaries) {
+          shard->querySummaries = std::unique_ptr<QuerySummaries>(new QuerySummaries(d_summariesSettings));
+        }
       }
       {
         std::lock_guard<std::mutex> wl(shard->respLock);
         shard->respRing.clear();
+        if (shard->respSummaries) {
+          shard->respSummaries = std::unique_ptr<ResponseSummaries>(new ResponseSummaries(d_summariesSettings));
+        }
       }
     }
 
@@ -208,26 +324,60 @@ private:
     return d_shards[getShardId()];
   }
 
-  void insertQueryLocked(std::unique_ptr<Shard>& shard, const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, uint16_t size, const struct dnsheader& dh)
+  /* the caller is expected to hold the query lock */
+  void setupSummaries(std::unique_ptr<Shard>& shard)
+  {
+    if (d_summariesSettings.capacity == 0) {
+      shard->querySummaries.reset();
+      std::lock_guard<std::mutex> wl(shard->respLock);
+      shard->respSummaries.reset();
+      return;
+    }
+
+    shard->querySummaries = std::unique_ptr<QuerySummaries>(new QuerySummaries(d_summariesSettings));
+    std::lock_guard<std::mutex> wl(shard->respLock);
+    shard->respSummaries = std::unique_ptr<ResponseSummaries>(new ResponseSummaries(d_summariesSettings));
+  }
+
+  /* the suffix kept in the summaries, computed before taking the shard lock so that
+     the allocation does not happen in the critical section */
+  DNSName getSummarySuffix(const DNSName& name) const
+  {
+    DNSName suffix;
+    if (hasSummaries() && name.countLabels() > d_summariesSettings.suffixLabels) {
+      suffix = name;
+      suffix.trimToLabels(d_summariesSettings.suffixLabels);
+    }
+    return suffix;
+  }
+
+  void insertQueryLocked(std::unique_ptr<Shard>& shard, const struct timespec& when, const ComboAddress& requestor, const DNSName& name, const DNSName& suffix, uint16_t qtype, uint16_t size, const struct dnsheader& dh)
   {
     if (!shard->queryRing.full()) {
       d_nbQueryEntries++;
     }
     shard->queryRing.push_back({when, requestor, name, size, qtype, dh});
+    if (shard->querySummaries) {
+      shard->querySummaries->add(when.tv_sec, requestor, name, suffix, size);
+    }
   }
 
-  void insertResponseLocked(std::unique_ptr<Shard>& shard, const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, unsigned int usec, unsigned int size, const struct dnsheader& dh, const ComboAddress& backend)
+  void insertResponseLocked(std::unique_ptr<Shard>& shard, const struct timespec& when, const ComboAddress& requestor, const DNSName& name, const DNSName& suffix, uint16_t qtype, unsigned int usec, unsigned int size, const struct dnsheader& dh, const ComboAddress& backend)
   {
     if (!shard->respRing.full()) {
       d_nbResponseEntries++;
     }
     shard->respRing.push_back({when, requestor, name, qtype, usec, size, dh, backend});
+    if (shard->respSummaries) {
+      shard->respSummaries->add(d_summariesSettings, when.tv_sec, requestor, name, suffix, size, dh.rcode);
+    }
   }
 
   std::atomic<size_t> d_nbQueryEntries;
   std::atomic<size_t> d_nbResponseEntries;
   std::atomic<size_t> d_currentShardId;
 
+  SummariesSettings d_summariesSettings;
   size_t d_numberOfShards;
   size_t d_nbLockTries = 5;
   bool d_keepLockingStats{false};
@@ -440,16 +440,28 @@ public:
 
 static void handleDownstreamIOCallback(int fd, FDMultiplexer::funcparam_t& param);
 
+class OutgoingTCPQueryState;
+
+/* a response waiting to be sent to the client. d_query is set when the response
+   comes from a backend, and empty for self-generated ones (cache hits, spoofed
+   responses, DNSCrypt certificates..) */
+struct TCPResponse
+{
+  std::vector<uint8_t> d_buffer;
+  std::shared_ptr<OutgoingTCPQueryState> d_query{nullptr};
+  dnsheader d_cleartextDH;
+};
+
 class IncomingTCPConnectionState
 {
 public:
-  IncomingTCPConnectionState(ConnectionInfo&& ci, TCPClientThreadData& threadData, const struct timeval& now): d_buffer(s_maxPacketCacheEntrySize), d_responseBuffer(s_maxPacketCacheEntrySize), d_threadData(threadData), d_ci(std::move(ci)), d_handler(d_ci.fd, g_tcpRecvTimeout, d_ci.cs->tlsFrontend ? d_ci.cs->tlsFrontend->getContext() : nullptr, now.tv_sec), d_connectionStartTime(now)
+  IncomingTCPConnectionState(ConnectionInfo&& ci, TCPClientThreadData& threadData, const struct timeval& now): d_buffer(s_maxPacketCacheEntrySize), d_threadData(threadData), d_ci(std::move(ci)), d_handler(d_ci.fd, g_tcpRecvTimeout, d_ci.cs->tlsFrontend ? d_ci.cs->tlsFrontend->getContext() : nullptr, now.tv_sec), d_connectionStartTime(now)
   {
-    d_ids.origDest.reset();
-    d_ids.origDest.sin4.sin_family = d_ci.remote.sin4.sin_family;
-    socklen_t socklen = d_ids.origDest.getSocklen();
-    if (getsockname(d_ci.fd, reinterpret_cast<sockaddr*>(&d_ids.origDest), &socklen)) {
-      d_ids.origDest = d_ci.cs->local;
+    d_origDest.reset();
+    d_origDest.sin4.sin_family = d_ci.remote.sin4.sin_family;
+    socklen_t socklen = d_origDest.getSocklen();
+    if (getsockname(d_ci.fd, reinterpret_cast<sockaddr*>(&d_origDest), &socklen)) {
+      d_origDest = d_ci.cs->local;
     }
   }
 
@@ -467,33 +479,6 @@ public:
       d_ci.cs->updateTCPMetrics(d_queriesCount, diff.tv_sec * 1000.0 + diff.tv_usec / 1000.0);
     }
 
-    if (d_ds != nullptr) {
-      if (d_outstanding) {
-        --d_ds->outstanding;
-        d_outstanding = false;
-      }
-
-      if (d_downstreamConnection) {
-        try {
-          if (d_lastIOState == IOState::NeedRead) {
-            cerr<<__func__<<": removing leftover backend read FD "<<d_downstreamConnection->getHandle()<<endl;
-            d_threadData.mplexer->removeReadFD(d_downstreamConnection->getHandle());
-          }
-          else if (d_lastIOState == IOState::NeedWrite) {
-            cerr<<__func__<<": removing leftover backend write FD "<<d_downstreamConnection->getHandle()<<endl;
-            d_threadData.mplexer->removeWriteFD(d_downstreamConnection->getHandle());
-          }
-        }
-        catch(const FDMultiplexerException& e) {
-          vinfolog("Got an exception when trying to remove a pending IO operation on the socket to the %s backend: %s", d_ds->getName(), e.what());
-        }
-        catch(const std::runtime_error& e) {
-          /* might be thrown by getHandle() */
-          vinfolog("Got an exception when trying to remove a pending IO operation on the socket to the %s backend: %s", d_ds->getName(), e.what());
-        }
-      }
-    }
-
     try {
       if (d_lastIOState == IOState::NeedRead) {
         cerr<<__func__<<": removing leftover client read FD "<<d_ci.fd<<endl;
@@ -514,11 +499,36 @@ public:
     d_buffer.resize(sizeof(uint16_t));
     d_currentPos = 0;
     d_querySize = 0;
-    d_responseSize = 0;
-    d_downstreamFailures = 0;
     d_state = State::readingQuerySize;
-    d_lastIOState = IOState::Done;
-    d_selfGeneratedResponse = false;
+  }
+
+  /* the connection to the client is no longer usable. The queries still in flight hold a reference
+     to this object so it will only be destroyed, and the socket closed, once they are done */
+  void markAsDead()
+  {
+    d_connectionDied = true;
+    d_stopReading = true;
+    /* the responses hold a reference to their query, which holds one to us */
+    d_queuedResponses.clear();
+  }
+
+  size_t getMaxInFlightQueries() const
+  {
+    /* 0 means that we process the queries one after another */
+    return d_ci.cs->tcpMaxInFlightQueriesPerConn > 0 ? d_ci.cs->tcpMaxInFlightQueriesPerConn : 1;
+  }
+
+  bool canReadQuery() const
+  {
+    if (d_stopReading) {
+      return false;
+    }
+
+    if (g_maxTCPQueriesPerConn && d_queriesCount > g_maxTCPQueriesPerConn) {
+      return false;
+    }
+
+    return d_currentQueriesInFlight < getMaxInFlightQueries();
   }
 
   boost::optional<struct timeval> getClientReadTTD(struct timeval now) const
@@ -543,21 +553,6 @@ public:
     return now;
   }
 
-  boost::optional<struct timeval> getBackendReadTTD(const struct timeval& now) const
-  {
-    if (d_ds == nullptr) {
-      throw std::runtime_error("getBackendReadTTD() without any backend selected");
-    }
-    if (d_ds->tcpRecvTimeout == 0) {
-      return boost::none;
-    }
-
-    struct timeval res = now;
-    res.tv_sec += d_ds->tcpRecvTimeout;
-
-    return res;
-  }
-
   boost::optional<struct timeval> getClientWriteTTD(const struct timeval& now) const
   {
     if (g_maxTCPConnectionDuration == 0 && g_tcpSendTimeout == 0) {
@@ -582,21 +577,6 @@ public:
     return res;
   }
 
-  boost::optional<struct timeval> getBackendWriteTTD(const struct timeval& now) const
-  {
-    if (d_ds == nullptr) {
-      throw std::runtime_error("getBackendReadTTD() called without any backend selected");
-    }
-    if (d_ds->tcpSendTimeout == 0) {
-      return boost::none;
-    }
-
-    struct timeval res = now;
-    res.tv_sec += d_ds->tcpSendTimeout;
-
-    return res;
-  }
-
   bool maxConnectionDurationReached(unsigned int maxConnectionDuration, const struct timeval& now)
   {
     if (maxConnectionDuration) {
@@ -624,94 +604,209 @@ public:
     {
       std::lock_guard<std::mutex> lock(s_mutex);
       fprintf(stderr, "State is %p\n", this);
-      cerr << "Current state is " << static_cast<int>(d_state) << ", got "<<d_queriesCount<<" queries so far" << endl;
+      cerr << "Current state is " << static_cast<int>(d_state) << ", got "<<d_queriesCount<<" queries so far, "<<d_currentQueriesInFlight<<" in flight and "<<d_queuedResponses.size()<<" responses waiting to be sent" << endl;
       cerr << "Current time is " << now.tv_sec << " - " << now.tv_usec << endl;
       cerr << "Connection started at " << d_connectionStartTime.tv_sec << " - " << d_connectionStartTime.tv_usec << endl;
       if (d_state > State::doingHandshake) {
         cerr << "Handshake done at " << d_handshakeDoneTime.tv_sec << " - " << d_handshakeDoneTime.tv_usec << endl;
       }
-      if (d_state > State::readingQuerySize) {
+      if (d_queriesCount > 0) {
         cerr << "Got first query size at " << d_firstQuerySizeReadTime.tv_sec << " - " << d_firstQuerySizeReadTime.tv_usec << endl;
-      }
-      if (d_state > State::readingQuerySize) {
-        cerr << "Got query size at " << d_querySizeReadTime.tv_sec << " - " << d_querySizeReadTime.tv_usec << endl;
-      }
-      if (d_state > State::readingQuery) {
-        cerr << "Got query at " << d_queryReadTime.tv_sec << " - " << d_queryReadTime.tv_usec << endl;
-      }
-      if (d_state > State::sendingQueryToBackend) {
-        cerr << "Sent query at " << d_querySentTime.tv_sec << " - " << d_querySentTime.tv_usec << endl;
-      }
-      if (d_state > State::readingResponseFromBackend) {
-        cerr << "Got response at " << d_responseReadTime.tv_sec << " - " << d_responseReadTime.tv_usec << endl;
+        cerr << "Got last query size at " << d_querySizeReadTime.tv_sec << " - " << d_querySizeReadTime.tv_usec << endl;
+        cerr << "Got last query at " << d_queryReadTime.tv_sec << " - " << d_queryReadTime.tv_usec << endl;
       }
     }
   }
 
-  enum class State { doingHandshake, readingQuerySize, readingQuery, sendingQueryToBackend, readingResponseSizeFromBackend, readingResponseFromBackend, sendingResponse };
+  enum class State { doingHandshake, readingQuerySize, readingQuery };
 
   std::vector<uint8_t> d_buffer;
-  std::vector<uint8_t> d_responseBuffer;
+  std::deque<TCPResponse> d_queuedResponses;
   TCPClientThreadData& d_threadData;
-  IDState d_ids;
   ConnectionInfo d_ci;
+  ComboAddress d_origDest;
   TCPIOHandler d_handler;
-  std::unique_ptr<TCPConnectionToBackend> d_downstreamConnection{nullptr};
-  std::shared_ptr<DownstreamState> d_ds{nullptr};
-  dnsheader d_cleartextDH;
+  /* connection to a backend on which we sent a Proxy Protocol payload without any TLV,
+     that can be reused for the next queries from this client only */
+  std::unique_ptr<TCPConnectionToBackend> d_ownedConnectionToBackend{nullptr};
   struct timeval d_connectionStartTime;
   struct timeval d_handshakeDoneTime;
   struct timeval d_firstQuerySizeReadTime;
   struct timeval d_querySizeReadTime;
   struct timeval d_queryReadTime;
-  struct timeval d_querySentTime;
-  struct timeval d_responseReadTime;
   size_t d_currentPos{0};
+  size_t d_currentResponsePos{0};
   size_t d_queriesCount{0};
+  size_t d_currentQueriesInFlight{0};
   unsigned int d_remainingTime{0};
   uint16_t d_querySize{0};
-  uint16_t d_responseSize{0};
-  uint16_t d_downstreamFailures{0};
   State d_state{State::doingHandshake};
   IOState d_lastIOState{IOState::Done};
   bool d_readingFirstQuery{true};
+  bool d_stopReading{false};
+  bool d_connectionDied{false};
+  bool d_handlingIO{false};
+  bool d_proxyProtocolPayloadHasTLV{false};
+};
+
+/* a query read from an incoming TCP connection and forwarded to a backend over its own
+   connection, so that several queries from the same client can be processed at once */
+class OutgoingTCPQueryState
+{
+public:
+  OutgoingTCPQueryState(std::shared_ptr<IncomingTCPConnectionState>& incoming, std::shared_ptr<DownstreamState>& ds): d_incoming(incoming), d_ds(ds), d_responseBuffer(sizeof(uint16_t)), d_threadData(incoming->d_threadData)
+  {
+  }
+
+  OutgoingTCPQueryState(const OutgoingTCPQueryState& rhs) = delete;
+  OutgoingTCPQueryState& operator=(const OutgoingTCPQueryState& rhs) = delete;
+
+  ~OutgoingTCPQueryState()
+  {
+    if (d_outstanding) {
+      --d_ds->outstanding;
+      d_outstanding = false;
+    }
+
+    if (d_downstreamConnection) {
+      try {
+        if (d_lastIOState == IOState::NeedRead) {
+          cerr<<__func__<<": removing leftover backend read FD "<<d_downstreamConnection->getHandle()<<endl;
+          d_threadData.mplexer->removeReadFD(d_downstreamConnection->getHandle());
+        }
+        else if (d_lastIOState == IOState::NeedWrite) {
+          cerr<<__func__<<": removing leftover backend write FD "<<d_downstreamConnection->getHandle()<<endl;
+          d_threadData.mplexer->removeWriteFD(d_downstreamConnection->getHandle());
+        }
+      }
+      catch(const FDMultiplexerException& e) {
+        vinfolog("Got an exception when trying to remove a pending IO operation on the socket to the %s backend: %s", d_ds->getName(), e.what());
+      }
+      catch(const std::runtime_error& e) {
+        /* might be thrown by getHandle() */
+        vinfolog("Got an exception when trying to remove a pending IO operation on the socket to the %s backend: %s", d_ds->getName(), e.what());
+      }
+    }
+  }
+
+  boost::optional<struct timeval> getBackendReadTTD(const struct timeval& now) const
+  {
+    if (d_ds->tcpRecvTimeout == 0) {
+      return boost::none;
+    }
+
+    struct timeval res = now;
+    res.tv_sec += d_ds->tcpRecvTimeout;
+
+    return res;
+  }
+
+  boost::optional<struct timeval> getBackendWriteTTD(const struct timeval& now) const
+  {
+    if (d_ds->tcpSendTimeout == 0) {
+      return boost::none;
+    }
+
+    struct timeval res = now;
+    res.tv_sec += d_ds->tcpSendTimeout;
+
+    return res;
+  }
+
+  enum class State { sendingQueryToBackend, readingResponseSizeFromBackend, readingResponseFromBackend };
+
+  std::shared_ptr<IncomingTCPConnectionState> d_incoming;
+  std::shared_ptr<DownstreamState> d_ds;
+  std::vector<uint8_t> d_buffer;
+  std::vector<uint8_t> d_responseBuffer;
+  TCPClientThreadData& d_threadData;
+  IDState d_ids;
+  std::unique_ptr<TCPConnectionToBackend> d_downstreamConnection{nullptr};
+  dnsheader d_cleartextDH;
+  struct timeval d_querySentTime;
+  struct timeval d_responseReadTime;
+  size_t d_currentPos{0};
+  uint16_t d_responseSize{0};
+  uint16_t d_downstreamFailures{0};
+  State d_state{State::sendingQueryToBackend};
+  IOState d_lastIOState{IOState::Done};
   bool d_outstanding{false};
   bool d_firstResponsePacket{true};
   bool d_isXFR{false};
   bool d_xfrStarted{false};
-  bool d_selfGeneratedResponse{false};
   bool d_proxyProtocolPayloadAdded{false};
-  bool d_proxyProtocolPayloadHasTLV{false};
+  bool d_done{false};
 };
 
 static void handleIOCallback(int fd, FDMultiplexer::funcparam_t& param);
-static void handleNewIOState(std::shared_ptr<IncomingTCPConnectionState>& state, IOState iostate, const int fd, FDMultiplexer::callbackfunc_t callback, boost::optional<struct timeval> ttd=boost::none);
+template <class T> static void handleNewIOState(std::shared_ptr<T>& state, IOState iostate, const int fd, FDMultiplexer::callbackfunc_t callback, boost::optional<struct timeval> ttd=boost::none);
 static void handleIO(std::shared_ptr<IncomingTCPConnectionState>& state, struct timeval& now);
-static void handleDownstreamIO(std::shared_ptr<IncomingTCPConnectionState>& state, struct timeval& now);
+static void handleDownstreamIO(std::shared_ptr<OutgoingTCPQueryState>& query, struct timeval& now);
+
+/* we are done with this query, either because we got a response or because we gave up */
+static void finishQuery(std::shared_ptr<OutgoingTCPQueryState>& query, struct timeval& now, bool failed)
+{
+  if (query->d_done) {
+    return;
+  }
+  query->d_done = true;
+
+  if (query->d_outstanding) {
+    --query->d_ds->outstanding;
+    query->d_outstanding = false;
+  }
+
+  auto state = query->d_incoming;
+  --state->d_currentQueriesInFlight;
+  if (failed) {
+    /* we are not going to answer this query, so let's close the connection once we are done
+       with the other ones so that the client knows that it needs to retry */
+    state->d_stopReading = true;
+  }
+
+  /* we might be able to read a new query now, or we might have a response to send */
+  handleIO(state, now);
+}
+
+static void queueResponse(std::shared_ptr<IncomingTCPConnectionState>& state, TCPResponse&& response)
+{
+  if (state->d_connectionDied) {
+    return;
+  }
+
+  const uint16_t responseSize = static_cast<uint16_t>(response.d_buffer.size());
+  const uint8_t sizeBytes[] = { static_cast<uint8_t>(responseSize / 256), static_cast<uint8_t>(responseSize % 256) };
+  /* prepend the size. Yes, this is not the most efficient way but it prevents mistakes
+     that could occur if we had to deal with the size during the processing,
+     especially alignment issues */
+  response.d_buffer.insert(response.d_buffer.begin(), sizeBytes, sizeBytes + 2);
+
+  state->d_queuedResponses.push_back(std::move(response));
+}
 
-static void handleResponseSent(std::shared_ptr<IncomingTCPConnectionState>& state, struct timeval& now)
+static void handleResponseSent(std::shared_ptr<IncomingTCPConnectionState>& state, TCPResponse& response, struct timeval& now)
 {
-  handleNewIOState(state, IOState::Done, state->d_ci.fd, handleIOCallback);
+  auto& query = response.d_query;
 
-  if (state->d_isXFR && state->d_downstreamConnection) {
+  if (query && query->d_isXFR && query->d_downstreamConnection) {
     /* we need to resume reading from the backend! */
-    state->d_state = IncomingTCPConnectionState::State::readingResponseSizeFromBackend;
-    state->d_currentPos = 0;
-    handleDownstreamIO(state, now);
+    query->d_state = OutgoingTCPQueryState::State::readingResponseSizeFromBackend;
+    query->d_currentPos = 0;
+    query->d_responseBuffer.resize(sizeof(uint16_t));
+    handleDownstreamIO(query, now);
     return;
   }
 
-  if (state->d_selfGeneratedResponse == false && state->d_ds) {
-    /* if we have no downstream server selected, this was a self-answered response
-       but cache hits have a selected server as well, so be careful */
+  if (query) {
+    /* self-answered responses, including cache hits, have no query attached */
     struct timespec answertime;
     gettime(&answertime);
-    double udiff = state->d_ids.sentTime.udiff();
-    g_rings.insertResponse(answertime, state->d_ci.remote, state->d_ids.qname, state->d_ids.qtype, static_cast<unsigned int>(udiff), static_cast<unsigned int>(state->d_responseBuffer.size()), state->d_cleartextDH, state->d_ds->remote);
-    vinfolog("Got answer from %s, relayed to %s (%s), took %f usec", state->d_ds->remote.toStringWithPort(), state->d_ids.origRemote.toStringWithPort(), (state->d_ci.cs->tlsFrontend ? "DoT" : "TCP"), udiff);
+    double udiff = query->d_ids.sentTime.udiff();
+    g_rings.insertResponse(answertime, state->d_ci.remote, query->d_ids.qname, query->d_ids.qtype, static_cast<unsigned int>(udiff), static_cast<unsigned int>(response.d_buffer.size()), response.d_cleartextDH, query->d_ds->remote);
+    vinfolog("Got answer from %s, relayed to %s (%s), took %f usec", query->d_ds->remote.toStringWithPort(), query->d_ids.origRemote.toStringWithPort(), (state->d_ci.cs->tlsFrontend ? "DoT" : "TCP"), udiff);
   }
 
-  switch (state->d_cleartextDH.rcode) {
+  switch (response.d_cleartextDH.rcode) {
   case RCode::NXDomain:
     ++g_stats.frontendNXDomain;
     break;
@@ -724,136 +819,135 @@ static void handleResponseSent(std::shared_ptr<IncomingTCPConnectionState>& stat
     break;
   }
 
+  if (state->d_stopReading) {
+    return;
+  }
+
   if (g_maxTCPQueriesPerConn && state->d_queriesCount > g_maxTCPQueriesPerConn) {
     vinfolog("Terminating TCP connection from %s because it reached the maximum number of queries per conn (%d / %d)", state->d_ci.remote.toStringWithPort(), state->d_queriesCount, g_maxTCPQueriesPerConn);
+    state->d_stopReading = true;
     return;
   }
 
   if (state->maxConnectionDurationReached(g_maxTCPConnectionDuration, now)) {
     vinfolog("Terminating TCP connection from %s because it reached the maximum TCP connection duration", state->d_ci.remote.toStringWithPort());
+    state->d_stopReading = true;
     return;
   }
-
-  state->resetForNewQuery();
-
-  handleIO(state, now);
 }
 
-static void sendResponse(std::shared_ptr<IncomingTCPConnectionState>& state, struct timeval& now)
+static bool handleResponse(std::shared_ptr<OutgoingTCPQueryState>& query, struct timeval& now)
 {
-  state->d_state = IncomingTCPConnectionState::State::sendingResponse;
-  const uint8_t sizeBytes[] = { static_cast<uint8_t>(state->d_responseSize / 256), static_cast<uint8_t>(state->d_responseSize % 256) };
-  /* prepend the size. Yes, this is not the most efficient way but it prevents mistakes
-     that could occur if we had to deal with the size during the processing,
-     especially alignment issues */
-  state->d_responseBuffer.insert(state->d_responseBuffer.begin(), sizeBytes, sizeBytes + 2);
-
-  state->d_currentPos = 0;
+  auto& state = query->d_incoming;
 
-  handleIO(state, now);
-}
-
-static void handleResponse(std::shared_ptr<IncomingTCPConnectionState>& state, struct timeval& now)
-{
-  if (state->d_responseSize < sizeof(dnsheader) || !state->d_ds) {
-    return;
+  if (query->d_responseSize < sizeof(dnsheader)) {
+    return false;
   }
 
-  auto response = reinterpret_cast<char*>(&state->d_responseBuffer.at(0));
+  auto response = reinterpret_cast<char*>(&query->d_responseBuffer.at(0));
   unsigned int consumed;
-  if (state->d_firstResponsePacket && !responseContentMatches(response, state->d_responseSize, state->d_ids.qname, state->d_ids.qtype, state->d_ids.qclass, state->d_ds->remote, consumed)) {
-    return;
+  if (query->d_firstResponsePacket && !responseContentMatches(response, query->d_responseSize, query->d_ids.qname, query->d_ids.qtype, query->d_ids.qclass, query->d_ds->remote, consumed)) {
+    return false;
   }
-  state->d_firstResponsePacket = false;
+  query->d_firstResponsePacket = false;
 
-  if (state->d_outstanding) {
-    --state->d_ds->outstanding;
-    state->d_outstanding = false;
+  if (query->d_outstanding) {
+    --query->d_ds->outstanding;
+    query->d_outstanding = false;
   }
 
   auto dh = reinterpret_cast<struct dnsheader*>(response);
   uint16_t addRoom = 0;
-  DNSResponse dr = makeDNSResponseFromIDState(state->d_ids, dh, state->d_responseBuffer.size(), state->d_responseSize, true);
+  DNSResponse dr = makeDNSResponseFromIDState(query->d_ids, dh, query->d_responseBuffer.size(), query->d_responseSize, true);
   if (dr.dnsCryptQuery) {
     addRoom = DNSCRYPT_MAX_RESPONSE_PADDING_AND_MAC_SIZE;
   }
 
-  memcpy(&state->d_cleartextDH, dr.dh, sizeof(state->d_cleartextDH));
+  memcpy(&query->d_cleartextDH, dr.dh, sizeof(query->d_cleartextDH));
 
   std::vector<uint8_t> rewrittenResponse;
-  size_t responseSize = state->d_responseBuffer.size();
-  if (!processResponse(&response, &state->d_responseSize, &responseSize, state->d_threadData.localRespRulactions, dr, addRoom, rewrittenResponse, false)) {
-    return;
+  size_t responseSize = query->d_responseBuffer.size();
+  if (!processResponse(&response, &query->d_responseSize, &responseSize, state->d_threadData.localRespRulactions, dr, addRoom, rewrittenResponse, false)) {
+    return false;
   }
 
   if (!rewrittenResponse.empty()) {
     /* responseSize has been updated as well but we don't really care since it will match
        the capacity of rewrittenResponse anyway */
-    state->d_responseBuffer = std::move(rewrittenResponse);
-    state->d_responseSize = state->d_responseBuffer.size();
+    query->d_responseBuffer = std::move(rewrittenResponse);
+    query->d_responseSize = query->d_responseBuffer.size();
   } else {
     /* the size might have been updated (shrinked) if we removed the whole OPT RR, for example) */
-    state->d_responseBuffer.resize(state->d_responseSize);
+    query->d_responseBuffer.resize(query->d_responseSize);
   }
 
-  if (state->d_isXFR && !state->d_xfrStarted) {
+  if (query->d_isXFR && !query->d_xfrStarted) {
     /* don't bother parsing the content of the response for now */
-    state->d_xfrStarted = true;
+    query->d_xfrStarted = true;
     ++g_stats.responses;
     ++state->d_ci.cs->responses;
-    ++state->d_ds->responses;
+    ++query->d_ds->responses;
   }
 
-  if (!state->d_isXFR) {
+  if (!query->d_isXFR) {
     ++g_stats.responses;
     ++state->d_ci.cs->responses;
-    ++state->d_ds->responses;
+    ++query->d_ds->responses;
   }
 
-  sendResponse(state, now);
+  TCPResponse tcpResponse;
+  tcpResponse.d_buffer = std::move(query->d_responseBuffer);
+  tcpResponse.d_query = query;
+  memcpy(&tcpResponse.d_cleartextDH, &query->d_cleartextDH, sizeof(tcpResponse.d_cleartextDH));
+  queueResponse(state, std::move(tcpResponse));
+
+  return true;
 }
 
-static void sendQueryToBackend(std::shared_ptr<IncomingTCPConnectionState>& state, struct timeval& now)
+static void sendQueryToBackend(std::shared_ptr<OutgoingTCPQueryState>& query, struct timeval& now)
 {
-  auto ds = state->d_ds;
-  state->d_state = IncomingTCPConnectionState::State::sendingQueryToBackend;
-  state->d_currentPos = 0;
-  state->d_firstResponsePacket = true;
+  auto ds = query->d_ds;
+  auto& state = query->d_incoming;
+  query->d_state = OutgoingTCPQueryState::State::sendingQueryToBackend;
+  query->d_currentPos = 0;
+  query->d_firstResponsePacket = true;
 
-  if (state->d_xfrStarted) {
+  if (query->d_xfrStarted) {
     /* sorry, but we are not going to resume a XFR if we have already sent some packets
        to the client */
+    finishQuery(query, now, true);
     return;
   }
 
-  if (!state->d_downstreamConnection) {
-    if (state->d_downstreamFailures < state->d_ds->retries) {
+  if (!query->d_downstreamConnection) {
+    if (query->d_downstreamFailures < ds->retries) {
       try {
-        state->d_downstreamConnection = getConnectionToDownstream(ds, state->d_downstreamFailures, now);
+        query->d_downstreamConnection = getConnectionToDownstream(ds, query->d_downstreamFailures, now);
       }
       catch (const std::runtime_error& e) {
-        state->d_downstreamConnection.reset();
+        query->d_downstreamConnection.reset();
       }
     }
 
-    if (!state->d_downstreamConnection) {
+    if (!query->d_downstreamConnection) {
       ++ds->tcpGaveUp;
       ++state->d_ci.cs->tcpGaveUp;
-      vinfolog("Downstream connection to %s failed %d times in a row, giving up.", ds->getName(), state->d_downstreamFailures);
+      vinfolog("Downstream connection to %s failed %d times in a row, giving up.", ds->getName(), query->d_downstreamFailures);
+      finishQuery(query, now, true);
       return;
     }
 
-    if (ds->useProxyProtocol && !state->d_proxyProtocolPayloadAdded) {
+    if (ds->useProxyProtocol && !query->d_proxyProtocolPayloadAdded) {
       /* we know there is no TLV values to add, otherwise we would not have tried
          to reuse the connection and d_proxyProtocolPayloadAdded would be true already */
-      addProxyProtocol(state->d_buffer, true, state->d_ci.remote, state->d_ids.origDest, std::vector<ProxyProtocolValue>());
-      state->d_proxyProtocolPayloadAdded = true;
+      addProxyProtocol(query->d_buffer, true, state->d_ci.remote, state->d_origDest, std::vector<ProxyProtocolValue>());
+      query->d_proxyProtocolPayloadAdded = true;
     }
   }
 
-  vinfolog("Got query for %s|%s from %s (%s), relayed to %s", state->d_ids.qname.toLogString(), QType(state->d_ids.qtype).getName(), state->d_ci.remote.toStringWithPort(), (state->d_ci.cs->tlsFrontend ? "DoT" : "TCP"), ds->getName());
+  vinfolog("Got query for %s|%s from %s (%s), relayed to %s", query->d_ids.qname.toLogString(), QType(query->d_ids.qtype).getName(), state->d_ci.remote.toStringWithPort(), (state->d_ci.cs->tlsFrontend ? "DoT" : "TCP"), ds->getName());
 
-  handleDownstreamIO(state, now);
+  handleDownstreamIO(query, now);
   return;
 }
 
@@ -861,15 +955,19 @@ static void handleQuery(std::shared_ptr<IncomingTCPConnectionState>& state, stru
 {
   if (state->d_querySize < sizeof(dnsheader)) {
     ++g_stats.nonCompliantQueries;
+    state->d_stopReading = true;
     return;
   }
 
   state->d_readingFirstQuery = false;
-  state->d_proxyProtocolPayloadAdded = false;
   ++state->d_queriesCount;
   ++state->d_ci.cs->queries;
   ++g_stats.queries;
 
+  if (state->d_currentQueriesInFlight > 0) {
+    ++state->d_ci.cs->tcpPipelinedQueries;
+  }
+
   if (state->d_handler.isTLS()) {
     auto tlsVersion = state->d_handler.getTLSVersion();
     switch (tlsVersion) {
@@ -900,84 +998,108 @@ static void handleQuery(std::shared_ptr<IncomingTCPConnectionState>& state, stru
   std::shared_ptr<DNSCryptQuery> dnsCryptQuery{nullptr};
   auto dnsCryptResponse = checkDNSCryptQuery(*state->d_ci.cs, query, state->d_querySize, dnsCryptQuery, queryRealTime.tv_sec, true);
   if (dnsCryptResponse) {
-    state->d_responseBuffer = std::move(*dnsCryptResponse);
-    state->d_responseSize = state->d_responseBuffer.size();
-    sendResponse(state, now);
+    TCPResponse response;
+    response.d_buffer = std::move(*dnsCryptResponse);
+    memset(&response.d_cleartextDH, 0, sizeof(response.d_cleartextDH));
+    if (response.d_buffer.size() >= sizeof(dnsheader)) {
+      memcpy(&response.d_cleartextDH, response.d_buffer.data(), sizeof(response.d_cleartextDH));
+    }
+    queueResponse(state, std::move(response));
     return;
   }
 
   const auto& dh = reinterpret_cast<dnsheader*>(query);
   if (!checkQueryHeaders(dh)) {
+    state->d_stopReading = true;
     return;
   }
 
   uint16_t qtype, qclass;
   unsigned int consumed = 0;
   DNSName qname(query, state->d_querySize, sizeof(dnsheader), false, &qtype, &qclass, &consumed);
-  DNSQuestion dq(&qname, qtype, qclass, consumed, &state->d_ids.origDest, &state->d_ci.remote, reinterpret_cast<dnsheader*>(query), state->d_buffer.size(), state->d_querySize, true, &queryRealTime);
+  DNSQuestion dq(&qname, qtype, qclass, consumed, &state->d_origDest, &state->d_ci.remote, reinterpret_cast<dnsheader*>(query), state->d_buffer.size(), state->d_querySize, true, &queryRealTime);
   dq.dnsCryptQuery = std::move(dnsCryptQuery);
   dq.sni = state->d_handler.getServerNameIndication();
 
-  state->d_isXFR = (dq.qtype == QType::AXFR || dq.qtype == QType::IXFR);
-  if (state->d_isXFR) {
+  bool isXFR = (dq.qtype == QType::AXFR || dq.qtype == QType::IXFR);
+  if (isXFR) {
     dq.skipCache = true;
   }
 
-  state->d_ds.reset();
-  auto result = processQuery(dq, *state->d_ci.cs, state->d_threadData.holders, state->d_ds);
+  std::shared_ptr<DownstreamState> ds{nullptr};
+  auto result = processQuery(dq, *state->d_ci.cs, state->d_threadData.holders, ds);
 
   if (result == ProcessQueryResult::Drop) {
+    state->d_stopReading = true;
     return;
   }
 
   if (result == ProcessQueryResult::SendAnswer) {
-    state->d_selfGeneratedResponse = true;
+    TCPResponse response;
+    memcpy(&response.d_cleartextDH, dq.dh, sizeof(response.d_cleartextDH));
     state->d_buffer.resize(dq.len);
-    state->d_responseBuffer = std::move(state->d_buffer);
-    state->d_responseSize = state->d_responseBuffer.size();
-    sendResponse(state, now);
+    response.d_buffer = std::move(state->d_buffer);
+    queueResponse(state, std::move(response));
     return;
   }
 
-  if (result != ProcessQueryResult::PassToBackend || state->d_ds == nullptr) {
+  if (result != ProcessQueryResult::PassToBackend || ds == nullptr) {
+    state->d_stopReading = true;
     return;
   }
 
-  setIDStateFromDNSQuestion(state->d_ids, dq, std::move(qname));
+  auto outgoing = std::make_shared<OutgoingTCPQueryState>(state, ds);
+  setIDStateFromDNSQuestion(outgoing->d_ids, dq, std::move(qname));
+  outgoing->d_isXFR = isXFR;
+  /* the buffer is moved, not copied, so dq is still pointing to the right place */
+  outgoing->d_buffer = std::move(state->d_buffer);
 
   const uint8_t sizeBytes[] = { static_cast<uint8_t>(dq.len / 256), static_cast<uint8_t>(dq.len % 256) };
   /* prepend the size. Yes, this is not the most efficient way but it prevents mistakes
      that could occur if we had to deal with the size during the processing,
      especially alignment issues */
-  state->d_buffer.insert(state->d_buffer.begin(), sizeBytes, sizeBytes + 2);
+  outgoing->d_buffer.insert(outgoing->d_buffer.begin(), sizeBytes, sizeBytes + 2);
   dq.len = dq.len + 2;
-  dq.dh = reinterpret_cast<dnsheader*>(&state->d_buffer.at(0));
-  dq.size = state->d_buffer.size();
-  state->d_buffer.resize(dq.len);
+  dq.dh = reinterpret_cast<dnsheader*>(&outgoing->d_buffer.at(0));
+  dq.size = outgoing->d_buffer.size();
+  outgoing->d_buffer.resize(dq.len);
 
-  if (state->d_ds->useProxyProtocol) {
+  if (ds->useProxyProtocol) {
     /* if we ever sent a TLV over a connection, we can never go back */
     if (!state->d_proxyProtocolPayloadHasTLV) {
       state->d_proxyProtocolPayloadHasTLV = dq.proxyProtocolValues && !dq.proxyProtocolValues->empty();
     }
 
-    if (state->d_downstreamConnection && !state->d_proxyProtocolPayloadHasTLV && state->d_downstreamConnection->matches(state->d_ds)) {
+    if (state->d_ownedConnectionToBackend && !state->d_proxyProtocolPayloadHasTLV && state->d_ownedConnectionToBackend->matches(ds)) {
       /* we have an existing connection, on which we already sent a Proxy Protocol header with no values
          (in the previous query had TLV values we would have reset the connection afterwards),
          so let's reuse it as long as we still don't have any values */
-      state->d_proxyProtocolPayloadAdded = false;
+      outgoing->d_downstreamConnection = std::move(state->d_ownedConnectionToBackend);
+      outgoing->d_proxyProtocolPayloadAdded = false;
     }
     else {
-      state->d_downstreamConnection.reset();
-      addProxyProtocol(state->d_buffer, true, state->d_ci.remote, state->d_ids.origDest, dq.proxyProtocolValues ? *dq.proxyProtocolValues : std::vector<ProxyProtocolValue>());
-      state->d_proxyProtocolPayloadAdded = true;
+      state->d_ownedConnectionToBackend.reset();
+      addProxyProtocol(outgoing->d_buffer, true, state->d_ci.remote, state->d_origDest, dq.proxyProtocolValues ? *dq.proxyProtocolValues : std::vector<ProxyProtocolValue>());
+      outgoing->d_proxyProtocolPayloadAdded = true;
     }
   }
 
-  sendQueryToBackend(state, now);
+  ++state->d_currentQueriesInFlight;
+  if (state->d_ci.cs->tcpMaxInFlightQueriesPerConn > 0 && state->d_currentQueriesInFlight >= state->getMaxInFlightQueries()) {
+    ++state->d_ci.cs->tcpInFlightLimitReached;
+  }
+
+  if (isXFR) {
+    /* the responses to a XFR are streamed until the backend closes the connection,
+       so this is the last query we read from this client */
+    state->d_stopReading = true;
+  }
+
+  sendQueryToBackend(outgoing, now);
 }
 
-static void handleNewIOState(std::shared_ptr<IncomingTCPConnectionState>& state, IOState iostate, const int fd, FDMultiplexer::callbackfunc_t callback, boost::optional<struct timeval> ttd)
+template <class T>
+static void handleNewIOState(std::shared_ptr<T>& state, IOState iostate, const int fd, FDMultiplexer::callbackfunc_t callback, boost::optional<struct timeval> ttd)
 {
   //cerr<<"in "<<__func__<<" for fd "<<fd<<", last state was "<<(int)state->d_lastIOState<<", new state is "<<(int)iostate<<endl;
 
@@ -994,10 +1116,9 @@ static void handleNewIOState(std::shared_ptr<IncomingTCPConnectionState>& state,
 
   if (iostate == IOState::NeedRead) {
     if (state->d_lastIOState == IOState::NeedRead) {
-      if (ttd) {
-        /* let's update the TTD ! */
-        state->d_threadData.mplexer->setReadTTD(fd, *ttd, /* we pass 0 here because we already have a TTD */0);
-      }
+      /* let's update the TTD, or remove it if we don't want one anymore (a zero TTD never expires) */
+      struct timeval noTTD{0, 0};
+      state->d_threadData.mplexer->setReadTTD(fd, ttd ? *ttd : noTTD, /* we pass 0 here because we already have a TTD */0);
       return;
     }
 
@@ -1019,103 +1140,117 @@ static void handleNewIOState(std::shared_ptr<IncomingTCPConnectionState>& state,
   }
 }
 
-static void handleDownstreamIO(std::shared_ptr<IncomingTCPConnectionState>& state, struct timeval& now)
+static void handleDownstreamIO(std::shared_ptr<OutgoingTCPQueryState>& query, struct timeval& now)
 {
-  if (state->d_downstreamConnection == nullptr) {
+  if (query->d_downstreamConnection == nullptr) {
     throw std::runtime_error("No downstream socket in " + std::string(__func__) + "!");
   }
 
-  int fd = state->d_downstreamConnection->getHandle();
+  auto& state = query->d_incoming;
+  int fd = query->d_downstreamConnection->getHandle();
   IOState iostate = IOState::Done;
   bool connectionDied = false;
 
   try {
-    if (state->d_state == IncomingTCPConnectionState::State::sendingQueryToBackend) {
+    if (query->d_state == OutgoingTCPQueryState::State::sendingQueryToBackend) {
       int socketFlags = 0;
 #ifdef MSG_FASTOPEN
-      if (state->d_downstreamConnection->isFastOpenEnabled()) {
+      if (query->d_downstreamConnection->isFastOpenEnabled()) {
         socketFlags |= MSG_FASTOPEN;
       }
 #endif /* MSG_FASTOPEN */
 
-      size_t sent = sendMsgWithOptions(fd, reinterpret_cast<const char *>(&state->d_buffer.at(state->d_currentPos)), state->d_buffer.size() - state->d_currentPos, &state->d_ds->remote, &state->d_ds->sourceAddr, state->d_ds->sourceItf, socketFlags);
-      if (sent == state->d_buffer.size()) {
+      size_t sent = sendMsgWithOptions(fd, reinterpret_cast<const char *>(&query->d_buffer.at(query->d_currentPos)), query->d_buffer.size() - query->d_currentPos, &query->d_ds->remote, &query->d_ds->sourceAddr, query->d_ds->sourceItf, socketFlags);
+      if (sent == query->d_buffer.size()) {
         /* request sent ! */
-        state->d_downstreamConnection->incQueries();
-        state->d_state = IncomingTCPConnectionState::State::readingResponseSizeFromBackend;
-        state->d_currentPos = 0;
-        state->d_querySentTime = now;
+        query->d_downstreamConnection->incQueries();
+        query->d_state = OutgoingTCPQueryState::State::readingResponseSizeFromBackend;
+        query->d_currentPos = 0;
+        query->d_querySentTime = now;
         iostate = IOState::NeedRead;
-        if (!state->d_isXFR && !state->d_outstanding) {
+        if (!query->d_isXFR && !query->d_outstanding) {
           /* don't bother with the outstanding count for XFR queries */
-          ++state->d_ds->outstanding;
-          state->d_outstanding = true;
+          ++query->d_ds->outstanding;
+          query->d_outstanding = true;
         }
       }
       else {
-        state->d_currentPos += sent;
+        query->d_currentPos += sent;
         iostate = IOState::NeedWrite;
         /* disable fast open on partial write */
-        state->d_downstreamConnection->disableFastOpen();
+        query->d_downstreamConnection->disableFastOpen();
       }
     }
 
-    if (state->d_state == IncomingTCPConnectionState::State::readingResponseSizeFromBackend) {
+    if (query->d_state == OutgoingTCPQueryState::State::readingResponseSizeFromBackend) {
       // then we need to allocate a new buffer (new because we might need to re-send the query if the
       // backend dies on us
       // We also might need to read and send to the client more than one response in case of XFR (yeah!)
       // should very likely be a TCPIOHandler d_downstreamHandler
-      iostate = tryRead(fd, state->d_responseBuffer, state->d_currentPos, sizeof(uint16_t) - state->d_currentPos);
+      iostate = tryRead(fd, query->d_responseBuffer, query->d_currentPos, sizeof(uint16_t) - query->d_currentPos);
       if (iostate == IOState::Done) {
-        state->d_state = IncomingTCPConnectionState::State::readingResponseFromBackend;
-        state->d_responseSize = state->d_responseBuffer.at(0) * 256 + state->d_responseBuffer.at(1);
-        state->d_responseBuffer.resize((state->d_ids.dnsCryptQuery && (UINT16_MAX - state->d_responseSize) > static_cast<uint16_t>(DNSCRYPT_MAX_RESPONSE_PADDING_AND_MAC_SIZE)) ? state->d_responseSize + DNSCRYPT_MAX_RESPONSE_PADDING_AND_MAC_SIZE : state->d_responseSize);
-        state->d_currentPos = 0;
+        query->d_state = OutgoingTCPQueryState::State::readingResponseFromBackend;
+        query->d_responseSize = query->d_responseBuffer.at(0) * 256 + query->d_responseBuffer.at(1);
+        query->d_responseBuffer.resize((query->d_ids.dnsCryptQuery && (UINT16_MAX - query->d_responseSize) > static_cast<uint16_t>(DNSCRYPT_MAX_RESPONSE_PADDING_AND_MAC_SIZE)) ? query->d_responseSize + DNSCRYPT_MAX_RESPONSE_PADDING_AND_MAC_SIZE : query->d_responseSize);
+        query->d_currentPos = 0;
       }
     }
 
-    if (state->d_state == IncomingTCPConnectionState::State::readingResponseFromBackend) {
-      iostate = tryRead(fd, state->d_responseBuffer, state->d_currentPos, state->d_responseSize - state->d_currentPos);
+    if (query->d_state == OutgoingTCPQueryState::State::readingResponseFromBackend) {
+      iostate = tryRead(fd, query->d_responseBuffer, query->d_currentPos, query->d_responseSize - query->d_currentPos);
       if (iostate == IOState::Done) {
-        handleNewIOState(state, IOState::Done, fd, handleDownstreamIOCallback);
+        handleNewIOState(query, IOState::Done, fd, handleDownstreamIOCallback);
 
-        if (state->d_isXFR) {
+        if (query->d_isXFR) {
           /* Don't reuse the TCP connection after an {A,I}XFR */
           /* but don't reset it either, we will need to read more messages */
         }
         else {
           /* if we did not send a Proxy Protocol header, let's pool the connection */
-          if (state->d_ds && state->d_ds->useProxyProtocol == false) {
-            releaseDownstreamConnection(std::move(state->d_downstreamConnection));
+          if (query->d_ds->useProxyProtocol == false) {
+            releaseDownstreamConnection(std::move(query->d_downstreamConnection));
           }
           else {
-            if (state->d_proxyProtocolPayloadHasTLV) {
+            if (state->d_proxyProtocolPayloadHasTLV || state->d_ownedConnectionToBackend) {
               /* sent a Proxy Protocol header with TLV values, we can't reuse it */
-              state->d_downstreamConnection.reset();
+              query->d_downstreamConnection.reset();
             }
             else {
               /* if we did but there was no TLV values, let's try to reuse it but only
                  for this incoming connection */
+              state->d_ownedConnectionToBackend = std::move(query->d_downstreamConnection);
             }
           }
         }
         fd = -1;
 
-        state->d_responseReadTime = now;
+        query->d_responseReadTime = now;
+        bool handled = false;
         try {
-          handleResponse(state, now);
+          handled = handleResponse(query, now);
         }
         catch (const std::exception& e) {
-          vinfolog("Got an exception while handling TCP response from %s (client is %s): %s", state->d_ds ? state->d_ds->getName() : "unknown", state->d_ci.remote.toStringWithPort(), e.what());
+          vinfolog("Got an exception while handling TCP response from %s (client is %s): %s", query->d_ds->getName(), state->d_ci.remote.toStringWithPort(), e.what());
+        }
+
+        if (!handled) {
+          finishQuery(query, now, true);
+        }
+        else if (!query->d_isXFR) {
+          finishQuery(query, now, false);
+        }
+        else {
+          /* the XFR is done when the backend closes the connection, but we have a response to send */
+          handleIO(state, now);
         }
         return;
       }
     }
 
-    if (state->d_state != IncomingTCPConnectionState::State::sendingQueryToBackend &&
-        state->d_state != IncomingTCPConnectionState::State::readingResponseSizeFromBackend &&
-        state->d_state != IncomingTCPConnectionState::State::readingResponseFromBackend) {
-      vinfolog("Unexpected state %d in handleDownstreamIOCallback", static_cast<int>(state->d_state));
+    if (query->d_state != OutgoingTCPQueryState::State::sendingQueryToBackend &&
+        query->d_state != OutgoingTCPQueryState::State::readingResponseSizeFromBackend &&
+        query->d_state != OutgoingTCPQueryState::State::readingResponseFromBackend) {
+      vinfolog("Unexpected state %d in handleDownstreamIOCallback", static_cast<int>(query->d_state));
     }
   }
   catch(const std::exception& e) {
@@ -1123,25 +1258,22 @@ static void handleDownstreamIO(std::shared_ptr<IncomingTCPConnectionState>& stat
        but it might also be a real IO error or something else.
        Let's just drop the connection
     */
-    vinfolog("Got an exception while handling (%s backend) TCP query from %s: %s", (state->d_lastIOState == IOState::NeedRead ? "reading from" : "writing to"), state->d_ci.remote.toStringWithPort(), e.what());
-    if (state->d_state == IncomingTCPConnectionState::State::sendingQueryToBackend) {
-      ++state->d_ds->tcpDiedSendingQuery;
+    vinfolog("Got an exception while handling (%s backend) TCP query from %s: %s", (query->d_lastIOState == IOState::NeedRead ? "reading from" : "writing to"), state->d_ci.remote.toStringWithPort(), e.what());
+    if (query->d_state == OutgoingTCPQueryState::State::sendingQueryToBackend) {
+      ++query->d_ds->tcpDiedSendingQuery;
     }
     else {
-      ++state->d_ds->tcpDiedReadingResponse;
+      ++query->d_ds->tcpDiedReadingResponse;
     }
 
     /* don't increase this counter when reusing connections */
-    if (state->d_downstreamConnection && state->d_downstreamConnection->isFresh()) {
-      ++state->d_downstreamFailures;
+    if (query->d_downstreamConnection && query->d_downstreamConnection->isFresh()) {
+      ++query->d_downstreamFailures;
     }
 
-    if (state->d_outstanding) {
-      state->d_outstanding = false;
-
-      if (state->d_ds != nullptr) {
-        --state->d_ds->outstanding;
-      }
+    if (query->d_outstanding) {
+      query->d_outstanding = false;
+      --query->d_ds->outstanding;
     }
     /* remove this FD from the IO multiplexer */
     iostate = IOState::Done;
@@ -1149,44 +1281,58 @@ static void handleDownstreamIO(std::shared_ptr<IncomingTCPConnectionState>& stat
   }
 
   if (iostate == IOState::Done) {
-    handleNewIOState(state, iostate, fd, handleDownstreamIOCallback);
+    handleNewIOState(query, iostate, fd, handleDownstreamIOCallback);
   }
   else {
-    handleNewIOState(state, iostate, fd, handleDownstreamIOCallback, iostate == IOState::NeedRead ? state->getBackendReadTTD(now) : state->getBackendWriteTTD(now));
+    handleNewIOState(query, iostate, fd, handleDownstreamIOCallback, iostate == IOState::NeedRead ? query->getBackendReadTTD(now) : query->getBackendWriteTTD(now));
   }
 
   if (connectionDied) {
-    state->d_downstreamConnection.reset();
-    sendQueryToBackend(state, now);
+    query->d_downstreamConnection.reset();
+    sendQueryToBackend(query, now);
   }
 }
 
 static void handleDownstreamIOCallback(int fd, FDMultiplexer::funcparam_t& param)
 {
-  auto state = boost::any_cast<std::shared_ptr<IncomingTCPConnectionState>>(param);
-  if (state->d_downstreamConnection == nullptr) {
+  auto query = boost::any_cast<std::shared_ptr<OutgoingTCPQueryState>>(param);
+  if (query->d_downstreamConnection == nullptr) {
     throw std::runtime_error("No downstream socket in " + std::string(__func__) + "!");
   }
-  if (fd != state->d_downstreamConnection->getHandle()) {
-    throw std::runtime_error("Unexpected socket descriptor " + std::to_string(fd) + " received in " + std::string(__func__) + ", expected " + std::to_string(state->d_downstreamConnection->getHandle()));
+  if (fd != query->d_downstreamConnection->getHandle()) {
+    throw std::runtime_error("Unexpected socket descriptor " + std::to_string(fd) + " received in " + std::string(__func__) + ", expected " + std::to_string(query->d_downstreamConnection->getHandle()));
   }
 
   struct timeval now;
   gettimeofday(&now, 0);
-  handleDownstreamIO(state, now);
+  handleDownstreamIO(query, now);
 }
 
 static void handleIO(std::shared_ptr<IncomingTCPConnectionState>& state, struct timeval& now)
 {
+  if (state->d_handlingIO) {
+    /* we have been called further down the stack of another handleIO() call, for example
+       because a backend answered right away, which will pick up the new work */
+    return;
+  }
+
+  if (state->d_connectionDied) {
+    return;
+  }
+
   int fd = state->d_ci.fd;
   IOState iostate = IOState::Done;
+  bool sendingResponse = false;
 
   if (state->maxConnectionDurationReached(g_maxTCPConnectionDuration, now)) {
     vinfolog("Terminating TCP connection from %s because it reached the maximum TCP connection duration", state->d_ci.remote.toStringWithPort());
+    state->markAsDead();
     handleNewIOState(state, IOState::Done, fd, handleIOCallback);
     return;
   }
 
+  state->d_handlingIO = true;
+
   try {
     if (state->d_state == IncomingTCPConnectionState::State::doingHandshake) {
       iostate = state->d_handler.tryHandshake();
@@ -1204,6 +1350,9 @@ static void handleIO(std::shared_ptr<IncomingTCPConnectionState>& state, struct
           if (state->d_handler.getUnknownTicketKey()) {
             ++state->d_ci.cs->tlsUnknownTicketKey;
           }
+          if (state->d_handler.isUsingKTLS()) {
+            ++state->d_ci.cs->tlsKTLSSessions;
+          }
         }
 
         state->d_handshakeDoneTime = now;
@@ -1211,50 +1360,58 @@ static void handleIO(std::shared_ptr<IncomingTCPConnectionState>& state, struct
       }
     }
 
-    if (state->d_state == IncomingTCPConnectionState::State::readingQuerySize) {
-      iostate = state->d_handler.tryRead(state->d_buffer, state->d_currentPos, sizeof(uint16_t));
-      if (iostate == IOState::Done) {
-        state->d_state = IncomingTCPConnectionState::State::readingQuery;
-        state->d_querySizeReadTime = now;
-        if (state->d_queriesCount == 0) {
-          state->d_firstQuerySizeReadTime = now;
+    /* send the responses we have first, then read new queries as long as we have not reached the
+       maximum number of queries in flight, until we would block */
+    while (iostate == IOState::Done && state->d_state != IncomingTCPConnectionState::State::doingHandshake) {
+      if (!state->d_queuedResponses.empty()) {
+        sendingResponse = true;
+        auto& response = state->d_queuedResponses.front();
+        iostate = state->d_handler.tryWrite(response.d_buffer, state->d_currentResponsePos, response.d_buffer.size());
+        if (iostate == IOState::Done) {
+          TCPResponse sent = std::move(response);
+          state->d_queuedResponses.pop_front();
+          state->d_currentResponsePos = 0;
+          sendingResponse = false;
+          handleResponseSent(state, sent, now);
         }
-        state->d_querySize = state->d_buffer.at(0) * 256 + state->d_buffer.at(1);
-        if (state->d_querySize < sizeof(dnsheader)) {
-          /* go away */
-          handleNewIOState(state, IOState::Done, fd, handleIOCallback);
-          return;
-        }
-
-        /* allocate a bit more memory to be able to spoof the content, get an answer from the cache
-           or to add ECS without allocating a new buffer */
-        state->d_buffer.resize(std::max(state->d_querySize + static_cast<size_t>(512), s_maxPacketCacheEntrySize));
-        state->d_currentPos = 0;
+        continue;
       }
-    }
 
-    if (state->d_state == IncomingTCPConnectionState::State::readingQuery) {
-      iostate = state->d_handler.tryRead(state->d_buffer, state->d_currentPos, state->d_querySize);
-      if (iostate == IOState::Done) {
-        handleNewIOState(state, IOState::Done, fd, handleIOCallback);
-        handleQuery(state, now);
-        return;
+      if (!state->canReadQuery()) {
+        /* nothing to do until one of the queries in flight is done */
+        break;
       }
-    }
 
-    if (state->d_state == IncomingTCPConnectionState::State::sendingResponse) {
-      iostate = state->d_handler.tryWrite(state->d_responseBuffer, state->d_currentPos, state->d_responseBuffer.size());
-      if (iostate == IOState::Done) {
-        handleResponseSent(state, now);
-        return;
+      if (state->d_state == IncomingTCPConnectionState::State::readingQuerySize) {
+        iostate = state->d_handler.tryRead(state->d_buffer, state->d_currentPos, sizeof(uint16_t));
+        if (iostate == IOState::Done) {
+          state->d_state = IncomingTCPConnectionState::State::readingQuery;
+          state->d_querySizeReadTime = now;
+          if (state->d_queriesCount == 0) {
+            state->d_firstQuerySizeReadTime = now;
+          }
+          state->d_querySize = state->d_buffer.at(0) * 256 + state->d_buffer.at(1);
+          if (state->d_querySize < sizeof(dnsheader)) {
+            /* go away */
+            state->d_stopReading = true;
+            continue;
+          }
+
+          /* allocate a bit more memory to be able to spoof the content, get an answer from the cache
+             or to add ECS without allocating a new buffer */
+          state->d_buffer.resize(std::max(state->d_querySize + static_cast<size_t>(512), s_maxPacketCacheEntrySize));
+          state->d_currentPos = 0;
+        }
       }
-    }
 
-    if (state->d_state != IncomingTCPConnectionState::State::doingHandshake &&
-        state->d_state != IncomingTCPConnectionState::State::readingQuerySize &&
-        state->d_state != IncomingTCPConnectionState::State::readingQuery &&
-        state->d_state != IncomingTCPConnectionState::State::sendingResponse) {
-      vinfolog("Unexpected state %d in handleIOCallback", static_cast<int>(state->d_state));
+      if (state->d_state == IncomingTCPConnectionState::State::readingQuery) {
+        iostate = state->d_handler.tryRead(state->d_buffer, state->d_currentPos, state->d_querySize);
+        if (iostate == IOState::Done) {
+          state->d_queryReadTime = now;
+          handleQuery(state, now);
+          state->resetForNewQuery();
+        }
+      }
     }
   }
   catch(const std::exception& e) {
@@ -1262,14 +1419,12 @@ static void handleIO(std::shared_ptr<IncomingTCPConnectionState>& state, struct
        but it might also be a real IO error or something else.
        Let's just drop the connection
     */
-    if (state->d_state == IncomingTCPConnectionState::State::doingHandshake ||
-        state->d_state == IncomingTCPConnectionState::State::readingQuerySize ||
-        state->d_state == IncomingTCPConnectionState::State::readingQuery) {
-      ++state->d_ci.cs->tcpDiedReadingQuery;
-    }
-    else if (state->d_state == IncomingTCPConnectionState::State::sendingResponse) {
+    if (sendingResponse) {
       ++state->d_ci.cs->tcpDiedSendingResponse;
     }
+    else {
+      ++state->d_ci.cs->tcpDiedReadingQuery;
+    }
 
     if (state->d_lastIOState == IOState::NeedWrite || state->d_readingFirstQuery) {
       vinfolog("Got an exception while handling (%s) TCP query from %s: %s", (state->d_lastIOState == IOState::NeedRead ? "reading" : "writing"), state->d_ci.remote.toStringWithPort(), e.what());
@@ -1277,15 +1432,30 @@ static void handleIO(std::shared_ptr<IncomingTCPConnectionState>& state, struct
     else {
       vinfolog("Closing TCP client connection with %s", state->d_ci.remote.toStringWithPort());
     }
+
+    if (!sendingResponse && state->d_currentQueriesInFlight > 0) {
+      /* we can't read anymore but we might still be able to send the responses to the queries in flight */
+      state->d_stopReading = true;
+    }
+    else {
+      state->markAsDead();
+    }
     /* remove this FD from the IO multiplexer */
     iostate = IOState::Done;
   }
 
+  state->d_handlingIO = false;
+
   if (iostate == IOState::Done) {
     handleNewIOState(state, iostate, fd, handleIOCallback);
   }
+  else if (iostate == IOState::NeedRead) {
+    /* while queries are in flight we are waiting for the backend, not for the client,
+       so the client read timeout is only armed once all of them have been answered */
+    handleNewIOState(state, iostate, fd, handleIOCallback, state->d_currentQueriesInFlight == 0 ? state->getClientReadTTD(now) : boost::none);
+  }
   else {
-    handleNewIOState(state, iostate, fd, handleIOCallback, iostate == IOState::NeedRead ? state->getClientReadTTD(now) : state->getClientWriteTTD(now));
+    handleNewIOState(state, iostate, fd, handleIOCallback, state->getClientWriteTTD(now));
   }
 }
 
@@ -1369,34 +1539,45 @@ void tcpClientThread(int pipefd)
       lastTimeoutScan = now.tv_sec;
       auto expiredReadConns = data.mplexer->getTimeouts(now, false);
       for(const auto& conn : expiredReadConns) {
-        auto state = boost::any_cast<std::shared_ptr<IncomingTCPConnectionState>>(conn.second);
-        if (conn.first == state->d_ci.fd) {
+        if (conn.second.type() == typeid(std::shared_ptr<OutgoingTCPQueryState>)) {
+          auto query = boost::any_cast<std::shared_ptr<OutgoingTCPQueryState>>(conn.second);
+          vinfolog("Timeout (read) from remote backend %s", query->d_ds->getName());
+          ++query->d_incoming->d_ci.cs->tcpDownstreamTimeouts;
+          ++query->d_ds->tcpReadTimeouts;
+          data.mplexer->removeReadFD(conn.first);
+          query->d_lastIOState = IOState::Done;
+          finishQuery(query, now, true);
+        }
+        else {
+          auto state = boost::any_cast<std::shared_ptr<IncomingTCPConnectionState>>(conn.second);
           vinfolog("Timeout (read) from remote TCP client %s", state->d_ci.remote.toStringWithPort());
           ++state->d_ci.cs->tcpClientTimeouts;
+          data.mplexer->removeReadFD(conn.first);
+          state->d_lastIOState = IOState::Done;
+          /* we still want to send the responses to the queries in flight, if any */
+          state->d_stopReading = true;
         }
-        else if (state->d_ds) {
-          vinfolog("Timeout (read) from remote backend %s", state->d_ds->getName());
-          ++state->d_ci.cs->tcpDownstreamTimeouts;
-          ++state->d_ds->tcpReadTimeouts;
-        }
-        data.mplexer->removeReadFD(conn.first);
-        state->d_lastIOState = IOState::Done;
       }
 
       auto expiredWriteConns = data.mplexer->getTimeouts(now, true);
       for(const auto& conn : expiredWriteConns) {
-        auto state = boost::any_cast<std::shared_ptr<IncomingTCPConnectionState>>(conn.second);
-        if (conn.first == state->d_ci.fd) {
+        if (conn.second.type() == typeid(std::shared_ptr<OutgoingTCPQueryState>)) {
+          auto query = boost::any_cast<std::shared_ptr<OutgoingTCPQueryState>>(conn.second);
+          vinfolog("Timeout (write) from remote backend %s", query->d_ds->getName());
+          ++query->d_incoming->d_ci.cs->tcpDownstreamTimeouts;
+          ++query->d_ds->tcpWriteTimeouts;
+          data.mplexer->removeWriteFD(conn.first);
+          query->d_lastIOState = IOState::Done;
+          finishQuery(query, now, true);
+        }
+        else {
+          auto state = boost::any_cast<std::shared_ptr<IncomingTCPConnectionState>>(conn.second);
           vinfolog("Timeout (write) from remote TCP client %s", state->d_ci.remote.toStringWithPort());
           ++state->d_ci.cs->tcpClientTimeouts;
+          data.mplexer->removeWriteFD(conn.first);
+          state->d_lastIOState = IOState::Done;
+          state->markAsDead();
         }
-        else if (state->d_ds) {
-          vinfolog("Timeout (write) from remote backend %s", state->d_ds->getName());
-          ++state->d_ci.cs->tcpDownstreamTimeouts;
-          ++state->d_ds->tcpWriteTimeouts;
-        }
-        data.mplexer->removeWriteFD(conn.first);
-        state->d_lastIOState = IOState::Done;
       }
     }
   }
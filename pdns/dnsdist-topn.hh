@@ -0,0 +1,258 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <unordered_map>
+#include <vector>
+
+/* Space-Saving summary (Metwally, Agrawal and El Abbadi), keeping track of
+   at most 'capacity' keys. Every tracked key has a count that might be an
+   overestimation of its real count by at most 'error', and any key whose
+   real count is larger than the smallest tracked count is guaranteed to be
+   tracked.
+   The entries are kept in a binary min-heap ordered on the count, so that
+   the smallest one, which is the one we evict, is always at the front, and
+   the map gives us the position of a given key in the heap.
+   This class is not thread-safe. */
+template <typename T, typename Hash = std::hash<T>, typename KeyEqual = std::equal_to<T>>
+class SpaceSavingSummary
+{
+public:
+  struct Entry
+  {
+    T key;
+    uint64_t count;
+    uint64_t error;
+  };
+
+  SpaceSavingSummary(size_t capacity): d_capacity(capacity)
+  {
+  }
+
+  void add(const T& key, uint64_t weight = 1)
+  {
+    if (d_capacity == 0) {
+      return;
+    }
+
+    d_total += weight;
+
+    auto it = d_positions.find(key);
+    if (it != d_positions.end()) {
+      d_entries[it->second].count += weight;
+      siftDown(it->second);
+      return;
+    }
+
+    if (d_entries.size() < d_capacity) {
+      d_entries.push_back({key, weight, 0});
+      d_positions.insert({key, d_entries.size() - 1});
+      siftUp(d_entries.size() - 1);
+      return;
+    }
+
+    /* evict the smallest entry, its replacement inherits its count */
+    auto& smallest = d_entries.front();
+    d_positions.erase(smallest.key);
+    smallest.error = smallest.count;
+    smallest.count += weight;
+    smallest.key = key;
+    d_positions.insert({key, 0});
+    siftDown(0);
+  }
+
+  void clear()
+  {
+    d_entries.clear();
+    d_positions.clear();
+    d_total = 0;
+  }
+
+  const std::vector<Entry>& getEntries() const
+  {
+    return d_entries;
+  }
+
+  /* sum of the weights of every key added, tracked or not */
+  uint64_t getTotal() const
+  {
+    return d_total;
+  }
+
+  size_t getCapacity() const
+  {
+    return d_capacity;
+  }
+
+private:
+  void swapEntries(size_t a, size_t b)
+  {
+    std::swap(d_entries[a], d_entries[b]);
+    d_positions[d_entries[a].key] = a;
+    d_positions[d_entries[b].key] = b;
+  }
+
+  void siftUp(size_t pos)
+  {
+    while (pos > 0) {
+      size_t parent = (pos - 1) / 2;
+      if (d_entries[parent].count <= d_entries[pos].count) {
+        break;
+      }
+      swapEntries(parent, pos);
+      pos = parent;
+    }
+  }
+
+  void siftDown(size_t pos)
+  {
+    const size_t size = d_entries.size();
+    for (;;) {
+      size_t smallest = pos;
+      size_t left = 2 * pos + 1;
+      size_t right = left + 1;
+      if (left < size && d_entries[left].count < d_entries[smallest].count) {
+        smallest = left;
+      }
+      if (right < size && d_entries[right].count < d_entries[smallest].count) {
+        smallest = right;
+      }
+      if (smallest == pos) {
+        break;
+      }
+      swapEntries(smallest, pos);
+      pos = smallest;
+    }
+  }
+
+  std::vector<Entry> d_entries;
+  std::unordered_map<T, size_t, Hash, KeyEqual> d_positions;
+  size_t d_capacity;
+  uint64_t d_total{0};
+};
+
+/* A sliding window made of a fixed number of Space-Saving summaries, each
+   one covering 'granularity' seconds. A bucket is recycled as soon as time
+   moves past the window it covered, so that the memory usage only depends
+   on the capacity and on the number of buckets, not on the traffic.
+   This class is not thread-safe. */
+template <typename T, typename Hash = std::hash<T>, typename KeyEqual = std::equal_to<T>>
+class WindowedSpaceSavingSummary
+{
+public:
+  typedef std::unordered_map<T, uint64_t, Hash, KeyEqual> counts_t;
+
+  WindowedSpaceSavingSummary(size_t capacity, unsigned int window, unsigned int granularity): d_granularity(granularity > 0 ? granularity : 1)
+  {
+    size_t nbBuckets = (window + d_granularity - 1) / d_granularity;
+    if (nbBuckets == 0) {
+      nbBuckets = 1;
+    }
+    d_buckets.reserve(nbBuckets);
+    for (size_t idx = 0; idx < nbBuckets; idx++) {
+      d_buckets.emplace_back(capacity);
+    }
+  }
+
+  void add(time_t now, const T& key, uint64_t weight = 1)
+  {
+    const time_t epoch = now / d_granularity;
+    auto& bucket = d_buckets.at(epoch % d_buckets.size());
+    if (bucket.epoch != epoch) {
+      bucket.summary.clear();
+      bucket.epoch = epoch;
+    }
+    bucket.summary.add(key, weight);
+  }
+
+  /* Add the counts seen during the last 'seconds' seconds (0 meaning the whole
+     window) to 'counts', and return the total number of occurrences seen during
+     that period, tracked or not. The bucket straddling the start of the period
+     is accounted for proportionally to the part of it that falls in the period. */
+  uint64_t collect(time_t now, unsigned int seconds, counts_t& counts) const
+  {
+    const time_t nowEpoch = now / d_granularity;
+    const time_t windowStart = (nowEpoch - static_cast<time_t>(d_buckets.size()) + 1) * d_granularity;
+    time_t cutoff = seconds > 0 ? (now - seconds) : windowStart;
+    if (cutoff < windowStart) {
+      cutoff = windowStart;
+    }
+
+    uint64_t total = 0;
+    for (const auto& bucket : d_buckets) {
+      if (bucket.epoch < 0 || bucket.epoch > nowEpoch) {
+        continue;
+      }
+      const time_t bucketStart = bucket.epoch * d_granularity;
+      const time_t bucketEnd = bucketStart + d_granularity;
+      if (bucketEnd <= cutoff) {
+        continue;
+      }
+
+      if (bucketStart >= cutoff) {
+        for (const auto& entry : bucket.summary.getEntries()) {
+          counts[entry.key] += entry.count;
+        }
+        total += bucket.summary.getTotal();
+      }
+      else {
+        const uint64_t part = bucketEnd - cutoff;
+        for (const auto& entry : bucket.summary.getEntries()) {
+          counts[entry.key] += (entry.count * part) / d_granularity;
+        }
+        total += (bucket.summary.getTotal() * part) / d_granularity;
+      }
+    }
+
+    return total;
+  }
+
+  /* the number of seconds actually covered by our buckets */
+  unsigned int getWindow() const
+  {
+    return d_buckets.size() * d_granularity;
+  }
+
+  void clear()
+  {
+    for (auto& bucket : d_buckets) {
+      bucket.summary.clear();
+      bucket.epoch = -1;
+    }
+  }
+
+private:
+  struct Bucket
+  {
+    Bucket(size_t capacity): summary(capacity)
+    {
+    }
+
+    SpaceSavingSummary<T, Hash, KeyEqual> summary;
+    time_t epoch{-1};
+  };
+
+  std::vector<Bucket> d_buckets;
+  unsigned int d_granularity;
+};
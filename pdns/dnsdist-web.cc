@@ -21,6 +21,7 @@
  */
 #include "dnsdist.hh"
 #include "dnsdist-healthchecks.hh"
+#include "dnsdist-metrics.hh"
 #include "dnsdist-prometheus.hh"
 
 #include "sstuff.hh"
@@ -38,61 +39,10 @@
 #include "htmlfiles.h"
 #include "base64.hh"
 #include "gettime.hh"
-#include  <boost/format.hpp>
 
 bool g_apiReadWrite{false};
 WebserverConfig g_webserverConfig;
 std::string g_apiConfigDirectory;
-static const MetricDefinitionStorage s_metricDefinitions;
-
-const std::map<std::string, MetricDefinition> MetricDefinitionStorage::metrics{
-  { "responses",              MetricDefinition(PrometheusMetricType::counter, "Number of responses received from backends") },
-  { "servfail-responses",     MetricDefinition(PrometheusMetricType::counter, "Number of SERVFAIL answers received from backends") },
-  { "queries",                MetricDefinition(PrometheusMetricType::counter, "Number of received queries")},
-  { "frontend-nxdomain",      MetricDefinition(PrometheusMetricType::counter, "Number of NXDomain answers sent to clients")},
-  { "frontend-servfail",      MetricDefinition(PrometheusMetricType::counter, "Number of SERVFAIL answers sent to clients")},
-  { "frontend-noerror",       MetricDefinition(PrometheusMetricType::counter, "Number of NoError answers sent to clients")},
-  { "acl-drops",              MetricDefinition(PrometheusMetricType::counter, "Number of packets dropped because of the ACL")},
-  { "rule-drop",              MetricDefinition(PrometheusMetricType::counter, "Number of queries dropped because of a rule")},
-  { "rule-nxdomain",          MetricDefinition(PrometheusMetricType::counter, "Number of NXDomain answers returned because of a rule")},
-  { "rule-refused",           MetricDefinition(PrometheusMetricType::counter, "Number of Refused answers returned because of a rule")},
-  { "rule-servfail",          MetricDefinition(PrometheusMetricType::counter, "Number of SERVFAIL answers received because of a rule")},
-  { "self-answered",          MetricDefinition(PrometheusMetricType::counter, "Number of self-answered responses")},
-  { "downstream-timeouts",    MetricDefinition(PrometheusMetricType::counter, "Number of queries not answered in time by a backend")},
-  { "downstream-send-errors", MetricDefinition(PrometheusMetricType::counter, "Number of errors when sending a query to a backend")},
-  { "trunc-failures",         MetricDefinition(PrometheusMetricType::counter, "Number of errors encountered while truncating an answer")},
-  { "no-policy",              MetricDefinition(PrometheusMetricType::counter, "Number of queries dropped because no server was available")},
-  { "latency0-1",             MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in less than 1ms")},
-  { "latency1-10",            MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in 1-10 ms")},
-  { "latency10-50",           MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in 10-50 ms")},
-  { "latency50-100",          MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in 50-100 ms")},
-  { "latency100-1000",        MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in 100-1000 ms")},
-  { "latency-slow",           MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in more than 1 second")},
-  { "latency-avg100",         MetricDefinition(PrometheusMetricType::gauge,   "Average response latency in microseconds of the last 100 packets")},
-  { "latency-avg1000",        MetricDefinition(PrometheusMetricType::gauge,   "Average response latency in microseconds of the last 1000 packets")},
-  { "latency-avg10000",       MetricDefinition(PrometheusMetricType::gauge,   "Average response latency in microseconds of the last 10000 packets")},
-  { "latency-avg1000000",     MetricDefinition(PrometheusMetricType::gauge,   "Average response latency in microseconds of the last 1000000 packets")},
-  { "uptime",                 MetricDefinition(PrometheusMetricType::gauge,   "Uptime of the dnsdist process in seconds")},
-  { "real-memory-usage",      MetricDefinition(PrometheusMetricType::gauge,   "Current memory usage in bytes")},
-  { "noncompliant-queries",   MetricDefinition(PrometheusMetricType::counter, "Number of queries dropped as non-compliant")},
-  { "noncompliant-responses", MetricDefinition(PrometheusMetricType::counter, "Number of answers from a backend dropped as non-compliant")},
-  { "rdqueries",              MetricDefinition(PrometheusMetricType::counter, "Number of received queries with the recursion desired bit set")},
-  { "empty-queries",          MetricDefinition(PrometheusMetricType::counter, "Number of empty queries received from clients")},
-  { "cache-hits",             MetricDefinition(PrometheusMetricType::counter, "Number of times an answer was retrieved from cache")},
-  { "cache-misses",           MetricDefinition(PrometheusMetricType::counter, "Number of times an answer not found in the cache")},
-  { "cpu-iowait",             MetricDefinition(PrometheusMetricType::counter, "Time waiting for I/O to complete by the whole system, in units of USER_HZ")},
-  { "cpu-user-msec",          MetricDefinition(PrometheusMetricType::counter, "Milliseconds spent by dnsdist in the user state")},
-  { "cpu-steal",              MetricDefinition(PrometheusMetricType::counter, "Stolen time, which is the time spent by the whole system in other operating systems when running in a virtualized environment, in units of USER_HZ")},
-  { "cpu-sys-msec",           MetricDefinition(PrometheusMetricType::counter, "Milliseconds spent by dnsdist in the system state")},
-  { "fd-usage",               MetricDefinition(PrometheusMetricType::gauge,   "Number of currently used file descriptors")},
-  { "dyn-blocked",            MetricDefinition(PrometheusMetricType::counter, "Number of queries dropped because of a dynamic block")},
-  { "dyn-block-nmg-size",     MetricDefinition(PrometheusMetricType::gauge,   "Number of dynamic blocks entries") },
-  { "security-status",        MetricDefinition(PrometheusMetricType::gauge,   "Security status of this software. 0=unknown, 1=OK, 2=upgrade recommended, 3=upgrade mandatory") },
-  { "udp-in-errors",          MetricDefinition(PrometheusMetricType::counter, "From /proc/net/snmp InErrors") },
-  { "udp-noport-errors",      MetricDefinition(PrometheusMetricType::counter, "From /proc/net/snmp NoPorts") },
-  { "udp-recvbuf-errors",     MetricDefinition(PrometheusMetricType::counter, "From /proc/net/snmp RcvbufErrors") },
-  { "udp-sndbuf-errors",      MetricDefinition(PrometheusMetricType::counter, "From /proc/net/snmp SndbufErrors") },
-};
 
 static bool apiWriteConfigFile(const string& filebasename, const string& content)
 {
@@ -458,344 +408,23 @@ static void connectionThread(int sock, ComboAddress remote)
         handleCORS(req, resp);
         resp.status = 200;
 
-        std::ostringstream output;
-        static const std::set<std::string> metricBlacklist = { "latency-count", "latency-sum" };
-        for (const auto& e : g_stats.entries) {
-          if (e.first == "special-memory-usage")
-            continue; // Too expensive for get-all
-          std::string metricName = std::get<0>(e);
-
-          // Prometheus suggest using '_' instead of '-'
-          std::string prometheusMetricName = "dnsdist_" + boost::replace_all_copy(metricName, "-", "_");
-          if (metricBlacklist.count(metricName) != 0) {
-            continue;
-          }
-
-          MetricDefinition metricDetails;
-          if (!s_metricDefinitions.getMetricDetails(metricName, metricDetails)) {
-              vinfolog("Do not have metric details for %s", metricName);
-              continue;
-          }
-
-          std::string prometheusTypeName = s_metricDefinitions.getPrometheusStringMetricType(metricDetails.prometheusType);
-
-          if (prometheusTypeName == "") {
-              vinfolog("Unknown Prometheus type for %s", metricName);
-              continue;
-          }
-
-          // for these we have the help and types encoded in the sources:
-          output << "# HELP " << prometheusMetricName << " " << metricDetails.description    << "\n";
-          output << "# TYPE " << prometheusMetricName << " " << prometheusTypeName << "\n";
-          output << prometheusMetricName << " ";
-
-          if (const auto& val = boost::get<DNSDistStats::stat_t*>(&std::get<1>(e)))
-            output << (*val)->load();
-          else if (const auto& dval = boost::get<double*>(&std::get<1>(e)))
-            output << **dval;
-          else
-            output << (*boost::get<DNSDistStats::statfunction_t>(&std::get<1>(e)))(std::get<0>(e));
-
-          output << "\n";
-        }
-
-        // Latency histogram buckets
-        output << "# HELP dnsdist_latency Histogram of responses by latency\n";
-        output << "# TYPE dnsdist_latency histogram\n";
-        uint64_t latency_amounts = g_stats.latency0_1;
-        output << "dnsdist_latency_bucket{le=\"1\"} " << latency_amounts << "\n";
-        latency_amounts += g_stats.latency1_10;
-        output << "dnsdist_latency_bucket{le=\"10\"} " << latency_amounts << "\n";
-        latency_amounts += g_stats.latency10_50;
-        output << "dnsdist_latency_bucket{le=\"50\"} " << latency_amounts << "\n";
-        latency_amounts += g_stats.latency50_100;
-        output << "dnsdist_latency_bucket{le=\"100\"} " << latency_amounts << "\n";
-        latency_amounts += g_stats.latency100_1000;
-        output << "dnsdist_latency_bucket{le=\"1000\"} " << latency_amounts << "\n";
-        latency_amounts += g_stats.latencySlow; // Should be the same as latency_count
-        output << "dnsdist_latency_bucket{le=\"+Inf\"} " << latency_amounts << "\n";
-        output << "dnsdist_latency_sum " << g_stats.latencySum << "\n";
-        output << "dnsdist_latency_count " << getLatencyCount(std::string()) << "\n";
-
-        auto states = g_dstates.getLocal();
-        const string statesbase = "dnsdist_server_";
-
-        output << "# HELP " << statesbase << "status "                 << "Whether this backend is up (1) or down (0)"                        << "\n";
-        output << "# TYPE " << statesbase << "status "                 << "gauge"                                                             << "\n";
-        output << "# HELP " << statesbase << "queries "                << "Amount of queries relayed to server"                               << "\n";
-        output << "# TYPE " << statesbase << "queries "                << "counter"                                                           << "\n";
-        output << "# HELP " << statesbase << "responses "              << "Amount of responses received from this server"                     << "\n";
-        output << "# TYPE " << statesbase << "responses "              << "counter"                                                           << "\n";
-        output << "# HELP " << statesbase << "drops "                  << "Amount of queries not answered by server"                          << "\n";
-        output << "# TYPE " << statesbase << "drops "                  << "counter"                                                           << "\n";
-        output << "# HELP " << statesbase << "latency "                << "Server's latency when answering questions in milliseconds"         << "\n";
-        output << "# TYPE " << statesbase << "latency "                << "gauge"                                                             << "\n";
-        output << "# HELP " << statesbase << "senderrors "             << "Total number of OS send errors while relaying queries"             << "\n";
-        output << "# TYPE " << statesbase << "senderrors "             << "counter"                                                           << "\n";
-        output << "# HELP " << statesbase << "outstanding "            << "Current number of queries that are waiting for a backend response" << "\n";
-        output << "# TYPE " << statesbase << "outstanding "            << "gauge"                                                             << "\n";
-        output << "# HELP " << statesbase << "order "                  << "The order in which this server is picked"                          << "\n";
-        output << "# TYPE " << statesbase << "order "                  << "gauge"                                                             << "\n";
-        output << "# HELP " << statesbase << "weight "                 << "The weight within the order in which this server is picked"        << "\n";
-        output << "# TYPE " << statesbase << "weight "                 << "gauge"                                                             << "\n";
-        output << "# HELP " << statesbase << "tcpdiedsendingquery "    << "The number of TCP I/O errors while sending the query"              << "\n";
-        output << "# TYPE " << statesbase << "tcpdiedsendingquery "    << "counter"                                                           << "\n";
-        output << "# HELP " << statesbase << "tcpdiedreadingresponse " << "The number of TCP I/O errors while reading the response"           << "\n";
-        output << "# TYPE " << statesbase << "tcpdiedreadingresponse " << "counter"                                                           << "\n";
-        output << "# HELP " << statesbase << "tcpgaveup "              << "The number of TCP connections failing after too many attempts"     << "\n";
-        output << "# TYPE " << statesbase << "tcpgaveup "              << "counter"                                                           << "\n";
-        output << "# HELP " << statesbase << "tcpreadtimeouts "        << "The number of TCP read timeouts"                                   << "\n";
-        output << "# TYPE " << statesbase << "tcpreadtimeouts "        << "counter"                                                           << "\n";
-        output << "# HELP " << statesbase << "tcpwritetimeouts "       << "The number of TCP write timeouts"                                  << "\n";
-        output << "# TYPE " << statesbase << "tcpwritetimeouts "       << "counter"                                                           << "\n";
-        output << "# HELP " << statesbase << "tcpcurrentconnections "  << "The number of current TCP connections"                             << "\n";
-        output << "# TYPE " << statesbase << "tcpcurrentconnections "  << "gauge"                                                             << "\n";
-        output << "# HELP " << statesbase << "tcpavgqueriesperconn "   << "The average number of queries per TCP connection"                  << "\n";
-        output << "# TYPE " << statesbase << "tcpavgqueriesperconn "   << "gauge"                                                             << "\n";
-        output << "# HELP " << statesbase << "tcpavgconnduration "     << "The average duration of a TCP connection (ms)"                     << "\n";
-        output << "# TYPE " << statesbase << "tcpavgconnduration "     << "gauge"                                                             << "\n";
-
-        for (const auto& state : *states) {
-          string serverName;
-
-          if (state->getName().empty())
-              serverName = state->remote.toStringWithPort();
-          else
-              serverName = state->getName();
-
-          boost::replace_all(serverName, ".", "_");
-
-          const std::string label = boost::str(boost::format("{server=\"%1%\",address=\"%2%\"}")
-            % serverName % state->remote.toStringWithPort());
-
-          output << statesbase << "status"                 << label << " " << (state->isUp() ? "1" : "0")       << "\n";
-          output << statesbase << "queries"                << label << " " << state->queries.load()             << "\n";
-          output << statesbase << "responses"              << label << " " << state->responses.load()           << "\n";
-          output << statesbase << "drops"                  << label << " " << state->reuseds.load()             << "\n";
-          output << statesbase << "latency"                << label << " " << state->latencyUsec/1000.0         << "\n";
-          output << statesbase << "senderrors"             << label << " " << state->sendErrors.load()          << "\n";
-          output << statesbase << "outstanding"            << label << " " << state->outstanding.load()         << "\n";
-          output << statesbase << "order"                  << label << " " << state->order                      << "\n";
-          output << statesbase << "weight"                 << label << " " << state->weight                     << "\n";
-          output << statesbase << "tcpdiedsendingquery"    << label << " " << state->tcpDiedSendingQuery        << "\n";
-          output << statesbase << "tcpdiedreadingresponse" << label << " " << state->tcpDiedReadingResponse     << "\n";
-          output << statesbase << "tcpgaveup"              << label << " " << state->tcpGaveUp                  << "\n";
-          output << statesbase << "tcpreadtimeouts"        << label << " " << state->tcpReadTimeouts            << "\n";
-          output << statesbase << "tcpwritetimeouts"       << label << " " << state->tcpWriteTimeouts           << "\n";
-          output << statesbase << "tcpcurrentconnections"  << label << " " << state->tcpCurrentConnections      << "\n";
-          output << statesbase << "tcpavgqueriesperconn"   << label << " " << state->tcpAvgQueriesPerConnection << "\n";
-          output << statesbase << "tcpavgconnduration"     << label << " " << state->tcpAvgConnectionDuration   << "\n";
-        }
-
-        const string frontsbase = "dnsdist_frontend_";
-        output << "# HELP " << frontsbase << "queries " << "Amount of queries received by this frontend" << "\n";
-        output << "# TYPE " << frontsbase << "queries " << "counter" << "\n";
-        output << "# HELP " << frontsbase << "responses " << "Amount of responses sent by this frontend" << "\n";
-        output << "# TYPE " << frontsbase << "responses " << "counter" << "\n";
-        output << "# HELP " << frontsbase << "tcpdiedreadingquery " << "Amount of TCP connections terminated while reading the query from the client" << "\n";
-        output << "# TYPE " << frontsbase << "tcpdiedreadingquery " << "counter" << "\n";
-        output << "# HELP " << frontsbase << "tcpdiedsendingresponse " << "Amount of TCP connections terminated while sending a response to the client" << "\n";
-        output << "# TYPE " << frontsbase << "tcpdiedsendingresponse " << "counter" << "\n";
-        output << "# HELP " << frontsbase << "tcpgaveup " << "Amount of TCP connections terminated after too many attempts to get a connection to the backend" << "\n";
-        output << "# TYPE " << frontsbase << "tcpgaveup " << "counter" << "\n";
-        output << "# HELP " << frontsbase << "tcpclientimeouts " << "Amount of TCP connections terminated by a timeout while reading from the client" << "\n";
-        output << "# TYPE " << frontsbase << "tcpclientimeouts " << "counter" << "\n";
-        output << "# HELP " << frontsbase << "tcpdownstreamtimeouts " << "Amount of TCP connections terminated by a timeout while reading from the backend" << "\n";
-        output << "# TYPE " << frontsbase << "tcpdownstreamtimeouts " << "counter" << "\n";
-        output << "# HELP " << frontsbase << "tcpcurrentconnections " << "Amount of current incoming TCP connections from clients" << "\n";
-        output << "# TYPE " << frontsbase << "tcpcurrentconnections " << "gauge" << "\n";
-        output << "# HELP " << frontsbase << "tcpavgqueriesperconnection " << "The average number of queries per TCP connection" << "\n";
-        output << "# TYPE " << frontsbase << "tcpavgqueriesperconnection " << "gauge" << "\n";
-        output << "# HELP " << frontsbase << "tcpavgconnectionduration " << "The average duration of a TCP connection (ms)" << "\n";
-        output << "# TYPE " << frontsbase << "tcpavgconnectionduration " << "gauge" << "\n";
-        output << "# HELP " << frontsbase << "tlsqueries " << "Number of queries received by dnsdist over TLS, by TLS version" << "\n";
-        output << "# TYPE " << frontsbase << "tlsqueries " << "counter" << "\n";
-        output << "# HELP " << frontsbase << "tlsnewsessions " << "Amount of new TLS sessions negotiated" << "\n";
-        output << "# TYPE " << frontsbase << "tlsnewsessions " << "counter" << "\n";
-        output << "# HELP " << frontsbase << "tlsresumptions " << "Amount of TLS sessions resumed" << "\n";
-        output << "# TYPE " << frontsbase << "tlsresumptions " << "counter" << "\n";
-        output << "# HELP " << frontsbase << "tlsunknownticketkeys " << "Amount of attempts to resume TLS session from an unknown key (possibly expired)" << "\n";
-        output << "# TYPE " << frontsbase << "tlsunknownticketkeys " << "counter" << "\n";
-        output << "# HELP " << frontsbase << "tlsinactiveticketkeys " << "Amount of TLS sessions resumed from an inactive key" << "\n";
-        output << "# TYPE " << frontsbase << "tlsinactiveticketkeys " << "counter" << "\n";
-
-        output << "# HELP " << frontsbase << "tlshandshakefailures " << "Amount of TLS handshake failures" << "\n";
-        output << "# TYPE " << frontsbase << "tlshandshakefailures " << "counter" << "\n";
-
-        std::map<std::string,uint64_t> frontendDuplicates;
-        for (const auto& front : g_frontends) {
-          if (front->udpFD == -1 && front->tcpFD == -1)
-            continue;
-
-          const string frontName = front->local.toString() + ":" + std::to_string(front->local.getPort());
-          const string proto = front->getType();
-          const string fullName = frontName + "_" + proto;
-          uint64_t threadNumber = 0;
-          auto dupPair = frontendDuplicates.insert({fullName, 1});
-          if (!dupPair.second) {
-            threadNumber = dupPair.first->second;
-            ++(dupPair.first->second);
-          }
-          const std::string label = boost::str(boost::format("{frontend=\"%1%\",proto=\"%2%\",thread=\"%3%\"} ")
-            % frontName % proto % threadNumber);
-
-          output << frontsbase << "queries" << label << front->queries.load() << "\n";
-          output << frontsbase << "responses" << label << front->responses.load() << "\n";
-          if (front->isTCP()) {
-            output << frontsbase << "tcpdiedreadingquery" << label << front->tcpDiedReadingQuery.load() << "\n";
-            output << frontsbase << "tcpdiedsendingresponse" << label << front->tcpDiedSendingResponse.load() << "\n";
-            output << frontsbase << "tcpgaveup" << label << front->tcpGaveUp.load() << "\n";
-            output << frontsbase << "tcpclientimeouts" << label << front->tcpClientTimeouts.load() << "\n";
-            output << frontsbase << "tcpdownstreamtimeouts" << label << front->tcpDownstreamTimeouts.load() << "\n";
-            output << frontsbase << "tcpcurrentconnections" << label << front->tcpCurrentConnections.load() << "\n";
-            output << frontsbase << "tcpavgqueriesperconnection" << label << front->tcpAvgQueriesPerConnection.load() << "\n";
-            output << frontsbase << "tcpavgconnectionduration" << label << front->tcpAvgConnectionDuration.load() << "\n";
-            if (front->hasTLS()) {
-              output << frontsbase << "tlsnewsessions" << label << front->tlsNewSessions.load() << "\n";
-              output << frontsbase << "tlsresumptions" << label << front->tlsResumptions.load() << "\n";
-              output << frontsbase << "tlsunknownticketkeys" << label << front->tlsUnknownTicketKey.load() << "\n";
-              output << frontsbase << "tlsinactiveticketkeys" << label << front->tlsInactiveTicketKey.load() << "\n";
-
-              output << frontsbase << "tlsqueries{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",tls=\"tls10\"} " << front->tls10queries.load() << "\n";
-              output << frontsbase << "tlsqueries{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",tls=\"tls11\"} " << front->tls11queries.load() << "\n";
-              output << frontsbase << "tlsqueries{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",tls=\"tls12\"} " << front->tls12queries.load() << "\n";
-              output << frontsbase << "tlsqueries{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",tls=\"tls13\"} " << front->tls13queries.load() << "\n";
-              output << frontsbase << "tlsqueries{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",tls=\"unknown\"} " << front->tlsUnknownqueries.load() << "\n";
-
-              const TLSErrorCounters* errorCounters = nullptr;
-              if (front->tlsFrontend != nullptr) {
-                errorCounters = &front->tlsFrontend->d_tlsCounters;
-              }
-              else if (front->dohFrontend != nullptr) {
-                errorCounters = &front->dohFrontend->d_tlsCounters;
-              }
-
-              if (errorCounters != nullptr) {
-                output << frontsbase << "tlshandshakefailures{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",error=\"dhKeyTooSmall\"} " << errorCounters->d_dhKeyTooSmall << "\n";
-                output << frontsbase << "tlshandshakefailures{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",error=\"inappropriateFallBack\"} " << errorCounters->d_inappropriateFallBack << "\n";
-                output << frontsbase << "tlshandshakefailures{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",error=\"noSharedCipher\"} " << errorCounters->d_noSharedCipher << "\n";
-                output << frontsbase << "tlshandshakefailures{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",error=\"unknownCipherType\"} " << errorCounters->d_unknownCipherType << "\n";
-                output << frontsbase << "tlshandshakefailures{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",error=\"unknownKeyExchangeType\"} " << errorCounters->d_unknownKeyExchangeType << "\n";
-                output << frontsbase << "tlshandshakefailures{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",error=\"unknownProtocol\"} " << errorCounters->d_unknownProtocol << "\n";
-                output << frontsbase << "tlshandshakefailures{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",error=\"unsupportedEC\"} " << errorCounters->d_unsupportedEC << "\n";
-                output << frontsbase << "tlshandshakefailures{frontend=\"" << frontName << "\",proto=\"" << proto << "\",thread=\"" << threadNumber << "\",error=\"unsupportedProtocol{\"} " << errorCounters->d_unsupportedProtocol << "\n";
-              }
-            }
-          }
-        }
-
-        output << "# HELP " << frontsbase << "http_connects " << "Number of DoH TCP connections established to this frontend" << "\n";
-        output << "# TYPE " << frontsbase << "http_connects " << "counter" << "\n";
-
-        output << "# HELP " << frontsbase << "doh_http_method_queries " << "Number of DoH queries received by dnsdist, by HTTP method" << "\n";
-        output << "# TYPE " << frontsbase << "doh_http_method_queries " << "counter" << "\n";
-
-        output << "# HELP " << frontsbase << "doh_http_version_queries " << "Number of DoH queries received by dnsdist, by HTTP version" << "\n";
-        output << "# TYPE " << frontsbase << "doh_http_version_queries " << "counter" << "\n";
-
-        output << "# HELP " << frontsbase << "doh_bad_requests " << "Number of requests that could not be converted to a DNS query" << "\n";
-        output << "# TYPE " << frontsbase << "doh_bad_requests " << "counter" << "\n";
-
-        output << "# HELP " << frontsbase << "doh_responses " << "Number of responses sent, by type" << "\n";
-        output << "# TYPE " << frontsbase << "doh_responses " << "counter" << "\n";
-
-        output << "# HELP " << frontsbase << "doh_version_status_responses " << "Number of requests that could not be converted to a DNS query" << "\n";
-        output << "# TYPE " << frontsbase << "doh_version_status_responses " << "counter" << "\n";
-
-#ifdef HAVE_DNS_OVER_HTTPS
-        std::map<std::string,uint64_t> dohFrontendDuplicates;
-        for(const auto& doh : g_dohlocals) {
-          const string frontName = doh->d_local.toStringWithPort();
-          uint64_t threadNumber = 0;
-          auto dupPair = frontendDuplicates.insert({frontName, 1});
-          if (!dupPair.second) {
-            threadNumber = dupPair.first->second;
-            ++(dupPair.first->second);
-          }
-          const std::string addrlabel = boost::str(boost::format("frontend=\"%1%\",thread=\"%2%\"") % frontName % threadNumber);
-          const std::string label = "{" + addrlabel + "} ";
-
-          output << frontsbase << "http_connects" << label << doh->d_httpconnects << "\n";
-          output << frontsbase << "doh_http_method_queries{method=\"get\"," << addrlabel << "} " << doh->d_getqueries << "\n";
-          output << frontsbase << "doh_http_method_queries{method=\"post\"," << addrlabel << "} " << doh->d_postqueries << "\n";
-
-          output << frontsbase << "doh_http_version_queries{version=\"1\"," << addrlabel << "} " << doh->d_http1Stats.d_nbQueries << "\n";
-          output << frontsbase << "doh_http_version_queries{version=\"2\"," << addrlabel << "} " << doh->d_http2Stats.d_nbQueries << "\n";
-
-          output << frontsbase << "doh_bad_requests{" << addrlabel << "} " << doh->d_badrequests << "\n";
-
-          output << frontsbase << "doh_responses{type=\"error\"," << addrlabel << "} " << doh->d_errorresponses << "\n";
-          output << frontsbase << "doh_responses{type=\"redirect\"," << addrlabel << "} " << doh->d_redirectresponses << "\n";
-          output << frontsbase << "doh_responses{type=\"valid\"," << addrlabel << "} " << doh->d_validresponses << "\n";
-
-          output << frontsbase << "doh_version_status_responses{httpversion=\"1\",status=\"200\"," << addrlabel << "} " << doh->d_http1Stats.d_nb200Responses << "\n";
-          output << frontsbase << "doh_version_status_responses{httpversion=\"1\",status=\"400\"," << addrlabel << "} " << doh->d_http1Stats.d_nb400Responses << "\n";
-          output << frontsbase << "doh_version_status_responses{httpversion=\"1\",status=\"403\"," << addrlabel << "} " << doh->d_http1Stats.d_nb403Responses << "\n";
-          output << frontsbase << "doh_version_status_responses{httpversion=\"1\",status=\"500\"," << addrlabel << "} " << doh->d_http1Stats.d_nb500Responses << "\n";
-          output << frontsbase << "doh_version_status_responses{httpversion=\"1\",status=\"502\"," << addrlabel << "} " << doh->d_http1Stats.d_nb502Responses << "\n";
-          output << frontsbase << "doh_version_status_responses{httpversion=\"1\",status=\"other\"," << addrlabel << "} " << doh->d_http1Stats.d_nbOtherResponses << "\n";
-          output << frontsbase << "doh_version_status_responses{httpversion=\"2\",status=\"200\"," << addrlabel << "} " << doh->d_http2Stats.d_nb200Responses << "\n";
-          output << frontsbase << "doh_version_status_responses{httpversion=\"2\",status=\"400\"," << addrlabel << "} " << doh->d_http2Stats.d_nb400Responses << "\n";
-          output << frontsbase << "doh_version_status_responses{httpversion=\"2\",status=\"403\"," << addrlabel << "} " << doh->d_http2Stats.d_nb403Responses << "\n";
-          output << frontsbase << "doh_version_status_responses{httpversion=\"2\",status=\"500\"," << addrlabel << "} " << doh->d_http2Stats.d_nb500Responses << "\n";
-          output << frontsbase << "doh_version_status_responses{httpversion=\"2\",status=\"502\"," << addrlabel << "} " << doh->d_http2Stats.d_nb502Responses << "\n";
-          output << frontsbase << "doh_version_status_responses{httpversion=\"2\",status=\"other\"," << addrlabel << "} " << doh->d_http2Stats.d_nbOtherResponses << "\n";
-        }
-#endif /* HAVE_DNS_OVER_HTTPS */
-
-        auto localPools = g_pools.getLocal();
-        const string cachebase = "dnsdist_pool_";
-        output << "# HELP dnsdist_pool_servers " << "Number of servers in that pool" << "\n";
-        output << "# TYPE dnsdist_pool_servers " << "gauge" << "\n";
-        output << "# HELP dnsdist_pool_active_servers " << "Number of available servers in that pool" << "\n";
-        output << "# TYPE dnsdist_pool_active_servers " << "gauge" << "\n";
-
-        output << "# HELP dnsdist_pool_cache_size " << "Maximum number of entries that this cache can hold" << "\n";
-        output << "# TYPE dnsdist_pool_cache_size " << "gauge" << "\n";
-        output << "# HELP dnsdist_pool_cache_entries " << "Number of entries currently present in that cache" << "\n";
-        output << "# TYPE dnsdist_pool_cache_entries " << "gauge" << "\n";
-        output << "# HELP dnsdist_pool_cache_hits " << "Number of hits from that cache" << "\n";
-        output << "# TYPE dnsdist_pool_cache_hits " << "counter" << "\n";
-        output << "# HELP dnsdist_pool_cache_misses " << "Number of misses from that cache" << "\n";
-        output << "# TYPE dnsdist_pool_cache_misses " << "counter" << "\n";
-        output << "# HELP dnsdist_pool_cache_deferred_inserts " << "Number of insertions into that cache skipped because it was already locked" << "\n";
-        output << "# TYPE dnsdist_pool_cache_deferred_inserts " << "counter" << "\n";
-        output << "# HELP dnsdist_pool_cache_deferred_lookups " << "Number of lookups into that cache skipped because it was already locked" << "\n";
-        output << "# TYPE dnsdist_pool_cache_deferred_lookups " << "counter" << "\n";
-        output << "# HELP dnsdist_pool_cache_lookup_collisions " << "Number of lookups into that cache that triggered a collision (same hash but different entry)" << "\n";
-        output << "# TYPE dnsdist_pool_cache_lookup_collisions " << "counter" << "\n";
-        output << "# HELP dnsdist_pool_cache_insert_collisions " << "Number of insertions into that cache that triggered a collision (same hash but different entry)" << "\n";
-        output << "# TYPE dnsdist_pool_cache_insert_collisions " << "counter" << "\n";
-        output << "# HELP dnsdist_pool_cache_ttl_too_shorts " << "Number of insertions into that cache skipped because the TTL of the answer was not long enough" << "\n";
-        output << "# TYPE dnsdist_pool_cache_ttl_too_shorts " << "counter" << "\n";
-
-        for (const auto& entry : *localPools) {
-          string poolName = entry.first;
-
-          if (poolName.empty()) {
-            poolName = "_default_";
-          }
-          const string label = "{pool=\"" + poolName + "\"}";
-          const std::shared_ptr<ServerPool> pool = entry.second;
-          output << "dnsdist_pool_servers" << label << " " << pool->countServers(false) << "\n";
-          output << "dnsdist_pool_active_servers" << label << " " << pool->countServers(true) << "\n";
-
-          if (pool->packetCache != nullptr) {
-            const auto& cache = pool->packetCache;
-
-            output << cachebase << "cache_size"              <<label << " " << cache->getMaxEntries()       << "\n";
-            output << cachebase << "cache_entries"           <<label << " " << cache->getEntriesCount()     << "\n";
-            output << cachebase << "cache_hits"              <<label << " " << cache->getHits()             << "\n";
-            output << cachebase << "cache_misses"            <<label << " " << cache->getMisses()           << "\n";
-            output << cachebase << "cache_deferred_inserts"  <<label << " " << cache->getDeferredInserts()  << "\n";
-            output << cachebase << "cache_deferred_lookups"  <<label << " " << cache->getDeferredLookups()  << "\n";
-            output << cachebase << "cache_lookup_collisions" <<label << " " << cache->getLookupCollisions() << "\n";
-            output << cachebase << "cache_insert_collisions" <<label << " " << cache->getInsertCollisions() << "\n";
-            output << cachebase << "cache_ttl_too_shorts"    <<label << " " << cache->getTTLTooShorts()     << "\n";
-          }
+        /* the exporter caches the rendered names between two scrapes, and several
+           scrapes might be processed at the same time by different threads */
+        static std::mutex s_exporterLock;
+        static MetricsExporter s_exporter;
+        static size_t s_lastOutputSize{0};
+
+        std::string output;
+        {
+          std::lock_guard<std::mutex> lock(s_exporterLock);
+          output.reserve(s_lastOutputSize);
+          MetricsWriter writer(output, "\n");
+          s_exporter.dump(writer);
+          writer.finish();
+          s_lastOutputSize = output.size();
         }
 
-        resp.body = output.str();
+        resp.body = std::move(output);
         resp.headers["Content-Type"] = "text/plain";
     }
 
@@ -875,10 +504,13 @@ static void connectionThread(int sock, ComboAddress remote)
           { "tcpCurrentConnections", (double) front->tcpCurrentConnections },
           { "tcpAvgQueriesPerConnection", (double) front->tcpAvgQueriesPerConnection },
           { "tcpAvgConnectionDuration", (double) front->tcpAvgConnectionDuration },
+          { "tcpPipelinedQueries", (double) front->tcpPipelinedQueries },
+          { "tcpInFlightLimitReached", (double) front->tcpInFlightLimitReached },
           { "tlsNewSessions", (double) front->tlsNewSessions },
           { "tlsResumptions", (double) front->tlsResumptions },
           { "tlsUnknownTicketKey", (double) front->tlsUnknownTicketKey },
           { "tlsInactiveTicketKey", (double) front->tlsInactiveTicketKey },
+          { "tlsKTLSSessions", (double) front->tlsKTLSSessions },
           { "tls10Queries", (double) front->tls10queries },
           { "tls11Queries", (double) front->tls11queries },
           { "tls12Queries", (double) front->tls12queries },
@@ -50,6 +50,7 @@
 #include "dnsdist-lua.hh"
 #include "dnsdist-proxy-protocol.hh"
 #include "dnsdist-rings.hh"
+#include "dnsdist-rule-chain.hh"
 #include "dnsdist-secpoll.hh"
 #include "dnsdist-xpf.hh"
 
@@ -138,6 +139,7 @@ bool g_servFailOnNoPolicy{false};
 bool g_truncateTC{false};
 bool g_fixupCase{false};
 bool g_preserveTrailingData{false};
+bool g_compileQueryRules{false};
 
 std::set<std::string> g_capabilitiesToRetain;
 
@@ -346,8 +348,8 @@ static bool fixUpResponse(char** response, uint16_t* responseLen, size_t* respon
           arcount--;
           dh->arcount = htons(arcount);
         }
-        else {
-          /* Removing an intermediary RR could lead to compression error */
+        else if (removeOPTRRInPlace(*response, responseLen) != 0) {
+          /* we could not fix the compression pointers of the records following the OPT RR, rebuild the response */
           if (rewriteResponseWithoutEDNS(responseStr, rewrittenResponse) == 0) {
             *responseLen = rewrittenResponse.size();
             if (addRoom && (UINT16_MAX - *responseLen) > addRoom) {
@@ -372,17 +374,20 @@ static bool fixUpResponse(char** response, uint16_t* responseLen, size_t* respon
           *responseLen -= (existingOptLen - optLen);
         }
         else {
-          /* Removing an intermediary RR could lead to compression error */
-          if (rewriteResponseWithoutEDNSOption(responseStr, EDNSOptionCode::ECS, rewrittenResponse) == 0) {
-            *responseLen = rewrittenResponse.size();
-            if (addRoom && (UINT16_MAX - *responseLen) > addRoom) {
-              rewrittenResponse.reserve(*responseLen + addRoom);
+          res = removeEDNSOptionInPlace(*response, responseLen, EDNSOptionCode::ECS);
+          if (res != 0 && res != ENOENT) {
+            /* we could not fix the compression pointers of the records following the OPT RR, rebuild the response */
+            if (rewriteResponseWithoutEDNSOption(responseStr, EDNSOptionCode::ECS, rewrittenResponse) == 0) {
+              *responseLen = rewrittenResponse.size();
+              if (addRoom && (UINT16_MAX - *responseLen) > addRoom) {
+                rewrittenResponse.reserve(*responseLen + addRoom);
+              }
+              *responseSize = rewrittenResponse.capacity();
+              *response = reinterpret_cast<char*>(rewrittenResponse.data());
+            }
+            else {
+              warnlog("Error rewriting content");
             }
-            *responseSize = rewrittenResponse.capacity();
-            *response = reinterpret_cast<char*>(rewrittenResponse.data());
-          }
-          else {
-            warnlog("Error rewriting content");
           }
         }
       }
@@ -592,6 +597,8 @@ try {
 
         unsigned int consumed = 0;
         if (!responseContentMatches(response, responseLen, ids->qname, ids->qtype, ids->qclass, dss->remote, consumed)) {
+          /* we reset the age of a state that is still waiting for its response */
+          dss->recheckIDState(queryId);
           continue;
         }
 
@@ -964,8 +971,16 @@ static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const stru
   DNSAction::Action action=DNSAction::Action::None;
   string ruleresult;
   bool drop = false;
-  for(const auto& lr : *holders.rulactions) {
-    if(lr.d_rule->matches(&dq)) {
+  if (g_compileQueryRules) {
+    if (!holders.compiledRulactions || &holders.compiledRulactions->getRules() != &*holders.rulactions) {
+      holders.compiledRulactions = std::make_shared<DNSRuleChain>(holders.rulactions.getShared());
+    }
+
+    const auto& chain = *holders.compiledRulactions;
+    /* owned by the chain, so it stays valid even if the rules are updated in the meantime */
+    const auto& rulactions = chain.getRules();
+    for (size_t idx = chain.findNextMatch(dq, 0); idx < rulactions.size(); idx = chain.findNextMatch(dq, idx + 1)) {
+      const auto& lr = rulactions[idx];
       lr.d_rule->d_matches++;
       action=(*lr.d_action)(&dq, &ruleresult);
       if (processRulesResult(action, dq, ruleresult, drop)) {
@@ -973,6 +988,17 @@ static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const stru
       }
     }
   }
+  else {
+    for(const auto& lr : *holders.rulactions) {
+      if(lr.d_rule->matches(&dq)) {
+        lr.d_rule->d_matches++;
+        action=(*lr.d_action)(&dq, &ruleresult);
+        if (processRulesResult(action, dq, ruleresult, drop)) {
+          break;
+        }
+      }
+    }
+  }
 
   if (drop) {
     return false;
@@ -1637,14 +1663,19 @@ static void healthChecksThread()
 
   static const int interval = 1;
 
+  HealthCheckScheduler scheduler;
+
   for(;;) {
-    sleep(interval);
+    /* the health checks are sent and processed by the scheduler while we wait */
+    struct timeval next;
+    gettimeofday(&next, nullptr);
+    next.tv_sec += interval;
+    scheduler.run(next);
 
     if(g_tcpclientthreads->getQueuedCount() > 1 && !g_tcpclientthreads->hasReachedMaxThreads()) {
       g_tcpclientthreads->addTCPClientThread();
     }
 
-    auto mplexer = std::shared_ptr<FDMultiplexer>(FDMultiplexer::getMultiplexerSilent());
     auto states = g_dstates.getLocal(); // this points to the actual shared_ptrs!
     for(auto& dss : *states) {
       if(++dss->lastCheck < dss->checkInterval) {
@@ -1653,55 +1684,29 @@ static void healthChecksThread()
 
       dss->lastCheck = 0;
 
-      if (dss->availability == DownstreamState::Availability::Auto) {
-        if (!queueHealthCheck(mplexer, dss)) {
-          updateHealthCheckResult(dss, false);
-        }
-      }
-
       auto delta = dss->sw.udiffAndSet()/1000000.0;
       dss->queryLoad = 1.0*(dss->queries.load() - dss->prev.queries.load())/delta;
       dss->dropRate = 1.0*(dss->reuseds.load() - dss->prev.reuseds.load())/delta;
       dss->prev.queries.store(dss->queries.load());
       dss->prev.reuseds.store(dss->reuseds.load());
       
-      for (IDState& ids  : dss->idStates) { // timeouts
-        int64_t usageIndicator = ids.usageIndicator;
-        if(IDState::isInUse(usageIndicator) && ids.age++ > g_udpTimeout) {
-          /* We mark the state as unused as soon as possible
-             to limit the risk of racing with the
-             responder thread.
-          */
-          auto oldDU = ids.du;
+      dss->handleUDPTimeouts(g_udpTimeout, [&dss](IDState& ids, DOHUnit* du) {
+        handleDOHTimeout(du);
+        ++g_stats.downstreamTimeouts; // this is an 'actively' discovered timeout
+        vinfolog("Had a downstream timeout from %s (%s) for query for %s|%s from %s",
+                 dss->remote.toStringWithPort(), dss->getName(),
+                 ids.qname.toLogString(), QType(ids.qtype).getName(), ids.origRemote.toStringWithPort());
 
-          if (!ids.tryMarkUnused(usageIndicator)) {
-            /* this state has been altered in the meantime,
-               don't go anywhere near it */
-            continue;
-          }
-          ids.du = nullptr;
-          handleDOHTimeout(oldDU);
-          ids.age = 0;
-          dss->reuseds++;
-          --dss->outstanding;
-          ++g_stats.downstreamTimeouts; // this is an 'actively' discovered timeout
-          vinfolog("Had a downstream timeout from %s (%s) for query for %s|%s from %s",
-                   dss->remote.toStringWithPort(), dss->getName(),
-                   ids.qname.toLogString(), QType(ids.qtype).getName(), ids.origRemote.toStringWithPort());
-
-          struct timespec ts;
-          gettime(&ts);
-
-          struct dnsheader fake;
-          memset(&fake, 0, sizeof(fake));
-          fake.id = ids.origID;
-
-          g_rings.insertResponse(ts, ids.origRemote, ids.qname, ids.qtype, std::numeric_limits<unsigned int>::max(), 0, fake, dss->remote);
-        }          
-      }
-    }
+        struct timespec ts;
+        gettime(&ts);
+
+        struct dnsheader fake;
+        memset(&fake, 0, sizeof(fake));
+        fake.id = ids.origID;
 
-    handleQueuedHealthChecks(mplexer);
+        g_rings.insertResponse(ts, ids.origRemote, ids.qname, ids.qtype, std::numeric_limits<unsigned int>::max(), 0, fake, dss->remote);
+      });
+    }
   }
 }
 
@@ -2357,7 +2362,7 @@ try
       }
     }
   }
-  handleQueuedHealthChecks(mplexer, true);
+  handleQueuedHealthChecks(mplexer);
 
   for(auto& cs : g_frontends) {
     if (cs->dohFrontend != nullptr) {
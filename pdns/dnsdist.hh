@@ -24,7 +24,9 @@
 #include "ext/luawrapper/include/LuaContext.hpp"
 
 #include <atomic>
+#include <deque>
 #include <mutex>
+#include <set>
 #include <string>
 #include <thread>
 #include <time.h>
@@ -39,6 +41,7 @@
 #include "dnsdist-cache.hh"
 #include "dnsdist-dynbpf.hh"
 #include "dnsdist-lbpolicies.hh"
+#include "dnsdist-metrics.hh"
 #include "dnsname.hh"
 #include "doh.hh"
 #include "ednsoptions.hh"
@@ -237,7 +240,7 @@ extern uint64_t getLatencyCount(const std::string&);
 
 struct DNSDistStats
 {
-  using stat_t=std::atomic<uint64_t>; // aww yiss ;-)
+  using stat_t=ShardedCounter;
   stat_t responses{0};
   stat_t servfailResponses{0};
   stat_t queries{0};
@@ -315,6 +318,10 @@ struct DNSDistStats
     {"dyn-blocked", &dynBlocked},
     {"dyn-block-nmg-size", [](const std::string&) { return g_dynblockNMG.getLocal()->size(); }},
     {"security-status", &securityStatus},
+#ifdef HAVE_DNSCRYPT
+    {"dnscrypt-shared-key-cache-hits", [](const std::string&) { return DNSCryptQuery::getSharedKeysCacheHits(); }},
+    {"dnscrypt-shared-key-cache-misses", [](const std::string&) { return DNSCryptQuery::getSharedKeysCacheMisses(); }},
+#endif /* HAVE_DNSCRYPT */
     // Latency histogram
     {"latency-sum", &latencySum},
     {"latency-count", getLatencyCount},
@@ -608,10 +615,13 @@ struct ClientState
   std::atomic<uint64_t> tcpClientTimeouts{0};
   std::atomic<uint64_t> tcpDownstreamTimeouts{0};
   std::atomic<uint64_t> tcpCurrentConnections{0};
+  std::atomic<uint64_t> tcpPipelinedQueries{0}; // queries read while other queries from the same connection were still being processed
+  std::atomic<uint64_t> tcpInFlightLimitReached{0}; // a connection reached the maximum number of queries in flight, and we stopped reading from it
   std::atomic<uint64_t> tlsNewSessions{0}; // A new TLS session has been negotiated, no resumption
   std::atomic<uint64_t> tlsResumptions{0}; // A TLS session has been resumed, either via session id or via a TLS ticket
   std::atomic<uint64_t> tlsUnknownTicketKey{0}; // A TLS ticket has been presented but we don't have the associated key (might have expired)
   std::atomic<uint64_t> tlsInactiveTicketKey{0}; // A TLS ticket has been successfully resumed but the key is no longer active, we should issue a new one
+  std::atomic<uint64_t> tlsKTLSSessions{0}; // The record layer of a TLS session has been offloaded to the kernel (kTLS) after the handshake
   std::atomic<uint64_t> tls10queries{0};   // valid DNS queries received via TLSv1.0
   std::atomic<uint64_t> tls11queries{0};   // valid DNS queries received via TLSv1.1
   std::atomic<uint64_t> tls12queries{0};   // valid DNS queries received via TLSv1.2
@@ -623,6 +633,8 @@ struct ClientState
   int udpFD{-1};
   int tcpFD{-1};
   int tcpListenQueueSize{SOMAXCONN};
+  /* maximum number of queries from a single TCP connection processed at the same time, 0 meaning that they are processed one after another */
+  size_t tcpMaxInFlightQueriesPerConn{0};
   int fastOpenQueueSize{0};
   bool muted{false};
   bool tcp;
@@ -791,6 +803,16 @@ struct DownstreamState
   QType checkType{QType::A};
   uint16_t checkClass{QClass::IN};
   std::atomic<uint64_t> idOffset{0};
+  /* values of idOffset at the last timeout scans, only accessed by the health checks thread */
+  std::deque<uint64_t> idOffsetHistory;
+  /* number of timeout scans so far, only accessed by the health checks thread */
+  uint64_t udpTimeoutScans{0};
+  /* the timeout scans look at the whole table once every that many scans */
+  static const uint64_t s_udpTimeoutsFullScanInterval{60};
+  /* in-flight states whose age has been reset by a responder thread without being released,
+     which have to be looked at by the timeout scans even once they are out of the recent window */
+  std::set<uint16_t> idStatesToRecheck;
+  std::mutex idStatesToRecheckLock;
   std::atomic<uint64_t> sendErrors{0};
   std::atomic<uint64_t> outstanding{0};
   std::atomic<uint64_t> reuseds{0};
@@ -810,16 +832,30 @@ struct DownstreamState
   std::atomic<double> tcpAvgQueriesPerConnection{0.0};
   /* in ms */
   std::atomic<double> tcpAvgConnectionDuration{0.0};
+  /* latency of the successful health checks, same buckets as the global latency histogram */
+  struct {
+    std::atomic<uint64_t> latency0_1{0};
+    std::atomic<uint64_t> latency1_10{0};
+    std::atomic<uint64_t> latency10_50{0};
+    std::atomic<uint64_t> latency50_100{0};
+    std::atomic<uint64_t> latency100_1000{0};
+    std::atomic<uint64_t> latencySlow{0};
+    /* in ms */
+    std::atomic<uint64_t> latencySum{0};
+  } checkLatency;
   size_t socketsOffset{0};
   double queryLoad{0.0};
   double dropRate{0.0};
-  double latencyUsec{0.0};
+  /* moving average of the latency of the last 128 responses, read by the latency-aware policy */
+  std::atomic<double> latencyUsec{0.0};
   int order{1};
   int weight{1};
   int tcpConnectTimeout{5};
   int tcpRecvTimeout{30};
   int tcpSendTimeout{30};
   unsigned int checkInterval{1};
+  /* the interval between two checks is doubled after every successful check of an up backend, up to this value. 0 disables */
+  unsigned int maxCheckInterval{0};
   unsigned int lastCheck{0};
   const unsigned int sourceItf{0};
   uint16_t retries{5};
@@ -837,6 +873,8 @@ struct DownstreamState
   bool useECS{false};
   bool useProxyProtocol{false};
   bool setCD{false};
+  /* send the health checks over a TCP connection kept open between checks, instead of UDP */
+  bool checkTCP{false};
   bool disableZeroScope{false};
   std::atomic<bool> connected{false};
   std::atomic_flag threadStarted;
@@ -881,6 +919,22 @@ struct DownstreamState
   void hash();
   void setId(const boost::uuids::uuid& newId);
   void setWeight(int newWeight);
+  /* called by a responder thread after resetting the age of an in-flight state that it could not release */
+  void recheckIDState(uint16_t id);
+  /* look for the in-flight UDP states that have been waiting for a response for more than udpTimeout scans,
+     releasing them and calling timedOut for each one */
+  void handleUDPTimeouts(int udpTimeout, const std::function<void(IDState&, DOHUnit*)>& timedOut);
+
+  void updateCheckLatency(uint64_t udiff)
+  {
+    if (udiff < 1000) ++checkLatency.latency0_1;
+    else if (udiff < 10000) ++checkLatency.latency1_10;
+    else if (udiff < 50000) ++checkLatency.latency10_50;
+    else if (udiff < 100000) ++checkLatency.latency50_100;
+    else if (udiff < 1000000) ++checkLatency.latency100_1000;
+    else ++checkLatency.latencySlow;
+    checkLatency.latencySum += udiff / 1000;
+  }
 
   void updateTCPMetrics(size_t nbQueries, uint64_t durationMs)
   {
@@ -1078,6 +1132,8 @@ extern shared_ptr<BPFFilter> g_defaultBPFFilter;
 extern std::vector<std::shared_ptr<DynBPFFilter> > g_dynBPFFilters;
 #endif /* HAVE_EBPF */
 
+class DNSRuleChain;
+
 struct LocalHolders
 {
   LocalHolders(): acl(g_ACL.getLocal()), policy(g_policy.getLocal()), rulactions(g_rulactions.getLocal()), cacheHitRespRulactions(g_cachehitresprulactions.getLocal()), selfAnsweredRespRulactions(g_selfansweredresprulactions.getLocal()), servers(g_dstates.getLocal()), dynNMGBlock(g_dynblockNMG.getLocal()), dynSMTBlock(g_dynblockSMT.getLocal()), pools(g_pools.getLocal())
@@ -1093,6 +1149,9 @@ struct LocalHolders
   LocalStateHolder<NetmaskTree<DynBlock> > dynNMGBlock;
   LocalStateHolder<SuffixMatchTree<DynBlock> > dynSMTBlock;
   LocalStateHolder<pools_t> pools;
+  /* only used when the compilation of query rules is enabled,
+     rebuilt whenever 'rulactions' changes */
+  std::shared_ptr<DNSRuleChain> compiledRulactions;
 };
 
 struct dnsheader;
@@ -155,3 +155,105 @@ DownstreamState::DownstreamState(const ComboAddress& remote_, const ComboAddress
   }
 
 }
+
+void DownstreamState::recheckIDState(uint16_t id)
+{
+  std::lock_guard<std::mutex> lock(idStatesToRecheckLock);
+  idStatesToRecheck.insert(id);
+}
+
+/* returns true if the state is still in use afterwards */
+static bool checkIDStateTimeout(DownstreamState& dss, IDState& ids, int udpTimeout, const std::function<void(IDState&, DOHUnit*)>& timedOut)
+{
+  int64_t usageIndicator = ids.usageIndicator;
+  if (!IDState::isInUse(usageIndicator)) {
+    return false;
+  }
+
+  if (ids.age++ <= udpTimeout) {
+    return true;
+  }
+
+  /* We mark the state as unused as soon as possible
+     to limit the risk of racing with the
+     responder thread.
+  */
+  auto oldDU = ids.du;
+
+  if (!ids.tryMarkUnused(usageIndicator)) {
+    /* this state has been altered in the meantime,
+       don't go anywhere near it */
+    return true;
+  }
+  ids.du = nullptr;
+  ids.age = 0;
+  dss.reuseds++;
+  --dss.outstanding;
+  timedOut(ids, oldDU);
+  return false;
+}
+
+void DownstreamState::handleUDPTimeouts(int udpTimeout, const std::function<void(IDState&, DOHUnit*)>& timedOut)
+{
+  const size_t statesCount = idStates.size();
+  if (statesCount == 0) {
+    return;
+  }
+
+  /* The states are assigned in a round-robin fashion based on idOffset, so the ones
+     assigned before the oldest of the last udpTimeout + 3 scans have been looked at enough times
+     to have been either answered or timed out already, and we only need to look at the ones
+     assigned since. The extra scan covers a state whose offset has been taken by a client thread
+     but which has not been marked as used yet when we first look at it.
+     Until we have enough history, if the whole table has been used since then, and every
+     s_udpTimeoutsFullScanInterval scans as a safety net, we scan all of them. */
+  const uint64_t currentOffset = idOffset.load();
+  const size_t historySize = static_cast<size_t>(std::max(udpTimeout, 0)) + 3;
+  uint64_t firstOffset = 0;
+  size_t toScan = statesCount;
+  const bool fullScan = (udpTimeoutScans++ % s_udpTimeoutsFullScanInterval) == 0;
+  if (!fullScan && idOffsetHistory.size() >= historySize && (currentOffset - idOffsetHistory.front()) < statesCount) {
+    firstOffset = idOffsetHistory.front();
+    toScan = currentOffset - firstOffset;
+  }
+  idOffsetHistory.push_back(currentOffset);
+  while (idOffsetHistory.size() > historySize) {
+    idOffsetHistory.pop_front();
+  }
+
+  for (size_t idx = 0; idx < toScan; idx++) {
+    checkIDStateTimeout(*this, idStates[(firstOffset + idx) % statesCount], udpTimeout, timedOut);
+  }
+
+  /* A responder thread resets the age of a state while it processes the response, so a state that
+     did not match the response might have been reset after its last scan. Keep looking at these
+     until they are released, even if they are not in the recent window anymore. */
+  std::set<uint16_t> toRecheck;
+  {
+    std::lock_guard<std::mutex> lock(idStatesToRecheckLock);
+    toRecheck.swap(idStatesToRecheck);
+  }
+
+  const size_t firstPosition = firstOffset % statesCount;
+  for (auto it = toRecheck.begin(); it != toRecheck.end(); ) {
+    if (*it >= statesCount) {
+      it = toRecheck.erase(it);
+      continue;
+    }
+
+    auto& ids = idStates[*it];
+    const bool scanned = ((*it + statesCount - firstPosition) % statesCount) < toScan;
+    const bool inUse = scanned ? ids.isInUse() : checkIDStateTimeout(*this, ids, udpTimeout, timedOut);
+    if (inUse) {
+      ++it;
+    }
+    else {
+      it = toRecheck.erase(it);
+    }
+  }
+
+  if (!toRecheck.empty()) {
+    std::lock_guard<std::mutex> lock(idStatesToRecheckLock);
+    idStatesToRecheck.insert(toRecheck.begin(), toRecheck.end());
+  }
+}
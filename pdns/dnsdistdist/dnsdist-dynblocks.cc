@@ -7,6 +7,12 @@ void DynBlockRulesGroup::apply(const struct timespec& now)
   counts_t counts;
   StatNode statNodeRoot;
 
+#ifdef HAVE_EBPF
+  if (d_dynBPFFilter) {
+    d_dynBPFFilter->purgeExpired(now);
+  }
+#endif /* HAVE_EBPF */
+
   size_t entriesCount = 0;
   if (hasQueryRules()) {
     entriesCount += g_rings.getNumberOfQueryEntries();
@@ -210,6 +216,17 @@ void DynBlockRulesGroup::addOrRefreshBlock(boost::optional<NetmaskTree<DynBlock>
   }
   blocks->insert(Netmask(requestor)).second = db;
   updated = true;
+
+#ifdef HAVE_EBPF
+  if (d_dynBPFFilter && !warning && (db.action == DNSAction::Action::Drop || (db.action == DNSAction::Action::None && g_dynBlockAction == DNSAction::Action::Drop))) {
+    try {
+      d_dynBPFFilter->block(requestor, until);
+    }
+    catch (const std::exception& e) {
+      vinfolog("Unable to insert eBPF dynamic block for %s: %s", requestor.toString(), e.what());
+    }
+  }
+#endif /* HAVE_EBPF */
 }
 
 void DynBlockRulesGroup::addOrRefreshBlockSMT(SuffixMatchTree<DynBlock>& blocks, const struct timespec& now, const DNSName& name, const DynBlockRule& rule, bool& updated)
@@ -77,105 +77,305 @@ void updateHealthCheckResult(const std::shared_ptr<DownstreamState>& dss, bool n
   }
 }
 
-static bool handleResponse(std::shared_ptr<HealthCheckData>& data)
+enum class HealthCheckOutcome : uint8_t { Success, Failure, Ignored };
+
+static HealthCheckOutcome checkResponse(const std::shared_ptr<HealthCheckData>& data, const std::string& reply)
 {
   auto& ds = data->d_ds;
-  try {
-    string reply;
-    ComboAddress from;
-    data->d_sock.recvFrom(reply, from);
+  const dnsheader * responseHeader = reinterpret_cast<const dnsheader *>(reply.c_str());
 
-    /* we are using a connected socket but hey.. */
-    if (from != ds->remote) {
-      if (g_verboseHealthChecks) {
-        infolog("Invalid health check response received from %s, expecting one from %s", from.toStringWithPort(), ds->remote.toStringWithPort());
-      }
-      return false;
+  if (reply.size() < sizeof(*responseHeader)) {
+    if (g_verboseHealthChecks) {
+      infolog("Invalid health check response of size %d from backend %s, expecting at least %d", reply.size(), ds->getNameWithAddr(), sizeof(*responseHeader));
     }
+    return HealthCheckOutcome::Failure;
+  }
 
-    const dnsheader * responseHeader = reinterpret_cast<const dnsheader *>(reply.c_str());
-
-    if (reply.size() < sizeof(*responseHeader)) {
+  if (responseHeader->id != data->d_queryID) {
+    if (data->d_tcpConnection) {
+      /* the TCP connection is dropped after a failed check, so this can't be an answer to a previous one */
       if (g_verboseHealthChecks) {
-        infolog("Invalid health check response of size %d from backend %s, expecting at least %d", reply.size(), ds->getNameWithAddr(), sizeof(*responseHeader));
+        infolog("Invalid health check response id %d from backend %s over TCP, expecting %d", responseHeader->id, ds->getNameWithAddr(), data->d_queryID);
       }
-      return false;
+      return HealthCheckOutcome::Failure;
     }
+    /* the socket might be reused between checks, so this could be a late answer to
+       a previous check. Keep waiting for the right one until the timeout. */
+    if (g_verboseHealthChecks) {
+      infolog("Ignoring health check response id %d from backend %s, expecting %d", responseHeader->id, ds->getNameWithAddr(), data->d_queryID);
+    }
+    return HealthCheckOutcome::Ignored;
+  }
 
-    if (responseHeader->id != data->d_queryID) {
-      if (g_verboseHealthChecks) {
-        infolog("Invalid health check response id %d from backend %s, expecting %d", data->d_queryID, ds->getNameWithAddr(), data->d_queryID);
-      }
-      return false;
+  if (!responseHeader->qr) {
+    if (g_verboseHealthChecks) {
+      infolog("Invalid health check response from backend %s, expecting QR to be set", ds->getNameWithAddr());
     }
+    return HealthCheckOutcome::Failure;
+  }
 
-    if (!responseHeader->qr) {
-      if (g_verboseHealthChecks) {
-        infolog("Invalid health check response from backend %s, expecting QR to be set", ds->getNameWithAddr());
-      }
-      return false;
+  if (responseHeader->rcode == RCode::ServFail) {
+    if (g_verboseHealthChecks) {
+      infolog("Backend %s responded to health check with ServFail", ds->getNameWithAddr());
     }
+    return HealthCheckOutcome::Failure;
+  }
 
-    if (responseHeader->rcode == RCode::ServFail) {
-      if (g_verboseHealthChecks) {
-        infolog("Backend %s responded to health check with ServFail", ds->getNameWithAddr());
-      }
-      return false;
+  if (ds->mustResolve && (responseHeader->rcode == RCode::NXDomain || responseHeader->rcode == RCode::Refused)) {
+    if (g_verboseHealthChecks) {
+      infolog("Backend %s responded to health check with %s while mustResolve is set", ds->getNameWithAddr(), responseHeader->rcode == RCode::NXDomain ? "NXDomain" : "Refused");
     }
+    return HealthCheckOutcome::Failure;
+  }
 
-    if (ds->mustResolve && (responseHeader->rcode == RCode::NXDomain || responseHeader->rcode == RCode::Refused)) {
-      if (g_verboseHealthChecks) {
-        infolog("Backend %s responded to health check with %s while mustResolve is set", ds->getNameWithAddr(), responseHeader->rcode == RCode::NXDomain ? "NXDomain" : "Refused");
-      }
-      return false;
+  uint16_t receivedType;
+  uint16_t receivedClass;
+  DNSName receivedName(reply.c_str(), reply.size(), sizeof(dnsheader), false, &receivedType, &receivedClass);
+
+  if (receivedName != data->d_checkName || receivedType != data->d_checkType || receivedClass != data->d_checkClass) {
+    if (g_verboseHealthChecks) {
+      infolog("Backend %s responded to health check with an invalid qname (%s vs %s), qtype (%s vs %s) or qclass (%d vs %d)", ds->getNameWithAddr(), receivedName.toLogString(), data->d_checkName.toLogString(), QType(receivedType).getName(), QType(data->d_checkType).getName(), receivedClass, data->d_checkClass);
     }
+    return HealthCheckOutcome::Failure;
+  }
+
+  return HealthCheckOutcome::Success;
+}
 
-    uint16_t receivedType;
-    uint16_t receivedClass;
-    DNSName receivedName(reply.c_str(), reply.size(), sizeof(dnsheader), false, &receivedType, &receivedClass);
+static HealthCheckOutcome handleResponse(std::shared_ptr<HealthCheckData>& data)
+{
+  auto& ds = data->d_ds;
+  try {
+    string reply;
+    ComboAddress from;
+    data->d_sock->recvFrom(reply, from);
 
-    if (receivedName != data->d_checkName || receivedType != data->d_checkType || receivedClass != data->d_checkClass) {
+    /* we are using a connected socket but hey.. */
+    if (from != ds->remote) {
       if (g_verboseHealthChecks) {
-        infolog("Backend %s responded to health check with an invalid qname (%s vs %s), qtype (%s vs %s) or qclass (%d vs %d)", ds->getNameWithAddr(), receivedName.toLogString(), data->d_checkName.toLogString(), QType(receivedType).getName(), QType(data->d_checkType).getName(), receivedClass, data->d_checkClass);
+        infolog("Invalid health check response received from %s, expecting one from %s", from.toStringWithPort(), ds->remote.toStringWithPort());
       }
-      return false;
+      return HealthCheckOutcome::Failure;
     }
+
+    return checkResponse(data, reply);
   }
   catch(const std::exception& e)
   {
     if (g_verboseHealthChecks) {
       infolog("Error checking the health of backend %s: %s", ds->getNameWithAddr(), e.what());
     }
-    return false;
+    return HealthCheckOutcome::Failure;
   }
   catch(...)
   {
     if (g_verboseHealthChecks) {
       infolog("Unknown exception while checking the health of backend %s", ds->getNameWithAddr());
     }
-    return false;
+    return HealthCheckOutcome::Failure;
   }
+}
 
-  return true;
+static void updateCheckLatency(const std::shared_ptr<HealthCheckData>& data, const struct timeval& now)
+{
+  auto diff = now - data->d_sent;
+  data->d_ds->updateCheckLatency(diff.tv_sec * 1000000 + diff.tv_usec);
+}
+
+static void unregisterHealthCheck(const std::shared_ptr<HealthCheckData>& data, int fd)
+{
+  if (data->d_ioState == IOState::NeedWrite) {
+    data->d_mplexer->removeWriteFD(fd);
+  }
+  else if (data->d_ioState == IOState::NeedRead) {
+    data->d_mplexer->removeReadFD(fd);
+  }
+  data->d_ioState = IOState::Done;
+}
+
+static void completeHealthCheck(const std::shared_ptr<HealthCheckData>& data, bool success, const struct timeval& now)
+{
+  if (success) {
+    updateCheckLatency(data, now);
+  }
+  else if (data->d_tcpConnection && data->d_backend) {
+    /* we don't know in which state the connection is, open a new one for the next check */
+    data->d_backend->d_tcpConnection.reset();
+  }
+
+  if (data->d_initial) {
+    warnlog("Marking downstream %s as '%s'", data->d_ds->getNameWithAddr(), success ? "up" : "down");
+    data->d_ds->upStatus = success;
+  }
+  else {
+    updateHealthCheckResult(data->d_ds, success);
+  }
+
+  if (data->d_scheduler != nullptr) {
+    data->d_scheduler->checkCompleted(data->d_backend, success, now);
+  }
 }
 
 static void healthCheckCallback(int fd, FDMultiplexer::funcparam_t& param)
 {
   auto data = boost::any_cast<std::shared_ptr<HealthCheckData>>(param);
-  data->d_mplexer->removeReadFD(fd);
-  updateHealthCheckResult(data->d_ds, handleResponse(data));
+  auto outcome = handleResponse(data);
+  if (outcome == HealthCheckOutcome::Ignored) {
+    return;
+  }
+
+  unregisterHealthCheck(data, fd);
+
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  completeHealthCheck(data, outcome == HealthCheckOutcome::Success, now);
+}
+
+static void healthCheckTCPCallback(int fd, FDMultiplexer::funcparam_t& param);
+
+static void handleTCPHealthCheckIO(const std::shared_ptr<HealthCheckData>& data)
+{
+  auto& handler = *data->d_tcpConnection->d_handler;
+  const int fd = data->d_tcpConnection->d_sock->getHandle();
+  IOState ioState = IOState::Done;
+
+  try {
+    if (data->d_tcpState == HealthCheckData::TCPState::WritingQuery) {
+      ioState = handler.tryWrite(data->d_buffer, data->d_bufferPos, data->d_buffer.size());
+      if (ioState == IOState::Done) {
+        data->d_tcpConnection->d_fresh = false;
+        data->d_tcpState = HealthCheckData::TCPState::ReadingResponseSize;
+        data->d_buffer.resize(sizeof(uint16_t));
+        data->d_bufferPos = 0;
+      }
+    }
+
+    if (data->d_tcpState == HealthCheckData::TCPState::ReadingResponseSize) {
+      ioState = handler.tryRead(data->d_buffer, data->d_bufferPos, data->d_buffer.size());
+      if (ioState == IOState::Done) {
+        uint16_t responseSize = data->d_buffer.at(0) * 256 + data->d_buffer.at(1);
+        if (responseSize < sizeof(dnsheader)) {
+          throw std::runtime_error("invalid response size " + std::to_string(responseSize));
+        }
+        data->d_tcpState = HealthCheckData::TCPState::ReadingResponse;
+        data->d_buffer.resize(responseSize);
+        data->d_bufferPos = 0;
+      }
+    }
+
+    if (data->d_tcpState == HealthCheckData::TCPState::ReadingResponse) {
+      ioState = handler.tryRead(data->d_buffer, data->d_bufferPos, data->d_buffer.size());
+      if (ioState == IOState::Done) {
+        unregisterHealthCheck(data, fd);
+        auto outcome = checkResponse(data, std::string(data->d_buffer.begin(), data->d_buffer.end()));
+        struct timeval now;
+        gettimeofday(&now, nullptr);
+        completeHealthCheck(data, outcome == HealthCheckOutcome::Success, now);
+        return;
+      }
+    }
+  }
+  catch(const std::exception& e)
+  {
+    if (g_verboseHealthChecks) {
+      infolog("Error checking the health of backend %s over TCP: %s", data->d_ds->getNameWithAddr(), e.what());
+    }
+    unregisterHealthCheck(data, fd);
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    completeHealthCheck(data, false, now);
+    return;
+  }
+
+  if (ioState != data->d_ioState) {
+    unregisterHealthCheck(data, fd);
+    if (ioState == IOState::NeedRead) {
+      data->d_mplexer->addReadFD(fd, &healthCheckTCPCallback, data, &data->d_ttd);
+    }
+    else {
+      data->d_mplexer->addWriteFD(fd, &healthCheckTCPCallback, data, &data->d_ttd);
+    }
+    data->d_ioState = ioState;
+  }
 }
 
-static void initialHealthCheckCallback(int fd, FDMultiplexer::funcparam_t& param)
+static void healthCheckTCPCallback(int fd, FDMultiplexer::funcparam_t& param)
 {
   auto data = boost::any_cast<std::shared_ptr<HealthCheckData>>(param);
-  data->d_mplexer->removeReadFD(fd);
-  bool up = handleResponse(data);
-  warnlog("Marking downstream %s as '%s'", data->d_ds->getNameWithAddr(), up ? "up" : "down");
-  data->d_ds->upStatus = up;
+  handleTCPHealthCheckIO(data);
 }
 
-bool queueHealthCheck(std::shared_ptr<FDMultiplexer>& mplexer, const std::shared_ptr<DownstreamState>& ds, bool initialCheck)
+HealthCheckTCPConnection::HealthCheckTCPConnection(const std::shared_ptr<DownstreamState>& ds, const struct timeval& now)
+{
+  d_sock = std::unique_ptr<Socket>(new Socket(ds->remote.sin4.sin_family, SOCK_STREAM, 0));
+  if (!IsAnyAddress(ds->sourceAddr)) {
+    d_sock->setReuseAddr();
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    if (ds->ipBindAddrNoPort) {
+      SSetsockopt(d_sock->getHandle(), SOL_IP, IP_BIND_ADDRESS_NO_PORT, 1);
+    }
+#endif
+#ifdef SO_BINDTODEVICE
+    if (!ds->sourceItfName.empty()) {
+      int res = setsockopt(d_sock->getHandle(), SOL_SOCKET, SO_BINDTODEVICE, ds->sourceItfName.c_str(), ds->sourceItfName.length());
+      if (res != 0 && g_verboseHealthChecks) {
+        infolog("Error setting SO_BINDTODEVICE on the TCP health check socket for backend '%s': %s", ds->getNameWithAddr(), stringerror());
+      }
+    }
+#endif
+    d_sock->bind(ds->sourceAddr, false);
+  }
+  d_sock->setNonBlocking();
+  SConnectWithTimeout(d_sock->getHandle(), ds->remote, /* no timeout, the multiplexer will handle it */ 0);
+  d_handler = std::unique_ptr<TCPIOHandler>(new TCPIOHandler(d_sock->getHandle(), 0, nullptr, now.tv_sec));
+}
+
+static std::shared_ptr<Socket> createHealthCheckSocket(const std::shared_ptr<DownstreamState>& ds)
+{
+  auto sock = std::make_shared<Socket>(ds->remote.sin4.sin_family, SOCK_DGRAM);
+  sock->setNonBlocking();
+  if (!IsAnyAddress(ds->sourceAddr)) {
+    sock->setReuseAddr();
+    if (!ds->sourceItfName.empty()) {
+#ifdef SO_BINDTODEVICE
+      int res = setsockopt(sock->getHandle(), SOL_SOCKET, SO_BINDTODEVICE, ds->sourceItfName.c_str(), ds->sourceItfName.length());
+      if (res != 0 && g_verboseHealthChecks) {
+        infolog("Error setting SO_BINDTODEVICE on the health check socket for backend '%s': %s", ds->getNameWithAddr(), stringerror());
+      }
+#endif
+    }
+    sock->bind(ds->sourceAddr);
+  }
+  sock->connect(ds->remote);
+  return sock;
+}
+
+/* discard any late answer to a previous check still waiting in a reused socket */
+static void drainHealthCheckSocket(Socket& sock)
+{
+  char buffer[512];
+  while (recv(sock.getHandle(), buffer, sizeof(buffer), 0) >= 0) {
+  }
+}
+
+static std::shared_ptr<HealthCheckTCPConnection> getHealthCheckTCPConnection(const std::shared_ptr<DownstreamState>& ds, const std::shared_ptr<HealthCheckBackend>& backend, const struct timeval& now)
+{
+  if (backend && backend->d_tcpConnection) {
+    if (isTCPSocketUsable(backend->d_tcpConnection->d_sock->getHandle())) {
+      return backend->d_tcpConnection;
+    }
+    /* closed by the backend since the last check */
+    backend->d_tcpConnection.reset();
+  }
+
+  auto conn = std::make_shared<HealthCheckTCPConnection>(ds, now);
+  if (backend) {
+    backend->d_tcpConnection = conn;
+  }
+  return conn;
+}
+
+static bool queueHealthCheck(std::shared_ptr<FDMultiplexer>& mplexer, const std::shared_ptr<DownstreamState>& ds, HealthCheckScheduler* scheduler, const std::shared_ptr<HealthCheckBackend>& backend, bool initialCheck)
 {
   try
   {
@@ -207,44 +407,80 @@ bool queueHealthCheck(std::shared_ptr<FDMultiplexer>& mplexer, const std::shared
     dnsheader * requestHeader = dpw.getHeader();
     *requestHeader = checkHeader;
 
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    struct timeval ttd = now;
+    ttd.tv_sec += ds->checkTimeout / 1000; /* ms to seconds */
+    ttd.tv_usec += (ds->checkTimeout % 1000) * 1000; /* remaining ms to us */
+    if (ttd.tv_usec > 1000000) {
+      ++ttd.tv_sec;
+      ttd.tv_usec -= 1000000;
+    }
+
+    if (ds->checkTCP) {
+      auto conn = getHealthCheckTCPConnection(ds, backend, now);
+      auto data = std::make_shared<HealthCheckData>(mplexer, ds, nullptr, std::move(checkName), checkType, checkClass, queryID);
+      data->d_scheduler = scheduler;
+      data->d_backend = backend;
+      data->d_initial = initialCheck;
+      data->d_tcpConnection = conn;
+      data->d_sent = now;
+      data->d_ttd = ttd;
+
+      /* the proxy protocol header is only sent once, at the beginning of the connection */
+      if (conn->d_fresh && ds->useProxyProtocol) {
+        auto payload = makeLocalProxyHeader();
+        data->d_buffer.insert(data->d_buffer.end(), payload.begin(), payload.end());
+      }
+      const uint16_t packetSize = packet.size();
+      data->d_buffer.reserve(data->d_buffer.size() + sizeof(packetSize) + packet.size());
+      data->d_buffer.push_back(packetSize / 256);
+      data->d_buffer.push_back(packetSize % 256);
+      data->d_buffer.insert(data->d_buffer.end(), packet.begin(), packet.end());
+
+      handleTCPHealthCheckIO(data);
+      return true;
+    }
+
     if (ds->useProxyProtocol) {
       auto payload = makeLocalProxyHeader();
       packet.insert(packet.begin(), payload.begin(), payload.end());
     }
 
-    Socket sock(ds->remote.sin4.sin_family, SOCK_DGRAM);
-    sock.setNonBlocking();
-    if (!IsAnyAddress(ds->sourceAddr)) {
-      sock.setReuseAddr();
-      if (!ds->sourceItfName.empty()) {
-#ifdef SO_BINDTODEVICE
-        int res = setsockopt(sock.getHandle(), SOL_SOCKET, SO_BINDTODEVICE, ds->sourceItfName.c_str(), ds->sourceItfName.length());
-        if (res != 0 && g_verboseHealthChecks) {
-          infolog("Error setting SO_BINDTODEVICE on the health check socket for backend '%s': %s", ds->getNameWithAddr(), stringerror());
-        }
-#endif
+    std::shared_ptr<Socket> sock;
+    if (backend) {
+      if (!backend->d_sock) {
+        backend->d_sock = createHealthCheckSocket(ds);
       }
-      sock.bind(ds->sourceAddr);
+      else {
+        drainHealthCheckSocket(*backend->d_sock);
+      }
+      sock = backend->d_sock;
+    }
+    else {
+      sock = createHealthCheckSocket(ds);
     }
-    sock.connect(ds->remote);
-    ssize_t sent = udpClientSendRequestToBackend(ds, sock.getHandle(), reinterpret_cast<char*>(&packet[0]), packet.size(), true);
+
+    ssize_t sent = udpClientSendRequestToBackend(ds, sock->getHandle(), reinterpret_cast<char*>(&packet[0]), packet.size(), true);
     if (sent < 0) {
       int ret = errno;
       if (g_verboseHealthChecks)
         infolog("Error while sending a health check query to backend %s: %d", ds->getNameWithAddr(), ret);
+      if (backend) {
+        /* start over with a new socket next time */
+        backend->d_sock.reset();
+      }
       return false;
     }
 
-    auto data = std::make_shared<HealthCheckData>(mplexer, ds, std::move(sock), std::move(checkName), checkType, checkClass, queryID);
-    struct timeval ttd;
-    gettimeofday(&ttd, nullptr);
-    ttd.tv_sec += ds->checkTimeout / 1000; /* ms to seconds */
-    ttd.tv_usec += (ds->checkTimeout % 1000) * 1000; /* remaining ms to us */
-    if (ttd.tv_usec > 1000000) {
-      ++ttd.tv_sec;
-      ttd.tv_usec -= 1000000;
-    }
-    mplexer->addReadFD(data->d_sock.getHandle(), initialCheck ? &initialHealthCheckCallback : &healthCheckCallback, data, &ttd);
+    auto data = std::make_shared<HealthCheckData>(mplexer, ds, sock, std::move(checkName), checkType, checkClass, queryID);
+    data->d_scheduler = scheduler;
+    data->d_backend = backend;
+    data->d_initial = initialCheck;
+    data->d_sent = now;
+    data->d_ttd = ttd;
+    data->d_ioState = IOState::NeedRead;
+    mplexer->addReadFD(data->d_sock->getHandle(), &healthCheckCallback, data, &data->d_ttd);
 
     return true;
   }
@@ -264,9 +500,30 @@ bool queueHealthCheck(std::shared_ptr<FDMultiplexer>& mplexer, const std::shared
   }
 }
 
-void handleQueuedHealthChecks(std::shared_ptr<FDMultiplexer>& mplexer, bool initial)
+bool queueHealthCheck(std::shared_ptr<FDMultiplexer>& mplexer, const std::shared_ptr<DownstreamState>& ds, bool initialCheck)
+{
+  return queueHealthCheck(mplexer, ds, nullptr, nullptr, initialCheck);
+}
+
+static void handleHealthCheckTimeouts(std::shared_ptr<FDMultiplexer>& mplexer, const struct timeval& now)
+{
+  /* TCP checks might still be waiting to be able to send the query */
+  for (const bool writes : { false, true }) {
+    auto timeouts = mplexer->getTimeouts(now, writes);
+    for (const auto& timeout : timeouts) {
+      auto data = boost::any_cast<std::shared_ptr<HealthCheckData>>(timeout.second);
+      unregisterHealthCheck(data, timeout.first);
+      if (g_verboseHealthChecks) {
+        infolog("Timeout while waiting for the health check response from backend %s", data->d_ds->getNameWithAddr());
+      }
+      completeHealthCheck(data, false, now);
+    }
+  }
+}
+
+void handleQueuedHealthChecks(std::shared_ptr<FDMultiplexer>& mplexer)
 {
-  while (mplexer->getWatchedFDCount(false) > 0) {
+  while (mplexer->getWatchedFDCount(false) > 0 || mplexer->getWatchedFDCount(true) > 0) {
     struct timeval now;
     int ret = mplexer->run(&now, 100);
     if (ret == -1) {
@@ -275,20 +532,141 @@ void handleQueuedHealthChecks(std::shared_ptr<FDMultiplexer>& mplexer, bool init
       }
       break;
     }
-    auto timeouts = mplexer->getTimeouts(now);
-    for (const auto& timeout : timeouts) {
-      mplexer->removeReadFD(timeout.first);
-      auto data = boost::any_cast<std::shared_ptr<HealthCheckData>>(timeout.second);
-      if (g_verboseHealthChecks) {
-        infolog("Timeout while waiting for the health check response from backend %s", data->d_ds->getNameWithAddr());
+    handleHealthCheckTimeouts(mplexer, now);
+  }
+}
+
+static unsigned int getBaseCheckInterval(const DownstreamState& ds)
+{
+  return ds.checkInterval > 0 ? ds.checkInterval : 1;
+}
+
+HealthCheckScheduler::HealthCheckScheduler(): d_mplexer(std::shared_ptr<FDMultiplexer>(FDMultiplexer::getMultiplexerSilent()))
+{
+}
+
+void HealthCheckScheduler::schedule(const std::shared_ptr<HealthCheckBackend>& backend)
+{
+  d_schedule.push({backend->d_nextCheck, backend});
+}
+
+void HealthCheckScheduler::refreshBackends(const struct timeval& now)
+{
+  auto states = g_dstates.getLocal();
+  std::map<const DownstreamState*, std::shared_ptr<HealthCheckBackend>> backends;
+
+  for (const auto& ds : *states) {
+    auto it = d_backends.find(ds.get());
+    if (it != d_backends.end()) {
+      auto& backend = it->second;
+      struct timeval latest = now;
+      latest.tv_sec += backend->d_interval;
+      if (!backend->d_inFlight && latest < backend->d_nextCheck) {
+        /* the clock went backward, don't wait for it */
+        backend->d_nextCheck = now;
+        schedule(backend);
+      }
+      backends.insert(*it);
+      d_backends.erase(it);
+      continue;
+    }
+
+    auto backend = std::make_shared<HealthCheckBackend>(ds);
+    backend->d_interval = getBaseCheckInterval(*ds);
+    /* spread the checks of the new backends over their interval to avoid sending them all at once */
+    unsigned int offsetMs = random() % (backend->d_interval * 1000);
+    struct timeval offset{static_cast<time_t>(offsetMs / 1000), static_cast<suseconds_t>((offsetMs % 1000) * 1000)};
+    backend->d_nextCheck = now + offset;
+    schedule(backend);
+    backends.insert({ds.get(), backend});
+  }
+
+  /* the remaining ones have been removed, the pending checks will be discarded */
+  for (auto& entry : d_backends) {
+    entry.second->d_removed = true;
+  }
+
+  d_backends = std::move(backends);
+}
+
+void HealthCheckScheduler::checkCompleted(const std::shared_ptr<HealthCheckBackend>& backend, bool success, const struct timeval& now)
+{
+  backend->d_inFlight = false;
+  if (backend->d_removed) {
+    return;
+  }
+
+  const auto& ds = backend->d_ds;
+  const auto baseInterval = getBaseCheckInterval(*ds);
+  if (success && ds->upStatus && ds->maxCheckInterval > baseInterval) {
+    /* the backend is up and healthy, back off */
+    backend->d_interval = std::min(backend->d_interval * 2, ds->maxCheckInterval);
+  }
+  else {
+    backend->d_interval = baseInterval;
+  }
+
+  /* d_nextCheck holds the time the check was sent, keeping the schedule stable regardless of the latency */
+  backend->d_nextCheck.tv_sec += backend->d_interval;
+  if (backend->d_nextCheck < now) {
+    backend->d_nextCheck = now;
+  }
+  schedule(backend);
+}
+
+void HealthCheckScheduler::handleTimeouts(const struct timeval& now)
+{
+  handleHealthCheckTimeouts(d_mplexer, now);
+}
+
+void HealthCheckScheduler::run(const struct timeval& until)
+{
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  refreshBackends(now);
+
+  while (now < until) {
+    while (!d_schedule.empty() && !(now < d_schedule.top().d_when)) {
+      const auto when = d_schedule.top().d_when;
+      auto backend = d_schedule.top().d_backend;
+      d_schedule.pop();
+
+      if (backend->d_removed || backend->d_inFlight || when.tv_sec != backend->d_nextCheck.tv_sec || when.tv_usec != backend->d_nextCheck.tv_usec) {
+        /* removed backend, or outdated entry */
+        continue;
       }
-      if (initial) {
-        warnlog("Marking downstream %s as 'down'", data->d_ds->getNameWithAddr());
-        data->d_ds->upStatus = false;
+
+      const auto& ds = backend->d_ds;
+      backend->d_nextCheck = now;
+
+      if (ds->availability != DownstreamState::Availability::Auto) {
+        /* no check needed, but we might be switched back to auto later */
+        checkCompleted(backend, false, now);
+        continue;
       }
-      else {
-        updateHealthCheckResult(data->d_ds, false);
+
+      backend->d_inFlight = true;
+      if (!queueHealthCheck(d_mplexer, ds, this, backend, false)) {
+        updateHealthCheckResult(ds, false);
+        checkCompleted(backend, false, now);
+      }
+    }
+
+    /* wake up for the next scheduled check, or every 100 ms to look for timeouts */
+    struct timeval next = until;
+    if (!d_schedule.empty() && d_schedule.top().d_when < next) {
+      next = d_schedule.top().d_when;
+    }
+    auto wait = next - now;
+    int timeout = std::min(static_cast<int>(wait.tv_sec * 1000 + (wait.tv_usec + 999) / 1000), 100);
+
+    int ret = d_mplexer->run(&now, timeout);
+    if (ret == -1) {
+      if (g_verboseHealthChecks) {
+        infolog("Error while waiting for the health check response from backends: %d", ret);
       }
     }
+
+    handleTimeouts(now);
   }
 }
@@ -21,28 +21,116 @@
  */
 #pragma once
 
+#include <queue>
+
 #include "dnsdist.hh"
 #include "mplexer.hh"
 #include "sstuff.hh"
 
+struct HealthCheckBackend;
+class HealthCheckScheduler;
+
+/* A TCP connection to a backend, kept open by the HealthCheckScheduler between two checks */
+struct HealthCheckTCPConnection
+{
+  HealthCheckTCPConnection(const std::shared_ptr<DownstreamState>& ds, const struct timeval& now);
+
+  /* the socket has to outlive the handler, which shuts the connection down when destroyed */
+  std::unique_ptr<Socket> d_sock{nullptr};
+  std::unique_ptr<TCPIOHandler> d_handler{nullptr};
+  /* no query has been sent over this connection yet, so the proxy protocol header is still needed */
+  bool d_fresh{true};
+};
+
 struct HealthCheckData
 {
-  HealthCheckData(std::shared_ptr<FDMultiplexer>& mplexer, const std::shared_ptr<DownstreamState>& ds, Socket&& sock, DNSName&& checkName, uint16_t checkType, uint16_t checkClass, uint16_t queryID): d_mplexer(mplexer), d_ds(ds), d_sock(std::move(sock)), d_checkName(std::move(checkName)), d_checkType(checkType), d_checkClass(checkClass), d_queryID(queryID)
+  enum class TCPState : uint8_t { WritingQuery, ReadingResponseSize, ReadingResponse };
+
+  HealthCheckData(std::shared_ptr<FDMultiplexer>& mplexer, const std::shared_ptr<DownstreamState>& ds, const std::shared_ptr<Socket>& sock, DNSName&& checkName, uint16_t checkType, uint16_t checkClass, uint16_t queryID): d_mplexer(mplexer), d_ds(ds), d_sock(sock), d_checkName(std::move(checkName)), d_checkType(checkType), d_checkClass(checkClass), d_queryID(queryID)
   {
   }
 
   std::shared_ptr<FDMultiplexer> d_mplexer;
   const std::shared_ptr<DownstreamState> d_ds;
-  Socket d_sock;
+  /* set when the check has been queued by the HealthCheckScheduler */
+  HealthCheckScheduler* d_scheduler{nullptr};
+  std::shared_ptr<HealthCheckBackend> d_backend{nullptr};
+  /* UDP socket, unset for TCP checks */
+  std::shared_ptr<Socket> d_sock;
+  /* TCP connection, unset for UDP checks */
+  std::shared_ptr<HealthCheckTCPConnection> d_tcpConnection{nullptr};
+  std::vector<uint8_t> d_buffer;
   DNSName d_checkName;
+  struct timeval d_sent;
+  struct timeval d_ttd;
+  size_t d_bufferPos{0};
   uint16_t d_checkType;
   uint16_t d_checkClass;
   uint16_t d_queryID;
+  TCPState d_tcpState{TCPState::WritingQuery};
+  /* the IO state the TCP connection is currently registered for in the multiplexer */
+  IOState d_ioState{IOState::Done};
+  /* initial check done before the health checks thread starts: no rise / maxCheckFailures thresholds */
+  bool d_initial{false};
+};
+
+/* The scheduling state of a backend, kept by the HealthCheckScheduler between two checks */
+struct HealthCheckBackend
+{
+  HealthCheckBackend(const std::shared_ptr<DownstreamState>& ds): d_ds(ds), d_interval(ds->checkInterval)
+  {
+  }
+
+  const std::shared_ptr<DownstreamState> d_ds;
+  /* the UDP socket, or the TCP connection when checkTCP is set, is kept open and reused for all the checks of this backend */
+  std::shared_ptr<Socket> d_sock{nullptr};
+  std::shared_ptr<HealthCheckTCPConnection> d_tcpConnection{nullptr};
+  struct timeval d_nextCheck{0, 0};
+  /* current interval between two checks, in seconds, between checkInterval and maxCheckInterval */
+  unsigned int d_interval;
+  bool d_inFlight{false};
+  /* the backend is not in the list of servers anymore */
+  bool d_removed{false};
+};
+
+/* Persistent health checks scheduler: instead of checking all backends at the same time every
+   second, each backend is checked on its own schedule, the initial check being randomly spread over
+   the check interval. The multiplexer, UDP sockets and TCP connections are kept between checks, and
+   there is at most one check in flight for a given backend. */
+class HealthCheckScheduler
+{
+public:
+  HealthCheckScheduler();
+
+  /* send the checks that are due and process the responses and timeouts until 'until' */
+  void run(const struct timeval& until);
+
+  /* called by the responses and timeout handlers, to reschedule the next check */
+  void checkCompleted(const std::shared_ptr<HealthCheckBackend>& backend, bool success, const struct timeval& now);
+
+private:
+  struct ScheduledCheck
+  {
+    bool operator>(const ScheduledCheck& rhs) const
+    {
+      return rhs.d_when < d_when;
+    }
+
+    struct timeval d_when;
+    std::shared_ptr<HealthCheckBackend> d_backend;
+  };
+
+  void refreshBackends(const struct timeval& now);
+  void schedule(const std::shared_ptr<HealthCheckBackend>& backend);
+  void handleTimeouts(const struct timeval& now);
+
+  std::shared_ptr<FDMultiplexer> d_mplexer;
+  std::map<const DownstreamState*, std::shared_ptr<HealthCheckBackend>> d_backends;
+  std::priority_queue<ScheduledCheck, std::vector<ScheduledCheck>, std::greater<ScheduledCheck>> d_schedule;
 };
 
 extern bool g_verboseHealthChecks;
 
 void updateHealthCheckResult(const std::shared_ptr<DownstreamState>& dss, bool newState);
 bool queueHealthCheck(std::shared_ptr<FDMultiplexer>& mplexer, const std::shared_ptr<DownstreamState>& ds, bool initial=false);
-void handleQueuedHealthChecks(std::shared_ptr<FDMultiplexer>& mplexer, bool initial=false);
-
+void handleQueuedHealthChecks(std::shared_ptr<FDMultiplexer>& mplexer);
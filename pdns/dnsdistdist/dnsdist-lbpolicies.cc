@@ -42,7 +42,7 @@ shared_ptr<DownstreamState> leastOutstanding(const ServerPolicy::NumberedServerV
   size_t position = 0;
   for(const auto& d : servers) {
     if(d.second->isUp()) {
-      poss.emplace_back(make_tuple(d.second->outstanding.load(), d.second->order, d.second->latencyUsec), position);
+      poss.emplace_back(make_tuple(d.second->outstanding.load(), d.second->order, d.second->latencyUsec.load()), position);
     }
     ++position;
   }
@@ -55,6 +55,67 @@ shared_ptr<DownstreamState> leastOutstanding(const ServerPolicy::NumberedServerV
   return servers.at(poss.begin()->second).second;
 }
 
+static double getLatencyAwareCost(const DownstreamState& ds, double latency)
+{
+  return latency * (ds.outstanding.load() + 1) / ds.weight;
+}
+
+static const shared_ptr<DownstreamState>& getLatencyAwareBest(const shared_ptr<DownstreamState>& first, const shared_ptr<DownstreamState>& second)
+{
+  double firstLatency = first->latencyUsec.load();
+  double secondLatency = second->latencyUsec.load();
+  /* a server that has not answered a query yet has no latency, compare the outstanding queries only */
+  if (firstLatency == 0.0 || secondLatency == 0.0) {
+    firstLatency = secondLatency = 1.0;
+  }
+
+  return getLatencyAwareCost(*second, secondLatency) < getLatencyAwareCost(*first, firstLatency) ? second : first;
+}
+
+// pick two servers at random and use the one with the lowest latency times outstanding queries, divided by its weight
+shared_ptr<DownstreamState> latencyAware(const ServerPolicy::NumberedServerVector& servers, const DNSQuestion* dq)
+{
+  const size_t count = servers.size();
+  if (count == 0) {
+    return shared_ptr<DownstreamState>();
+  }
+
+  if (count == 1) {
+    return servers[0].second->isUp() ? servers[0].second : shared_ptr<DownstreamState>();
+  }
+
+  for (size_t attempt = 0; attempt < 3; attempt++) {
+    /* derive two distinct positions from one random value */
+    const size_t value = random();
+    const size_t first = value % count;
+    const size_t second = (first + 1 + (value / count) % (count - 1)) % count;
+    const auto& firstServer = servers[first].second;
+    const auto& secondServer = servers[second].second;
+    const bool firstUp = firstServer->isUp();
+    const bool secondUp = secondServer->isUp();
+
+    if (firstUp && secondUp) {
+      return getLatencyAwareBest(firstServer, secondServer);
+    }
+    if (firstUp) {
+      return firstServer;
+    }
+    if (secondUp) {
+      return secondServer;
+    }
+  }
+
+  /* most servers seem to be down, look at all of them */
+  const shared_ptr<DownstreamState>* best = nullptr;
+  for (const auto& d : servers) {
+    if (d.second->isUp()) {
+      best = best == nullptr ? &d.second : &getLatencyAwareBest(*best, d.second);
+    }
+  }
+
+  return best != nullptr ? *best : shared_ptr<DownstreamState>();
+}
+
 shared_ptr<DownstreamState> firstAvailable(const ServerPolicy::NumberedServerVector& servers, const DNSQuestion* dq)
 {
   for(auto& d : servers) {
@@ -0,0 +1,588 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <set>
+
+#include <boost/algorithm/string.hpp>
+
+#include "dnsdist.hh"
+#include "dnsdist-metrics.hh"
+#include "dolog.hh"
+
+const std::map<std::string, MetricDefinition> MetricDefinitionStorage::metrics{
+  { "responses",              MetricDefinition(PrometheusMetricType::counter, "Number of responses received from backends") },
+  { "servfail-responses",     MetricDefinition(PrometheusMetricType::counter, "Number of SERVFAIL answers received from backends") },
+  { "queries",                MetricDefinition(PrometheusMetricType::counter, "Number of received queries")},
+  { "frontend-nxdomain",      MetricDefinition(PrometheusMetricType::counter, "Number of NXDomain answers sent to clients")},
+  { "frontend-servfail",      MetricDefinition(PrometheusMetricType::counter, "Number of SERVFAIL answers sent to clients")},
+  { "frontend-noerror",       MetricDefinition(PrometheusMetricType::counter, "Number of NoError answers sent to clients")},
+  { "acl-drops",              MetricDefinition(PrometheusMetricType::counter, "Number of packets dropped because of the ACL")},
+  { "rule-drop",              MetricDefinition(PrometheusMetricType::counter, "Number of queries dropped because of a rule")},
+  { "rule-nxdomain",          MetricDefinition(PrometheusMetricType::counter, "Number of NXDomain answers returned because of a rule")},
+  { "rule-refused",           MetricDefinition(PrometheusMetricType::counter, "Number of Refused answers returned because of a rule")},
+  { "rule-servfail",          MetricDefinition(PrometheusMetricType::counter, "Number of SERVFAIL answers received because of a rule")},
+  { "self-answered",          MetricDefinition(PrometheusMetricType::counter, "Number of self-answered responses")},
+  { "downstream-timeouts",    MetricDefinition(PrometheusMetricType::counter, "Number of queries not answered in time by a backend")},
+  { "downstream-send-errors", MetricDefinition(PrometheusMetricType::counter, "Number of errors when sending a query to a backend")},
+  { "trunc-failures",         MetricDefinition(PrometheusMetricType::counter, "Number of errors encountered while truncating an answer")},
+  { "no-policy",              MetricDefinition(PrometheusMetricType::counter, "Number of queries dropped because no server was available")},
+  { "latency0-1",             MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in less than 1ms")},
+  { "latency1-10",            MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in 1-10 ms")},
+  { "latency10-50",           MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in 10-50 ms")},
+  { "latency50-100",          MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in 50-100 ms")},
+  { "latency100-1000",        MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in 100-1000 ms")},
+  { "latency-slow",           MetricDefinition(PrometheusMetricType::counter, "Number of queries answered in more than 1 second")},
+  { "latency-avg100",         MetricDefinition(PrometheusMetricType::gauge,   "Average response latency in microseconds of the last 100 packets")},
+  { "latency-avg1000",        MetricDefinition(PrometheusMetricType::gauge,   "Average response latency in microseconds of the last 1000 packets")},
+  { "latency-avg10000",       MetricDefinition(PrometheusMetricType::gauge,   "Average response latency in microseconds of the last 10000 packets")},
+  { "latency-avg1000000",     MetricDefinition(PrometheusMetricType::gauge,   "Average response latency in microseconds of the last 1000000 packets")},
+  { "uptime",                 MetricDefinition(PrometheusMetricType::gauge,   "Uptime of the dnsdist process in seconds")},
+  { "real-memory-usage",      MetricDefinition(PrometheusMetricType::gauge,   "Current memory usage in bytes")},
+  { "noncompliant-queries",   MetricDefinition(PrometheusMetricType::counter, "Number of queries dropped as non-compliant")},
+  { "noncompliant-responses", MetricDefinition(PrometheusMetricType::counter, "Number of answers from a backend dropped as non-compliant")},
+  { "rdqueries",              MetricDefinition(PrometheusMetricType::counter, "Number of received queries with the recursion desired bit set")},
+  { "empty-queries",          MetricDefinition(PrometheusMetricType::counter, "Number of empty queries received from clients")},
+  { "cache-hits",             MetricDefinition(PrometheusMetricType::counter, "Number of times an answer was retrieved from cache")},
+  { "cache-misses",           MetricDefinition(PrometheusMetricType::counter, "Number of times an answer not found in the cache")},
+  { "cpu-iowait",             MetricDefinition(PrometheusMetricType::counter, "Time waiting for I/O to complete by the whole system, in units of USER_HZ")},
+  { "cpu-user-msec",          MetricDefinition(PrometheusMetricType::counter, "Milliseconds spent by dnsdist in the user state")},
+  { "cpu-steal",              MetricDefinition(PrometheusMetricType::counter, "Stolen time, which is the time spent by the whole system in other operating systems when running in a virtualized environment, in units of USER_HZ")},
+  { "cpu-sys-msec",           MetricDefinition(PrometheusMetricType::counter, "Milliseconds spent by dnsdist in the system state")},
+  { "fd-usage",               MetricDefinition(PrometheusMetricType::gauge,   "Number of currently used file descriptors")},
+  { "dyn-blocked",            MetricDefinition(PrometheusMetricType::counter, "Number of queries dropped because of a dynamic block")},
+  { "dyn-block-nmg-size",     MetricDefinition(PrometheusMetricType::gauge,   "Number of dynamic blocks entries") },
+  { "security-status",        MetricDefinition(PrometheusMetricType::gauge,   "Security status of this software. 0=unknown, 1=OK, 2=upgrade recommended, 3=upgrade mandatory") },
+  { "udp-in-errors",          MetricDefinition(PrometheusMetricType::counter, "From /proc/net/snmp InErrors") },
+  { "udp-noport-errors",      MetricDefinition(PrometheusMetricType::counter, "From /proc/net/snmp NoPorts") },
+  { "udp-recvbuf-errors",     MetricDefinition(PrometheusMetricType::counter, "From /proc/net/snmp RcvbufErrors") },
+  { "udp-sndbuf-errors",      MetricDefinition(PrometheusMetricType::counter, "From /proc/net/snmp SndbufErrors") },
+  { "dnscrypt-shared-key-cache-hits",   MetricDefinition(PrometheusMetricType::counter, "Number of DNSCrypt shared keys retrieved from the per-thread cache") },
+  { "dnscrypt-shared-key-cache-misses", MetricDefinition(PrometheusMetricType::counter, "Number of DNSCrypt shared keys not found in the per-thread cache") },
+};
+
+static const MetricDefinitionStorage s_metricDefinitions;
+
+static const TLSErrorCounters* getTLSErrorCounters(const ClientState& front)
+{
+  if (front.tlsFrontend != nullptr) {
+    return &front.tlsFrontend->d_tlsCounters;
+  }
+  else if (front.dohFrontend != nullptr) {
+    return &front.dohFrontend->d_tlsCounters;
+  }
+  return nullptr;
+}
+
+static bool isTCPFrontend(ClientState& front)
+{
+  return front.isTCP();
+}
+
+static bool isTLSFrontend(ClientState& front)
+{
+  return front.isTCP() && front.hasTLS();
+}
+
+static bool hasTLSErrorCounters(ClientState& front)
+{
+  return getTLSErrorCounters(front) != nullptr;
+}
+
+static bool isTLSFrontendWithErrorCounters(ClientState& front)
+{
+  return isTLSFrontend(front) && hasTLSErrorCounters(front);
+}
+
+static bool hasPacketCache(ServerPool& pool)
+{
+  return pool.packetCache != nullptr;
+}
+
+/* the names exported to carbon do not always match the Prometheus ones, including a few
+   typos that we can't fix without breaking existing dashboards */
+static const std::vector<MetricDescriptor<DownstreamState>> s_backendMetrics{
+  { "dnsdist_server_status", nullptr, nullptr, PrometheusMetricType::gauge, "Whether this backend is up (1) or down (0)", [](DownstreamState& ds) { return ds.isUp() ? 1 : 0; }, nullptr, nullptr },
+  { "dnsdist_server_queries", nullptr, "queries", PrometheusMetricType::counter, "Amount of queries relayed to server", [](DownstreamState& ds) { return ds.queries.load(); }, nullptr, nullptr },
+  { "dnsdist_server_responses", nullptr, "responses", PrometheusMetricType::counter, "Amount of responses received from this server", [](DownstreamState& ds) { return ds.responses.load(); }, nullptr, nullptr },
+  { "dnsdist_server_drops", nullptr, "drops", PrometheusMetricType::counter, "Amount of queries not answered by server", [](DownstreamState& ds) { return ds.reuseds.load(); }, nullptr, nullptr },
+  { "dnsdist_server_latency", nullptr, nullptr, PrometheusMetricType::gauge, "Server's latency when answering questions in milliseconds", [](DownstreamState& ds) { return ds.latencyUsec / 1000.0; }, nullptr, nullptr },
+  { nullptr, nullptr, "latency", PrometheusMetricType::gauge, nullptr, [](DownstreamState& ds) { return ds.availability != DownstreamState::Availability::Down ? ds.latencyUsec / 1000.0 : 0; }, nullptr, nullptr },
+  { "dnsdist_server_senderrors", nullptr, "senderrors", PrometheusMetricType::counter, "Total number of OS send errors while relaying queries", [](DownstreamState& ds) { return ds.sendErrors.load(); }, nullptr, nullptr },
+  { "dnsdist_server_outstanding", nullptr, "outstanding", PrometheusMetricType::gauge, "Current number of queries that are waiting for a backend response", [](DownstreamState& ds) { return ds.outstanding.load(); }, nullptr, nullptr },
+  { "dnsdist_server_order", nullptr, nullptr, PrometheusMetricType::gauge, "The order in which this server is picked", [](DownstreamState& ds) { return ds.order; }, nullptr, nullptr },
+  { "dnsdist_server_weight", nullptr, nullptr, PrometheusMetricType::gauge, "The weight within the order in which this server is picked", [](DownstreamState& ds) { return ds.weight; }, nullptr, nullptr },
+  { "dnsdist_server_tcpdiedsendingquery", nullptr, "tcpdiedsendingquery", PrometheusMetricType::counter, "The number of TCP I/O errors while sending the query", [](DownstreamState& ds) { return ds.tcpDiedSendingQuery.load(); }, nullptr, nullptr },
+  { "dnsdist_server_tcpdiedreadingresponse", nullptr, "tcpdiedreaddingresponse", PrometheusMetricType::counter, "The number of TCP I/O errors while reading the response", [](DownstreamState& ds) { return ds.tcpDiedReadingResponse.load(); }, nullptr, nullptr },
+  { "dnsdist_server_tcpgaveup", nullptr, "tcpgaveup", PrometheusMetricType::counter, "The number of TCP connections failing after too many attempts", [](DownstreamState& ds) { return ds.tcpGaveUp.load(); }, nullptr, nullptr },
+  { "dnsdist_server_tcpreadtimeouts", nullptr, "tcpreadimeouts", PrometheusMetricType::counter, "The number of TCP read timeouts", [](DownstreamState& ds) { return ds.tcpReadTimeouts.load(); }, nullptr, nullptr },
+  { "dnsdist_server_tcpwritetimeouts", nullptr, "tcpwritetimeouts", PrometheusMetricType::counter, "The number of TCP write timeouts", [](DownstreamState& ds) { return ds.tcpWriteTimeouts.load(); }, nullptr, nullptr },
+  { "dnsdist_server_tcpcurrentconnections", nullptr, "tcpcurrentconnections", PrometheusMetricType::gauge, "The number of current TCP connections", [](DownstreamState& ds) { return ds.tcpCurrentConnections.load(); }, nullptr, nullptr },
+  { "dnsdist_server_tcpavgqueriesperconn", nullptr, "tcpavgqueriesperconnection", PrometheusMetricType::gauge, "The average number of queries per TCP connection", [](DownstreamState& ds) { return ds.tcpAvgQueriesPerConnection.load(); }, nullptr, nullptr },
+  { "dnsdist_server_tcpavgconnduration", nullptr, "tcpavgconnectionduration", PrometheusMetricType::gauge, "The average duration of a TCP connection (ms)", [](DownstreamState& ds) { return ds.tcpAvgConnectionDuration.load(); }, nullptr, nullptr },
+};
+
+static const std::vector<MetricDescriptor<ClientState>> s_frontendMetrics{
+  { "dnsdist_frontend_queries", nullptr, "queries", PrometheusMetricType::counter, "Amount of queries received by this frontend", [](ClientState& front) { return front.queries.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_responses", nullptr, "responses", PrometheusMetricType::counter, "Amount of responses sent by this frontend", [](ClientState& front) { return front.responses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_tcpdiedreadingquery", nullptr, "tcpdiedreadingquery", PrometheusMetricType::counter, "Amount of TCP connections terminated while reading the query from the client", [](ClientState& front) { return front.tcpDiedReadingQuery.load(); }, isTCPFrontend, nullptr },
+  { "dnsdist_frontend_tcpdiedsendingresponse", nullptr, "tcpdiedsendingresponse", PrometheusMetricType::counter, "Amount of TCP connections terminated while sending a response to the client", [](ClientState& front) { return front.tcpDiedSendingResponse.load(); }, isTCPFrontend, nullptr },
+  { "dnsdist_frontend_tcpgaveup", nullptr, "tcpgaveup", PrometheusMetricType::counter, "Amount of TCP connections terminated after too many attempts to get a connection to the backend", [](ClientState& front) { return front.tcpGaveUp.load(); }, isTCPFrontend, nullptr },
+  { "dnsdist_frontend_tcpclientimeouts", nullptr, "tcpclientimeouts", PrometheusMetricType::counter, "Amount of TCP connections terminated by a timeout while reading from the client", [](ClientState& front) { return front.tcpClientTimeouts.load(); }, isTCPFrontend, nullptr },
+  { "dnsdist_frontend_tcpdownstreamtimeouts", nullptr, "tcpdownstreamtimeouts", PrometheusMetricType::counter, "Amount of TCP connections terminated by a timeout while reading from the backend", [](ClientState& front) { return front.tcpDownstreamTimeouts.load(); }, isTCPFrontend, nullptr },
+  { "dnsdist_frontend_tcpcurrentconnections", nullptr, "tcpcurrentconnections", PrometheusMetricType::gauge, "Amount of current incoming TCP connections from clients", [](ClientState& front) { return front.tcpCurrentConnections.load(); }, isTCPFrontend, nullptr },
+  { "dnsdist_frontend_tcpavgqueriesperconnection", nullptr, "tcpavgqueriesperconnection", PrometheusMetricType::gauge, "The average number of queries per TCP connection", [](ClientState& front) { return front.tcpAvgQueriesPerConnection.load(); }, isTCPFrontend, nullptr },
+  { "dnsdist_frontend_tcpavgconnectionduration", nullptr, "tcpavgconnectionduration", PrometheusMetricType::gauge, "The average duration of a TCP connection (ms)", [](ClientState& front) { return front.tcpAvgConnectionDuration.load(); }, isTCPFrontend, nullptr },
+  { "dnsdist_frontend_tcppipelinedqueries", nullptr, "tcppipelinedqueries", PrometheusMetricType::counter, "Amount of queries read from a TCP connection while other queries from that connection were still being processed", [](ClientState& front) { return front.tcpPipelinedQueries.load(); }, isTCPFrontend, nullptr },
+  { "dnsdist_frontend_tcpinflightlimitreached", nullptr, "tcpinflightlimitreached", PrometheusMetricType::counter, "Amount of times a TCP connection reached the maximum number of queries in flight", [](ClientState& front) { return front.tcpInFlightLimitReached.load(); }, isTCPFrontend, nullptr },
+  { "dnsdist_frontend_tlsqueries", "tls=\"tls10\"", "tls10-queries", PrometheusMetricType::counter, "Number of queries received by dnsdist over TLS, by TLS version", [](ClientState& front) { return front.tls10queries.load(); }, isTLSFrontend, nullptr },
+  { "dnsdist_frontend_tlsqueries", "tls=\"tls11\"", "tls11-queries", PrometheusMetricType::counter, "Number of queries received by dnsdist over TLS, by TLS version", [](ClientState& front) { return front.tls11queries.load(); }, isTLSFrontend, nullptr },
+  { "dnsdist_frontend_tlsqueries", "tls=\"tls12\"", "tls12-queries", PrometheusMetricType::counter, "Number of queries received by dnsdist over TLS, by TLS version", [](ClientState& front) { return front.tls12queries.load(); }, isTLSFrontend, nullptr },
+  { "dnsdist_frontend_tlsqueries", "tls=\"tls13\"", "tls13-queries", PrometheusMetricType::counter, "Number of queries received by dnsdist over TLS, by TLS version", [](ClientState& front) { return front.tls13queries.load(); }, isTLSFrontend, nullptr },
+  { "dnsdist_frontend_tlsqueries", "tls=\"unknown\"", "tls-unknown-queries", PrometheusMetricType::counter, "Number of queries received by dnsdist over TLS, by TLS version", [](ClientState& front) { return front.tlsUnknownqueries.load(); }, isTLSFrontend, nullptr },
+  { "dnsdist_frontend_tlsnewsessions", nullptr, "tlsnewsessions", PrometheusMetricType::counter, "Amount of new TLS sessions negotiated", [](ClientState& front) { return front.tlsNewSessions.load(); }, isTLSFrontend, nullptr },
+  { "dnsdist_frontend_tlsresumptions", nullptr, "tlsresumptions", PrometheusMetricType::counter, "Amount of TLS sessions resumed", [](ClientState& front) { return front.tlsResumptions.load(); }, isTLSFrontend, nullptr },
+  { "dnsdist_frontend_tlsunknownticketkeys", nullptr, "tlsunknownticketkeys", PrometheusMetricType::counter, "Amount of attempts to resume TLS session from an unknown key (possibly expired)", [](ClientState& front) { return front.tlsUnknownTicketKey.load(); }, isTLSFrontend, nullptr },
+  { "dnsdist_frontend_tlsinactiveticketkeys", nullptr, "tlsinactiveticketkeys", PrometheusMetricType::counter, "Amount of TLS sessions resumed from an inactive key", [](ClientState& front) { return front.tlsInactiveTicketKey.load(); }, isTLSFrontend, nullptr },
+  { "dnsdist_frontend_tlsktlssessions", nullptr, "tlsktlssessions", PrometheusMetricType::counter, "Amount of TLS sessions whose record layer has been offloaded to the kernel (kTLS)", [](ClientState& front) { return front.tlsKTLSSessions.load(); }, isTLSFrontend, nullptr },
+  { "dnsdist_frontend_tlshandshakefailures", "error=\"dhKeyTooSmall\"", "tlsdhkeytoosmall", PrometheusMetricType::counter, "Amount of TLS handshake failures", [](ClientState& front) { return getTLSErrorCounters(front)->d_dhKeyTooSmall.load(); }, isTLSFrontendWithErrorCounters, hasTLSErrorCounters },
+  { "dnsdist_frontend_tlshandshakefailures", "error=\"inappropriateFallBack\"", "tlsinappropriatefallback", PrometheusMetricType::counter, "Amount of TLS handshake failures", [](ClientState& front) { return getTLSErrorCounters(front)->d_inappropriateFallBack.load(); }, isTLSFrontendWithErrorCounters, hasTLSErrorCounters },
+  { "dnsdist_frontend_tlshandshakefailures", "error=\"noSharedCipher\"", "tlsnosharedcipher", PrometheusMetricType::counter, "Amount of TLS handshake failures", [](ClientState& front) { return getTLSErrorCounters(front)->d_noSharedCipher.load(); }, isTLSFrontendWithErrorCounters, hasTLSErrorCounters },
+  { "dnsdist_frontend_tlshandshakefailures", "error=\"unknownCipherType\"", "tlsunknownciphertype", PrometheusMetricType::counter, "Amount of TLS handshake failures", [](ClientState& front) { return getTLSErrorCounters(front)->d_unknownCipherType.load(); }, isTLSFrontendWithErrorCounters, hasTLSErrorCounters },
+  { "dnsdist_frontend_tlshandshakefailures", "error=\"unknownKeyExchangeType\"", "tlsunknownkeyexchangetype", PrometheusMetricType::counter, "Amount of TLS handshake failures", [](ClientState& front) { return getTLSErrorCounters(front)->d_unknownKeyExchangeType.load(); }, isTLSFrontendWithErrorCounters, hasTLSErrorCounters },
+  { "dnsdist_frontend_tlshandshakefailures", "error=\"unknownProtocol\"", "tlsunknownprotocol", PrometheusMetricType::counter, "Amount of TLS handshake failures", [](ClientState& front) { return getTLSErrorCounters(front)->d_unknownProtocol.load(); }, isTLSFrontendWithErrorCounters, hasTLSErrorCounters },
+  { "dnsdist_frontend_tlshandshakefailures", "error=\"unsupportedEC\"", "tlsunsupportedec", PrometheusMetricType::counter, "Amount of TLS handshake failures", [](ClientState& front) { return getTLSErrorCounters(front)->d_unsupportedEC.load(); }, isTLSFrontendWithErrorCounters, hasTLSErrorCounters },
+  { "dnsdist_frontend_tlshandshakefailures", "error=\"unsupportedProtocol\"", "tlsunsupportedprotocol", PrometheusMetricType::counter, "Amount of TLS handshake failures", [](ClientState& front) { return getTLSErrorCounters(front)->d_unsupportedProtocol.load(); }, isTLSFrontendWithErrorCounters, hasTLSErrorCounters },
+};
+
+static const std::vector<MetricDescriptor<DOHFrontend>> s_dohFrontendMetrics{
+  { "dnsdist_frontend_http_connects", nullptr, "http-connects", PrometheusMetricType::counter, "Number of DoH TCP connections established to this frontend", [](DOHFrontend& doh) { return doh.d_httpconnects.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_http_method_queries", "method=\"get\"", "get-queries", PrometheusMetricType::counter, "Number of DoH queries received by dnsdist, by HTTP method", [](DOHFrontend& doh) { return doh.d_getqueries.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_http_method_queries", "method=\"post\"", "post-queries", PrometheusMetricType::counter, "Number of DoH queries received by dnsdist, by HTTP method", [](DOHFrontend& doh) { return doh.d_postqueries.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_http_version_queries", "version=\"1\"", "http1-queries", PrometheusMetricType::counter, "Number of DoH queries received by dnsdist, by HTTP version", [](DOHFrontend& doh) { return doh.d_http1Stats.d_nbQueries.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_http_version_queries", "version=\"2\"", "http2-queries", PrometheusMetricType::counter, "Number of DoH queries received by dnsdist, by HTTP version", [](DOHFrontend& doh) { return doh.d_http2Stats.d_nbQueries.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_bad_requests", nullptr, "bad-requests", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_badrequests.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_responses", "type=\"error\"", "error-responses", PrometheusMetricType::counter, "Number of responses sent, by type", [](DOHFrontend& doh) { return doh.d_errorresponses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_responses", "type=\"redirect\"", "redirect-responses", PrometheusMetricType::counter, "Number of responses sent, by type", [](DOHFrontend& doh) { return doh.d_redirectresponses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_responses", "type=\"valid\"", "valid-responses", PrometheusMetricType::counter, "Number of responses sent, by type", [](DOHFrontend& doh) { return doh.d_validresponses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"1\",status=\"200\"", "http1-200-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http1Stats.d_nb200Responses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"1\",status=\"400\"", "http1-400-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http1Stats.d_nb400Responses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"1\",status=\"403\"", "http1-403-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http1Stats.d_nb403Responses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"1\",status=\"500\"", "http1-500-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http1Stats.d_nb500Responses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"1\",status=\"502\"", "http1-502-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http1Stats.d_nb502Responses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"1\",status=\"other\"", "http1-other-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http1Stats.d_nbOtherResponses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"2\",status=\"200\"", "http2-200-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http2Stats.d_nb200Responses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"2\",status=\"400\"", "http2-400-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http2Stats.d_nb400Responses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"2\",status=\"403\"", "http2-403-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http2Stats.d_nb403Responses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"2\",status=\"500\"", "http2-500-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http2Stats.d_nb500Responses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"2\",status=\"502\"", "http2-502-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http2Stats.d_nb502Responses.load(); }, nullptr, nullptr },
+  { "dnsdist_frontend_doh_version_status_responses", "httpversion=\"2\",status=\"other\"", "http2-other-responses", PrometheusMetricType::counter, "Number of requests that could not be converted to a DNS query", [](DOHFrontend& doh) { return doh.d_http2Stats.d_nbOtherResponses.load(); }, nullptr, nullptr },
+};
+
+static const std::vector<MetricDescriptor<ServerPool>> s_poolMetrics{
+  { "dnsdist_pool_servers", nullptr, "servers", PrometheusMetricType::gauge, "Number of servers in that pool", [](ServerPool& pool) { return pool.countServers(false); }, nullptr, nullptr },
+  { "dnsdist_pool_active_servers", nullptr, "servers-up", PrometheusMetricType::gauge, "Number of available servers in that pool", [](ServerPool& pool) { return pool.countServers(true); }, nullptr, nullptr },
+  { "dnsdist_pool_cache_size", nullptr, "cache-size", PrometheusMetricType::gauge, "Maximum number of entries that this cache can hold", [](ServerPool& pool) { return pool.packetCache->getMaxEntries(); }, hasPacketCache, hasPacketCache },
+  { "dnsdist_pool_cache_entries", nullptr, "cache-entries", PrometheusMetricType::gauge, "Number of entries currently present in that cache", [](ServerPool& pool) { return pool.packetCache->getEntriesCount(); }, hasPacketCache, hasPacketCache },
+  { "dnsdist_pool_cache_hits", nullptr, "cache-hits", PrometheusMetricType::counter, "Number of hits from that cache", [](ServerPool& pool) { return pool.packetCache->getHits(); }, hasPacketCache, hasPacketCache },
+  { "dnsdist_pool_cache_misses", nullptr, "cache-misses", PrometheusMetricType::counter, "Number of misses from that cache", [](ServerPool& pool) { return pool.packetCache->getMisses(); }, hasPacketCache, hasPacketCache },
+  { "dnsdist_pool_cache_deferred_inserts", nullptr, "cache-deferred-inserts", PrometheusMetricType::counter, "Number of insertions into that cache skipped because it was already locked", [](ServerPool& pool) { return pool.packetCache->getDeferredInserts(); }, hasPacketCache, hasPacketCache },
+  { "dnsdist_pool_cache_deferred_lookups", nullptr, "cache-deferred-lookups", PrometheusMetricType::counter, "Number of lookups into that cache skipped because it was already locked", [](ServerPool& pool) { return pool.packetCache->getDeferredLookups(); }, hasPacketCache, hasPacketCache },
+  { "dnsdist_pool_cache_lookup_collisions", nullptr, "cache-lookup-collisions", PrometheusMetricType::counter, "Number of lookups into that cache that triggered a collision (same hash but different entry)", [](ServerPool& pool) { return pool.packetCache->getLookupCollisions(); }, hasPacketCache, hasPacketCache },
+  { "dnsdist_pool_cache_insert_collisions", nullptr, "cache-insert-collisions", PrometheusMetricType::counter, "Number of insertions into that cache that triggered a collision (same hash but different entry)", [](ServerPool& pool) { return pool.packetCache->getInsertCollisions(); }, hasPacketCache, hasPacketCache },
+  { "dnsdist_pool_cache_ttl_too_shorts", nullptr, "cache-ttl-too-shorts", PrometheusMetricType::counter, "Number of insertions into that cache skipped because the TTL of the answer was not long enough", [](ServerPool& pool) { return pool.packetCache->getTTLTooShorts(); }, hasPacketCache, hasPacketCache },
+};
+
+template <class T>
+static std::string renderPrometheusHeaders(const std::vector<MetricDescriptor<T>>& descriptors)
+{
+  std::string result;
+  std::set<std::string> seen;
+  for (const auto& descriptor : descriptors) {
+    if (descriptor.prometheusName == nullptr || !seen.insert(descriptor.prometheusName).second) {
+      continue;
+    }
+    const std::string name(descriptor.prometheusName);
+    result += "# HELP " + name + " " + descriptor.description + "\n";
+    result += "# TYPE " + name + " " + s_metricDefinitions.getPrometheusStringMetricType(descriptor.prometheusType) + "\n";
+  }
+  return result;
+}
+
+static MetricValue getGlobalStatValue(const std::pair<std::string, DNSDistStats::entry_t>& entry)
+{
+  if (const auto& val = boost::get<DNSDistStats::stat_t*>(&entry.second)) {
+    return (*val)->load();
+  }
+  else if (const auto& dval = boost::get<double*>(&entry.second)) {
+    return **dval;
+  }
+  return (*boost::get<DNSDistStats::statfunction_t>(&entry.second))(entry.first);
+}
+
+MetricsExporter::MetricsExporter(): d_backendsHeader(renderPrometheusHeaders(s_backendMetrics)), d_frontendsHeader(renderPrometheusHeaders(s_frontendMetrics)), d_dohFrontendsHeader(renderPrometheusHeaders(s_dohFrontendMetrics)), d_poolsHeader(renderPrometheusHeaders(s_poolMetrics)), d_prometheus(true)
+{
+}
+
+MetricsExporter::MetricsExporter(const std::string& carbonPrefix, const std::string& carbonHostname): d_carbonPrefix(carbonPrefix), d_carbonHostname(carbonHostname), d_prometheus(false)
+{
+}
+
+template <class T>
+void MetricsExporter::renderObject(RenderedObject<T>& object, const std::vector<MetricDescriptor<T>>& descriptors, const std::string& carbonBase, const std::string& prometheusLabels) const
+{
+  object.d_metrics.clear();
+  for (const auto& descriptor : descriptors) {
+    if (d_prometheus && descriptor.prometheusName != nullptr) {
+      std::string name(descriptor.prometheusName);
+      name += "{" + prometheusLabels;
+      if (descriptor.prometheusLabel != nullptr) {
+        name += ",";
+        name += descriptor.prometheusLabel;
+      }
+      name += "} ";
+      object.d_metrics.push_back({&descriptor, std::move(name)});
+    }
+    else if (!d_prometheus && descriptor.carbonName != nullptr) {
+      object.d_metrics.push_back({&descriptor, carbonBase + descriptor.carbonName + " "});
+    }
+  }
+}
+
+template <class T>
+void MetricsExporter::dumpObject(MetricsWriter& writer, const RenderedObject<T>& object, T& target) const
+{
+  for (const auto& metric : object.d_metrics) {
+    const auto& isExported = d_prometheus ? metric.first->isExportedToPrometheus : metric.first->isExportedToCarbon;
+    if (isExported && !isExported(target)) {
+      continue;
+    }
+    writer.add(metric.second, metric.first->getValue(target));
+  }
+}
+
+void MetricsExporter::renderGlobalStats()
+{
+  static const std::set<std::string> metricBlacklist = { "latency-count", "latency-sum" };
+
+  d_globalStats.clear();
+  for (size_t idx = 0; idx < g_stats.entries.size(); idx++) {
+    const auto& metricName = g_stats.entries.at(idx).first;
+    if (!d_prometheus) {
+      d_globalStats.push_back({idx, d_carbonPrefix + metricName + " "});
+      continue;
+    }
+
+    if (metricName == "special-memory-usage") {
+      continue; // Too expensive for get-all
+    }
+    if (metricBlacklist.count(metricName) != 0) {
+      continue;
+    }
+
+    MetricDefinition metricDetails;
+    if (!s_metricDefinitions.getMetricDetails(metricName, metricDetails)) {
+      vinfolog("Do not have metric details for %s", metricName);
+      continue;
+    }
+
+    const std::string prometheusTypeName = s_metricDefinitions.getPrometheusStringMetricType(metricDetails.prometheusType);
+    if (prometheusTypeName.empty()) {
+      vinfolog("Unknown Prometheus type for %s", metricName);
+      continue;
+    }
+
+    // Prometheus suggest using '_' instead of '-'
+    const std::string prometheusMetricName = "dnsdist_" + boost::replace_all_copy(metricName, "-", "_");
+    // for these we have the help and types encoded in the sources
+    d_globalStats.push_back({idx, "# HELP " + prometheusMetricName + " " + metricDetails.description + "\n" +
+                                  "# TYPE " + prometheusMetricName + " " + prometheusTypeName + "\n" +
+                                  prometheusMetricName + " "});
+  }
+  d_globalStatsCount = g_stats.entries.size();
+}
+
+void MetricsExporter::dumpGlobalStats(MetricsWriter& writer)
+{
+  if (d_globalStatsCount != g_stats.entries.size()) {
+    renderGlobalStats();
+  }
+
+  for (const auto& stat : d_globalStats) {
+    writer.add(stat.second, getGlobalStatValue(g_stats.entries.at(stat.first)));
+  }
+
+  if (!d_prometheus) {
+    return;
+  }
+
+  // Latency histogram buckets
+  static const std::string header("# HELP dnsdist_latency Histogram of responses by latency\n# TYPE dnsdist_latency histogram\n");
+  static const std::vector<std::string> bucketNames{
+    "dnsdist_latency_bucket{le=\"1\"} ",
+    "dnsdist_latency_bucket{le=\"10\"} ",
+    "dnsdist_latency_bucket{le=\"50\"} ",
+    "dnsdist_latency_bucket{le=\"100\"} ",
+    "dnsdist_latency_bucket{le=\"1000\"} ",
+    "dnsdist_latency_bucket{le=\"+Inf\"} "
+  };
+  static const std::string sumName("dnsdist_latency_sum ");
+  static const std::string countName("dnsdist_latency_count ");
+  const std::vector<uint64_t> buckets{
+    g_stats.latency0_1.load(),
+    g_stats.latency1_10.load(),
+    g_stats.latency10_50.load(),
+    g_stats.latency50_100.load(),
+    g_stats.latency100_1000.load(),
+    g_stats.latencySlow.load()
+  };
+
+  writer.addRaw(header);
+  uint64_t latencyAmounts = 0;
+  for (size_t idx = 0; idx < buckets.size(); idx++) {
+    latencyAmounts += buckets.at(idx);
+    writer.add(bucketNames.at(idx), latencyAmounts);
+  }
+  writer.add(sumName, g_stats.latencySum.load());
+  writer.add(countName, getLatencyCount(std::string()));
+}
+
+void MetricsExporter::renderBackend(RenderedBackend& rendered, const std::shared_ptr<DownstreamState>& backend) const
+{
+  rendered.d_backend = backend;
+  rendered.d_name = backend->getName();
+
+  if (d_prometheus) {
+    std::string serverName = backend->getName().empty() ? backend->remote.toStringWithPort() : backend->getName();
+    boost::replace_all(serverName, ".", "_");
+    const std::string labels = "server=\"" + serverName + "\",address=\"" + backend->remote.toStringWithPort() + "\"";
+    renderObject(rendered, s_backendMetrics, std::string(), labels);
+
+    rendered.d_checkLatencyNames.clear();
+    for (const auto& bucket : { "1", "10", "50", "100", "1000", "+Inf" }) {
+      rendered.d_checkLatencyNames.push_back("dnsdist_server_healthcheck_latency_bucket{" + labels + ",le=\"" + bucket + "\"} ");
+    }
+    rendered.d_checkLatencyNames.push_back("dnsdist_server_healthcheck_latency_sum{" + labels + "} ");
+    rendered.d_checkLatencyNames.push_back("dnsdist_server_healthcheck_latency_count{" + labels + "} ");
+  }
+  else {
+    std::string serverName = backend->getName().empty() ? (backend->remote.toString() + ":" + std::to_string(backend->remote.getPort())) : backend->getName();
+    boost::replace_all(serverName, ".", "_");
+    renderObject(rendered, s_backendMetrics, d_carbonPrefix + "servers." + serverName + ".", std::string());
+  }
+}
+
+void MetricsExporter::dumpBackends(MetricsWriter& writer)
+{
+  auto states = g_dstates.getLocal();
+
+  if (d_prometheus) {
+    writer.addRaw(d_backendsHeader);
+  }
+
+  for (const auto& state : *states) {
+    auto& rendered = d_backends[state.get()];
+    /* an expired entry means that the backend has been removed and that a new one is using the same address */
+    if (rendered.d_backend.expired() || rendered.d_name != state->getName()) {
+      renderBackend(rendered, state);
+    }
+    rendered.d_generation = d_generation;
+    dumpObject(writer, rendered, *state);
+  }
+
+  if (d_prometheus) {
+    static const std::string checkLatencyHeader("# HELP dnsdist_server_healthcheck_latency Histogram of the successful health checks by latency, in milliseconds\n# TYPE dnsdist_server_healthcheck_latency histogram\n");
+    writer.addRaw(checkLatencyHeader);
+
+    for (const auto& state : *states) {
+      const auto& names = d_backends[state.get()].d_checkLatencyNames;
+      const auto& latency = state->checkLatency;
+      const std::vector<uint64_t> buckets{
+        latency.latency0_1.load(),
+        latency.latency1_10.load(),
+        latency.latency10_50.load(),
+        latency.latency50_100.load(),
+        latency.latency100_1000.load(),
+        latency.latencySlow.load()
+      };
+
+      uint64_t count = 0;
+      for (size_t idx = 0; idx < buckets.size(); idx++) {
+        count += buckets.at(idx);
+        writer.add(names.at(idx), count);
+      }
+      writer.add(names.at(buckets.size()), latency.latencySum.load());
+      writer.add(names.at(buckets.size() + 1), count);
+    }
+  }
+
+  for (auto it = d_backends.begin(); it != d_backends.end(); ) {
+    if (it->second.d_generation != d_generation) {
+      it = d_backends.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+void MetricsExporter::renderFrontends()
+{
+  d_frontends.clear();
+  d_dohFrontends.clear();
+
+  std::map<std::string, uint64_t> frontendDuplicates;
+  for (const auto& front : g_frontends) {
+    if (front->udpFD == -1 && front->tcpFD == -1) {
+      continue;
+    }
+
+    RenderedObject<ClientState> rendered;
+    if (d_prometheus) {
+      const std::string frontName = front->local.toString() + ":" + std::to_string(front->local.getPort());
+      const std::string proto = front->getType();
+      uint64_t threadNumber = 0;
+      auto dupPair = frontendDuplicates.insert({frontName + "_" + proto, 1});
+      if (!dupPair.second) {
+        threadNumber = dupPair.first->second;
+        ++(dupPair.first->second);
+      }
+      renderObject(rendered, s_frontendMetrics, std::string(), "frontend=\"" + frontName + "\",proto=\"" + proto + "\",thread=\"" + std::to_string(threadNumber) + "\"");
+    }
+    else {
+      std::string frontName = front->local.toString() + ":" + std::to_string(front->local.getPort()) + (front->udpFD >= 0 ? "_udp" : "_tcp");
+      boost::replace_all(frontName, ".", "_");
+      auto dupPair = frontendDuplicates.insert({frontName, 1});
+      if (!dupPair.second) {
+        frontName = frontName + "_" + std::to_string(dupPair.first->second);
+        ++(dupPair.first->second);
+      }
+      renderObject(rendered, s_frontendMetrics, d_carbonPrefix + "frontends." + frontName + ".", std::string());
+    }
+    d_frontends.push_back({front.get(), std::move(rendered)});
+  }
+
+#ifdef HAVE_DNS_OVER_HTTPS
+  std::map<std::string, uint64_t> dohFrontendDuplicates;
+  for (const auto& doh : g_dohlocals) {
+    RenderedObject<DOHFrontend> rendered;
+    if (d_prometheus) {
+      const std::string frontName = doh->d_local.toStringWithPort();
+      uint64_t threadNumber = 0;
+      auto dupPair = dohFrontendDuplicates.insert({frontName, 1});
+      if (!dupPair.second) {
+        threadNumber = dupPair.first->second;
+        ++(dupPair.first->second);
+      }
+      renderObject(rendered, s_dohFrontendMetrics, std::string(), "frontend=\"" + frontName + "\",thread=\"" + std::to_string(threadNumber) + "\"");
+    }
+    else {
+      std::string name = doh->d_local.toStringWithPort();
+      boost::replace_all(name, ".", "_");
+      boost::replace_all(name, ":", "_");
+      boost::replace_all(name, "[", "_");
+      boost::replace_all(name, "]", "_");
+      auto dupPair = dohFrontendDuplicates.insert({name, 1});
+      if (!dupPair.second) {
+        name = name + "_" + std::to_string(dupPair.first->second);
+        ++(dupPair.first->second);
+      }
+      /* this one has always ignored the namespace and instance settings */
+      renderObject(rendered, s_dohFrontendMetrics, "dnsdist." + d_carbonHostname + ".main.doh." + name + ".", std::string());
+    }
+    d_dohFrontends.push_back({doh.get(), std::move(rendered)});
+  }
+#endif /* HAVE_DNS_OVER_HTTPS */
+
+  d_frontendsCount = g_frontends.size();
+  d_dohFrontendsCount = g_dohlocals.size();
+  d_frontendsRendered = true;
+}
+
+void MetricsExporter::dumpFrontends(MetricsWriter& writer)
+{
+  if (!d_frontendsRendered || d_frontendsCount != g_frontends.size() || d_dohFrontendsCount != g_dohlocals.size()) {
+    renderFrontends();
+  }
+
+  if (d_prometheus) {
+    writer.addRaw(d_frontendsHeader);
+  }
+  for (const auto& front : d_frontends) {
+    dumpObject(writer, front.second, *front.first);
+  }
+
+  if (d_prometheus) {
+    writer.addRaw(d_dohFrontendsHeader);
+  }
+  for (const auto& doh : d_dohFrontends) {
+    dumpObject(writer, doh.second, *doh.first);
+  }
+}
+
+void MetricsExporter::dumpPools(MetricsWriter& writer)
+{
+  auto localPools = g_pools.getLocal();
+
+  if (d_prometheus) {
+    writer.addRaw(d_poolsHeader);
+  }
+
+  for (const auto& entry : *localPools) {
+    auto& rendered = d_pools[entry.first];
+    if (rendered.d_generation == 0) {
+      std::string poolName = entry.first;
+      if (d_prometheus) {
+        if (poolName.empty()) {
+          poolName = "_default_";
+        }
+        renderObject(rendered, s_poolMetrics, std::string(), "pool=\"" + poolName + "\"");
+      }
+      else {
+        boost::replace_all(poolName, ".", "_");
+        if (poolName.empty()) {
+          poolName = "_default_";
+        }
+        renderObject(rendered, s_poolMetrics, d_carbonPrefix + "pools." + poolName + ".", std::string());
+      }
+    }
+    rendered.d_generation = d_generation;
+    dumpObject(writer, rendered, *entry.second);
+  }
+
+  for (auto it = d_pools.begin(); it != d_pools.end(); ) {
+    if (it->second.d_generation != d_generation) {
+      it = d_pools.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+void MetricsExporter::dump(MetricsWriter& writer)
+{
+  ++d_generation;
+
+  dumpGlobalStats(writer);
+  dumpBackends(writer);
+  dumpFrontends(writer);
+  dumpPools(writer);
+}
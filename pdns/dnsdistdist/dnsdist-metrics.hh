@@ -0,0 +1,299 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "dnsdist-prometheus.hh"
+
+/* A counter split into several slots living in different cache lines. A given thread only ever
+   updates one of them, so that the counters incremented by every thread for every query do not
+   keep bouncing between CPUs, and reading the value sums all the slots. */
+class ShardedCounter
+{
+public:
+  ShardedCounter(uint64_t value = 0)
+  {
+    d_slots.at(0).d_value.store(value, std::memory_order_relaxed);
+  }
+
+  ShardedCounter(const ShardedCounter&) = delete;
+  ShardedCounter& operator=(const ShardedCounter&) = delete;
+
+  ShardedCounter& operator++()
+  {
+    getLocalSlot().fetch_add(1, std::memory_order_relaxed);
+    return *this;
+  }
+
+  void operator++(int)
+  {
+    getLocalSlot().fetch_add(1, std::memory_order_relaxed);
+  }
+
+  ShardedCounter& operator+=(uint64_t value)
+  {
+    getLocalSlot().fetch_add(value, std::memory_order_relaxed);
+    return *this;
+  }
+
+  /* not atomic with regard to concurrent increments, only meant for values set from a single place */
+  void store(uint64_t value)
+  {
+    for (size_t idx = 1; idx < d_slots.size(); idx++) {
+      d_slots.at(idx).d_value.store(0, std::memory_order_relaxed);
+    }
+    d_slots.at(0).d_value.store(value, std::memory_order_relaxed);
+  }
+
+  ShardedCounter& operator=(uint64_t value)
+  {
+    store(value);
+    return *this;
+  }
+
+  uint64_t load() const
+  {
+    uint64_t result = 0;
+    for (const auto& slot : d_slots) {
+      result += slot.d_value.load(std::memory_order_relaxed);
+    }
+    return result;
+  }
+
+  operator uint64_t() const
+  {
+    return load();
+  }
+
+private:
+  static const size_t s_numberOfSlots = 16;
+  /* we can't rely on alignas() for objects allocated on the heap before C++17,
+     so we pad each slot to the size of a cache line instead */
+  struct Slot
+  {
+    std::atomic<uint64_t> d_value{0};
+    char d_padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+
+  static size_t getThreadSlot()
+  {
+    static std::atomic<size_t> s_nextSlot{0};
+    static thread_local size_t t_slot = s_nextSlot++ % s_numberOfSlots;
+    return t_slot;
+  }
+
+  std::atomic<uint64_t>& getLocalSlot()
+  {
+    return d_slots[getThreadSlot()].d_value;
+  }
+
+  std::array<Slot, s_numberOfSlots> d_slots;
+};
+
+/* the value of a metric, either an integer or a floating-point number */
+struct MetricValue
+{
+  template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+  MetricValue(T value): d_integer(static_cast<uint64_t>(value)), d_isInteger(true)
+  {
+  }
+
+  MetricValue(double value): d_double(value), d_isInteger(false)
+  {
+  }
+
+  uint64_t d_integer{0};
+  double d_double{0.0};
+  bool d_isInteger;
+};
+
+/* Appends values after their pre-rendered names to a buffer, which is handed over to the
+   flush function, if any, every time it grows larger than the flush threshold. Without
+   a flush function the whole content is available in the buffer after finish() */
+class MetricsWriter
+{
+public:
+  typedef std::function<void(const std::string&)> flush_t;
+
+  MetricsWriter(std::string& buffer, const std::string& lineEnd, flush_t flush = nullptr, size_t flushThreshold = 65536): d_buffer(buffer), d_lineEnd(lineEnd), d_flush(flush), d_flushThreshold(flushThreshold)
+  {
+  }
+
+  void addRaw(const std::string& content)
+  {
+    d_buffer.append(content);
+    flushIfNeeded();
+  }
+
+  /* name is expected to already contain the separator between the name and the value */
+  void add(const std::string& name, const MetricValue& value)
+  {
+    d_buffer.append(name);
+    if (value.d_isInteger) {
+      appendInteger(value.d_integer);
+    }
+    else {
+      appendDouble(value.d_double);
+    }
+    d_buffer.append(d_lineEnd);
+    flushIfNeeded();
+  }
+
+  void finish()
+  {
+    if (d_flush && !d_buffer.empty()) {
+      d_flush(d_buffer);
+      d_buffer.clear();
+    }
+  }
+
+private:
+  void flushIfNeeded()
+  {
+    if (d_flush && d_buffer.size() >= d_flushThreshold) {
+      d_flush(d_buffer);
+      d_buffer.clear();
+    }
+  }
+
+  void appendInteger(uint64_t value)
+  {
+    char buffer[20];
+    size_t pos = sizeof(buffer);
+    do {
+      buffer[--pos] = static_cast<char>('0' + (value % 10));
+      value /= 10;
+    }
+    while (value != 0);
+    d_buffer.append(buffer + pos, sizeof(buffer) - pos);
+  }
+
+  void appendDouble(double value)
+  {
+    /* same output than the default formatting of an ostream */
+    char buffer[32];
+    int len = snprintf(buffer, sizeof(buffer), "%g", value);
+    if (len > 0) {
+      d_buffer.append(buffer, std::min(static_cast<size_t>(len), sizeof(buffer) - 1));
+    }
+  }
+
+  std::string& d_buffer;
+  const std::string d_lineEnd;
+  flush_t d_flush;
+  const size_t d_flushThreshold;
+};
+
+/* A metric exported for every object of a given type (backend, frontend, pool..). The names
+   and labels are rendered once per object and output format, instead of on every scrape. */
+template <class T>
+struct MetricDescriptor
+{
+  const char* prometheusName; // nullptr if not exported to Prometheus
+  const char* prometheusLabel; // additional label, nullptr if none
+  const char* carbonName; // nullptr if not exported to carbon
+  PrometheusMetricType prometheusType;
+  const char* description;
+  /* not const because some of the objects, like pools, need to take a lock to compute a value */
+  std::function<MetricValue(T&)> getValue;
+  std::function<bool(T&)> isExportedToPrometheus; // nullptr if always exported
+  std::function<bool(T&)> isExportedToCarbon; // nullptr if always exported
+};
+
+struct ClientState;
+struct DOHFrontend;
+struct DownstreamState;
+struct ServerPool;
+
+/* Walks the metrics registry and writes them in the Prometheus or carbon format. The rendered
+   names are cached between two dumps, so an exporter should be kept around and not be shared
+   between threads. */
+class MetricsExporter
+{
+public:
+  /* Prometheus */
+  MetricsExporter();
+  /* carbon, the prefix being 'namespace.hostname.instance.' */
+  MetricsExporter(const std::string& carbonPrefix, const std::string& carbonHostname);
+
+  /* the caller is expected to call finish() on the writer once everything has been added */
+  void dump(MetricsWriter& writer);
+
+private:
+  template <class T>
+  struct RenderedObject
+  {
+    std::vector<std::pair<const MetricDescriptor<T>*, std::string>> d_metrics;
+    /* generation of the last dump this object was seen in, 0 if it has never been rendered */
+    uint64_t d_generation{0};
+  };
+
+  struct RenderedBackend: public RenderedObject<DownstreamState>
+  {
+    /* used to detect that the backend has been removed and its address reused */
+    std::weak_ptr<DownstreamState> d_backend;
+    /* used to detect that the backend has been renamed */
+    std::string d_name;
+    /* health-check latency histogram, Prometheus only */
+    std::vector<std::string> d_checkLatencyNames;
+  };
+
+  template <class T> void renderObject(RenderedObject<T>& object, const std::vector<MetricDescriptor<T>>& descriptors, const std::string& carbonBase, const std::string& prometheusLabels) const;
+  template <class T> void dumpObject(MetricsWriter& writer, const RenderedObject<T>& object, T& target) const;
+
+  void renderGlobalStats();
+  void renderBackend(RenderedBackend& rendered, const std::shared_ptr<DownstreamState>& backend) const;
+  void renderFrontends();
+  void dumpGlobalStats(MetricsWriter& writer);
+  void dumpBackends(MetricsWriter& writer);
+  void dumpFrontends(MetricsWriter& writer);
+  void dumpPools(MetricsWriter& writer);
+
+  std::string d_carbonPrefix;
+  std::string d_carbonHostname;
+  std::string d_backendsHeader;
+  std::string d_frontendsHeader;
+  std::string d_dohFrontendsHeader;
+  std::string d_poolsHeader;
+  /* index in g_stats.entries, rendered name */
+  std::vector<std::pair<size_t, std::string>> d_globalStats;
+  std::unordered_map<const DownstreamState*, RenderedBackend> d_backends;
+  std::vector<std::pair<ClientState*, RenderedObject<ClientState>>> d_frontends;
+  std::vector<std::pair<DOHFrontend*, RenderedObject<DOHFrontend>>> d_dohFrontends;
+  std::map<std::string, RenderedObject<ServerPool>> d_pools;
+  uint64_t d_generation{0};
+  size_t d_globalStatsCount{0};
+  size_t d_frontendsCount{0};
+  size_t d_dohFrontendsCount{0};
+  bool d_prometheus;
+  bool d_frontendsRendered{false};
+};
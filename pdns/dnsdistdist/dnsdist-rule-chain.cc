@@ -0,0 +1,230 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <algorithm>
+#include <map>
+
+#include "dnsdist-rule-chain.hh"
+#include "dnsdist-rules.hh"
+
+static void sortAndRemoveDuplicates(std::vector<size_t>& positions)
+{
+  std::sort(positions.begin(), positions.end());
+  positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+}
+
+DNSRuleChain::DNSRuleChain(std::shared_ptr<const std::vector<DNSDistRuleAction>> rulesPtr): d_rules(std::move(rulesPtr)), d_groupOfRule(d_rules->size(), -1)
+{
+  const auto& rules = *d_rules;
+  size_t idx = 0;
+  while (idx < rules.size()) {
+    if (!isCompilable(*rules.at(idx).d_rule)) {
+      ++idx;
+      continue;
+    }
+
+    size_t end = idx + 1;
+    while (end < rules.size() && isCompilable(*rules.at(end).d_rule)) {
+      ++end;
+    }
+
+    /* a lonely rule is cheaper to evaluate as it is */
+    if ((end - idx) > 1) {
+      compileGroup(idx, end);
+    }
+
+    idx = end;
+  }
+}
+
+bool DNSRuleChain::isCompilable(const DNSRule& rule)
+{
+  if (dynamic_cast<const QNameRule*>(&rule) != nullptr ||
+      dynamic_cast<const QNameSetRule*>(&rule) != nullptr ||
+      dynamic_cast<const SuffixMatchNodeRule*>(&rule) != nullptr ||
+      dynamic_cast<const QTypeRule*>(&rule) != nullptr) {
+    return true;
+  }
+
+  const auto nmgRule = dynamic_cast<const NetmaskGroupRule*>(&rule);
+  if (nmgRule != nullptr && nmgRule->isSource()) {
+    /* a negative entry can hide a less specific positive one,
+       which our merged tree would not know about */
+    std::vector<std::string> masks;
+    nmgRule->getNMG().toStringVector(&masks);
+    for (const auto& mask : masks) {
+      if (!mask.empty() && mask.at(0) == '!') {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  return false;
+}
+
+void DNSRuleChain::compileGroup(size_t begin, size_t end)
+{
+  const auto& rules = *d_rules;
+  Group group;
+  group.d_begin = begin;
+  group.d_end = end;
+
+  std::map<DNSName, positions_t> suffixes;
+  std::map<Netmask, positions_t> sources;
+
+  for (size_t idx = begin; idx < end; idx++) {
+    const DNSRule* rule = rules.at(idx).d_rule.get();
+
+    if (const auto qnameRule = dynamic_cast<const QNameRule*>(rule)) {
+      group.d_names[qnameRule->getQName()].push_back(idx);
+    }
+    else if (const auto qnameSetRule = dynamic_cast<const QNameSetRule*>(rule)) {
+      for (const auto& name : qnameSetRule->getNames()) {
+        group.d_names[name].push_back(idx);
+      }
+    }
+    else if (const auto smnRule = dynamic_cast<const SuffixMatchNodeRule*>(rule)) {
+      for (const auto& name : smnRule->getSuffixes().d_tree.getNodes()) {
+        suffixes[name].push_back(idx);
+      }
+    }
+    else if (const auto nmgRule = dynamic_cast<const NetmaskGroupRule*>(rule)) {
+      std::vector<std::string> masks;
+      nmgRule->getNMG().toStringVector(&masks);
+      for (const auto& mask : masks) {
+        sources[Netmask(mask)].push_back(idx);
+      }
+    }
+    else if (const auto qtypeRule = dynamic_cast<const QTypeRule*>(rule)) {
+      group.d_qtypes[qtypeRule->getQType()].push_back(idx);
+    }
+    d_groupOfRule.at(idx) = d_groups.size();
+    d_compiledRulesCount++;
+  }
+
+  for (auto& entry : group.d_names) {
+    sortAndRemoveDuplicates(entry.second);
+  }
+
+  for (auto& entry : group.d_qtypes) {
+    sortAndRemoveDuplicates(entry.second);
+  }
+
+  /* the suffix tree only returns the most specific suffix, so each node
+     has to know about the rules covering any of its ancestors as well */
+  for (const auto& entry : suffixes) {
+    positions_t positions = entry.second;
+    DNSName parent(entry.first);
+    while (parent.chopOff()) {
+      const auto& it = suffixes.find(parent);
+      if (it != suffixes.end()) {
+        positions.insert(positions.end(), it->second.begin(), it->second.end());
+      }
+    }
+    sortAndRemoveDuplicates(positions);
+    group.d_suffixes.add(entry.first, positions);
+    group.d_hasSuffixes = true;
+  }
+
+  /* same thing for the netmask tree */
+  for (const auto& entry : sources) {
+    positions_t positions = entry.second;
+    for (uint8_t bits = entry.first.getBits(); bits > 0; bits--) {
+      const auto& it = sources.find(Netmask(entry.first.getNetwork(), bits - 1));
+      if (it != sources.end()) {
+        positions.insert(positions.end(), it->second.begin(), it->second.end());
+      }
+    }
+    sortAndRemoveDuplicates(positions);
+    group.d_sources.insert(entry.first).second = std::move(positions);
+  }
+
+  d_groups.push_back(std::move(group));
+}
+
+size_t DNSRuleChain::Group::findFirstMatch(const DNSQuestion& dq, size_t from) const
+{
+  size_t best = d_end;
+  auto consider = [&best,from](const positions_t& positions) {
+    auto it = std::lower_bound(positions.begin(), positions.end(), from);
+    if (it != positions.end() && *it < best) {
+      best = *it;
+    }
+  };
+
+  if (!d_names.empty()) {
+    const auto& it = d_names.find(*dq.qname);
+    if (it != d_names.end()) {
+      consider(it->second);
+    }
+  }
+
+  if (d_hasSuffixes) {
+    const auto positions = d_suffixes.lookup(*dq.qname);
+    if (positions != nullptr) {
+      consider(*positions);
+    }
+  }
+
+  if (!d_sources.empty()) {
+    const auto node = d_sources.lookup(*dq.remote);
+    if (node != nullptr) {
+      consider(node->second);
+    }
+  }
+
+  if (!d_qtypes.empty()) {
+    const auto& it = d_qtypes.find(dq.qtype);
+    if (it != d_qtypes.end()) {
+      consider(it->second);
+    }
+  }
+
+  return best;
+}
+
+size_t DNSRuleChain::findNextMatch(const DNSQuestion& dq, size_t from) const
+{
+  const auto& rules = *d_rules;
+  size_t idx = from;
+
+  while (idx < rules.size()) {
+    int groupIdx = d_groupOfRule.at(idx);
+    if (groupIdx < 0) {
+      if (rules.at(idx).d_rule->matches(&dq)) {
+        return idx;
+      }
+      ++idx;
+      continue;
+    }
+
+    const auto& group = d_groups.at(groupIdx);
+    auto found = group.findFirstMatch(dq, idx);
+    if (found < group.d_end) {
+      return found;
+    }
+    idx = group.d_end;
+  }
+
+  return rules.size();
+}
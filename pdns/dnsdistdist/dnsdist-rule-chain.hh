@@ -0,0 +1,94 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "dnsdist.hh"
+
+/* A 'compiled' view of a list of query rules.
+   Runs of consecutive simple rules (QNameRule, QNameSetRule, SuffixMatchNodeRule,
+   source NetmaskGroupRule without negative entries and QTypeRule) are merged into
+   combined indexes: one hash for exact names, one suffix tree, one netmask tree and
+   one qtype map per run. Finding the first rule of the run that matches a query then
+   costs a few lookups instead of one virtual call per rule, while every other kind of
+   rule is still evaluated in order. First-match semantics are preserved, and looking
+   for the next match after a non-terminal action works the same way.
+
+   The chain shares the ownership of the rules it has been built from, so a newer
+   set of rules can never be allocated at the same address while the chain exists:
+   comparing the address of the current rules with getRules() is enough to know
+   whether the chain is stale. */
+class DNSRuleChain
+{
+public:
+  DNSRuleChain(std::shared_ptr<const std::vector<DNSDistRuleAction>> rules);
+
+  /* returns the index of the first rule matching this query, starting at 'from',
+     or the number of rules if none matches */
+  size_t findNextMatch(const DNSQuestion& dq, size_t from) const;
+
+  const std::vector<DNSDistRuleAction>& getRules() const
+  {
+    return *d_rules;
+  }
+
+  /* number of rules that have been merged into an index */
+  size_t getCompiledRulesCount() const
+  {
+    return d_compiledRulesCount;
+  }
+
+  size_t getGroupsCount() const
+  {
+    return d_groups.size();
+  }
+
+private:
+  typedef std::vector<size_t> positions_t;
+
+  struct Group
+  {
+    size_t findFirstMatch(const DNSQuestion& dq, size_t from) const;
+
+    std::unordered_map<DNSName, positions_t> d_names;
+    SuffixMatchTree<positions_t> d_suffixes;
+    NetmaskTree<positions_t> d_sources;
+    std::unordered_map<uint16_t, positions_t> d_qtypes;
+    size_t d_begin{0};
+    size_t d_end{0};
+    bool d_hasSuffixes{false};
+  };
+
+  static bool isCompilable(const DNSRule& rule);
+  void compileGroup(size_t begin, size_t end);
+
+  std::shared_ptr<const std::vector<DNSDistRuleAction>> d_rules;
+  std::vector<Group> d_groups;
+  /* for each rule, the index of the group it belongs to or -1 */
+  std::vector<int> d_groupOfRule;
+  size_t d_compiledRulesCount{0};
+};
+
+/* whether the query rules should be compiled into a DNSRuleChain */
+extern bool g_compileQueryRules;
@@ -32,60 +32,49 @@
 class MaxQPSIPRule : public DNSRule
 {
 public:
-  MaxQPSIPRule(unsigned int qps, unsigned int burst, unsigned int ipv4trunc=32, unsigned int ipv6trunc=64, unsigned int expiration=300, unsigned int cleanupDelay=60, unsigned int scanFraction=10):
-    d_qps(qps), d_burst(burst), d_ipv4trunc(ipv4trunc), d_ipv6trunc(ipv6trunc), d_cleanupDelay(cleanupDelay), d_expiration(expiration), d_scanFraction(scanFraction)
+  MaxQPSIPRule(unsigned int qps, unsigned int burst, unsigned int ipv4trunc=32, unsigned int ipv6trunc=64, unsigned int expiration=300, unsigned int cleanupDelay=60, unsigned int scanFraction=10, size_t shardsCount=10):
+    d_shards(shardsCount), d_qps(qps), d_burst(burst), d_ipv4trunc(ipv4trunc), d_ipv6trunc(ipv6trunc), d_cleanupDelay(cleanupDelay), d_expiration(expiration), d_scanFraction(scanFraction)
   {
-    gettime(&d_lastCleanup, true);
+    if (d_shards.empty()) {
+      throw std::runtime_error("The number of shards of a MaxQPSIPRule should be at least 1");
+    }
+    struct timespec now;
+    gettime(&now, true);
+    d_lastCleanup = now.tv_sec;
   }
 
   void clear()
   {
-    std::lock_guard<std::mutex> lock(d_lock);
-    d_limits.clear();
+    for (auto& shard : d_shards) {
+      std::lock_guard<std::mutex> lock(shard.d_lock);
+      shard.d_limits.clear();
+    }
   }
 
   size_t cleanup(const struct timespec& cutOff, size_t* scannedCount=nullptr) const
   {
-    std::lock_guard<std::mutex> lock(d_lock);
-    size_t toLook = d_limits.size() / d_scanFraction + 1;
-    size_t lookedAt = 0;
-
-    size_t removed = 0;
-    auto& sequence = d_limits.get<SequencedTag>();
-    for (auto entry = sequence.begin(); entry != sequence.end() && lookedAt < toLook; lookedAt++) {
-      if (entry->d_limiter.seenSince(cutOff)) {
-        /* entries are ordered from least recently seen to more recently
-           seen, as soon as we see one that has not expired yet, we are
-           done */
-        lookedAt++;
-        break;
-      }
-
-      entry = sequence.erase(entry);
-      removed++;
-    }
-
-    if (scannedCount != nullptr) {
-      *scannedCount = lookedAt;
-    }
-
-    return removed;
+    return cleanupShards(cutOff, scannedCount, false);
   }
 
   void cleanupIfNeeded(const struct timespec& now) const
   {
     if (d_cleanupDelay > 0) {
-      struct timespec cutOff = d_lastCleanup;
-      cutOff.tv_sec += d_cleanupDelay;
+      time_t lastCleanup = d_lastCleanup.load();
+
+      if ((lastCleanup + d_cleanupDelay) < now.tv_sec) {
+        /* only one thread gets to do the cleanup, the other ones go on with their queries */
+        if (!d_lastCleanup.compare_exchange_strong(lastCleanup, now.tv_sec)) {
+          return;
+        }
 
-      if (cutOff < now) {
         /* the QPS Limiter doesn't use realtime, be careful! */
+        struct timespec cutOff;
         gettime(&cutOff, false);
         cutOff.tv_sec -= d_expiration;
 
-        cleanup(cutOff);
-
-        d_lastCleanup = now;
+        /* skip the shards that are busy instead of waiting for them,
+           they will be looked at during the next round */
+        cleanupShards(cutOff, nullptr, true);
       }
     }
   }
@@ -97,15 +86,16 @@ public:
     ComboAddress zeroport(*dq->remote);
     zeroport.sin4.sin_port=0;
     zeroport.truncate(zeroport.sin4.sin_family == AF_INET ? d_ipv4trunc : d_ipv6trunc);
+    auto& shard = d_shards.at(getShardIndex(zeroport));
     {
-      std::lock_guard<std::mutex> lock(d_lock);
-      auto iter = d_limits.find(zeroport);
-      if (iter == d_limits.end()) {
+      std::lock_guard<std::mutex> lock(shard.d_lock);
+      auto iter = shard.d_limits.find(zeroport);
+      if (iter == shard.d_limits.end()) {
         Entry e(zeroport, QPSLimiter(d_qps, d_burst));
-        iter = d_limits.insert(e).first;
+        iter = shard.d_limits.insert(e).first;
       }
 
-      moveCacheItemToBack<SequencedTag>(d_limits, iter);
+      moveCacheItemToBack<SequencedTag>(shard.d_limits, iter);
       return !iter->d_limiter.check(d_qps, d_burst);
     }
   }
@@ -117,8 +107,17 @@ public:
 
   size_t getEntriesCount() const
   {
-    std::lock_guard<std::mutex> lock(d_lock);
-    return d_limits.size();
+    size_t count = 0;
+    for (const auto& shard : d_shards) {
+      std::lock_guard<std::mutex> lock(shard.d_lock);
+      count += shard.d_limits.size();
+    }
+    return count;
+  }
+
+  size_t getShardsCount() const
+  {
+    return d_shards.size();
   }
 
 private:
@@ -141,9 +140,63 @@ private:
       >
   > qpsContainer_t;
 
-  mutable std::mutex d_lock;
-  mutable qpsContainer_t d_limits;
-  mutable struct timespec d_lastCleanup;
+  /* each shard has its own lock, so that queries from different
+     clients (or netmasks) seldom contend on the same one */
+  struct Shard
+  {
+    mutable std::mutex d_lock;
+    mutable qpsContainer_t d_limits;
+  };
+
+  size_t getShardIndex(const ComboAddress& addr) const
+  {
+    return ComboAddress::addressOnlyHash()(addr) % d_shards.size();
+  }
+
+  size_t cleanupShards(const struct timespec& cutOff, size_t* scannedCount, bool skipBusyShards) const
+  {
+    size_t removed = 0;
+    size_t lookedAt = 0;
+
+    for (auto& shard : d_shards) {
+      std::unique_lock<std::mutex> lock(shard.d_lock, std::defer_lock);
+      if (skipBusyShards) {
+        if (!lock.try_lock()) {
+          continue;
+        }
+      }
+      else {
+        lock.lock();
+      }
+
+      size_t toLook = shard.d_limits.size() / d_scanFraction + 1;
+      size_t lookedAtInShard = 0;
+      auto& sequence = shard.d_limits.get<SequencedTag>();
+      for (auto entry = sequence.begin(); entry != sequence.end() && lookedAtInShard < toLook; lookedAtInShard++) {
+        if (entry->d_limiter.seenSince(cutOff)) {
+          /* entries are ordered from least recently seen to more recently
+             seen, as soon as we see one that has not expired yet, we are
+             done with this shard */
+          lookedAtInShard++;
+          break;
+        }
+
+        entry = sequence.erase(entry);
+        removed++;
+      }
+
+      lookedAt += lookedAtInShard;
+    }
+
+    if (scannedCount != nullptr) {
+      *scannedCount = lookedAt;
+    }
+
+    return removed;
+  }
+
+  mutable std::vector<Shard> d_shards;
+  mutable std::atomic<time_t> d_lastCleanup;
   unsigned int d_qps, d_burst, d_ipv4trunc, d_ipv6trunc, d_cleanupDelay, d_expiration;
   unsigned int d_scanFraction{10};
 };
@@ -210,6 +263,16 @@ public:
     }
     return ret + d_nmg.toString();
   }
+
+  const NetmaskGroup& getNMG() const
+  {
+    return d_nmg;
+  }
+
+  bool isSource() const
+  {
+    return d_src;
+  }
 private:
   bool d_src;
   bool d_quiet;
@@ -585,6 +648,11 @@ public:
     else
       return "qname in "+d_smn.toString();
   }
+
+  const SuffixMatchNode& getSuffixes() const
+  {
+    return d_smn;
+  }
 private:
   SuffixMatchNode d_smn;
   bool d_quiet;
@@ -605,6 +673,11 @@ public:
   {
     return "qname=="+d_qname.toString();
   }
+
+  const DNSName& getQName() const
+  {
+    return d_qname;
+  }
 private:
   DNSName d_qname;
 };
@@ -622,6 +695,10 @@ public:
         ss << "qname in DNSNameSet(" << qname_idx.size() << " FQDNs)";
         return ss.str();
     }
+
+    const DNSNameSet& getNames() const {
+        return qname_idx;
+    }
 private:
     DNSNameSet qname_idx;
 };
@@ -641,6 +718,11 @@ public:
     QType qt(d_qtype);
     return "qtype=="+qt.getName();
   }
+
+  uint16_t getQType() const
+  {
+    return d_qtype;
+  }
 private:
   uint16_t d_qtype;
 };
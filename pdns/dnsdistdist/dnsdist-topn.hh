@@ -0,0 +1 @@
+../dnsdist-topn.hh
\ No newline at end of file
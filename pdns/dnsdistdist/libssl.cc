@@ -671,6 +671,14 @@ std::unique_ptr<SSL_CTX, void(*)(SSL_CTX*)> libssl_init_server_context(const TLS
     sslOptions |= SSL_OP_CIPHER_SERVER_PREFERENCE;
   }
 
+#ifdef SSL_OP_ENABLE_KTLS
+  if (config.d_enableKTLS) {
+    /* once the handshake is done, let the kernel handle the record layer and the symmetric crypto,
+       if it supports the negotiated cipher. OpenSSL silently falls back to the user-space code otherwise */
+    sslOptions |= SSL_OP_ENABLE_KTLS;
+  }
+#endif /* SSL_OP_ENABLE_KTLS */
+
   SSL_CTX_set_options(ctx.get(), sslOptions);
   if (!libssl_set_min_tls_version(ctx, config.d_minTLSVersion)) {
     throw std::runtime_error("Failed to set the minimum version to '" + libssl_tls_version_to_string(config.d_minTLSVersion));
@@ -269,6 +269,16 @@ public:
     return false;
   }
 
+  bool isUsingKTLS() const override
+  {
+#ifdef SSL_OP_ENABLE_KTLS
+    if (d_conn) {
+      return BIO_get_ktls_send(SSL_get_wbio(d_conn.get())) != 0 || BIO_get_ktls_recv(SSL_get_rbio(d_conn.get())) != 0;
+    }
+#endif /* SSL_OP_ENABLE_KTLS */
+    return false;
+  }
+
   static int s_tlsConnIndex;
 
 private:
@@ -308,6 +318,12 @@ public:
       d_feContext->d_keyLogFile = libssl_set_key_log_file(d_feContext->d_tlsCtx, fe.d_tlsConfig.d_keyLogFile);
     }
 
+#ifndef SSL_OP_ENABLE_KTLS
+    if (fe.d_tlsConfig.d_enableKTLS) {
+      warnlog("kTLS has been requested for the TLS frontend on %s, but this version of OpenSSL does not support it", fe.d_addr.toStringWithPort());
+    }
+#endif /* SSL_OP_ENABLE_KTLS */
+
     try {
       if (fe.d_tlsConfig.d_ticketKeyFile.empty()) {
         handleTicketsKeyRotation(time(nullptr));
@@ -398,6 +414,9 @@ private:
 #ifdef HAVE_GNUTLS
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
+#if GNUTLS_VERSION_NUMBER >= 0x030703
+#include <gnutls/socket.h>
+#endif /* GNUTLS_VERSION_NUMBER >= 0x030703 */
 
 static void safe_memory_lock(void* data, size_t size)
 {
@@ -734,6 +753,16 @@ public:
     return false;
   }
 
+  bool isUsingKTLS() const override
+  {
+#if GNUTLS_VERSION_NUMBER >= 0x030703
+    if (d_conn) {
+      return gnutls_transport_is_ktls_enabled(d_conn.get()) != 0;
+    }
+#endif /* GNUTLS_VERSION_NUMBER >= 0x030703 */
+    return false;
+  }
+
   void close() override
   {
     if (d_conn) {
@@ -791,6 +820,11 @@ public:
       throw std::runtime_error("Error setting up TLS cipher preferences to '" + fe.d_tlsConfig.d_ciphers + "' (" + gnutls_strerror(rc) + ") on " + fe.d_addr.toStringWithPort());
     }
 
+    if (fe.d_tlsConfig.d_enableKTLS) {
+      /* GnuTLS does not offer a per-session knob, kTLS is enabled or not via its system-wide configuration file */
+      warnlog("kTLS has been requested for the TLS frontend on %s, but the GnuTLS provider only honors the system-wide GnuTLS configuration for that", fe.d_addr.toStringWithPort());
+    }
+
     pthread_rwlock_init(&d_lock, nullptr);
 
     try {
@@ -0,0 +1,221 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist.hh"
+
+BOOST_AUTO_TEST_SUITE(dnsdistbackend_cc)
+
+static std::shared_ptr<DownstreamState> getBackend(size_t statesCount)
+{
+  auto dss = std::make_shared<DownstreamState>(ComboAddress("192.0.2.1:53"), ComboAddress(), 0, std::string(), 1, false);
+  dss->idStates.resize(statesCount);
+  return dss;
+}
+
+/* pick a state the way the UDP client threads do */
+static IDState& assignState(DownstreamState& dss)
+{
+  auto& ids = dss.idStates[(dss.idOffset++) % dss.idStates.size()];
+  ids.age = 0;
+  if (!ids.markAsUsed()) {
+    ++dss.outstanding;
+  }
+  return ids;
+}
+
+/* release a state the way the responder threads do */
+static bool answerState(DownstreamState& dss, IDState& ids)
+{
+  int64_t usageIndicator = ids.usageIndicator;
+  ids.age = 0;
+  if (!IDState::isInUse(usageIndicator) || !ids.tryMarkUnused(usageIndicator)) {
+    return false;
+  }
+  --dss.outstanding;
+  return true;
+}
+
+BOOST_AUTO_TEST_CASE(test_UDPTimeouts) {
+  const int udpTimeout = 2;
+  auto dss = getBackend(16);
+  size_t timeouts = 0;
+  auto timedOut = [&timeouts](IDState& ids, DOHUnit* du) {
+    BOOST_CHECK(!ids.isInUse());
+    BOOST_CHECK(du == nullptr);
+    timeouts++;
+  };
+
+  assignState(*dss);
+  auto& answered = assignState(*dss);
+  assignState(*dss);
+  BOOST_CHECK_EQUAL(dss->outstanding.load(), 3U);
+
+  BOOST_CHECK(answerState(*dss, answered));
+  BOOST_CHECK_EQUAL(dss->outstanding.load(), 2U);
+
+  /* not yet */
+  for (int idx = 0; idx <= udpTimeout; idx++) {
+    dss->handleUDPTimeouts(udpTimeout, timedOut);
+  }
+  BOOST_CHECK_EQUAL(timeouts, 0U);
+  BOOST_CHECK_EQUAL(dss->outstanding.load(), 2U);
+
+  dss->handleUDPTimeouts(udpTimeout, timedOut);
+  BOOST_CHECK_EQUAL(timeouts, 2U);
+  BOOST_CHECK_EQUAL(dss->outstanding.load(), 0U);
+  BOOST_CHECK_EQUAL(dss->reuseds.load(), 2U);
+  for (const auto& ids : dss->idStates) {
+    BOOST_CHECK(!ids.isInUse());
+  }
+
+  /* nothing left */
+  dss->handleUDPTimeouts(udpTimeout, timedOut);
+  BOOST_CHECK_EQUAL(timeouts, 2U);
+}
+
+BOOST_AUTO_TEST_CASE(test_UDPTimeoutsWrapAround) {
+  const int udpTimeout = 2;
+  auto dss = getBackend(16);
+  size_t timeouts = 0;
+  auto timedOut = [&timeouts](IDState&, DOHUnit*) {
+    timeouts++;
+  };
+
+  /* fill the history so that only the recently assigned states are looked at */
+  for (int idx = 0; idx < udpTimeout + 3; idx++) {
+    dss->handleUDPTimeouts(udpTimeout, timedOut);
+  }
+
+  /* more states than the table holds have been assigned since the last scans, wrapping around */
+  for (size_t idx = 0; idx < dss->idStates.size() + 3; idx++) {
+    auto& ids = assignState(*dss);
+    answerState(*dss, ids);
+  }
+  auto& pending = assignState(*dss);
+
+  for (int idx = 0; idx <= udpTimeout; idx++) {
+    dss->handleUDPTimeouts(udpTimeout, timedOut);
+  }
+  BOOST_CHECK_EQUAL(timeouts, 0U);
+  BOOST_CHECK(pending.isInUse());
+
+  dss->handleUDPTimeouts(udpTimeout, timedOut);
+  BOOST_CHECK_EQUAL(timeouts, 1U);
+  BOOST_CHECK(!pending.isInUse());
+  BOOST_CHECK_EQUAL(dss->outstanding.load(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_UDPTimeoutsAgeReset) {
+  const int udpTimeout = 2;
+  auto dss = getBackend(16);
+  size_t timeouts = 0;
+  auto timedOut = [&timeouts](IDState&, DOHUnit*) {
+    timeouts++;
+  };
+
+  for (int idx = 0; idx < udpTimeout + 3; idx++) {
+    dss->handleUDPTimeouts(udpTimeout, timedOut);
+  }
+
+  auto& ids = assignState(*dss);
+  const uint16_t id = &ids - &dss->idStates.at(0);
+  for (int idx = 0; idx < udpTimeout; idx++) {
+    dss->handleUDPTimeouts(udpTimeout, timedOut);
+  }
+  BOOST_CHECK_EQUAL(timeouts, 0U);
+
+  /* a responder thread got a response that did not match, after resetting the age of the state */
+  ids.age = 0;
+  dss->recheckIDState(id);
+
+  /* the state is soon out of the recent window, but should still time out */
+  for (int idx = 0; idx <= udpTimeout; idx++) {
+    dss->handleUDPTimeouts(udpTimeout, timedOut);
+  }
+  BOOST_CHECK_EQUAL(timeouts, 0U);
+  BOOST_CHECK(ids.isInUse());
+
+  dss->handleUDPTimeouts(udpTimeout, timedOut);
+  BOOST_CHECK_EQUAL(timeouts, 1U);
+  BOOST_CHECK(!ids.isInUse());
+  BOOST_CHECK_EQUAL(dss->outstanding.load(), 0U);
+  BOOST_CHECK(dss->idStatesToRecheck.empty());
+
+  /* a state released in the meantime is forgotten */
+  auto& answered = assignState(*dss);
+  dss->recheckIDState(&answered - &dss->idStates.at(0));
+  BOOST_CHECK(answerState(*dss, answered));
+  dss->handleUDPTimeouts(udpTimeout, timedOut);
+  BOOST_CHECK_EQUAL(timeouts, 1U);
+  BOOST_CHECK(dss->idStatesToRecheck.empty());
+  BOOST_CHECK_EQUAL(dss->outstanding.load(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_UDPTimeoutsOffsetTakenBeforeMarkedAsUsed) {
+  const int udpTimeout = 2;
+  auto dss = getBackend(16);
+  size_t timeouts = 0;
+  auto timedOut = [&timeouts](IDState&, DOHUnit*) {
+    timeouts++;
+  };
+
+  for (int idx = 0; idx < udpTimeout + 3; idx++) {
+    dss->handleUDPTimeouts(udpTimeout, timedOut);
+  }
+
+  /* a client thread took the offset, but a scan happens before it marks the state as used */
+  auto& ids = dss->idStates[(dss->idOffset++) % dss->idStates.size()];
+  dss->handleUDPTimeouts(udpTimeout, timedOut);
+  ids.age = 0;
+  BOOST_CHECK(!ids.markAsUsed());
+  ++dss->outstanding;
+
+  for (int idx = 0; idx <= udpTimeout; idx++) {
+    dss->handleUDPTimeouts(udpTimeout, timedOut);
+  }
+  BOOST_CHECK_EQUAL(timeouts, 0U);
+  BOOST_CHECK(ids.isInUse());
+
+  dss->handleUDPTimeouts(udpTimeout, timedOut);
+  BOOST_CHECK_EQUAL(timeouts, 1U);
+  BOOST_CHECK(!ids.isInUse());
+  BOOST_CHECK_EQUAL(dss->outstanding.load(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_UDPTimeoutsFullScan) {
+  const int udpTimeout = 2;
+  const uint64_t fullScanInterval = DownstreamState::s_udpTimeoutsFullScanInterval;
+  auto dss = getBackend(16);
+  size_t timeouts = 0;
+  auto timedOut = [&timeouts](IDState&, DOHUnit*) {
+    timeouts++;
+  };
+
+  for (int idx = 0; idx < udpTimeout + 3; idx++) {
+    dss->handleUDPTimeouts(udpTimeout, timedOut);
+  }
+
+  /* a state that is in use but far from the recently assigned ones, which should not happen
+     but would otherwise never be released */
+  auto& ids = dss->idStates.at(8);
+  ids.age = udpTimeout + 1;
+  BOOST_CHECK(!ids.markAsUsed());
+  ++dss->outstanding;
+
+  uint64_t scans = udpTimeout + 3;
+  while (scans % fullScanInterval != 0) {
+    dss->handleUDPTimeouts(udpTimeout, timedOut);
+    scans++;
+  }
+  BOOST_CHECK_EQUAL(timeouts, 0U);
+  BOOST_CHECK(ids.isInUse());
+
+  dss->handleUDPTimeouts(udpTimeout, timedOut);
+  BOOST_CHECK_EQUAL(timeouts, 1U);
+  BOOST_CHECK(!ids.isInUse());
+  BOOST_CHECK_EQUAL(dss->outstanding.load(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -19,6 +19,7 @@ bool g_snmpTrapsEnabled{false};
 DNSDistSNMPAgent* g_snmpAgent{nullptr};
 
 #if BENCH_POLICIES
+#include <queue>
 bool g_verbose{true};
 bool g_syslog{true};
 #include "dnsdist-rings.hh"
@@ -131,6 +132,62 @@ static void benchPolicy(const ServerPolicy& pol)
 #endif /* BENCH_POLICIES */
 }
 
+/* simulate a pool of backends with different latencies, one of them being degraded, and report the latency distribution
+   of the queries as seen by the clients */
+static void simulatePolicy(const ServerPolicy& pol)
+{
+#if BENCH_POLICIES
+  bool existingVerboseValue = g_verbose;
+  g_verbose = false;
+
+  auto dq = getDQ();
+  ServerPolicy::NumberedServerVector servers;
+  std::vector<uint64_t> serviceTimes;
+  for (size_t idx = 1; idx <= 10; idx++) {
+    servers.push_back({ idx, std::make_shared<DownstreamState>(ComboAddress("192.0.2." + std::to_string(idx) + ":53")) });
+    servers.at(idx - 1).second->setUp();
+    servers.at(idx - 1).second->setWeight(1000);
+    servers.at(idx - 1).second->hash();
+    /* one backend is ten times slower than the others */
+    serviceTimes.push_back(idx == 1 ? 20000 : 2000);
+  }
+
+  srandom(42);
+  /* completion time in us, index of the backend */
+  std::priority_queue<std::pair<uint64_t, size_t>, std::vector<std::pair<uint64_t, size_t>>, std::greater<std::pair<uint64_t, size_t>>> pending;
+  std::vector<uint64_t> latencies;
+  const size_t queriesCount = 200000;
+  latencies.reserve(queriesCount);
+  /* one query every 5 us */
+  for (uint64_t now = 0; latencies.size() < queriesCount; now += 5) {
+    while (!pending.empty() && pending.top().first <= now) {
+      auto& ds = servers.at(pending.top().second).second;
+      --ds->outstanding;
+      pending.pop();
+    }
+
+    auto server = getSelectedBackendFromPolicy(pol, servers, dq);
+    size_t position = 0;
+    for (; position < servers.size(); position++) {
+      if (servers.at(position).second == server) {
+        break;
+      }
+    }
+    /* the more outstanding queries, the slower the backend */
+    uint64_t latency = serviceTimes.at(position) + server->outstanding * 10 + random() % 500;
+    ++server->outstanding;
+    server->latencyUsec = (127.0 * server->latencyUsec / 128.0) + latency / 128.0;
+    pending.push({now + latency, position});
+    latencies.push_back(latency);
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  cerr<<pol.name<<" simulation: median latency is "<<latencies.at(latencies.size() / 2)<<" us, 99th percentile is "<<latencies.at(latencies.size() * 99 / 100)<<" us, 99.9th percentile is "<<latencies.at(latencies.size() * 999 / 1000)<<" us"<<endl;
+
+  g_verbose = existingVerboseValue;
+#endif /* BENCH_POLICIES */
+}
+
 static void resetLuaContext()
 {
   /* we need to reset this before cleaning the Lua state because the server policy might holds
@@ -225,6 +282,90 @@ BOOST_AUTO_TEST_CASE(test_leastOutstanding) {
   benchPolicy(pol);
 }
 
+BOOST_AUTO_TEST_CASE(test_latencyAware) {
+  auto dq = getDQ();
+
+  ServerPolicy pol{"latencyAware", latencyAware, false};
+  ServerPolicy::NumberedServerVector servers;
+  servers.push_back({ 1, std::make_shared<DownstreamState>(ComboAddress("192.0.2.1:53")) });
+
+  /* servers start as 'down' */
+  auto server = getSelectedBackendFromPolicy(pol, servers, dq);
+  BOOST_CHECK(server == nullptr);
+
+  /* mark the server as 'up' */
+  servers.at(0).second->setUp();
+  server = getSelectedBackendFromPolicy(pol, servers, dq);
+  BOOST_CHECK(server == servers.at(0).second);
+
+  /* add a second server, 'down' */
+  servers.push_back({ 2, std::make_shared<DownstreamState>(ComboAddress("192.0.2.2:53")) });
+  for (size_t idx = 0; idx < 100; idx++) {
+    server = getSelectedBackendFromPolicy(pol, servers, dq);
+    BOOST_CHECK(server == servers.at(0).second);
+  }
+
+  /* both are 'up', the first one is much slower */
+  servers.at(1).second->setUp();
+  servers.at(0).second->latencyUsec = 100000;
+  servers.at(0).second->outstanding = 10;
+  servers.at(1).second->latencyUsec = 1000;
+  servers.at(1).second->outstanding = 10;
+  for (size_t idx = 0; idx < 100; idx++) {
+    server = getSelectedBackendFromPolicy(pol, servers, dq);
+    BOOST_CHECK(server == servers.at(1).second);
+  }
+
+  /* the second one has many more outstanding queries now */
+  servers.at(0).second->outstanding = 0;
+  servers.at(1).second->outstanding = 1000;
+  server = getSelectedBackendFromPolicy(pol, servers, dq);
+  BOOST_CHECK(server == servers.at(0).second);
+
+  /* same cost, but the first one has a greater weight */
+  servers.at(0).second->latencyUsec = 1000;
+  servers.at(0).second->outstanding = 10;
+  servers.at(1).second->outstanding = 10;
+  servers.at(0).second->setWeight(2);
+  server = getSelectedBackendFromPolicy(pol, servers, dq);
+  BOOST_CHECK(server == servers.at(0).second);
+
+  /* a server without latency measurement yet only competes on outstanding queries */
+  {
+    ServerPolicy::NumberedServerVector newServers;
+    newServers.push_back(servers.at(1));
+    newServers.push_back({ 2, std::make_shared<DownstreamState>(ComboAddress("192.0.2.3:53")) });
+    newServers.at(1).second->setUp();
+    server = getSelectedBackendFromPolicy(pol, newServers, dq);
+    BOOST_CHECK(server == newServers.at(1).second);
+
+    newServers.at(1).second->outstanding = 100;
+    server = getSelectedBackendFromPolicy(pol, newServers, dq);
+    BOOST_CHECK(server == newServers.at(0).second);
+  }
+
+  /* all down */
+  servers.at(0).second->setDown();
+  servers.at(1).second->setDown();
+  server = getSelectedBackendFromPolicy(pol, servers, dq);
+  BOOST_CHECK(server == nullptr);
+
+  /* many servers, only one of them 'up' */
+  for (size_t idx = 4; idx <= 20; idx++) {
+    servers.push_back({ idx, std::make_shared<DownstreamState>(ComboAddress("192.0.2." + std::to_string(idx) + ":53")) });
+  }
+  servers.at(17).second->setUp();
+  for (size_t idx = 0; idx < 100; idx++) {
+    server = getSelectedBackendFromPolicy(pol, servers, dq);
+    BOOST_CHECK(server == servers.at(17).second);
+  }
+
+  benchPolicy(pol);
+  simulatePolicy(pol);
+  simulatePolicy(ServerPolicy{"leastOutstanding", leastOutstanding, false});
+  simulatePolicy(ServerPolicy{"wrandom", wrandom, false});
+}
+
 BOOST_AUTO_TEST_CASE(test_wrandom) {
   auto dq = getDQ();
 
@@ -0,0 +1,409 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist.hh"
+#include "dnsdist-metrics.hh"
+
+struct DNSDistStats g_stats;
+GlobalStateHolder<servers_t> g_dstates;
+GlobalStateHolder<pools_t> g_pools;
+std::vector<std::unique_ptr<ClientState>> g_frontends;
+std::vector<std::shared_ptr<DOHFrontend>> g_dohlocals;
+
+uint64_t getLatencyCount(const std::string&)
+{
+  return 0;
+}
+
+uint64_t uptimeOfProcess(const std::string&)
+{
+  return 0;
+}
+
+BOOST_AUTO_TEST_SUITE(dnsdistmetrics_cc)
+
+BOOST_AUTO_TEST_CASE(test_ShardedCounter) {
+  ShardedCounter counter;
+  BOOST_CHECK_EQUAL(counter.load(), 0U);
+
+  ++counter;
+  counter++;
+  counter += 40;
+  BOOST_CHECK_EQUAL(counter.load(), 42U);
+  BOOST_CHECK_EQUAL(static_cast<uint64_t>(counter), 42U);
+
+  counter = 1;
+  BOOST_CHECK_EQUAL(counter.load(), 1U);
+
+  ShardedCounter initialized(10);
+  BOOST_CHECK_EQUAL(initialized.load(), 10U);
+}
+
+BOOST_AUTO_TEST_CASE(test_ShardedCounterThreads) {
+  ShardedCounter counter;
+  const size_t numberOfThreads = 32;
+  const size_t incrementsPerThread = 10000;
+
+  std::vector<std::thread> threads;
+  for (size_t idx = 0; idx < numberOfThreads; idx++) {
+    threads.push_back(std::thread([&counter]() {
+      for (size_t inc = 0; inc < incrementsPerThread; inc++) {
+        ++counter;
+      }
+    }));
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  BOOST_CHECK_EQUAL(counter.load(), numberOfThreads * incrementsPerThread);
+
+  /* storing a value resets the slots updated by the other threads */
+  counter.store(0);
+  BOOST_CHECK_EQUAL(counter.load(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_MetricsWriter) {
+  std::string buffer;
+  MetricsWriter writer(buffer, "\n");
+
+  writer.addRaw("# TYPE dnsdist_queries counter\n");
+  writer.add("dnsdist_queries ", 0U);
+  writer.add("dnsdist_responses ", std::numeric_limits<uint64_t>::max());
+  writer.add("dnsdist_server_order ", 1);
+  writer.add("dnsdist_latency_avg100 ", 0.0);
+  writer.add("dnsdist_server_latency ", 1.5);
+  writer.add("dnsdist_server_tcpavgconnduration ", 1234567.0);
+  writer.finish();
+
+  BOOST_CHECK_EQUAL(buffer, "# TYPE dnsdist_queries counter\n"
+                            "dnsdist_queries 0\n"
+                            "dnsdist_responses 18446744073709551615\n"
+                            "dnsdist_server_order 1\n"
+                            "dnsdist_latency_avg100 0\n"
+                            "dnsdist_server_latency 1.5\n"
+                            "dnsdist_server_tcpavgconnduration 1.23457e+06\n");
+}
+
+BOOST_AUTO_TEST_CASE(test_MetricsWriterFlush) {
+  std::string buffer;
+  std::string sent;
+  size_t flushes = 0;
+
+  {
+    MetricsWriter writer(buffer, " 1590000000\r\n", [&sent, &flushes](const std::string& data) {
+      sent += data;
+      flushes++;
+    }, 64);
+
+    for (size_t idx = 0; idx < 10; idx++) {
+      writer.add("dnsdist.host.main.queries ", idx);
+    }
+    /* every line is 40 bytes long, so we should have flushed every other line */
+    BOOST_CHECK_EQUAL(flushes, 5U);
+    BOOST_CHECK(buffer.empty());
+
+    writer.add("dnsdist.host.main.responses ", 42U);
+    BOOST_CHECK_EQUAL(flushes, 5U);
+    BOOST_CHECK(!buffer.empty());
+
+    writer.finish();
+    BOOST_CHECK_EQUAL(flushes, 6U);
+    BOOST_CHECK(buffer.empty());
+
+    /* nothing left to send */
+    writer.finish();
+    BOOST_CHECK_EQUAL(flushes, 6U);
+  }
+
+  BOOST_CHECK(sent.find("dnsdist.host.main.queries 0 1590000000\r\n") == 0);
+  BOOST_CHECK(sent.find("dnsdist.host.main.queries 9 1590000000\r\n") != std::string::npos);
+  BOOST_CHECK(sent.find("dnsdist.host.main.responses 42 1590000000\r\n") != std::string::npos);
+}
+
+/* keep only the lines starting with one of the prefixes, sorted since the order of the metrics of a given object does not matter.
+   labelledOnly skips the global metrics, some of them sharing a prefix with the frontend ones */
+static std::vector<std::string> getLines(const std::string& output, const std::vector<std::string>& prefixes, bool labelledOnly = false)
+{
+  std::vector<std::string> result;
+  std::vector<std::string> lines;
+  stringtok(lines, output, "\n");
+  for (const auto& line : lines) {
+    for (const auto& prefix : prefixes) {
+      if (line.compare(0, prefix.size(), prefix) == 0 && (!labelledOnly || line.find('{') != std::string::npos)) {
+        result.push_back(line);
+        break;
+      }
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+static std::string dumpMetrics(MetricsExporter& exporter)
+{
+  std::string buffer;
+  MetricsWriter writer(buffer, "\n");
+  exporter.dump(writer);
+  writer.finish();
+  return buffer;
+}
+
+static std::vector<std::string> getExpected(const std::string& prefix, const std::vector<std::pair<std::string, std::string>>& metrics, const std::string& suffix)
+{
+  std::vector<std::string> result;
+  for (const auto& metric : metrics) {
+    result.push_back(prefix + metric.first + suffix + " " + metric.second);
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+static std::shared_ptr<DownstreamState> getBackend(const std::string& address, const std::string& name)
+{
+  auto dss = std::make_shared<DownstreamState>(ComboAddress(address), ComboAddress(), 0, std::string(), 1, false);
+  dss->setName(name);
+  return dss;
+}
+
+static void setupObjects()
+{
+  auto backend = getBackend("192.0.2.1:53", "backend.one");
+  backend->setUp();
+  backend->queries += 42;
+  backend->latencyUsec = 1500.0;
+  backend->order = 2;
+  backend->weight = 3;
+  backend->checkLatency.latency1_10 += 2;
+  backend->checkLatency.latencySum += 7;
+  g_dstates.setState({backend});
+
+  g_frontends.clear();
+  /* two UDP frontends on the same address, as with several listening threads, and a DoT one */
+  for (size_t idx = 0; idx < 2; idx++) {
+    auto udp = std::unique_ptr<ClientState>(new ClientState(ComboAddress("127.0.0.1:53"), false, false, 0, "", {}));
+    udp->udpFD = 42;
+    udp->queries += 10 + idx;
+    g_frontends.push_back(std::move(udp));
+  }
+  auto dot = std::unique_ptr<ClientState>(new ClientState(ComboAddress("127.0.0.1:853"), true, false, 0, "", {}));
+  dot->tcpFD = 43;
+  dot->tlsFrontend = std::make_shared<TLSFrontend>();
+  dot->tcpPipelinedQueries += 5;
+  dot->tls13queries += 6;
+  dot->tlsFrontend->d_tlsCounters.d_unsupportedProtocol += 7;
+  g_frontends.push_back(std::move(dot));
+
+  pools_t pools;
+  pools[""] = std::make_shared<ServerPool>();
+  pools[""]->packetCache = std::make_shared<DNSDistPacketCache>(100);
+  pools["pool.two"] = std::make_shared<ServerPool>();
+  g_pools.setState(pools);
+}
+
+static void clearObjects()
+{
+  g_dstates.setState(servers_t());
+  g_pools.setState(pools_t());
+  g_frontends.clear();
+}
+
+/* the expected names, labels and values are the ones the web server generated before the MetricsExporter was introduced */
+BOOST_AUTO_TEST_CASE(test_MetricsExporterPrometheus) {
+  setupObjects();
+  MetricsExporter exporter;
+
+  /* the cached names should not alter the output of the following dumps */
+  for (size_t iteration = 0; iteration < 2; iteration++) {
+    const auto output = dumpMetrics(exporter);
+
+    auto expected = getExpected("dnsdist_server_", {
+        {"status", "1"}, {"queries", "42"}, {"responses", "0"}, {"drops", "0"}, {"latency", "1.5"}, {"senderrors", "0"}, {"outstanding", "0"}, {"order", "2"}, {"weight", "3"},
+        {"tcpdiedsendingquery", "0"}, {"tcpdiedreadingresponse", "0"}, {"tcpgaveup", "0"}, {"tcpreadtimeouts", "0"}, {"tcpwritetimeouts", "0"}, {"tcpcurrentconnections", "0"},
+        {"tcpavgqueriesperconn", "0"}, {"tcpavgconnduration", "0"},
+      }, "{server=\"backend_one\",address=\"192.0.2.1:53\"}");
+    const std::string histogramLabels = "server=\"backend_one\",address=\"192.0.2.1:53\"";
+    for (const auto& bucket : std::vector<std::pair<std::string, std::string>>{ {"1", "0"}, {"10", "2"}, {"50", "2"}, {"100", "2"}, {"1000", "2"}, {"+Inf", "2"} }) {
+      expected.push_back("dnsdist_server_healthcheck_latency_bucket{" + histogramLabels + ",le=\"" + bucket.first + "\"} " + bucket.second);
+    }
+    expected.push_back("dnsdist_server_healthcheck_latency_sum{" + histogramLabels + "} 7");
+    expected.push_back("dnsdist_server_healthcheck_latency_count{" + histogramLabels + "} 2");
+    std::sort(expected.begin(), expected.end());
+    auto lines = getLines(output, {"dnsdist_server_"});
+    BOOST_CHECK_EQUAL_COLLECTIONS(lines.begin(), lines.end(), expected.begin(), expected.end());
+
+    /* the UDP frontends only have the generic metrics, and are told apart by the thread label */
+    expected = getExpected("dnsdist_frontend_", { {"queries", "10"}, {"responses", "0"} }, "{frontend=\"127.0.0.1:53\",proto=\"UDP\",thread=\"0\"}");
+    auto second = getExpected("dnsdist_frontend_", { {"queries", "11"}, {"responses", "0"} }, "{frontend=\"127.0.0.1:53\",proto=\"UDP\",thread=\"1\"}");
+    expected.insert(expected.end(), second.begin(), second.end());
+    const std::string dotLabels = "frontend=\"127.0.0.1:853\",proto=\"TCP (DNS over TLS)\",thread=\"0\"";
+    auto dot = getExpected("dnsdist_frontend_", {
+        {"queries", "0"}, {"responses", "0"}, {"tcpdiedreadingquery", "0"}, {"tcpdiedsendingresponse", "0"}, {"tcpgaveup", "0"}, {"tcpclientimeouts", "0"}, {"tcpdownstreamtimeouts", "0"},
+        {"tcpcurrentconnections", "0"}, {"tcpavgqueriesperconnection", "0"}, {"tcpavgconnectionduration", "0"}, {"tcppipelinedqueries", "5"}, {"tcpinflightlimitreached", "0"},
+        {"tlsnewsessions", "0"}, {"tlsresumptions", "0"}, {"tlsunknownticketkeys", "0"}, {"tlsinactiveticketkeys", "0"}, {"tlsktlssessions", "0"},
+      }, "{" + dotLabels + "}");
+    expected.insert(expected.end(), dot.begin(), dot.end());
+    for (const auto& version : std::vector<std::pair<std::string, std::string>>{ {"tls10", "0"}, {"tls11", "0"}, {"tls12", "0"}, {"tls13", "6"}, {"unknown", "0"} }) {
+      expected.push_back("dnsdist_frontend_tlsqueries{" + dotLabels + ",tls=\"" + version.first + "\"} " + version.second);
+    }
+    /* the old output had a stray '{' in the unsupportedProtocol label */
+    for (const auto& error : std::vector<std::pair<std::string, std::string>>{ {"dhKeyTooSmall", "0"}, {"inappropriateFallBack", "0"}, {"noSharedCipher", "0"}, {"unknownCipherType", "0"}, {"unknownKeyExchangeType", "0"}, {"unknownProtocol", "0"}, {"unsupportedEC", "0"}, {"unsupportedProtocol", "7"} }) {
+      expected.push_back("dnsdist_frontend_tlshandshakefailures{" + dotLabels + ",error=\"" + error.first + "\"} " + error.second);
+    }
+    std::sort(expected.begin(), expected.end());
+    lines = getLines(output, {"dnsdist_frontend_"}, true);
+    BOOST_CHECK_EQUAL_COLLECTIONS(lines.begin(), lines.end(), expected.begin(), expected.end());
+
+    expected = getExpected("dnsdist_pool_", {
+        {"servers", "0"}, {"active_servers", "0"}, {"cache_size", "100"}, {"cache_entries", "0"}, {"cache_hits", "0"}, {"cache_misses", "0"}, {"cache_deferred_inserts", "0"},
+        {"cache_deferred_lookups", "0"}, {"cache_lookup_collisions", "0"}, {"cache_insert_collisions", "0"}, {"cache_ttl_too_shorts", "0"},
+      }, "{pool=\"_default_\"}");
+    second = getExpected("dnsdist_pool_", { {"servers", "0"}, {"active_servers", "0"} }, "{pool=\"pool.two\"}");
+    expected.insert(expected.end(), second.begin(), second.end());
+    std::sort(expected.begin(), expected.end());
+    lines = getLines(output, {"dnsdist_pool_"});
+    BOOST_CHECK_EQUAL_COLLECTIONS(lines.begin(), lines.end(), expected.begin(), expected.end());
+
+    /* every metric is preceded by its description, only once */
+    BOOST_CHECK_EQUAL(getLines(output, {"# TYPE dnsdist_server_queries "}).size(), 1U);
+    BOOST_CHECK_EQUAL(getLines(output, {"# HELP dnsdist_frontend_tlsqueries "}).size(), 1U);
+    BOOST_CHECK_EQUAL(getLines(output, {"# TYPE dnsdist_pool_cache_size gauge"}).size(), 1U);
+    BOOST_CHECK_EQUAL(getLines(output, {"# TYPE dnsdist_queries counter"}).size(), 1U);
+    BOOST_CHECK_EQUAL(getLines(output, {"dnsdist_queries "}).size(), 1U);
+    BOOST_CHECK_EQUAL(getLines(output, {"dnsdist_latency_count "}).size(), 1U);
+    /* too expensive, and blacklisted */
+    BOOST_CHECK(getLines(output, {"dnsdist_special_memory_usage", "dnsdist_latency_sum{"}).empty());
+  }
+
+  clearObjects();
+}
+
+BOOST_AUTO_TEST_CASE(test_MetricsExporterCarbon) {
+  setupObjects();
+  MetricsExporter exporter("dnsdist.host.main.", "host");
+
+  for (size_t iteration = 0; iteration < 2; iteration++) {
+    const auto output = dumpMetrics(exporter);
+
+    /* carbon has always used these typos */
+    auto expected = getExpected("dnsdist.host.main.servers.backend_one.", {
+        {"queries", "42"}, {"responses", "0"}, {"drops", "0"}, {"latency", "1.5"}, {"senderrors", "0"}, {"outstanding", "0"},
+        {"tcpdiedsendingquery", "0"}, {"tcpdiedreaddingresponse", "0"}, {"tcpgaveup", "0"}, {"tcpreadimeouts", "0"}, {"tcpwritetimeouts", "0"},
+        {"tcpcurrentconnections", "0"}, {"tcpavgqueriesperconnection", "0"}, {"tcpavgconnectionduration", "0"},
+      }, "");
+    auto lines = getLines(output, {"dnsdist.host.main.servers."});
+    BOOST_CHECK_EQUAL_COLLECTIONS(lines.begin(), lines.end(), expected.begin(), expected.end());
+
+    /* carbon exports all the TCP and TLS metrics for every frontend */
+    const std::vector<std::pair<std::string, std::string>> frontendMetrics{
+      {"responses", "0"}, {"tcpdiedreadingquery", "0"}, {"tcpdiedsendingresponse", "0"}, {"tcpgaveup", "0"}, {"tcpclientimeouts", "0"}, {"tcpdownstreamtimeouts", "0"},
+      {"tcpcurrentconnections", "0"}, {"tcpavgqueriesperconnection", "0"}, {"tcpavgconnectionduration", "0"}, {"tcpinflightlimitreached", "0"},
+      {"tls10-queries", "0"}, {"tls11-queries", "0"}, {"tls12-queries", "0"}, {"tls-unknown-queries", "0"},
+      {"tlsnewsessions", "0"}, {"tlsresumptions", "0"}, {"tlsunknownticketkeys", "0"}, {"tlsinactiveticketkeys", "0"}, {"tlsktlssessions", "0"},
+    };
+    expected.clear();
+    const std::vector<std::pair<std::string, std::vector<std::pair<std::string, std::string>>>> frontends{
+      {"127_0_0_1:53_udp", { {"queries", "10"}, {"tcppipelinedqueries", "0"}, {"tls13-queries", "0"} }},
+      {"127_0_0_1:53_udp_1", { {"queries", "11"}, {"tcppipelinedqueries", "0"}, {"tls13-queries", "0"} }},
+      {"127_0_0_1:853_tcp", { {"queries", "0"}, {"tcppipelinedqueries", "5"}, {"tls13-queries", "6"},
+                              {"tlsdhkeytoosmall", "0"}, {"tlsinappropriatefallback", "0"}, {"tlsnosharedcipher", "0"}, {"tlsunknownciphertype", "0"},
+                              {"tlsunknownkeyexchangetype", "0"}, {"tlsunknownprotocol", "0"}, {"tlsunsupportedec", "0"}, {"tlsunsupportedprotocol", "7"} }},
+    };
+    for (const auto& frontend : frontends) {
+      auto metrics = frontendMetrics;
+      metrics.insert(metrics.end(), frontend.second.begin(), frontend.second.end());
+      auto frontendExpected = getExpected("dnsdist.host.main.frontends." + frontend.first + ".", metrics, "");
+      expected.insert(expected.end(), frontendExpected.begin(), frontendExpected.end());
+    }
+    std::sort(expected.begin(), expected.end());
+    lines = getLines(output, {"dnsdist.host.main.frontends."});
+    BOOST_CHECK_EQUAL_COLLECTIONS(lines.begin(), lines.end(), expected.begin(), expected.end());
+
+    expected = getExpected("dnsdist.host.main.pools._default_.", {
+        {"servers", "0"}, {"servers-up", "0"}, {"cache-size", "100"}, {"cache-entries", "0"}, {"cache-hits", "0"}, {"cache-misses", "0"}, {"cache-deferred-inserts", "0"},
+        {"cache-deferred-lookups", "0"}, {"cache-lookup-collisions", "0"}, {"cache-insert-collisions", "0"}, {"cache-ttl-too-shorts", "0"},
+      }, "");
+    auto second = getExpected("dnsdist.host.main.pools.pool_two.", { {"servers", "0"}, {"servers-up", "0"} }, "");
+    expected.insert(expected.end(), second.begin(), second.end());
+    std::sort(expected.begin(), expected.end());
+    lines = getLines(output, {"dnsdist.host.main.pools."});
+    BOOST_CHECK_EQUAL_COLLECTIONS(lines.begin(), lines.end(), expected.begin(), expected.end());
+
+    /* every global stat is exported to carbon, without any description */
+    BOOST_CHECK_EQUAL(getLines(output, {"dnsdist.host.main.queries "}).size(), 1U);
+    BOOST_CHECK_EQUAL(getLines(output, {"dnsdist.host.main.special-memory-usage "}).size(), 1U);
+    BOOST_CHECK(getLines(output, {"#"}).empty());
+  }
+
+  clearObjects();
+}
+
+BOOST_AUTO_TEST_CASE(test_MetricsExporterBackendChanges) {
+  MetricsExporter prometheus;
+  MetricsExporter carbon("dnsdist.host.main.", "host");
+
+  auto backend = getBackend("192.0.2.1:53", "backend.one");
+  g_dstates.setState({backend});
+  BOOST_CHECK_EQUAL(getLines(dumpMetrics(prometheus), {"dnsdist_server_queries{server=\"backend_one\",address=\"192.0.2.1:53\"} 0"}).size(), 1U);
+  BOOST_CHECK_EQUAL(getLines(dumpMetrics(carbon), {"dnsdist.host.main.servers.backend_one.queries 0"}).size(), 1U);
+
+  /* renaming */
+  backend->setName("backend.renamed");
+  auto output = dumpMetrics(prometheus);
+  BOOST_CHECK_EQUAL(getLines(output, {"dnsdist_server_queries{server=\"backend_renamed\",address=\"192.0.2.1:53\"} 0"}).size(), 1U);
+  BOOST_CHECK_EQUAL(getLines(output, {"dnsdist_server_healthcheck_latency_count{server=\"backend_renamed\",address=\"192.0.2.1:53\"} 0"}).size(), 1U);
+  BOOST_CHECK(getLines(output, {"dnsdist_server_queries{server=\"backend_one\""}).empty());
+  output = dumpMetrics(carbon);
+  BOOST_CHECK_EQUAL(getLines(output, {"dnsdist.host.main.servers.backend_renamed.queries 0"}).size(), 1U);
+  BOOST_CHECK(getLines(output, {"dnsdist.host.main.servers.backend_one."}).empty());
+
+  /* without a name, the address is used */
+  backend->setName("");
+  BOOST_CHECK_EQUAL(getLines(dumpMetrics(prometheus), {"dnsdist_server_queries{server=\"192_0_2_1:53\",address=\"192.0.2.1:53\"} 0"}).size(), 1U);
+  BOOST_CHECK_EQUAL(getLines(dumpMetrics(carbon), {"dnsdist.host.main.servers.192_0_2_1:53.queries 0"}).size(), 1U);
+
+  /* replacing it by a new one */
+  backend = getBackend("192.0.2.2:53", "backend.two");
+  g_dstates.setState({backend});
+  output = dumpMetrics(prometheus);
+  BOOST_CHECK_EQUAL(getLines(output, {"dnsdist_server_queries{"}).size(), 1U);
+  BOOST_CHECK_EQUAL(getLines(output, {"dnsdist_server_queries{server=\"backend_two\",address=\"192.0.2.2:53\"} 0"}).size(), 1U);
+  BOOST_CHECK_EQUAL(getLines(output, {"dnsdist_server_healthcheck_latency_count{"}).size(), 1U);
+  output = dumpMetrics(carbon);
+  BOOST_CHECK_EQUAL(getLines(output, {"dnsdist.host.main.servers."}).size(), 14U);
+  BOOST_CHECK_EQUAL(getLines(output, {"dnsdist.host.main.servers.backend_two.queries 0"}).size(), 1U);
+
+  /* replacing it by a new one with the same name, living at the same address in memory as the removed one */
+  typedef std::aligned_storage<sizeof(DownstreamState), alignof(DownstreamState)>::type storage_t;
+  auto storage = std::unique_ptr<storage_t>(new storage_t);
+  auto inPlaceDeleter = [](DownstreamState* ds) { ds->~DownstreamState(); };
+  backend = std::shared_ptr<DownstreamState>(new (storage.get()) DownstreamState(ComboAddress("192.0.2.3:53"), ComboAddress(), 0, std::string(), 1, false), inPlaceDeleter);
+  backend->setName("backend.same");
+  g_dstates.setState({backend});
+  BOOST_CHECK_EQUAL(getLines(dumpMetrics(prometheus), {"dnsdist_server_queries{server=\"backend_same\",address=\"192.0.2.3:53\"} 0"}).size(), 1U);
+  BOOST_CHECK_EQUAL(getLines(dumpMetrics(carbon), {"dnsdist.host.main.servers.backend_same.queries 0"}).size(), 1U);
+
+  g_dstates.setState(servers_t());
+  backend.reset();
+  backend = std::shared_ptr<DownstreamState>(new (storage.get()) DownstreamState(ComboAddress("192.0.2.4:53"), ComboAddress(), 0, std::string(), 1, false), inPlaceDeleter);
+  backend->setName("backend.same");
+  backend->queries += 1;
+  g_dstates.setState({backend});
+  output = dumpMetrics(prometheus);
+  BOOST_CHECK_EQUAL(getLines(output, {"dnsdist_server_queries{"}).size(), 1U);
+  BOOST_CHECK_EQUAL(getLines(output, {"dnsdist_server_queries{server=\"backend_same\",address=\"192.0.2.4:53\"} 1"}).size(), 1U);
+  BOOST_CHECK_EQUAL(getLines(output, {"dnsdist_server_healthcheck_latency_count{server=\"backend_same\",address=\"192.0.2.4:53\"} 0"}).size(), 1U);
+  BOOST_CHECK_EQUAL(getLines(dumpMetrics(carbon), {"dnsdist.host.main.servers.backend_same.queries 1"}).size(), 1U);
+
+  g_dstates.setState(servers_t());
+  backend.reset();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -271,4 +271,162 @@ BOOST_AUTO_TEST_CASE(test_Rings_Threaded) {
 #endif
 }
 
+BOOST_AUTO_TEST_CASE(test_SpaceSavingSummary) {
+  SpaceSavingSummary<std::string> summary(2);
+
+  summary.add("a", 5);
+  summary.add("b", 3);
+  BOOST_CHECK_EQUAL(summary.getEntries().size(), 2U);
+  BOOST_CHECK_EQUAL(summary.getTotal(), 8U);
+
+  /* "c" evicts "b", the smallest entry, and inherits its count */
+  summary.add("c");
+  BOOST_CHECK_EQUAL(summary.getEntries().size(), 2U);
+  BOOST_CHECK_EQUAL(summary.getTotal(), 9U);
+  bool foundA = false, foundC = false;
+  for (const auto& entry : summary.getEntries()) {
+    if (entry.key == "a") {
+      foundA = true;
+      BOOST_CHECK_EQUAL(entry.count, 5U);
+      BOOST_CHECK_EQUAL(entry.error, 0U);
+    }
+    else if (entry.key == "c") {
+      foundC = true;
+      BOOST_CHECK_EQUAL(entry.count, 4U);
+      BOOST_CHECK_EQUAL(entry.error, 3U);
+    }
+  }
+  BOOST_CHECK(foundA);
+  BOOST_CHECK(foundC);
+
+  summary.clear();
+  BOOST_CHECK_EQUAL(summary.getEntries().size(), 0U);
+  BOOST_CHECK_EQUAL(summary.getTotal(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_WindowedSpaceSavingSummary) {
+  WindowedSpaceSavingSummary<std::string> summary(10, 60, 10);
+  BOOST_CHECK_EQUAL(summary.getWindow(), 60U);
+
+  const time_t now = 1000;
+  summary.add(now - 30, "old", 10);
+  summary.add(now, "new", 5);
+
+  WindowedSpaceSavingSummary<std::string>::counts_t counts;
+  /* whole window */
+  BOOST_CHECK_EQUAL(summary.collect(now, 0, counts), 15U);
+  BOOST_CHECK_EQUAL(counts.size(), 2U);
+  BOOST_CHECK_EQUAL(counts["old"], 10U);
+  BOOST_CHECK_EQUAL(counts["new"], 5U);
+
+  /* only the last 10 seconds */
+  counts.clear();
+  BOOST_CHECK_EQUAL(summary.collect(now, 10, counts), 5U);
+  BOOST_CHECK_EQUAL(counts.size(), 1U);
+  BOOST_CHECK_EQUAL(counts["new"], 5U);
+
+  /* once we are past the window, the old bucket is no longer considered, then recycled */
+  counts.clear();
+  BOOST_CHECK_EQUAL(summary.collect(now + 40, 0, counts), 5U);
+  summary.add(now + 40, "newer", 1);
+  counts.clear();
+  BOOST_CHECK_EQUAL(summary.collect(now + 40, 0, counts), 6U);
+  BOOST_CHECK_EQUAL(counts.count("old"), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_Rings_Summaries) {
+  Rings rings(100, 2, 0);
+  Rings::ClientsSummary::counts_t clients;
+  Rings::NamesSummary::counts_t names;
+  uint64_t total = 0;
+
+  /* disabled by default */
+  BOOST_CHECK(!rings.hasSummaries());
+  BOOST_CHECK(!rings.getSummarizedClients(Rings::ClientsSummaryType::Queries, 0, 0, clients, total));
+
+  Rings::SummariesSettings settings;
+  settings.capacity = 10;
+  settings.window = 60;
+  settings.granularity = 10;
+  settings.suffixLabels = 2;
+  rings.setSummaries(settings);
+  BOOST_CHECK(rings.hasSummaries());
+  BOOST_CHECK_EQUAL(rings.getSummariesWindow(), 60U);
+
+  dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  const DNSName qname("www.rings.powerdns.com.");
+  const DNSName other("other.example.net.");
+  const ComboAddress requestor1("192.0.2.1");
+  const ComboAddress requestor2("192.0.2.2");
+  const ComboAddress server("192.0.2.42:53");
+  struct timespec now;
+  gettime(&now);
+
+  for (size_t idx = 0; idx < 10; idx++) {
+    rings.insertQuery(now, requestor1, qname, QType::A, 100, dh);
+  }
+  rings.insertQuery(now, requestor2, other, QType::A, 50, dh);
+  dh.rcode = RCode::NXDomain;
+  for (size_t idx = 0; idx < 3; idx++) {
+    rings.insertResponse(now, requestor2, other, QType::A, 1000, 200, dh, server);
+  }
+
+  BOOST_CHECK(rings.getSummarizedClients(Rings::ClientsSummaryType::Queries, 0, 0, clients, total));
+  BOOST_CHECK_EQUAL(total, 11U);
+  BOOST_CHECK_EQUAL(clients[requestor1], 10U);
+  BOOST_CHECK_EQUAL(clients[requestor2], 1U);
+
+  clients.clear();
+  BOOST_CHECK(rings.getSummarizedClients(Rings::ClientsSummaryType::Bandwidth, 0, 0, clients, total));
+  BOOST_CHECK_EQUAL(total, 1000U + 50U + 600U);
+  BOOST_CHECK_EQUAL(clients[requestor1], 1000U);
+  BOOST_CHECK_EQUAL(clients[requestor2], 650U);
+
+  clients.clear();
+  BOOST_CHECK(rings.getSummarizedClients(Rings::ClientsSummaryType::RCode, RCode::NXDomain, 0, clients, total));
+  BOOST_CHECK_EQUAL(total, 3U);
+  BOOST_CHECK_EQUAL(clients.size(), 1U);
+  BOOST_CHECK_EQUAL(clients[requestor2], 3U);
+
+  clients.clear();
+  BOOST_CHECK(rings.getSummarizedClients(Rings::ClientsSummaryType::RCode, RCode::ServFail, 0, clients, total));
+  BOOST_CHECK_EQUAL(total, 0U);
+  BOOST_CHECK_EQUAL(clients.size(), 0U);
+
+  /* a period larger than the window can't be answered from the summaries */
+  BOOST_CHECK(!rings.getSummarizedClients(Rings::ClientsSummaryType::Queries, 0, 120, clients, total));
+
+  BOOST_CHECK(rings.getSummarizedNames(boost::none, boost::none, 0, names, total));
+  BOOST_CHECK_EQUAL(total, 11U);
+  BOOST_CHECK_EQUAL(names[qname], 10U);
+  BOOST_CHECK_EQUAL(names[other], 1U);
+
+  names.clear();
+  BOOST_CHECK(rings.getSummarizedNames(boost::none, 2U, 0, names, total));
+  BOOST_CHECK_EQUAL(names[DNSName("powerdns.com.")], 10U);
+  BOOST_CHECK_EQUAL(names[DNSName("example.net.")], 1U);
+
+  names.clear();
+  BOOST_CHECK(rings.getSummarizedNames(boost::none, 1U, 0, names, total));
+  BOOST_CHECK_EQUAL(names[DNSName("com.")], 10U);
+  BOOST_CHECK_EQUAL(names[DNSName("net.")], 1U);
+
+  /* we do not keep more than 2 labels */
+  BOOST_CHECK(!rings.getSummarizedNames(boost::none, 3U, 0, names, total));
+
+  names.clear();
+  BOOST_CHECK(rings.getSummarizedNames(static_cast<uint8_t>(RCode::NXDomain), boost::none, 0, names, total));
+  BOOST_CHECK_EQUAL(total, 3U);
+  BOOST_CHECK_EQUAL(names.size(), 1U);
+  BOOST_CHECK_EQUAL(names[other], 3U);
+
+  /* clearing the rings clears the summaries as well */
+  rings.clear();
+  clients.clear();
+  BOOST_CHECK(rings.getSummarizedClients(Rings::ClientsSummaryType::Queries, 0, 0, clients, total));
+  BOOST_CHECK_EQUAL(total, 0U);
+  BOOST_CHECK_EQUAL(clients.size(), 0U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,150 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist-rule-chain.hh"
+#include "dnsdist-rules.hh"
+
+BOOST_AUTO_TEST_SUITE(dnsdistrulechain_cc)
+
+static DNSDistRuleAction makeRuleAction(std::shared_ptr<DNSRule> rule)
+{
+  DNSDistRuleAction ra;
+  ra.d_rule = rule;
+  ra.d_creationOrder = 0;
+  return ra;
+}
+
+static std::vector<size_t> getAllMatches(const DNSRuleChain& chain, const DNSQuestion& dq)
+{
+  std::vector<size_t> result;
+  for (size_t idx = chain.findNextMatch(dq, 0); idx < chain.getRules().size(); idx = chain.findNextMatch(dq, idx + 1)) {
+    result.push_back(idx);
+  }
+  return result;
+}
+
+static std::vector<size_t> getAllMatchesLinear(const std::vector<DNSDistRuleAction>& rules, const DNSQuestion& dq)
+{
+  std::vector<size_t> result;
+  for (size_t idx = 0; idx < rules.size(); idx++) {
+    if (rules.at(idx).d_rule->matches(&dq)) {
+      result.push_back(idx);
+    }
+  }
+  return result;
+}
+
+BOOST_AUTO_TEST_CASE(test_RuleChain) {
+  std::vector<DNSDistRuleAction> rules;
+
+  /* 0 */
+  rules.push_back(makeRuleAction(std::make_shared<QNameRule>(DNSName("www.powerdns.com."))));
+  SuffixMatchNode smn;
+  smn.add(DNSName("powerdns.com."));
+  smn.add(DNSName("sub.powerdns.com."));
+  /* 1 */
+  rules.push_back(makeRuleAction(std::make_shared<SuffixMatchNodeRule>(smn)));
+  SuffixMatchNode deeper;
+  deeper.add(DNSName("deep.sub.powerdns.com."));
+  /* 2 */
+  rules.push_back(makeRuleAction(std::make_shared<SuffixMatchNodeRule>(deeper)));
+  NetmaskGroup nmg;
+  nmg.addMask("192.0.2.0/24");
+  nmg.addMask("192.0.2.128/25");
+  nmg.addMask("2001:db8::/32");
+  /* 3 */
+  rules.push_back(makeRuleAction(std::make_shared<NetmaskGroupRule>(nmg, true)));
+  NetmaskGroup narrower;
+  narrower.addMask("192.0.2.1/32");
+  /* 4 */
+  rules.push_back(makeRuleAction(std::make_shared<NetmaskGroupRule>(narrower, true)));
+  /* 5 */
+  rules.push_back(makeRuleAction(std::make_shared<QTypeRule>(QType::AAAA)));
+  DNSNameSet names;
+  names.insert(DNSName("www.powerdns.com."));
+  names.insert(DNSName("powerdns.org."));
+  /* 6 */
+  rules.push_back(makeRuleAction(std::make_shared<QNameSetRule>(names)));
+  /* 7, not compilable: breaks the run */
+  rules.push_back(makeRuleAction(std::make_shared<RDRule>()));
+  /* 8, lonely rule, not compiled */
+  rules.push_back(makeRuleAction(std::make_shared<QTypeRule>(QType::A)));
+  NetmaskGroup withNegative;
+  withNegative.addMask("192.0.2.0/24");
+  withNegative.addMask("!192.0.2.1");
+  /* 9, not compilable because of the negative entry */
+  rules.push_back(makeRuleAction(std::make_shared<NetmaskGroupRule>(withNegative, true)));
+  /* 10, destination: not compilable either */
+  rules.push_back(makeRuleAction(std::make_shared<NetmaskGroupRule>(nmg, false)));
+  /* 11, 12 */
+  rules.push_back(makeRuleAction(std::make_shared<QTypeRule>(QType::A)));
+  rules.push_back(makeRuleAction(std::make_shared<QNameRule>(DNSName("powerdns.org."))));
+
+  DNSRuleChain chain(std::make_shared<const std::vector<DNSDistRuleAction>>(rules));
+  BOOST_CHECK_EQUAL(chain.getGroupsCount(), 2U);
+  BOOST_CHECK_EQUAL(chain.getCompiledRulesCount(), 9U);
+
+  const std::vector<std::string> qnames = { "www.powerdns.com.", "WWW.PowerDNS.com.", "powerdns.com.", "sub.powerdns.com.", "deep.sub.powerdns.com.", "a.deep.sub.powerdns.com.", "powerdns.org.", "www.powerdns.org.", "example.com." };
+  const std::vector<std::string> sources = { "192.0.2.1:42", "192.0.2.2:42", "192.0.2.200:42", "198.51.100.1:42", "[2001:db8::1]:42" };
+  const std::vector<uint16_t> qtypes = { QType::A, QType::AAAA, QType::MX };
+  const ComboAddress lc("127.0.0.1:53");
+  uint16_t qclass = QClass::IN;
+  size_t bufferSize = 0;
+  size_t queryLen = 0;
+  bool isTcp = false;
+  struct timespec queryRealTime;
+  gettime(&queryRealTime, true);
+
+  for (const auto& qname : qnames) {
+    const DNSName name(qname);
+    for (const auto& source : sources) {
+      const ComboAddress remote(source);
+      for (const auto qtype : qtypes) {
+        for (const bool rd : { false, true }) {
+          struct dnsheader dh;
+          memset(&dh, 0, sizeof(dh));
+          dh.rd = rd;
+          DNSQuestion dq(&name, qtype, qclass, name.wirelength(), &lc, &remote, &dh, bufferSize, queryLen, isTcp, &queryRealTime);
+          BOOST_CHECK(getAllMatches(chain, dq) == getAllMatchesLinear(rules, dq));
+        }
+      }
+    }
+  }
+
+  /* and a few explicit ones */
+  const DNSName name("a.deep.sub.powerdns.com.");
+  const ComboAddress remote("192.0.2.1:42");
+  struct dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  DNSQuestion dq(&name, QType::MX, qclass, name.wirelength(), &lc, &remote, &dh, bufferSize, queryLen, isTcp, &queryRealTime);
+  BOOST_CHECK_EQUAL(chain.findNextMatch(dq, 0), 1U);
+  BOOST_CHECK_EQUAL(chain.findNextMatch(dq, 2), 2U);
+  BOOST_CHECK_EQUAL(chain.findNextMatch(dq, 3), 3U);
+  BOOST_CHECK_EQUAL(chain.findNextMatch(dq, 4), 4U);
+  /* rd is not set, the negative entry prevents 9 from matching and 10 only looks at the destination */
+  BOOST_CHECK_EQUAL(chain.findNextMatch(dq, 5), rules.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_RuleChain_Empty) {
+  std::vector<DNSDistRuleAction> rules;
+  DNSRuleChain chain(std::make_shared<const std::vector<DNSDistRuleAction>>(rules));
+  BOOST_CHECK_EQUAL(chain.getGroupsCount(), 0U);
+
+  const DNSName name("powerdns.com.");
+  const ComboAddress lc("127.0.0.1:53");
+  const ComboAddress remote("192.0.2.1:42");
+  struct dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  size_t bufferSize = 0;
+  size_t queryLen = 0;
+  bool isTcp = false;
+  struct timespec queryRealTime;
+  gettime(&queryRealTime, true);
+  DNSQuestion dq(&name, QType::A, QClass::IN, name.wirelength(), &lc, &remote, &dh, bufferSize, queryLen, isTcp, &queryRealTime);
+  BOOST_CHECK_EQUAL(chain.findNextMatch(dq, 0), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -15,7 +15,8 @@ BOOST_AUTO_TEST_CASE(test_MaxQPSIPRule) {
   unsigned int expiration = 300;
   unsigned int cleanupDelay = 60;
   unsigned int scanFraction = 10;
-  MaxQPSIPRule rule(maxQPS, maxBurst, 32, 64, expiration, cleanupDelay, scanFraction);
+  size_t shardsCount = 1;
+  MaxQPSIPRule rule(maxQPS, maxBurst, 32, 64, expiration, cleanupDelay, scanFraction, shardsCount);
 
   DNSName qname("powerdns.com.");
   uint16_t qtype = QType::A;
@@ -104,5 +105,62 @@ BOOST_AUTO_TEST_CASE(test_MaxQPSIPRule) {
   BOOST_CHECK_EQUAL(scanned, 0U);
 }
 
+BOOST_AUTO_TEST_CASE(test_MaxQPSIPRule_Sharded) {
+  size_t maxQPS = 10;
+  size_t maxBurst = maxQPS;
+  unsigned int expiration = 300;
+  unsigned int cleanupDelay = 60;
+  unsigned int scanFraction = 1;
+  size_t shardsCount = 16;
+  MaxQPSIPRule rule(maxQPS, maxBurst, 32, 64, expiration, cleanupDelay, scanFraction, shardsCount);
+  BOOST_CHECK_EQUAL(rule.getShardsCount(), shardsCount);
+
+  DNSName qname("powerdns.com.");
+  uint16_t qtype = QType::A;
+  uint16_t qclass = QClass::IN;
+  ComboAddress lc("127.0.0.1:53");
+  ComboAddress rem("192.0.2.1:42");
+  struct dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  size_t bufferSize = 0;
+  size_t queryLen = 0;
+  bool isTcp = false;
+  struct timespec queryRealTime;
+  gettime(&queryRealTime, true);
+
+  DNSQuestion dq(&qname, qtype, qclass, qname.wirelength(), &lc, &rem, &dh, bufferSize, queryLen, isTcp, &queryRealTime);
+
+  /* every source gets its own limiter, whatever shard it ends up in */
+  for (size_t idx = 0; idx < 256; idx++) {
+    rem = ComboAddress("10.0.0." + std::to_string(idx));
+    for (size_t count = 0; count < maxQPS; count++) {
+      BOOST_CHECK_EQUAL(rule.matches(&dq), false);
+    }
+    BOOST_CHECK_EQUAL(rule.matches(&dq), true);
+  }
+  BOOST_CHECK_EQUAL(rule.getEntriesCount(), 256U);
+
+  /* the same v6 /64 shares the same limiter */
+  rem = ComboAddress("2001:db8::1");
+  for (size_t count = 0; count < maxQPS; count++) {
+    BOOST_CHECK_EQUAL(rule.matches(&dq), false);
+  }
+  rem = ComboAddress("2001:db8::2");
+  BOOST_CHECK_EQUAL(rule.matches(&dq), true);
+  BOOST_CHECK_EQUAL(rule.getEntriesCount(), 257U);
+
+  struct timespec expiredTime;
+  gettime(&expiredTime);
+  expiredTime.tv_sec += 1;
+
+  /* with a scan fraction of 1, every shard is entirely scanned */
+  size_t scanned = 0;
+  auto removed = rule.cleanup(expiredTime, &scanned);
+  BOOST_CHECK_EQUAL(removed, 257U);
+  BOOST_CHECK_EQUAL(scanned, 257U);
+  BOOST_CHECK_EQUAL(rule.getEntriesCount(), 0U);
+
+  BOOST_CHECK_THROW(MaxQPSIPRule(maxQPS, maxBurst, 32, 64, expiration, cleanupDelay, scanFraction, 0), std::runtime_error);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
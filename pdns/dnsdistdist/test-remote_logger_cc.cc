@@ -0,0 +1,194 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "remote_logger.hh"
+
+BOOST_AUTO_TEST_SUITE(remote_logger_cc)
+
+BOOST_AUTO_TEST_CASE(test_SPSCMessageRing) {
+  SPSCMessageRing ring(100);
+  CircularWriteBuffer writer(1000);
+
+  /* 2 bytes of length + 30 bytes, three of them fit */
+  const std::string message(30, 'a');
+  BOOST_CHECK(ring.push(message));
+  BOOST_CHECK(ring.push(message));
+  BOOST_CHECK(ring.push(message));
+  BOOST_CHECK_EQUAL(ring.size(), 96U);
+  BOOST_CHECK(!ring.push(message));
+  /* but a smaller one does */
+  BOOST_CHECK(ring.push(std::string(2, 'b')));
+  BOOST_CHECK(!ring.push(std::string()));
+  BOOST_CHECK_EQUAL(ring.size(), 100U);
+
+  BOOST_CHECK_EQUAL(ring.drainInto(writer), 4U);
+  BOOST_CHECK_EQUAL(ring.size(), 0U);
+  BOOST_CHECK(!writer.empty());
+
+  /* messages larger than what the length prefix can express are rejected */
+  SPSCMessageRing large(100000);
+  BOOST_CHECK(!large.push(std::string(70000, 'a')));
+
+  /* a writer without enough room only gets whole messages */
+  CircularWriteBuffer small(40);
+  BOOST_CHECK(ring.push(message));
+  BOOST_CHECK(ring.push(message));
+  BOOST_CHECK_EQUAL(ring.drainInto(small), 1U);
+  BOOST_CHECK_EQUAL(ring.size(), 32U);
+}
+
+BOOST_AUTO_TEST_CASE(test_SPSCMessageRing_WrapAround) {
+  SPSCMessageRing ring(50);
+
+  int fds[2];
+  BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+
+  std::string expected;
+  for (size_t idx = 0; idx < 100; idx++) {
+    const std::string message(idx % 40, 'a' + (idx % 26));
+    BOOST_REQUIRE(ring.push(message));
+    uint16_t len = htons(message.size());
+    expected.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    expected.append(message);
+
+    CircularWriteBuffer writer(100);
+    BOOST_REQUIRE_EQUAL(ring.drainInto(writer), 1U);
+    writer.flush(fds[1]);
+
+    std::string got(message.size() + 2, 0);
+    BOOST_REQUIRE_EQUAL(read(fds[0], &got.at(0), got.size()), static_cast<ssize_t>(got.size()));
+    BOOST_CHECK(got == expected.substr(expected.size() - got.size()));
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(test_SPSCMessageRing_Threads) {
+  SPSCMessageRing ring(1000);
+  const size_t count = 100000;
+
+  std::thread producer([&ring,count]() {
+    for (size_t idx = 0; idx < count; idx++) {
+      const std::string message(idx % 64, 'a' + (idx % 26));
+      while (!ring.push(message)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  size_t drained = 0;
+  while (drained < count) {
+    CircularWriteBuffer writer(500);
+    const auto got = ring.drainInto(writer);
+    if (got == 0) {
+      /* don't starve the producer on a single CPU */
+      std::this_thread::yield();
+    }
+    drained += got;
+  }
+  producer.join();
+
+  BOOST_CHECK_EQUAL(drained, count);
+  BOOST_CHECK_EQUAL(ring.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_RemoteLogger_Threads) {
+  ComboAddress local("127.0.0.1", 0);
+  Socket listener(local.sin4.sin_family, SOCK_STREAM, 0);
+  listener.bind(local);
+  listener.listen(1);
+  socklen_t localLen = local.getSocklen();
+  BOOST_REQUIRE_EQUAL(getsockname(listener.getHandle(), reinterpret_cast<struct sockaddr*>(&local), &localLen), 0);
+
+  const size_t threadsCount = 4;
+  const size_t perThread = 1000;
+  const std::string message(20, 'a');
+  {
+    RemoteLogger logger(local, 2, 100000, 1, false);
+    std::unique_ptr<Socket> conn(listener.accept());
+    BOOST_REQUIRE(conn != nullptr);
+
+    std::vector<std::thread> producers;
+    for (size_t idx = 0; idx < threadsCount; idx++) {
+      producers.emplace_back([&logger,&message]() {
+        for (size_t count = 0; count < perThread; count++) {
+          logger.queueData(message);
+        }
+      });
+    }
+    for (auto& producer : producers) {
+      producer.join();
+    }
+    BOOST_CHECK_EQUAL(logger.toString(), local.toStringWithPort() + " (" + std::to_string(threadsCount * perThread) + " queued, 0 dropped)");
+
+    /* every message is sent exactly once, with its length prefix */
+    std::string expected;
+    uint16_t len = htons(message.size());
+    expected.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    expected.append(message);
+    const size_t total = threadsCount * perThread * expected.size();
+    std::string received;
+    received.reserve(total);
+    while (received.size() < total) {
+      char buffer[4096];
+      ssize_t got = read(conn->getHandle(), buffer, std::min(sizeof(buffer), total - received.size()));
+      BOOST_REQUIRE(got > 0);
+      received.append(buffer, got);
+    }
+    for (size_t pos = 0; pos < received.size(); pos += expected.size()) {
+      BOOST_REQUIRE(received.compare(pos, expected.size(), expected) == 0);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_RemoteLogger_Drops) {
+  /* nobody is listening there, everything we can't queue should be accounted as dropped */
+  const ComboAddress remote("127.0.0.1:1");
+  RemoteLogger logger(remote, 1, 1000, 1, true);
+  logger.stop();
+
+  const std::string message(48, 'a');
+  const size_t perThread = 50;
+  /* 50 bytes each, 20 of them fit in our queue */
+  for (size_t count = 0; count < perThread; count++) {
+    logger.queueData(message);
+  }
+  /* from another thread, which gets its own queue */
+  std::thread([&logger,&message]() {
+    for (size_t count = 0; count < perThread; count++) {
+      logger.queueData(message);
+    }
+  }).join();
+
+  /* the maintenance thread might have moved up to 20 messages to the connection
+     buffer before noticing that it had to stop, making room for as many in the queues */
+  BOOST_CHECK_EQUAL(logger.getQueuedCount() + logger.getDropsCount(), 2 * perThread);
+  BOOST_CHECK_GE(logger.getQueuedCount(), 40U);
+  BOOST_CHECK_LE(logger.getQueuedCount(), 60U);
+  BOOST_CHECK_EQUAL(logger.toString(), remote.toStringWithPort() + " (" + std::to_string(logger.getQueuedCount()) + " queued, " + std::to_string(logger.getDropsCount()) + " dropped)");
+}
+
+BOOST_AUTO_TEST_CASE(test_RemoteLogger_ThreadQueues) {
+  const ComboAddress remote("127.0.0.1:1");
+  const std::string message(48, 'a');
+  {
+    RemoteLogger first(remote, 1, 1000, 1, true);
+    first.stop();
+    first.queueData(message);
+    /* the queues of the loggers of the previous tests, which have all been destroyed, are gone */
+    BOOST_CHECK_EQUAL(RemoteLogger::getQueuesCountForThisThread(), 1U);
+  }
+
+  /* the queue of the logger that has been destroyed is forgotten as soon as
+     this thread starts logging to a new one */
+  RemoteLogger second(remote, 1, 1000, 1, true);
+  second.stop();
+  second.queueData(message);
+  BOOST_CHECK_EQUAL(RemoteLogger::getQueuesCountForThisThread(), 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
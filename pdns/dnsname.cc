@@ -161,16 +161,28 @@ void DNSName::packetParser(const char* qpos, int len, int offset, bool uncompres
 }
 
 std::string DNSName::toString(const std::string& separator, const bool trailing) const
+{
+  std::string ret;
+  appendToString(ret, separator, trailing);
+  return ret;
+}
+
+void DNSName::appendToString(std::string& output, const std::string& separator, const bool trailing) const
 {
   if (empty()) {
     throw std::out_of_range("Attempt to print an unset dnsname");
   }
 
-  if(isRoot())
-    return trailing ? separator : "";
+  if(isRoot()) {
+    if (trailing) {
+      output += separator;
+    }
+    return;
+  }
 
-  std::string ret;
-  ret.reserve(d_storage.size());
+  if (output.empty()) {
+    output.reserve(d_storage.size());
+  }
 
   {
     // iterate over the raw labels
@@ -178,15 +190,14 @@ std::string DNSName::toString(const std::string& separator, const bool trailing)
     const char* end = p + d_storage.size();
 
     while (p < end && *p) {
-      appendEscapedLabel(ret, p + 1, static_cast<size_t>(*p));
-      ret += separator;
+      appendEscapedLabel(output, p + 1, static_cast<size_t>(*p));
+      output += separator;
       p += *p + 1;
     }
   }
   if (!trailing) {
-    ret.resize(ret.size() - separator.size());
+    output.resize(output.size() - separator.size());
   }
-  return ret;
 }
 
 std::string DNSName::toLogString() const
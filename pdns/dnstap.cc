@@ -74,3 +74,67 @@ void DnstapMessage::setExtra(const std::string& extra)
   proto_message.set_extra(extra);
 #endif /* HAVE_PROTOBUF */
 }
+
+/* field numbers, from dnstap.proto */
+enum class DnstapField : uint32_t { identity = 1, version = 2, extra = 3, message = 14, type = 15 };
+enum class DnstapMessageField : uint32_t { type = 1, socket_family = 2, socket_protocol = 3, query_address = 4, response_address = 5, query_port = 6, response_port = 7, query_time_sec = 8, query_time_nsec = 9, query_message = 10, query_zone = 11, response_time_sec = 12, response_time_nsec = 13, response_message = 14 };
+
+#define DNSTAPFIELD(field) static_cast<uint32_t>(field)
+
+void encodeDnstapMessage(std::string& buffer, const std::string& identity, const ComboAddress* requestor, const ComboAddress* responder, bool isTCP, const char* packet, const size_t len, const struct timespec* queryTime, const struct timespec* responseTime, bool resolver, const DNSName* queryZone)
+{
+  const struct dnsheader* dh = reinterpret_cast<const struct dnsheader*>(packet);
+  ProtoBufEncoder encoder(buffer);
+
+  encoder.addBytes(DNSTAPFIELD(DnstapField::identity), identity);
+  encoder.addBytes(DNSTAPFIELD(DnstapField::version), PACKAGE_STRING, strlen(PACKAGE_STRING));
+
+  auto start = encoder.startMessage(DNSTAPFIELD(DnstapField::message));
+  /* RESOLVER_QUERY = 3, RESOLVER_RESPONSE = 4, CLIENT_QUERY = 5, CLIENT_RESPONSE = 6 */
+  encoder.addVarint(DNSTAPFIELD(DnstapMessageField::type), (resolver ? 3 : 5) + (dh->qr ? 1 : 0));
+
+  const ComboAddress* addr = responder ? responder : requestor;
+  if (addr != nullptr) {
+    /* INET = 1, INET6 = 2 */
+    encoder.addVarint(DNSTAPFIELD(DnstapMessageField::socket_family), addr->sin4.sin_family == AF_INET ? 1 : 2);
+  }
+  /* UDP = 1, TCP = 2 */
+  encoder.addVarint(DNSTAPFIELD(DnstapMessageField::socket_protocol), isTCP ? 2 : 1);
+
+  if (requestor != nullptr) {
+    encoder.addAddress(DNSTAPFIELD(DnstapMessageField::query_address), *requestor);
+  }
+  if (responder != nullptr) {
+    encoder.addAddress(DNSTAPFIELD(DnstapMessageField::response_address), *responder);
+  }
+  if (requestor != nullptr) {
+    encoder.addVarint(DNSTAPFIELD(DnstapMessageField::query_port), ntohs(requestor->sin4.sin_port));
+  }
+  if (responder != nullptr) {
+    encoder.addVarint(DNSTAPFIELD(DnstapMessageField::response_port), ntohs(responder->sin4.sin_port));
+  }
+  if (queryTime != nullptr) {
+    encoder.addVarint(DNSTAPFIELD(DnstapMessageField::query_time_sec), static_cast<uint64_t>(queryTime->tv_sec));
+    encoder.addFixed32(DNSTAPFIELD(DnstapMessageField::query_time_nsec), queryTime->tv_nsec);
+  }
+  if (!dh->qr) {
+    encoder.addBytes(DNSTAPFIELD(DnstapMessageField::query_message), packet, len);
+  }
+  if (queryZone != nullptr) {
+    const auto& storage = queryZone->getStorage();
+    encoder.addBytes(DNSTAPFIELD(DnstapMessageField::query_zone), storage.data(), storage.size());
+  }
+  if (responseTime != nullptr) {
+    encoder.addVarint(DNSTAPFIELD(DnstapMessageField::response_time_sec), static_cast<uint64_t>(responseTime->tv_sec));
+    encoder.addFixed32(DNSTAPFIELD(DnstapMessageField::response_time_nsec), responseTime->tv_nsec);
+  }
+  if (dh->qr) {
+    encoder.addBytes(DNSTAPFIELD(DnstapMessageField::response_message), packet, len);
+  }
+  encoder.endMessage(start);
+
+  /* MESSAGE = 1 */
+  encoder.addVarint(DNSTAPFIELD(DnstapField::type), 1);
+}
+
+#undef DNSTAPFIELD
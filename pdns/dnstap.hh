@@ -28,6 +28,7 @@
 
 #include "dnsname.hh"
 #include "iputils.hh"
+#include "protobuf-encoder.hh"
 
 #ifdef HAVE_PROTOBUF
 #include <boost/uuid/uuid.hpp>
@@ -48,3 +49,10 @@ protected:
   dnstap::Dnstap proto_message;
 #endif /* HAVE_PROTOBUF */
 };
+
+/* Serializes the same content than DnstapMessage straight into 'buffer', without
+   building the intermediate libprotobuf object. The output is byte-for-byte identical.
+   When 'resolver' is set the message is typed as RESOLVER_QUERY/RESOLVER_RESPONSE
+   instead of CLIENT_QUERY/CLIENT_RESPONSE, and 'queryZone' is set if present, as
+   RecDnstapMessage does. */
+void encodeDnstapMessage(std::string& buffer, const std::string& identity, const ComboAddress* requestor, const ComboAddress* responder, bool isTCP, const char* packet, const size_t len, const struct timespec* queryTime, const struct timespec* responseTime, bool resolver=false, const DNSName* queryZone=nullptr);
@@ -39,6 +39,14 @@
 #include <boost/array.hpp>
 #include <boost/program_options.hpp>
 
+#ifdef HAVE_LIBSSL
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+/* we need OpenSSL to take care of its own locking, since the workers run in parallel */
+#if !(OPENSSL_VERSION_NUMBER < 0x1010000fL || (defined LIBRESSL_VERSION_NUMBER && LIBRESSL_VERSION_NUMBER < 0x2090100fL))
+#define DNSTCPBENCH_TLS 1
+#endif
+#endif /* HAVE_LIBSSL */
 
 StatBag S;
 namespace po = boost::program_options;
@@ -47,9 +55,15 @@ po::variables_map g_vm;
 bool g_verbose;
 bool g_onlyTCP;
 bool g_tcpNoDelay;
+bool g_tls;
 unsigned int g_timeoutMsec;
+unsigned int g_queriesPerConnection;
 AtomicCounter g_networkErrors, g_otherErrors, g_OK, g_truncates, g_authAnswers, g_timeOuts;
 ComboAddress g_dest;
+#ifdef DNSTCPBENCH_TLS
+std::unique_ptr<SSL_CTX, void(*)(SSL_CTX*)> g_tlsCtx{nullptr, SSL_CTX_free};
+std::string g_sni;
+#endif /* DNSTCPBENCH_TLS */
 
 static unsigned int makeUsec(const struct timeval& tv)
 {
@@ -69,7 +83,104 @@ struct BenchQuery
   time_t answerSecond;
 };
 
-static void doQuery(BenchQuery* q)
+/* A TCP connection to the remote, over TLS if requested, reused by a worker for up to
+   g_queriesPerConnection queries */
+class BenchConnection
+{
+public:
+  BenchConnection(): d_sock(g_dest.sin4.sin_family, SOCK_STREAM)
+  {
+    int tmp=1;
+    if(setsockopt(d_sock.getHandle(),SOL_SOCKET,SO_REUSEADDR,(char*)&tmp,sizeof tmp)<0)
+      throw runtime_error("Unable to set socket reuse: "+stringerror());
+
+    if(g_tcpNoDelay && setsockopt(d_sock.getHandle(), IPPROTO_TCP, TCP_NODELAY,(char*)&tmp,sizeof tmp)<0)
+      throw runtime_error("Unable to set socket no delay: "+stringerror());
+
+    d_sock.connect(g_dest);
+
+#ifdef DNSTCPBENCH_TLS
+    if(g_tls) {
+      d_ssl = std::unique_ptr<SSL, void(*)(SSL*)>(SSL_new(g_tlsCtx.get()), SSL_free);
+      if(!d_ssl)
+        throw runtime_error("Unable to create a TLS session");
+      if(!g_sni.empty())
+        SSL_set_tlsext_host_name(d_ssl.get(), g_sni.c_str());
+      SSL_set_fd(d_ssl.get(), d_sock.getHandle());
+      if(SSL_connect(d_ssl.get()) != 1)
+        throw NetworkError("TLS handshake failed: "+getTLSError());
+    }
+#endif /* DNSTCPBENCH_TLS */
+  }
+
+  ~BenchConnection()
+  {
+#ifdef DNSTCPBENCH_TLS
+    if(d_ssl)
+      SSL_shutdown(d_ssl.get());
+#endif /* DNSTCPBENCH_TLS */
+  }
+
+  void write(const string& data)
+  {
+#ifdef DNSTCPBENCH_TLS
+    if(d_ssl) {
+      if(SSL_write(d_ssl.get(), data.c_str(), data.size()) != static_cast<int>(data.size()))
+        throw NetworkError("TLS write failed: "+getTLSError());
+      return;
+    }
+#endif /* DNSTCPBENCH_TLS */
+    d_sock.writen(data);
+  }
+
+  /* read exactly len bytes */
+  void read(char* buffer, size_t len)
+  {
+    size_t pos=0;
+    while(pos < len) {
+      int numread;
+#ifdef DNSTCPBENCH_TLS
+      if(d_ssl)
+        numread=SSL_read(d_ssl.get(), buffer+pos, len-pos);
+      else
+#endif /* DNSTCPBENCH_TLS */
+        numread=d_sock.read(buffer+pos, len-pos);
+      if(numread<=0)
+        throw PDNSException("tcp read failed");
+      pos+=numread;
+    }
+  }
+
+  /* same semantics as waitForData() */
+  int waitForResponse(int timeoutUsec)
+  {
+#ifdef DNSTCPBENCH_TLS
+    /* the response might already have been read from the socket by OpenSSL */
+    if(d_ssl && SSL_pending(d_ssl.get()) > 0)
+      return 1;
+#endif /* DNSTCPBENCH_TLS */
+    return waitForData(d_sock.getHandle(), 0, timeoutUsec);
+  }
+
+  unsigned int d_queries{0};
+
+private:
+#ifdef DNSTCPBENCH_TLS
+  static std::string getTLSError()
+  {
+    char buffer[256];
+    ERR_error_string_n(ERR_get_error(), buffer, sizeof(buffer));
+    return buffer;
+  }
+#endif /* DNSTCPBENCH_TLS */
+
+  Socket d_sock;
+#ifdef DNSTCPBENCH_TLS
+  std::unique_ptr<SSL, void(*)(SSL*)> d_ssl{nullptr, SSL_free};
+#endif /* DNSTCPBENCH_TLS */
+};
+
+static void doQuery(BenchQuery* q, std::unique_ptr<BenchConnection>& conn)
 try
 {
   vector<uint8_t> packet;
@@ -105,43 +216,34 @@ try
     g_truncates++;
   }
 
-  Socket sock(g_dest.sin4.sin_family, SOCK_STREAM);
-  int tmp=1;
-  if(setsockopt(sock.getHandle(),SOL_SOCKET,SO_REUSEADDR,(char*)&tmp,sizeof tmp)<0) 
-    throw runtime_error("Unable to set socket reuse: "+stringerror());
-    
-  if(g_tcpNoDelay && setsockopt(sock.getHandle(), IPPROTO_TCP, TCP_NODELAY,(char*)&tmp,sizeof tmp)<0) 
-    throw runtime_error("Unable to set socket no delay: "+stringerror());
+  if(!conn)
+    conn=std::unique_ptr<BenchConnection>(new BenchConnection());
 
-  sock.connect(g_dest);
   uint16_t len = htons(packet.size());
   string tcppacket((char*)& len, 2);
   tcppacket.append(packet.begin(), packet.end());
 
-  sock.writen(tcppacket);
+  conn->write(tcppacket);
 
-  res = waitForData(sock.getHandle(), 0, 1000 * g_timeoutMsec);
+  res = conn->waitForResponse(1000 * g_timeoutMsec);
   if(res < 0)
     throw NetworkError("Error waiting for response");
   if(!res) {
     g_timeOuts++;
+    /* we don't want to get this response as the answer to the next query */
+    conn.reset();
     return;
   }
-  
-  if(sock.read((char *) &len, 2) != 2)
-    throw PDNSException("tcp read failed");
-  
+
+  conn->read((char *) &len, 2);
+
   len=ntohs(len);
   std::unique_ptr<char[]> creply(new char[len]);
-  int n=0;
-  int numread;
-  while(n<len) {
-    numread=sock.read(creply.get()+n, len-n);
-    if(numread<0)
-      throw PDNSException("tcp read failed");
-    n+=numread;
-  }
-  
+  conn->read(creply.get(), len);
+
+  if(++conn->d_queries >= g_queriesPerConnection)
+    conn.reset();
+
   reply=string(creply.get(), len);
   
   gettimeofday(&now, 0);
@@ -158,10 +260,12 @@ catch(NetworkError& ne)
 {
   cerr<<"Network error: "<<ne.what()<<endl;
   g_networkErrors++;
+  conn.reset();
 }
 catch(...)
 {
   g_otherErrors++;
+  conn.reset();
 }
 
 /* read queries from stdin, put in vector
@@ -175,12 +279,13 @@ vector<BenchQuery> g_queries;
 static void* worker(void*)
 {
   setThreadName("dnstcpb/worker");
+  std::unique_ptr<BenchConnection> conn;
   for(;;) {
     unsigned int pos = g_pos++; 
     if(pos >= g_queries.size())
       break;
 
-    doQuery(&g_queries[pos]); // this is safe as long as nobody *inserts* to g_queries
+    doQuery(&g_queries[pos], conn); // this is safe as long as nobody *inserts* to g_queries
   }
   return 0;
 }
@@ -202,6 +307,9 @@ try
     ("udp-first,u", "try UDP first")
     ("file,f", po::value<string>(), "source file - if not specified, defaults to stdin")
     ("tcp-no-delay", po::value<bool>()->default_value(true), "use TCP_NODELAY socket option")
+    ("queries-per-connection", po::value<int>()->default_value(1), "number of queries sent over a TCP connection before opening a new one")
+    ("tls", "use DNS over TLS, to port 853 unless PORT is specified. The certificate of the remote is not verified")
+    ("sni", po::value<string>(), "server name to send in the TLS handshake")
     ("timeout-msec", po::value<int>()->default_value(10), "wait for this amount of milliseconds for an answer")
     ("workers", po::value<int>()->default_value(100), "number of parallel workers");
 
@@ -231,6 +339,8 @@ try
   g_onlyTCP = !g_vm.count("udp-first");
   g_verbose = g_vm.count("verbose");
   g_timeoutMsec = g_vm["timeout-msec"].as<int>();
+  g_queriesPerConnection = std::max(g_vm["queries-per-connection"].as<int>(), 1);
+  g_tls = g_vm.count("tls");
 
   reportAllTypes();
 
@@ -239,7 +349,25 @@ try
     exit(EXIT_FAILURE);
   }
 
-  g_dest = ComboAddress(g_vm["remote-host"].as<string>().c_str(), g_vm["remote-port"].as<int>());
+  int port = g_vm["remote-port"].as<int>();
+  if(g_tls && g_vm["remote-port"].defaulted())
+    port = 853;
+  g_dest = ComboAddress(g_vm["remote-host"].as<string>().c_str(), port);
+
+  if(g_tls) {
+#ifdef DNSTCPBENCH_TLS
+    g_tlsCtx = std::unique_ptr<SSL_CTX, void(*)(SSL_CTX*)>(SSL_CTX_new(SSLv23_client_method()), SSL_CTX_free);
+    if(!g_tlsCtx)
+      throw runtime_error("Unable to create a TLS context");
+    SSL_CTX_set_options(g_tlsCtx.get(), SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION);
+    SSL_CTX_set_verify(g_tlsCtx.get(), SSL_VERIFY_NONE, nullptr);
+    if(g_vm.count("sni"))
+      g_sni = g_vm["sni"].as<string>();
+#else
+    cerr<<"dnstcpbench was built without TLS support"<<endl;
+    exit(EXIT_FAILURE);
+#endif /* DNSTCPBENCH_TLS */
+  }
 
   unsigned int numworkers=g_vm["workers"].as<int>();
   
@@ -248,6 +376,8 @@ try
     cout<<"Attempting UDP first: " << (g_onlyTCP ? "no" : "yes") <<endl;
     cout<<"Timeout: "<< g_timeoutMsec<<"msec"<<endl;
     cout << "Using TCP_NODELAY: "<<g_tcpNoDelay<<endl;
+    cout << "Using TLS: "<<(g_tls ? "yes" : "no")<<endl;
+    cout << "Queries per connection: "<<g_queriesPerConnection<<endl;
   }
 
 
@@ -303,7 +433,7 @@ try
 
   cout<<"Average qps: "<<mean(qps)<<", median qps: "<<median(qps)<<endl;
   cout<<"Average UDP latency: "<<mean(udpspeeds)<<"usec, median: "<<median(udpspeeds)<<"usec"<<endl;
-  cout<<"Average TCP latency: "<<mean(tcpspeeds)<<"usec, median: "<<median(tcpspeeds)<<"usec"<<endl;
+  cout<<"Average "<<(g_tls ? "TLS" : "TCP")<<" latency: "<<mean(tcpspeeds)<<"usec, median: "<<median(tcpspeeds)<<"usec"<<endl;
 
   cout<<"OK: "<<g_OK<<", network errors: "<<g_networkErrors<<", other errors: "<<g_otherErrors<<endl;
   cout<<"Timeouts: "<<g_timeOuts<<endl;
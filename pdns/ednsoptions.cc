@@ -19,6 +19,8 @@
  * along with this program; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <limits>
+
 #include "dns.hh"
 #include "ednsoptions.hh"
 #include "iputils.hh"
@@ -136,3 +138,373 @@ void generateEDNSOption(uint16_t optionCode, const std::string& payload, std::st
   res.append((const char *) &payloadLen, sizeof payloadLen);
   res.append(payload);
 }
+
+/* position of the OPT RR in a packet, and of what follows it */
+struct OPTRRPosition
+{
+  size_t start{0};
+  size_t rdLenPos{0};
+  size_t end{0};
+  uint16_t recordsAfter{0};
+};
+
+/* skip the name starting at 'pos', calling 'visitor' with the position of the compression pointer ending it, if any */
+template<typename T> static bool skipName(const unsigned char* packet, const size_t len, size_t& pos, T& visitor)
+{
+  while (pos < len) {
+    const uint8_t labelLen = packet[pos];
+    if (labelLen == 0) {
+      pos++;
+      return true;
+    }
+    if ((labelLen & 0xC0) == 0xC0) {
+      if ((pos + 2) > len || !visitor(pos)) {
+        return false;
+      }
+      pos += 2;
+      return true;
+    }
+    if (labelLen & 0xC0) {
+      /* extended label types */
+      return false;
+    }
+    pos += 1 + labelLen;
+  }
+  return false;
+}
+
+static bool ignorePointer(size_t)
+{
+  return true;
+}
+
+static bool skipCharacterString(const unsigned char* packet, const size_t len, size_t& pos)
+{
+  if (pos >= len) {
+    return false;
+  }
+  pos += 1 + packet[pos];
+  return pos <= len;
+}
+
+/* visit the names of 'count' records starting at 'pos', including the ones inside the rdata of the types that
+   may be compressed, or that a receiver has to be able to decompress (RFC 3597 section 4) */
+template<typename T> static bool visitRecordsNames(const unsigned char* packet, const size_t len, size_t pos, size_t count, T& visitor)
+{
+  for (size_t idx = 0; idx < count; idx++) {
+    if (!skipName(packet, len, pos, visitor)) {
+      return false;
+    }
+    if ((pos + DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE + DNS_RDLENGTH_SIZE) > len) {
+      return false;
+    }
+    const uint16_t qtype = packet[pos] * 256 + packet[pos + 1];
+    pos += DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE;
+    const uint16_t rdLen = packet[pos] * 256 + packet[pos + 1];
+    pos += DNS_RDLENGTH_SIZE;
+    const size_t rdEnd = pos + rdLen;
+    if (rdEnd > len) {
+      return false;
+    }
+
+    size_t rdPos = pos;
+    switch (qtype) {
+    case QType::NS:
+    case 3: /* MD */
+    case 4: /* MF */
+    case QType::CNAME:
+    case QType::MB:
+    case QType::MG:
+    case QType::MR:
+    case QType::PTR:
+      if (!skipName(packet, rdEnd, rdPos, visitor)) {
+        return false;
+      }
+      break;
+    case QType::SOA:
+    case QType::MINFO:
+    case QType::RP:
+      if (!skipName(packet, rdEnd, rdPos, visitor) || !skipName(packet, rdEnd, rdPos, visitor)) {
+        return false;
+      }
+      break;
+    case QType::MX:
+    case QType::AFSDB:
+    case 21: /* RT */
+      rdPos += 2;
+      if (!skipName(packet, rdEnd, rdPos, visitor)) {
+        return false;
+      }
+      break;
+    case 26: /* PX */
+      rdPos += 2;
+      if (!skipName(packet, rdEnd, rdPos, visitor) || !skipName(packet, rdEnd, rdPos, visitor)) {
+        return false;
+      }
+      break;
+    case QType::SRV:
+      /* priority, weight and port */
+      rdPos += 6;
+      if (!skipName(packet, rdEnd, rdPos, visitor)) {
+        return false;
+      }
+      break;
+    case QType::NAPTR:
+      /* order and preference, then flags, services and regexp */
+      rdPos += 4;
+      for (size_t str = 0; str < 3; str++) {
+        if (!skipCharacterString(packet, rdEnd, rdPos)) {
+          return false;
+        }
+      }
+      if (!skipName(packet, rdEnd, rdPos, visitor)) {
+        return false;
+      }
+      break;
+    case QType::SIG:
+      /* type covered, algorithm, labels, original TTL, expiration, inception and key tag, then the signer's name */
+      rdPos += 18;
+      if (!skipName(packet, rdEnd, rdPos, visitor)) {
+        return false;
+      }
+      break;
+    case 30: /* NXT */
+      if (!skipName(packet, rdEnd, rdPos, visitor)) {
+        return false;
+      }
+      break;
+    default:
+      break;
+    }
+
+    pos = rdEnd;
+  }
+
+  return true;
+}
+
+static int locateOPTRR(const unsigned char* packet, const size_t len, OPTRRPosition& opt)
+{
+  if (len < sizeof(dnsheader)) {
+    return EINVAL;
+  }
+
+  const struct dnsheader* dh = reinterpret_cast<const struct dnsheader*>(packet);
+  const uint16_t qdcount = ntohs(dh->qdcount);
+  const uint16_t arcount = ntohs(dh->arcount);
+  if (arcount == 0) {
+    return ENOENT;
+  }
+
+  size_t pos = sizeof(dnsheader);
+  for (size_t idx = 0; idx < qdcount; idx++) {
+    if (!skipName(packet, len, pos, ignorePointer)) {
+      return EINVAL;
+    }
+    pos += DNS_TYPE_SIZE + DNS_CLASS_SIZE;
+  }
+
+  const size_t total = static_cast<size_t>(ntohs(dh->ancount)) + ntohs(dh->nscount) + arcount;
+  const size_t firstAdditional = total - arcount;
+  for (size_t idx = 0; idx < total; idx++) {
+    const size_t start = pos;
+    if (!skipName(packet, len, pos, ignorePointer)) {
+      return EINVAL;
+    }
+    if ((pos + DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE + DNS_RDLENGTH_SIZE) > len) {
+      return EINVAL;
+    }
+    const uint16_t qtype = packet[pos] * 256 + packet[pos + 1];
+    pos += DNS_TYPE_SIZE + DNS_CLASS_SIZE + DNS_TTL_SIZE;
+    const size_t rdLenPos = pos;
+    pos += DNS_RDLENGTH_SIZE + packet[rdLenPos] * 256 + packet[rdLenPos + 1];
+    if (pos > len) {
+      return EINVAL;
+    }
+
+    if (idx >= firstAdditional && qtype == QType::OPT) {
+      opt.start = start;
+      opt.rdLenPos = rdLenPos;
+      opt.end = pos;
+      opt.recordsAfter = total - idx - 1;
+      return 0;
+    }
+  }
+
+  return ENOENT;
+}
+
+/* Replace the 'oldSize' bytes at 'at', inside the OPT RR, by 'newSize' bytes, shifting everything located after them,
+   including trailing data, and fixing the compression pointers of the following records that point after the OPT RR.
+   The caller is responsible for writing the new bytes and fixing the OPT rdlen and counts. */
+static int resizeInOPTRR(unsigned char* packet, const size_t packetSize, uint16_t* len, const OPTRRPosition& opt, const size_t at, const size_t oldSize, const size_t newSize)
+{
+  const ssize_t delta = static_cast<ssize_t>(newSize) - static_cast<ssize_t>(oldSize);
+  const size_t newLen = *len + delta;
+  if (newLen > packetSize || newLen > std::numeric_limits<uint16_t>::max()) {
+    return ENOSPC;
+  }
+
+  if (opt.recordsAfter > 0) {
+    /* no pointer can target the OPT RR, and the shifted ones have to remain reachable */
+    bool overflow = false;
+    auto check = [packet, &opt, delta, &overflow](size_t pos) {
+      const size_t target = (packet[pos] & 0x3F) * 256 + packet[pos + 1];
+      if (target >= opt.start && target < opt.end) {
+        return false;
+      }
+      if (target >= opt.end && (target + delta) > 0x3FFF) {
+        overflow = true;
+        return false;
+      }
+      return true;
+    };
+    if (!visitRecordsNames(packet, *len, opt.end, opt.recordsAfter, check)) {
+      return overflow ? ENOSPC : EINVAL;
+    }
+  }
+
+  if (delta != 0) {
+    memmove(packet + at + newSize, packet + at + oldSize, *len - (at + oldSize));
+  }
+  *len = newLen;
+
+  if (opt.recordsAfter > 0 && delta != 0) {
+    auto fix = [packet, &opt, delta](size_t pos) {
+      size_t target = (packet[pos] & 0x3F) * 256 + packet[pos + 1];
+      if (target >= opt.end) {
+        target += delta;
+        packet[pos] = 0xC0 | (target / 256);
+        packet[pos + 1] = target % 256;
+      }
+      return true;
+    };
+    visitRecordsNames(packet, *len, opt.end + delta, opt.recordsAfter, fix);
+  }
+
+  return 0;
+}
+
+/* find the option 'optionCode' in the OPT RR, returning its start and total size */
+static int findOptionInOPTRR(const unsigned char* packet, const OPTRRPosition& opt, const uint16_t optionCode, size_t& optionStart, size_t& optionSize)
+{
+  size_t pos = opt.rdLenPos + DNS_RDLENGTH_SIZE;
+  while (pos < opt.end) {
+    if ((pos + EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE) > opt.end) {
+      return EINVAL;
+    }
+    const uint16_t code = packet[pos] * 256 + packet[pos + 1];
+    const uint16_t optionLen = packet[pos + 2] * 256 + packet[pos + 3];
+    const size_t size = EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE + optionLen;
+    if ((pos + size) > opt.end) {
+      return EINVAL;
+    }
+    if (code == optionCode) {
+      optionStart = pos;
+      optionSize = size;
+      return 0;
+    }
+    pos += size;
+  }
+  return ENOENT;
+}
+
+static void setOPTRRDLen(unsigned char* packet, const OPTRRPosition& opt, const size_t rdLen)
+{
+  packet[opt.rdLenPos] = rdLen / 256;
+  packet[opt.rdLenPos + 1] = rdLen % 256;
+}
+
+int setEDNSOptionInPlace(char* packet, const size_t packetSize, uint16_t* len, const std::string& option, const bool overrideExisting, bool& optionAdded)
+{
+  assert(packet != nullptr);
+  assert(len != nullptr);
+  optionAdded = false;
+
+  if (option.size() < (EDNS_OPTION_CODE_SIZE + EDNS_OPTION_LENGTH_SIZE)) {
+    return EINVAL;
+  }
+
+  unsigned char* data = reinterpret_cast<unsigned char*>(packet);
+  OPTRRPosition opt;
+  int res = locateOPTRR(data, *len, opt);
+  if (res != 0) {
+    return res;
+  }
+
+  const uint16_t optionCode = static_cast<unsigned char>(option.at(0)) * 256 + static_cast<unsigned char>(option.at(1));
+  size_t optionStart = opt.end;
+  size_t optionSize = 0;
+  res = findOptionInOPTRR(data, opt, optionCode, optionStart, optionSize);
+  if (res == EINVAL) {
+    return res;
+  }
+  if (res == 0 && !overrideExisting) {
+    return 0;
+  }
+
+  const size_t rdLen = (opt.end - opt.rdLenPos - DNS_RDLENGTH_SIZE) - optionSize + option.size();
+  if (rdLen > std::numeric_limits<uint16_t>::max()) {
+    return ENOSPC;
+  }
+
+  res = resizeInOPTRR(data, packetSize, len, opt, optionStart, optionSize, option.size());
+  if (res != 0) {
+    return res;
+  }
+
+  memcpy(data + optionStart, option.data(), option.size());
+  setOPTRRDLen(data, opt, rdLen);
+  optionAdded = optionSize == 0;
+  return 0;
+}
+
+int removeEDNSOptionInPlace(char* packet, uint16_t* len, const uint16_t optionCode)
+{
+  assert(packet != nullptr);
+  assert(len != nullptr);
+
+  unsigned char* data = reinterpret_cast<unsigned char*>(packet);
+  OPTRRPosition opt;
+  int res = locateOPTRR(data, *len, opt);
+  if (res != 0) {
+    return res;
+  }
+
+  size_t optionStart = 0;
+  size_t optionSize = 0;
+  res = findOptionInOPTRR(data, opt, optionCode, optionStart, optionSize);
+  if (res != 0) {
+    return res;
+  }
+
+  res = resizeInOPTRR(data, *len, len, opt, optionStart, optionSize, 0);
+  if (res != 0) {
+    return res;
+  }
+
+  setOPTRRDLen(data, opt, opt.end - opt.rdLenPos - DNS_RDLENGTH_SIZE - optionSize);
+  return 0;
+}
+
+int removeOPTRRInPlace(char* packet, uint16_t* len)
+{
+  assert(packet != nullptr);
+  assert(len != nullptr);
+
+  unsigned char* data = reinterpret_cast<unsigned char*>(packet);
+  OPTRRPosition opt;
+  int res = locateOPTRR(data, *len, opt);
+  if (res != 0) {
+    return res;
+  }
+
+  res = resizeInOPTRR(data, *len, len, opt, opt.start, opt.end - opt.start, 0);
+  if (res != 0) {
+    return res;
+  }
+
+  struct dnsheader* dh = reinterpret_cast<struct dnsheader*>(packet);
+  dh->arcount = htons(ntohs(dh->arcount) - 1);
+  return 0;
+}
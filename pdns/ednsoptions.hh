@@ -49,3 +49,15 @@ int getEDNSOptions(const char* optRR, size_t len, EDNSOptionViewMap& options);
 bool getEDNSOptionsFromContent(const std::string& content, std::vector<std::pair<uint16_t, std::string>>& options);
 
 void generateEDNSOption(uint16_t optionCode, const std::string& payload, std::string& res);
+
+/* The following functions edit the OPT RR of a 'len' bytes long packet directly in its buffer, shifting the records
+   placed after it and fixing their compression pointers. They return 0 on success, ENOENT if there is no OPT RR
+   (or no such option), ENOSPC if the result would not fit and EINVAL if the packet could not be parsed. */
+
+/* add 'option' (as generated by generateEDNSOption()) to the existing OPT RR of a packet, stored in a buffer of
+   'packetSize' bytes, replacing an existing option with the same code only if 'overrideExisting' is set */
+int setEDNSOptionInPlace(char* packet, size_t packetSize, uint16_t* len, const std::string& option, bool overrideExisting, bool& optionAdded);
+/* remove the first option 'optionCode' from the OPT RR */
+int removeEDNSOptionInPlace(char* packet, uint16_t* len, uint16_t optionCode);
+/* remove the whole OPT RR */
+int removeOPTRRInPlace(char* packet, uint16_t* len);
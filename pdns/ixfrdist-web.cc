@@ -30,7 +30,7 @@ IXFRDistWebServer::IXFRDistWebServer(const ComboAddress &listenAddress, const Ne
 {
   d_ws->setACL(acl);
   d_ws->setLogLevel(loglevel);
-  d_ws->registerWebHandler("/metrics", boost::bind(&IXFRDistWebServer::getMetrics, this, _1, _2));
+  d_ws->registerWebHandler("/metrics", boost::bind(&IXFRDistWebServer::getMetrics, d_ws.get(), _1, _2));
   d_ws->bind();
 }
 
@@ -39,11 +39,13 @@ void IXFRDistWebServer::go() {
   d_ws->go();
 }
 
-void IXFRDistWebServer::getMetrics(HttpRequest* req, HttpResponse* resp) {
+void IXFRDistWebServer::getMetrics(const WebServer* ws, HttpRequest* req, HttpResponse* resp) {
   if(req->method != "GET")
     throw HttpMethodNotAllowedException();
 
-  resp->body = doGetStats();
+  std::ostringstream latencies;
+  ws->getLatencyMetrics(latencies, "ixfrdist_");
+  resp->body = doGetStats() + latencies.str();
   resp->headers["Content-Type"] = "text/plain; version=0.0.4"; // https://prometheus.io/docs/instrumenting/exposition_formats/#text-based-format
   resp->status = 200;
 }
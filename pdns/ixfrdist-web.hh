@@ -33,5 +33,6 @@ class IXFRDistWebServer
     std::unique_ptr<WebServer> d_ws;
 
     // All endpoints
-    void getMetrics(HttpRequest* req, HttpResponse* resp);
+    // the WebServer is passed explicitly because this object is moved to the webserver thread
+    static void getMetrics(const WebServer* ws, HttpRequest* req, HttpResponse* resp);
 };
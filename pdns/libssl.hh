@@ -31,6 +31,7 @@ public:
 
   bool d_preferServerCiphers{true};
   bool d_enableTickets{true};
+  bool d_enableKTLS{false};
 };
 
 struct TLSErrorCounters
@@ -30,6 +30,7 @@
 #include <boost/algorithm/string.hpp>
 #include "dnssecinfra.hh"
 #include "dnsseckeeper.hh"
+#include "auth-nsec3cache.hh"
 #include "dns.hh"
 #include "dnsbackend.hh"
 #include "ueberbackend.hh"
@@ -64,6 +65,7 @@ PacketHandler::PacketHandler():B(s_programname), d_dk(&B)
   d_doExpandALIAS = ::arg().mustDo("expand-alias");
   d_logDNSDetails= ::arg().mustDo("log-dns-details");
   d_doIPv6AdditionalProcessing = ::arg().mustDo("do-ipv6-additional-processing");
+  d_doBatchedLookups = ::arg().mustDo("batched-lookups");
   string fname= ::arg()["lua-prequery-script"];
   if(fname.empty())
   {
@@ -626,7 +628,7 @@ void PacketHandler::addNSECX(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const
   }
 }
 
-static bool getNSEC3Hashes(bool narrow, DNSBackend* db, int id, const std::string& hashed, bool decrement, DNSName& unhashed, std::string& before, std::string& after, int mode=0)
+static bool getNSEC3Hashes(bool narrow, const SOAData& sd, const NSEC3PARAMRecordContent& ns3rc, const std::string& hashed, bool decrement, DNSName& unhashed, std::string& before, std::string& after, int mode=0)
 {
   bool ret;
   if(narrow) { // nsec3-narrow
@@ -640,13 +642,30 @@ static bool getNSEC3Hashes(bool narrow, DNSBackend* db, int id, const std::strin
     incrementHash(after);
   }
   else {
+    bool presetBefore = (!decrement && mode >= 2);
+    string cachedBefore;
+    DNSName cachedUnhashed;
+    if (g_nsec3Cache.getRange(sd.qname, sd.domain_id, sd.serial, ns3rc, hashed, cachedBefore, after, cachedUnhashed)) {
+      if (presetBefore) {
+        before=hashed;
+      }
+      else {
+        before=std::move(cachedBefore);
+        unhashed=std::move(cachedUnhashed);
+      }
+      return true;
+    }
+
     DNSName hashedName = DNSName(toBase32Hex(hashed));
     DNSName beforeName, afterName;
-    if (!decrement && mode >= 2)
+    if (presetBefore)
       beforeName = hashedName;
-    ret=db->getBeforeAndAfterNamesAbsolute(id, hashedName, unhashed, beforeName, afterName);
+    ret=sd.db->getBeforeAndAfterNamesAbsolute(sd.domain_id, hashedName, unhashed, beforeName, afterName);
     before=fromBase32Hex(beforeName.toString());
     after=fromBase32Hex(afterName.toString());
+    if (ret && !presetBefore && before.size() == hashed.size()) {
+      g_nsec3Cache.insertRange(sd.qname, sd.domain_id, sd.serial, ns3rc, before, after, unhashed);
+    }
   }
   return ret;
 }
@@ -674,10 +693,10 @@ void PacketHandler::addNSEC3(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const
   // add matching NSEC3 RR
   if (mode != 3) {
     unhashed=(mode == 0 || mode == 1 || mode == 5) ? target : closest;
-    hashed=hashQNameWithSalt(ns3rc, unhashed);
+    hashed=g_nsec3Cache.getHash(ns3rc, unhashed);
     DLOG(g_log<<"1 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
-    getNSEC3Hashes(narrow, sd.db, sd.domain_id,  hashed, false, unhashed, before, after, mode);
+    getNSEC3Hashes(narrow, sd, ns3rc, hashed, false, unhashed, before, after, mode);
 
     if (((mode == 0 && ns3rc.d_flags) ||  mode == 1) && (hashed != before)) {
       DLOG(g_log<<"No matching NSEC3, do closest (provable) encloser"<<endl);
@@ -694,10 +713,10 @@ void PacketHandler::addNSEC3(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const
       }
       doNextcloser = true;
       unhashed=closest;
-      hashed=hashQNameWithSalt(ns3rc, unhashed);
+      hashed=g_nsec3Cache.getHash(ns3rc, unhashed);
       DLOG(g_log<<"1 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
-      getNSEC3Hashes(narrow, sd.db, sd.domain_id,  hashed, false, unhashed, before, after);
+      getNSEC3Hashes(narrow, sd, ns3rc, hashed, false, unhashed, before, after);
     }
 
     if (!after.empty()) {
@@ -714,10 +733,10 @@ void PacketHandler::addNSEC3(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const
     }
     while( next.chopOff() && !(next==closest));
 
-    hashed=hashQNameWithSalt(ns3rc, unhashed);
+    hashed=g_nsec3Cache.getHash(ns3rc, unhashed);
     DLOG(g_log<<"2 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
-    getNSEC3Hashes(narrow, sd.db,sd.domain_id,  hashed, true, unhashed, before, after);
+    getNSEC3Hashes(narrow, sd, ns3rc, hashed, true, unhashed, before, after);
     DLOG(g_log<<"Done calling for covering, hashed: '"<<toBase32Hex(hashed)<<"' before='"<<toBase32Hex(before)<<"', after='"<<toBase32Hex(after)<<"'"<<endl);
     emitNSEC3( r, sd, ns3rc, unhashed, before, after, mode);
   }
@@ -726,10 +745,10 @@ void PacketHandler::addNSEC3(DNSPacket& p, std::unique_ptr<DNSPacket>& r, const
   if (mode == 2 || mode == 4) {
     unhashed=g_wildcarddnsname+closest;
 
-    hashed=hashQNameWithSalt(ns3rc, unhashed);
+    hashed=g_nsec3Cache.getHash(ns3rc, unhashed);
     DLOG(g_log<<"3 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
-    getNSEC3Hashes(narrow, sd.db, sd.domain_id,  hashed, (mode != 2), unhashed, before, after);
+    getNSEC3Hashes(narrow, sd, ns3rc, hashed, (mode != 2), unhashed, before, after);
     DLOG(g_log<<"Done calling for '*', hashed: '"<<toBase32Hex(hashed)<<"' before='"<<toBase32Hex(before)<<"', after='"<<toBase32Hex(after)<<"'"<<endl);
     emitNSEC3( r, sd, ns3rc, unhashed, before, after, mode);
   }
@@ -854,6 +873,7 @@ int PacketHandler::trySuperMasterSynchronous(const DNSPacket& p, const DNSName&
   }
   try {
     db->createSlaveDomain(p.getRemote().toString(), p.qdomain, nameserver, account);
+    B.addToZoneCache(p.qdomain);
     if (tsigkeyname.empty() == false) {
       vector<string> meta;
       meta.push_back(tsigkeyname.toStringNoDot());
@@ -1106,6 +1126,21 @@ bool PacketHandler::tryWildcard(DNSPacket& p, std::unique_ptr<DNSPacket>& r, con
   return true;
 }
 
+/* retrieves, in as few backend queries as possible, the names we are likely to look up
+   while answering for target: the target itself, its ancestors up to the apex and the
+   wildcards that could match it */
+void PacketHandler::prefetchTarget(const DNSName& target, const SOAData& sd)
+{
+  vector<DNSName> names;
+  DNSName name(target);
+  names.push_back(name);
+  while(name != sd.qname && name.chopOff()) {
+    names.push_back(name);
+    names.push_back(g_wildcarddnsname + name);
+  }
+  B.prefetchNames(names, sd.domain_id);
+}
+
 //! Called by the Distributor to ask a question. Returns 0 in case of an error
 std::unique_ptr<DNSPacket> PacketHandler::doQuestion(DNSPacket& p)
 {
@@ -1126,7 +1161,9 @@ std::unique_ptr<DNSPacket> PacketHandler::doQuestion(DNSPacket& p)
 #ifdef HAVE_LUA_RECORDS
   bool doLua=g_doLuaRecord;
 #endif
-  
+
+  B.clearPrefetched();
+
   if(p.d.qr) { // QR bit from dns packet (thanks RA from N)
     if(d_logDNSDetails)
       g_log<<Logger::Error<<"Received an answer (non-query) packet from "<<p.getRemote()<<", dropping"<<endl;
@@ -1281,6 +1318,9 @@ std::unique_ptr<DNSPacket> PacketHandler::doQuestion(DNSPacket& p)
     DLOG(g_log<<Logger::Error<<"We have authority, zone='"<<sd.qname<<"', id="<<sd.domain_id<<endl);
 
     authSet.insert(sd.qname);
+    if(d_doBatchedLookups) {
+      prefetchTarget(target, sd);
+    }
     d_dnssec=(p.d_dnssecOk && d_dk.isSecuredZone(sd.qname));
     doSigs |= d_dnssec;
 
@@ -17,11 +17,18 @@
 #include "arguments.hh"
 #include "auth-packetcache.hh"
 #include "auth-querycache.hh"
+#include "auth-zonecache.hh"
+#include "auth-nsec3cache.hh"
 #include "zoneparser-tng.hh"
 #include "signingpipe.hh"
 #include "dns_random.hh"
 #include "ipcipher.hh"
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
 #include <termios.h>            //termios, TCSANOW, ECHO, ICANON
 #include "opensslsigners.hh"
 #ifdef HAVE_LIBSODIUM
@@ -35,6 +42,8 @@
 StatBag S;
 AuthPacketCache PC;
 AuthQueryCache QC;
+AuthZoneCache g_zoneCache;
+AuthNSEC3Cache g_nsec3Cache;
 
 namespace po = boost::program_options;
 po::variables_map g_vm;
@@ -43,6 +52,7 @@ string s_programname="pdns";
 
 namespace {
   bool g_verbose;
+  unsigned int g_jobs;
 }
 
 ArgvMap &arg()
@@ -129,6 +139,12 @@ static void loadMainConfig(const std::string& configdir)
   if (! ::arg().laxFile(configname.c_str()))
     cerr<<"Warning: unable to read configuration file '"<<configname<<"': "<<stringerror()<<endl;
 
+  // overrides the configuration: the bind backends have to be done loading their zones before we can work on them
+  for (const auto& name : ::arg().list()) {
+    if (boost::starts_with(name, "bind") && boost::ends_with(name, "-background-load"))
+      ::arg().set(name)="no";
+  }
+
 #ifdef HAVE_LIBSODIUM
   if (sodium_init() == -1) {
     cerr<<"Unable to initialize sodium crypto library"<<endl;
@@ -149,7 +165,7 @@ static void loadMainConfig(const std::string& configdir)
   UeberBackend::go();
 }
 
-static bool rectifyZone(DNSSECKeeper& dk, const DNSName& zone, bool quiet = false, bool rectifyTransaction = true)
+static bool rectifyZone(DNSSECKeeper& dk, const DNSName& zone, bool quiet = false, bool rectifyTransaction = true, ostream& err = cerr)
 {
   string output;
   string error;
@@ -157,10 +173,10 @@ static bool rectifyZone(DNSSECKeeper& dk, const DNSName& zone, bool quiet = fals
   if (!quiet || !ret) {
     // When quiet, only print output if there was an error
     if (!output.empty()) {
-      cerr<<output<<endl;
+      err<<output<<endl;
     }
     if (!ret && !error.empty()) {
-      cerr<<error<<endl;
+      err<<error<<endl;
     }
   }
   return ret;
@@ -209,49 +225,167 @@ static void dbBench(const std::string& fname)
   cout<<"Packet cache reports: "<<S.read("query-cache-hit")<<" hits (should be 0) and "<<S.read("query-cache-miss") <<" misses"<<endl;
 }
 
-static bool rectifyAllZones(DNSSECKeeper &dk, bool quiet = false)
+/* Calls zoneFunc for each of the 'count' zones of a zone-wide operation, then
+   doneFunc from the main thread, in zone order. When more than one job has
+   been requested, zones are handed out to worker threads that each get their
+   own backends, and the output of every zone is buffered so that it is printed
+   in the same order as a sequential run would have. doneFunc can return false
+   to stop processing. Returns the number of zones that have been processed. */
+typedef std::function<bool(size_t idx, DNSSECKeeper& dk, UeberBackend& B, ostream& out, ostream& err)> zonefunc_t;
+typedef std::function<bool(size_t idx, bool ok)> zonedonefunc_t;
+
+static size_t processZones(size_t count, const zonefunc_t& zoneFunc, const zonedonefunc_t& doneFunc)
+{
+  if (g_jobs <= 1 || count <= 1) {
+    DNSSECKeeper dk;
+    UeberBackend B("default");
+    for (size_t idx = 0; idx < count; idx++) {
+      bool ok = zoneFunc(idx, dk, B, cout, cerr);
+      if (!doneFunc(idx, ok)) {
+        return idx + 1;
+      }
+    }
+    return count;
+  }
+
+  struct ZoneResult
+  {
+    std::ostringstream out;
+    std::ostringstream err;
+    std::exception_ptr exception{nullptr};
+    bool ok{false};
+    bool done{false};
+  };
+
+  vector<ZoneResult> results(count);
+  std::mutex lock;
+  std::condition_variable cond;
+  std::atomic<size_t> next(0);
+  std::atomic<bool> stop(false);
+
+  auto worker = [&]() {
+    DNSSECKeeper dk;
+    UeberBackend B("default");
+    size_t idx;
+    while (!stop && (idx = next++) < count) {
+      auto& result = results.at(idx);
+      bool ok = false;
+      try {
+        ok = zoneFunc(idx, dk, B, result.out, result.err);
+      }
+      catch (...) {
+        result.exception = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> lk(lock);
+        result.ok = ok;
+        result.done = true;
+      }
+      cond.notify_one();
+    }
+  };
+
+  const unsigned int jobs = std::min(static_cast<size_t>(g_jobs), count);
+  vector<std::thread> workers;
+  workers.reserve(jobs);
+  DTime dt;
+  dt.set();
+  for (unsigned int n = 0; n < jobs; n++) {
+    workers.emplace_back(worker);
+  }
+
+  size_t processed = 0;
+  time_t lastProgress = time(nullptr);
+  std::exception_ptr exception{nullptr};
+  while (processed < count) {
+    auto& result = results.at(processed);
+    {
+      std::unique_lock<std::mutex> lk(lock);
+      while (!result.done) {
+        cond.wait_for(lk, std::chrono::seconds(1));
+        time_t now = time(nullptr);
+        if (now - lastProgress >= 5) {
+          cerr<<"Processed "<<processed<<" of "<<count<<" zones"<<endl;
+          lastProgress = now;
+        }
+      }
+    }
+    cout<<result.out.str()<<std::flush;
+    cerr<<result.err.str()<<std::flush;
+    processed++;
+    if (result.exception) {
+      exception = result.exception;
+      break;
+    }
+    if (!doneFunc(processed - 1, result.ok)) {
+      break;
+    }
+    /* release the buffered output */
+    result.out.str(string());
+    result.err.str(string());
+  }
+
+  stop = true;
+  for (auto& thread : workers) {
+    thread.join();
+  }
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+
+  double elapsed = dt.udiff() / 1000000.0;
+  cerr<<"Processed "<<processed<<" zones in "<<elapsed<<" seconds using "<<jobs<<" jobs ("<<(elapsed > 0 ? processed / elapsed : processed)<<" zones/s)"<<endl;
+  return processed;
+}
+
+static bool rectifyAllZones(bool quiet = false)
 {
   UeberBackend B("default");
   vector<DomainInfo> domainInfo;
   bool result = true;
 
   B.getAllDomains(&domainInfo);
-  for(DomainInfo di :  domainInfo) {
-    if (!quiet) {
-      cerr<<"Rectifying "<<di.zone<<": ";
-    }
-    if (!rectifyZone(dk, di.zone, quiet)) {
-      result = false;
-    }
-  }
+  processZones(domainInfo.size(),
+               [&domainInfo,quiet](size_t idx, DNSSECKeeper& dk, UeberBackend&, ostream&, ostream& err) {
+                 if (!quiet) {
+                   err<<"Rectifying "<<domainInfo.at(idx).zone<<": ";
+                 }
+                 return rectifyZone(dk, domainInfo.at(idx).zone, quiet, true, err);
+               },
+               [&result](size_t, bool ok) {
+                 if (!ok) {
+                   result = false;
+                 }
+                 return true;
+               });
   if (!quiet) {
     cout<<"Rectified "<<domainInfo.size()<<" zones."<<endl;
   }
   return result;
 }
 
-static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, const vector<DNSResourceRecord>* suppliedrecords=0)
+static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, const vector<DNSResourceRecord>* suppliedrecords=0, ostream& out = cout)
 {
   uint64_t numerrors=0, numwarnings=0;
 
   DomainInfo di;
   try {
     if (!B.getDomainInfo(zone, di)) {
-      cout<<"[Error] Unable to get domain information for zone '"<<zone<<"'"<<endl;
+      out<<"[Error] Unable to get domain information for zone '"<<zone<<"'"<<endl;
       return 1;
     }
   } catch(const PDNSException &e) {
     if (di.kind == DomainInfo::Slave) {
-      cout<<"[Error] non-IP address for masters: "<<e.reason<<endl;
+      out<<"[Error] non-IP address for masters: "<<e.reason<<endl;
       numerrors++;
     }
   }
 
   SOAData sd;
   if(!B.getSOAUncached(zone, sd)) {
-    cout<<"[Error] No SOA record present, or active, in zone '"<<zone<<"'"<<endl;
+    out<<"[Error] No SOA record present, or active, in zone '"<<zone<<"'"<<endl;
     numerrors++;
-    cout<<"Checked 0 records of '"<<zone<<"', "<<numerrors<<" errors, 0 warnings."<<endl;
+    out<<"Checked 0 records of '"<<zone<<"', "<<numerrors<<" errors, 0 warnings."<<endl;
     return 1;
   }
 
@@ -268,7 +402,7 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
   if (haveNSEC3) {
     if(isSecure && zone.wirelength() > 222) {
       numerrors++;
-      cout<<"[Error] zone '" << zone << "' has NSEC3 semantics but is too long to have the hash prepended. Zone name is " << zone.wirelength() << " bytes long, whereas the maximum is 222 bytes." << endl;
+      out<<"[Error] zone '" << zone << "' has NSEC3 semantics but is too long to have the hash prepended. Zone name is " << zone.wirelength() << " bytes long, whereas the maximum is 222 bytes." << endl;
     }
 
     vector<DNSBackend::KeyData> dbkeyset;
@@ -279,7 +413,7 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
       shared_ptr<DNSCryptoKeyEngine>(DNSCryptoKeyEngine::makeFromISCString(dkrc, kd.content));
 
       if(dkrc.d_algorithm == DNSSECKeeper::RSASHA1) {
-        cout<<"[Error] zone '"<<zone<<"' has NSEC3 semantics, but the "<< (kd.active ? "" : "in" ) <<"active key with id "<<kd.id<<" has 'Algorithm: 5'. This should be corrected to 'Algorithm: 7' in the database (or NSEC3 should be disabled)."<<endl;
+        out<<"[Error] zone '"<<zone<<"' has NSEC3 semantics, but the "<< (kd.active ? "" : "in" ) <<"active key with id "<<kd.id<<" has 'Algorithm: 5'. This should be corrected to 'Algorithm: 7' in the database (or NSEC3 should be disabled)."<<endl;
         numerrors++;
       }
     }
@@ -287,9 +421,9 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
 
   if (!validKeys) {
     numerrors++;
-    cout<<"[Error] zone '" << zone << "' has at least one invalid DNS Private Key." << endl;
+    out<<"[Error] zone '" << zone << "' has at least one invalid DNS Private Key." << endl;
     for (const auto &msg : checkKeyErrors) {
-      cout<<"\t"<<msg<<endl;
+      out<<"\t"<<msg<<endl;
     }
   }
 
@@ -304,7 +438,7 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
       while(B.get(zr))
         ns |= (zr.dr.d_type == QType::NS);
       if (!ns) {
-        cout<<"[Error] No delegation for zone '"<<zone<<"' in parent '"<<parent<<"'"<<endl;
+        out<<"[Error] No delegation for zone '"<<zone<<"' in parent '"<<parent<<"'"<<endl;
         numerrors++;
       }
       break;
@@ -340,7 +474,7 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
       stringtok(parts, rr.content);
 
       if(parts.size() < 7) {
-        cout<<"[Warning] SOA autocomplete is deprecated, missing field(s) in SOA content: "<<rr.qname<<" IN " <<rr.qtype.getName()<< " '" << rr.content<<"'"<<endl;
+        out<<"[Warning] SOA autocomplete is deprecated, missing field(s) in SOA content: "<<rr.qname<<" IN " <<rr.qtype.getName()<< " '" << rr.content<<"'"<<endl;
       }
 
       ostringstream o;
@@ -364,28 +498,28 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
             tmp = drc->getZoneRepresentation(false);
           }
           if(!pdns_iequals(tmp, rr.content)) {
-            cout<<"[Warning] Parsed and original record content are not equal: "<<rr.qname<<" IN " <<rr.qtype.getName()<< " '" << rr.content<<"' (Content parsed as '"<<tmp<<"')"<<endl;
+            out<<"[Warning] Parsed and original record content are not equal: "<<rr.qname<<" IN " <<rr.qtype.getName()<< " '" << rr.content<<"' (Content parsed as '"<<tmp<<"')"<<endl;
             numwarnings++;
           }
         }
       } else {
         struct in6_addr tmpbuf;
         if (inet_pton(AF_INET6, rr.content.c_str(), &tmpbuf) != 1 || rr.content.find('.') != string::npos) {
-          cout<<"[Warning] Following record is not a valid IPv6 address: "<<rr.qname<<" IN " <<rr.qtype.getName()<< " '" << rr.content<<"'"<<endl;
+          out<<"[Warning] Following record is not a valid IPv6 address: "<<rr.qname<<" IN " <<rr.qtype.getName()<< " '" << rr.content<<"'"<<endl;
           numwarnings++;
         }
       }
     }
     catch(std::exception& e)
     {
-      cout<<"[Error] Following record had a problem: \""<<rr.qname<<" IN "<<rr.qtype.getName()<<" "<<rr.content<<"\""<<endl;
-      cout<<"[Error] Error was: "<<e.what()<<endl;
+      out<<"[Error] Following record had a problem: \""<<rr.qname<<" IN "<<rr.qtype.getName()<<" "<<rr.content<<"\""<<endl;
+      out<<"[Error] Error was: "<<e.what()<<endl;
       numerrors++;
       continue;
     }
 
     if(!rr.qname.isPartOf(zone)) {
-      cout<<"[Error] Record '"<<rr.qname<<" IN "<<rr.qtype.getName()<<" "<<rr.content<<"' in zone '"<<zone<<"' is out-of-zone."<<endl;
+      out<<"[Error] Record '"<<rr.qname<<" IN "<<rr.qtype.getName()<<" "<<rr.content<<"' in zone '"<<zone<<"' is out-of-zone."<<endl;
       numerrors++;
       continue;
     }
@@ -397,7 +531,7 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
       contentstr=toLower(contentstr);
     }
     if (recordcontents.count(contentstr)) {
-      cout<<"[Error] Duplicate record found in rrset: '"<<rr.qname<<" IN "<<rr.qtype.getName()<<" "<<rr.content<<"'"<<endl;
+      out<<"[Error] Duplicate record found in rrset: '"<<rr.qname<<" IN "<<rr.qtype.getName()<<" "<<rr.content<<"'"<<endl;
       numerrors++;
       continue;
     } else
@@ -411,14 +545,14 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
     }
     ret = ttl.insert(pair<string, unsigned int>(toLower(content.str()), rr.ttl));
     if (ret.second == false && ret.first->second != rr.ttl) {
-      cout<<"[Error] TTL mismatch in rrset: '"<<rr.qname<<" IN " <<rr.qtype.getName()<<" "<<rr.content<<"' ("<<ret.first->second<<" != "<<rr.ttl<<")"<<endl;
+      out<<"[Error] TTL mismatch in rrset: '"<<rr.qname<<" IN " <<rr.qtype.getName()<<" "<<rr.content<<"' ("<<ret.first->second<<" != "<<rr.ttl<<")"<<endl;
       numerrors++;
       continue;
     }
 
     if (isSecure && isOptOut && (rr.qname.countLabels() && rr.qname.getRawLabels()[0] == "*")) {
-      cout<<"[Warning] wildcard record '"<<rr.qname<<" IN " <<rr.qtype.getName()<<" "<<rr.content<<"' is insecure"<<endl;
-      cout<<"[Info] Wildcard records in opt-out zones are insecure. Disable the opt-out flag for this zone to avoid this warning. Command: pdnsutil set-nsec3 "<<zone<<endl;
+      out<<"[Warning] wildcard record '"<<rr.qname<<" IN " <<rr.qtype.getName()<<" "<<rr.content<<"' is insecure"<<endl;
+      out<<"[Info] Wildcard records in opt-out zones are insecure. Disable the opt-out flag for this zone to avoid this warning. Command: pdnsutil set-nsec3 "<<zone<<endl;
       numwarnings++;
     }
 
@@ -426,16 +560,16 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
       if (rr.qtype.getCode() == QType::NS) {
         hasNsAtApex=true;
       } else if (rr.qtype.getCode() == QType::DS) {
-        cout<<"[Warning] DS at apex in zone '"<<zone<<"', should not be here."<<endl;
+        out<<"[Warning] DS at apex in zone '"<<zone<<"', should not be here."<<endl;
         numwarnings++;
       }
     } else {
       if (rr.qtype.getCode() == QType::SOA) {
-        cout<<"[Error] SOA record not at apex '"<<rr.qname<<" IN "<<rr.qtype.getName()<<" "<<rr.content<<"' in zone '"<<zone<<"'"<<endl;
+        out<<"[Error] SOA record not at apex '"<<rr.qname<<" IN "<<rr.qtype.getName()<<" "<<rr.content<<"' in zone '"<<zone<<"'"<<endl;
         numerrors++;
         continue;
       } else if (rr.qtype.getCode() == QType::DNSKEY) {
-        cout<<"[Warning] DNSKEY record not at apex '"<<rr.qname<<" IN "<<rr.qtype.getName()<<" "<<rr.content<<"' in zone '"<<zone<<"', should not be here."<<endl;
+        out<<"[Warning] DNSKEY record not at apex '"<<rr.qname<<" IN "<<rr.qtype.getName()<<" "<<rr.content<<"' in zone '"<<zone<<"', should not be here."<<endl;
         numwarnings++;
       } else if (rr.qtype.getCode() == QType::NS) {
         if (DNSName(rr.content).isPartOf(rr.qname)) {
@@ -449,13 +583,13 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
       }
     }
     if((rr.qtype.getCode() == QType::A || rr.qtype.getCode() == QType::AAAA) && !rr.qname.isWildcard() && !rr.qname.isHostname())
-      cout<<"[Info] "<<rr.qname.toString()<<" record for '"<<rr.qtype.getName()<<"' is not a valid hostname."<<endl;
+      out<<"[Info] "<<rr.qname.toString()<<" record for '"<<rr.qtype.getName()<<"' is not a valid hostname."<<endl;
 
     // Check if the DNSNames that should be hostnames, are hostnames
     try {
       checkHostnameCorrectness(rr);
     } catch (const std::exception& e) {
-      cout << "[Warning] " << rr.qtype.getName() << " record in zone '" << zone << ": " << e.what() << endl;
+      out << "[Warning] " << rr.qtype.getName() << " record in zone '" << zone << ": " << e.what() << endl;
       numwarnings++;
     }
 
@@ -463,14 +597,14 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
       if (!cnames.count(rr.qname))
         cnames.insert(rr.qname);
       else {
-        cout<<"[Error] Duplicate CNAME found at '"<<rr.qname<<"'"<<endl;
+        out<<"[Error] Duplicate CNAME found at '"<<rr.qname<<"'"<<endl;
         numerrors++;
         continue;
       }
     } else {
       if (rr.qtype.getCode() == QType::RRSIG) {
         if(!presigned) {
-          cout<<"[Error] RRSIG found at '"<<rr.qname<<"' in non-presigned zone. These do not belong in the database."<<endl;
+          out<<"[Error] RRSIG found at '"<<rr.qname<<"' in non-presigned zone. These do not belong in the database."<<endl;
           numerrors++;
           continue;
         }
@@ -480,7 +614,7 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
 
     if(rr.qtype.getCode() == QType::NSEC || rr.qtype.getCode() == QType::NSEC3)
     {
-      cout<<"[Error] NSEC or NSEC3 found at '"<<rr.qname<<"'. These do not belong in the database."<<endl;
+      out<<"[Error] NSEC or NSEC3 found at '"<<rr.qname<<"'. These do not belong in the database."<<endl;
       numerrors++;
       continue;
     }
@@ -491,13 +625,13 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
       {
         if(rr.ttl != sd.minimum)
         {
-          cout<<"[Warning] DNSKEY TTL of "<<rr.ttl<<" at '"<<rr.qname<<"' differs from SOA minimum of "<<sd.minimum<<endl;
+          out<<"[Warning] DNSKEY TTL of "<<rr.ttl<<" at '"<<rr.qname<<"' differs from SOA minimum of "<<sd.minimum<<endl;
           numwarnings++;
         }
       }
       else
       {
-        cout<<"[Warning] DNSKEY at '"<<rr.qname<<"' in non-presigned zone will mostly be ignored and can cause problems."<<endl;
+        out<<"[Warning] DNSKEY at '"<<rr.qname<<"' in non-presigned zone will mostly be ignored and can cause problems."<<endl;
         numwarnings++;
       }
     }
@@ -505,7 +639,7 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
 
   for(auto &i: cnames) {
     if (noncnames.find(i) != noncnames.end()) {
-      cout<<"[Error] CNAME "<<i<<" found, but other records with same label exist."<<endl;
+      out<<"[Error] CNAME "<<i<<" found, but other records with same label exist."<<endl;
       numerrors++;
     }
   }
@@ -516,28 +650,28 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
     if (cnames.find(name) == cnames.end() && noncnames.find(name) == noncnames.end()) {
       // No specific record for the name in the TLSA record exists, this
       // is already worth emitting a warning. Let's see if a wildcard exist.
-      cout<<"[Warning] ";
+      out<<"[Warning] ";
       DNSName wcname(name);
       wcname.chopOff();
       wcname.prependRawLabel("*");
       if (cnames.find(wcname) != cnames.end() || noncnames.find(wcname) != noncnames.end()) {
-        cout<<"A wildcard record exist for '"<<wcname<<"' and a TLSA record for '"<<i<<"'.";
+        out<<"A wildcard record exist for '"<<wcname<<"' and a TLSA record for '"<<i<<"'.";
       } else {
-        cout<<"No record for '"<<name<<"' exists, but a TLSA record for '"<<i<<"' does.";
+        out<<"No record for '"<<name<<"' exists, but a TLSA record for '"<<i<<"' does.";
       }
       numwarnings++;
-      cout<<" A query for '"<<name<<"' will yield an empty response. This is most likely a mistake, please create records for '"<<name<<"'."<<endl;
+      out<<" A query for '"<<name<<"' will yield an empty response. This is most likely a mistake, please create records for '"<<name<<"'."<<endl;
     }
   }
 
   if(!hasNsAtApex) {
-    cout<<"[Error] No NS record at zone apex in zone '"<<zone<<"'"<<endl;
+    out<<"[Error] No NS record at zone apex in zone '"<<zone<<"'"<<endl;
     numerrors++;
   }
 
   for(const auto &qname : checkglue) {
     if (!glue.count(qname)) {
-      cout<<"[Warning] Missing glue for '"<<qname<<"' in zone '"<<zone<<"'"<<endl;
+      out<<"[Warning] Missing glue for '"<<qname<<"' in zone '"<<zone<<"'"<<endl;
       numwarnings++;
     }
   }
@@ -549,13 +683,13 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
       }
       if( rr.qname.isPartOf( qname.first ) ) {
         if( qname.second == QType::DNAME || ( rr.qtype != QType::ENT && rr.qtype.getCode() != QType::A && rr.qtype.getCode() != QType::AAAA ) ) {
-          cout << "[Warning] '" << rr.qname << "|" << rr.qtype.getName() << "' in zone '" << zone << "' is occluded by a ";
+          out << "[Warning] '" << rr.qname << "|" << rr.qtype.getName() << "' in zone '" << zone << "' is occluded by a ";
           if( qname.second == QType::NS ) {
-            cout << "delegation";
+            out << "delegation";
           } else {
-            cout << "DNAME";
+            out << "DNAME";
           }
-          cout << " at '" << qname.first << "'" << endl;
+          out << " at '" << qname.first << "'" << endl;
           numwarnings++;
         }
       }
@@ -589,22 +723,22 @@ static int checkZone(DNSSECKeeper &dk, UeberBackend &B, const DNSName& zone, con
       }
     }
     if( ! ds_ns && rr.qtype.getCode() == QType::DS && rr.qname != zone ) {
-      cout << "[Warning] DS record without a delegation '" << rr.qname<<"'." << endl;
+      out << "[Warning] DS record without a delegation '" << rr.qname<<"'." << endl;
       numwarnings++;
     }
     if( ! ok && ! suppliedrecords ) {
-      cout << "[Error] Following record is auth=" << rr.auth << ", run pdnsutil rectify-zone?: " << rr.qname << " IN " << rr.qtype.getName() << " " << rr.content << endl;
+      out << "[Error] Following record is auth=" << rr.auth << ", run pdnsutil rectify-zone?: " << rr.qname << " IN " << rr.qtype.getName() << " " << rr.content << endl;
       numerrors++;
     }
   }
 
-  cout<<"Checked "<<records.size()<<" records of '"<<zone<<"', "<<numerrors<<" errors, "<<numwarnings<<" warnings."<<endl;
+  out<<"Checked "<<records.size()<<" records of '"<<zone<<"', "<<numerrors<<" errors, "<<numwarnings<<" warnings."<<endl;
   if(!numerrors)
     return EXIT_SUCCESS;
   return EXIT_FAILURE;
 }
 
-static int checkAllZones(DNSSECKeeper &dk, bool exitOnError)
+static int checkAllZones(bool exitOnError)
 {
   UeberBackend B("default");
   vector<DomainInfo> domainInfo;
@@ -620,45 +754,51 @@ static int checkAllZones(DNSSECKeeper &dk, bool exitOnError)
 
   B.getAllDomains(&domainInfo, true);
   int errors=0;
-  for(auto di : domainInfo) {
-    if (checkZone(dk, B, di.zone) > 0) {
-      errors++;
-    }
-
-    auto seenName = seenNames.find(di.zone);
-    if (seenName != seenNames.end()) {
-      cout<<"[Error] Another SOA for zone '"<<di.zone<<"' (serial "<<di.serial<<") has already been seen (serial "<<seenName->serial<<")."<<endl;
-      errors++;
-    }
-
-    auto seenId = seenIds.find(di.id);
-    if (seenId != seenIds.end()) {
-      cout<<"[Error] Domain ID "<<di.id<<" of '"<<di.zone<<"' in backend "<<di.backend->getPrefix()<<" has already been used by zone '"<<seenId->zone<<"' in backend "<<seenId->backend->getPrefix()<<"."<<endl;
-      errors++;
-    }
-
-    seenInfos.insert(di);
-
-    if(errors && exitOnError)
-      return EXIT_FAILURE;
-  }
+  processZones(domainInfo.size(),
+               [&domainInfo](size_t idx, DNSSECKeeper& zdk, UeberBackend& zB, ostream& out, ostream&) {
+                 return checkZone(zdk, zB, domainInfo.at(idx).zone, 0, out) == EXIT_SUCCESS;
+               },
+               [&](size_t idx, bool ok) {
+                 const auto& di = domainInfo.at(idx);
+                 if (!ok) {
+                   errors++;
+                 }
+
+                 auto seenName = seenNames.find(di.zone);
+                 if (seenName != seenNames.end()) {
+                   cout<<"[Error] Another SOA for zone '"<<di.zone<<"' (serial "<<di.serial<<") has already been seen (serial "<<seenName->serial<<")."<<endl;
+                   errors++;
+                 }
+
+                 auto seenId = seenIds.find(di.id);
+                 if (seenId != seenIds.end()) {
+                   cout<<"[Error] Domain ID "<<di.id<<" of '"<<di.zone<<"' in backend "<<di.backend->getPrefix()<<" has already been used by zone '"<<seenId->zone<<"' in backend "<<seenId->backend->getPrefix()<<"."<<endl;
+                   errors++;
+                 }
+
+                 seenInfos.insert(di);
+
+                 return !(errors && exitOnError);
+               });
+  if(errors && exitOnError)
+    return EXIT_FAILURE;
   cout<<"Checked "<<domainInfo.size()<<" zones, "<<errors<<" had errors."<<endl;
   if(!errors)
     return EXIT_SUCCESS;
   return EXIT_FAILURE;
 }
 
-static int increaseSerial(const DNSName& zone, DNSSECKeeper &dk)
+static int increaseSerial(const DNSName& zone, DNSSECKeeper &dk, ostream& out = cout, ostream& err = cerr)
 {
   UeberBackend B("default");
   SOAData sd;
   if(!B.getSOAUncached(zone, sd)) {
-    cerr<<"No SOA for zone '"<<zone<<"'"<<endl;
+    err<<"No SOA for zone '"<<zone<<"'"<<endl;
     return -1;
   }
 
   if (dk.isPresigned(zone)) {
-    cerr<<"Serial increase of presigned zone '"<<zone<<"' is not allowed."<<endl;
+    err<<"Serial increase of presigned zone '"<<zone<<"' is not allowed."<<endl;
     return -1;
   }
 
@@ -672,7 +812,7 @@ static int increaseSerial(const DNSName& zone, DNSSECKeeper &dk)
 
   if (!sd.db->replaceRRSet(sd.domain_id, zone, rr.qtype, vector<DNSResourceRecord>(1, rr))) {
    sd.db->abortTransaction();
-   cerr<<"Backend did not replace SOA record. Backend might not support this operation."<<endl;
+   err<<"Backend did not replace SOA record. Backend might not support this operation."<<endl;
    return -1;
   }
 
@@ -688,13 +828,13 @@ static int increaseSerial(const DNSName& zone, DNSSECKeeper &dk)
     } else
       ordername=DNSName("");
     if(g_verbose)
-      cerr<<"'"<<rr.qname<<"' -> '"<< ordername <<"'"<<endl;
+      err<<"'"<<rr.qname<<"' -> '"<< ordername <<"'"<<endl;
     sd.db->updateDNSSECOrderNameAndAuth(sd.domain_id, rr.qname, ordername, true);
   }
 
   sd.db->commitTransaction();
 
-  cout<<"SOA serial for zone "<<zone<<" set to "<<sd.serial<<endl;
+  out<<"SOA serial for zone "<<zone<<" set to "<<sd.serial<<endl;
   return 0;
 }
 
@@ -1076,19 +1216,19 @@ static int xcryptIP(const std::string& cmd, const std::string& ip, const std::st
 }
 
 
-static int loadZone(DNSName zone, const string& fname) {
+static int loadZone(DNSName zone, const string& fname, ostream& err = cerr) {
   UeberBackend B;
   DomainInfo di;
 
   if (B.getDomainInfo(zone, di)) {
-    cerr<<"Domain '"<<zone<<"' exists already, replacing contents"<<endl;
+    err<<"Domain '"<<zone<<"' exists already, replacing contents"<<endl;
   }
   else {
-    cerr<<"Creating '"<<zone<<"'"<<endl;
+    err<<"Creating '"<<zone<<"'"<<endl;
     B.createDomain(zone);
 
     if(!B.getDomainInfo(zone, di)) {
-      cerr<<"Domain '"<<zone<<"' was not created - perhaps backend ("<<::arg()["launch"]<<") does not support storing new zones."<<endl;
+      err<<"Domain '"<<zone<<"' was not created - perhaps backend ("<<::arg()["launch"]<<") does not support storing new zones."<<endl;
       return EXIT_FAILURE;
     }
   }
@@ -1098,14 +1238,14 @@ static int loadZone(DNSName zone, const string& fname) {
 
   DNSResourceRecord rr;
   if(!db->startTransaction(zone, di.id)) {
-    cerr<<"Unable to start transaction for load of zone '"<<zone<<"'"<<endl;
+    err<<"Unable to start transaction for load of zone '"<<zone<<"'"<<endl;
     return EXIT_FAILURE;
   }
   rr.domain_id=di.id;
   bool haveSOA = false;
   while(zpt.get(rr)) {
     if(!rr.qname.isPartOf(zone) && rr.qname!=zone) {
-      cerr<<"File contains record named '"<<rr.qname<<"' which is not part of zone '"<<zone<<"'"<<endl;
+      err<<"File contains record named '"<<rr.qname<<"' which is not part of zone '"<<zone<<"'"<<endl;
       return EXIT_FAILURE;
     }
     if (rr.qtype == QType::SOA) {
@@ -1719,7 +1859,7 @@ static bool showZone(DNSSECKeeper& dk, const DNSName& zone, bool exportDS = fals
   return true;
 }
 
-static bool secureZone(DNSSECKeeper& dk, const DNSName& zone)
+static bool secureZone(DNSSECKeeper& dk, const DNSName& zone, ostream& out = cout, ostream& err = cerr)
 {
   // parse attribute
   int k_size;
@@ -1745,68 +1885,68 @@ static bool secureZone(DNSSECKeeper& dk, const DNSName& zone)
   }
 
   if(dk.isSecuredZone(zone)) {
-    cerr << "Zone '"<<zone<<"' already secure, remove keys with pdnsutil remove-zone-key if needed"<<endl;
+    err << "Zone '"<<zone<<"' already secure, remove keys with pdnsutil remove-zone-key if needed"<<endl;
     return false;
   }
 
   DomainInfo di;
   UeberBackend B("default");
   if(!B.getDomainInfo(zone, di) || !di.backend) { // di.backend and B are mostly identical
-    cerr<<"Can't find a zone called '"<<zone<<"'"<<endl;
+    err<<"Can't find a zone called '"<<zone<<"'"<<endl;
     return false;
   }
 
   if(di.kind == DomainInfo::Slave)
   {
-    cerr<<"Warning! This is a slave domain! If this was a mistake, please run"<<endl;
-    cerr<<"pdnsutil disable-dnssec "<<zone<<" right now!"<<endl;
+    err<<"Warning! This is a slave domain! If this was a mistake, please run"<<endl;
+    err<<"pdnsutil disable-dnssec "<<zone<<" right now!"<<endl;
   }
 
   if (k_algo != "") { // Add a KSK
     if (k_size)
-      cout << "Securing zone with key size " << k_size << endl;
+      out << "Securing zone with key size " << k_size << endl;
     else
-      cout << "Securing zone with default key size" << endl;
+      out << "Securing zone with default key size" << endl;
 
-    cout << "Adding "<<(z_algo == "" ? "CSK (257)" : "KSK")<<" with algorithm " << k_algo << endl;
+    out << "Adding "<<(z_algo == "" ? "CSK (257)" : "KSK")<<" with algorithm " << k_algo << endl;
 
     int k_real_algo = DNSSECKeeper::shorthand2algorithm(k_algo);
 
     if (!dk.addKey(zone, true, k_real_algo, id, k_size, true, true)) {
-      cerr<<"No backend was able to secure '"<<zone<<"', most likely because no DNSSEC"<<endl;
-      cerr<<"capable backends are loaded, or because the backends have DNSSEC disabled."<<endl;
-      cerr<<"For the Generic SQL backends, set the 'gsqlite3-dnssec', 'gmysql-dnssec' or"<<endl;
-      cerr<<"'gpgsql-dnssec' flag. Also make sure the schema has been updated for DNSSEC!"<<endl;
+      err<<"No backend was able to secure '"<<zone<<"', most likely because no DNSSEC"<<endl;
+      err<<"capable backends are loaded, or because the backends have DNSSEC disabled."<<endl;
+      err<<"For the Generic SQL backends, set the 'gsqlite3-dnssec', 'gmysql-dnssec' or"<<endl;
+      err<<"'gpgsql-dnssec' flag. Also make sure the schema has been updated for DNSSEC!"<<endl;
       return false;
     }
   }
 
   if (z_algo != "") {
-    cout << "Adding "<<(k_algo == "" ? "CSK (256)" : "ZSK")<<" with algorithm " << z_algo << endl;
+    out << "Adding "<<(k_algo == "" ? "CSK (256)" : "ZSK")<<" with algorithm " << z_algo << endl;
 
     int z_real_algo = DNSSECKeeper::shorthand2algorithm(z_algo);
 
     if (!dk.addKey(zone, false, z_real_algo, id, z_size, true, true)) {
-      cerr<<"No backend was able to secure '"<<zone<<"', most likely because no DNSSEC"<<endl;
-      cerr<<"capable backends are loaded, or because the backends have DNSSEC disabled."<<endl;
-      cerr<<"For the Generic SQL backends, set the 'gsqlite3-dnssec', 'gmysql-dnssec' or"<<endl;
-      cerr<<"'gpgsql-dnssec' flag. Also make sure the schema has been updated for DNSSEC!"<<endl;
+      err<<"No backend was able to secure '"<<zone<<"', most likely because no DNSSEC"<<endl;
+      err<<"capable backends are loaded, or because the backends have DNSSEC disabled."<<endl;
+      err<<"For the Generic SQL backends, set the 'gsqlite3-dnssec', 'gmysql-dnssec' or"<<endl;
+      err<<"'gpgsql-dnssec' flag. Also make sure the schema has been updated for DNSSEC!"<<endl;
       return false;
     }
   }
 
   if(!dk.isSecuredZone(zone)) {
-    cerr<<"Failed to secure zone. Is your backend dnssec enabled? (set "<<endl;
-    cerr<<"gsqlite3-dnssec, or gmysql-dnssec etc). Check this first."<<endl;
-    cerr<<"If you run with the BIND backend, make sure you have configured"<<endl;
-    cerr<<"it to use DNSSEC with 'bind-dnssec-db=/path/fname' and"<<endl;
-    cerr<<"'pdnsutil create-bind-db /path/fname'!"<<endl;
+    err<<"Failed to secure zone. Is your backend dnssec enabled? (set "<<endl;
+    err<<"gsqlite3-dnssec, or gmysql-dnssec etc). Check this first."<<endl;
+    err<<"If you run with the BIND backend, make sure you have configured"<<endl;
+    err<<"it to use DNSSEC with 'bind-dnssec-db=/path/fname' and"<<endl;
+    err<<"'pdnsutil create-bind-db /path/fname'!"<<endl;
     return false;
   }
 
   // rectifyZone(dk, zone);
   // showZone(dk, zone);
-  cout<<"Zone "<<zone<<" secured"<<endl;
+  out<<"Zone "<<zone<<" secured"<<endl;
   return true;
 }
 
@@ -1968,6 +2108,7 @@ try
     ("help,h", "produce help message")
     ("version", "show version")
     ("verbose,v", "be verbose")
+    ("jobs,j", po::value<unsigned int>()->default_value(1), "number of zones to process in parallel for zone-wide commands")
     ("force", "force an action")
     ("config-name", po::value<string>()->default_value(""), "virtual configuration name")
     ("config-dir", po::value<string>()->default_value(SYSCONFDIR), "location of pdns.conf")
@@ -1984,6 +2125,7 @@ try
     cmds = g_vm["commands"].as<vector<string> >();
 
   g_verbose = g_vm.count("verbose");
+  g_jobs = g_vm["jobs"].as<unsigned int>();
 
   if (g_vm.count("version")) {
     cout<<"pdnsutil "<<VERSION<<endl;
@@ -2192,7 +2334,7 @@ try
   }
   else if (cmds[0] == "rectify-all-zones") {
     bool quiet = (cmds.size() >= 2 && cmds[1] == "quiet");
-    if (!rectifyAllZones(dk, quiet)) {
+    if (!rectifyAllZones(quiet)) {
       return 1;
     }
   }
@@ -2209,7 +2351,7 @@ try
   }
   else if (cmds[0] == "check-all-zones") {
     bool exitOnError = ((cmds.size() >= 2 ? cmds[1] : "") == "exit-on-error");
-    exit(checkAllZones(dk, exitOnError));
+    exit(checkAllZones(exitOnError));
   }
   else if (cmds[0] == "list-all-zones") {
     if (cmds.size() > 2) {
@@ -2526,8 +2668,11 @@ try
     if(cmds[1]==".")
       cmds[1].clear();
 
-    for(size_t n=1; n + 2 <= cmds.size(); n+=2)
-      loadZone(DNSName(cmds[n]), cmds[n+1]);
+    processZones((cmds.size() - 1) / 2,
+                 [&cmds](size_t idx, DNSSECKeeper&, UeberBackend&, ostream&, ostream& err) {
+                   return loadZone(DNSName(cmds.at(1 + 2 * idx)), cmds.at(2 + 2 * idx), err) == EXIT_SUCCESS;
+                 },
+                 [](size_t, bool) { return true; });
     return 0;
   }
   else if(cmds[0] == "secure-zone") {
@@ -2567,21 +2712,35 @@ try
     vector<DomainInfo> domainInfo;
     B.getAllDomains(&domainInfo);
 
+    const bool mustIncreaseSerial = (cmds.size() == 2);
+    vector<char> secured(domainInfo.size(), false);
     unsigned int zonesSecured=0, zoneErrors=0;
-    for(DomainInfo di :  domainInfo) {
-      if(!dk.isSecuredZone(di.zone)) {
-        cout<<"Securing "<<di.zone<<": ";
-        if (secureZone(dk, di.zone)) {
-          zonesSecured++;
-          if (cmds.size() == 2) {
-            if (!increaseSerial(di.zone, dk))
-              continue;
-          } else
-            continue;
-        }
-        zoneErrors++;
-      }
-    }
+    processZones(domainInfo.size(),
+                 [&domainInfo,&secured,mustIncreaseSerial](size_t idx, DNSSECKeeper& zdk, UeberBackend&, ostream& out, ostream& err) {
+                   const auto& zone = domainInfo.at(idx).zone;
+                   if(zdk.isSecuredZone(zone)) {
+                     return true;
+                   }
+                   out<<"Securing "<<zone<<": ";
+                   if (secureZone(zdk, zone, out, err)) {
+                     secured.at(idx) = true;
+                     if (mustIncreaseSerial) {
+                       if (!increaseSerial(zone, zdk, out, err))
+                         return true;
+                     } else
+                       return true;
+                   }
+                   return false;
+                 },
+                 [&](size_t idx, bool ok) {
+                   if (secured.at(idx)) {
+                     zonesSecured++;
+                   }
+                   if (!ok) {
+                     zoneErrors++;
+                   }
+                   return true;
+                 });
 
     cout<<"Secured: "<<zonesSecured<<" zones. Errors: "<<zoneErrors<<endl;
 
@@ -0,0 +1,159 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "dnsname.hh"
+#include "iputils.hh"
+
+/* A minimal encoder for the protocol buffers wire format, appending to an
+   existing buffer so that the same buffer can be reused for every message.
+   It does not know anything about the schema: fields are written as they are
+   added, so they need to be added in increasing field number order to get the
+   same output than libprotobuf. */
+class ProtoBufEncoder
+{
+public:
+  ProtoBufEncoder(std::string& buffer): d_buffer(buffer)
+  {
+  }
+
+  void addVarint(uint32_t field, uint64_t value)
+  {
+    addTag(field, WireType::Varint);
+    addRawVarint(value);
+  }
+
+  void addBool(uint32_t field, bool value)
+  {
+    addVarint(field, value ? 1 : 0);
+  }
+
+  void addFixed32(uint32_t field, uint32_t value)
+  {
+    addTag(field, WireType::Fixed32);
+    /* little endian, whatever the host order is */
+    for (size_t idx = 0; idx < sizeof(value); idx++) {
+      d_buffer.append(1, static_cast<char>((value >> (idx * 8)) & 0xff));
+    }
+  }
+
+  void addBytes(uint32_t field, const char* data, size_t len)
+  {
+    addTag(field, WireType::LengthDelimited);
+    addRawVarint(len);
+    d_buffer.append(data, len);
+  }
+
+  void addBytes(uint32_t field, const std::string& data)
+  {
+    addBytes(field, data.data(), data.size());
+  }
+
+  /* the raw address: 4 bytes for IPv4, 16 for IPv6, nothing otherwise */
+  void addAddress(uint32_t field, const ComboAddress& ca)
+  {
+    if (ca.sin4.sin_family == AF_INET) {
+      addBytes(field, reinterpret_cast<const char*>(&ca.sin4.sin_addr.s_addr), sizeof(ca.sin4.sin_addr.s_addr));
+    }
+    else if (ca.sin4.sin_family == AF_INET6) {
+      addBytes(field, reinterpret_cast<const char*>(&ca.sin6.sin6_addr.s6_addr), sizeof(ca.sin6.sin6_addr.s6_addr));
+    }
+  }
+
+  /* the textual representation of the name, with a trailing dot */
+  void addName(uint32_t field, const DNSName& name)
+  {
+    /* the length of the textual representation is not known in advance,
+       so do as if it were an embedded message */
+    auto start = startMessage(field);
+    name.appendToString(d_buffer);
+    endMessage(start);
+  }
+
+  /* starts an embedded message, whose length is not known yet.
+     The returned value has to be passed to endMessage() once the content
+     of the embedded message has been added. */
+  size_t startMessage(uint32_t field)
+  {
+    addTag(field, WireType::LengthDelimited);
+    /* most embedded messages are smaller than 128 bytes, so we reserve
+       one byte for the length and move the content later if needed */
+    d_buffer.append(1, 0);
+    return d_buffer.size();
+  }
+
+  void endMessage(size_t start)
+  {
+    const size_t len = d_buffer.size() - start;
+    if (len < 128) {
+      d_buffer.at(start - 1) = static_cast<char>(len);
+      return;
+    }
+
+    size_t lenBytes = getVarintSize(len);
+    d_buffer.insert(start, lenBytes - 1, 0);
+    size_t pos = start - 1;
+    uint64_t value = len;
+    while (value >= 0x80) {
+      d_buffer.at(pos++) = static_cast<char>((value & 0x7f) | 0x80);
+      value >>= 7;
+    }
+    d_buffer.at(pos) = static_cast<char>(value);
+  }
+
+  const std::string& getBuffer() const
+  {
+    return d_buffer;
+  }
+
+private:
+  enum class WireType : uint8_t { Varint = 0, Fixed64 = 1, LengthDelimited = 2, Fixed32 = 5 };
+
+  static size_t getVarintSize(uint64_t value)
+  {
+    size_t size = 1;
+    while (value >= 0x80) {
+      value >>= 7;
+      size++;
+    }
+    return size;
+  }
+
+  void addTag(uint32_t field, WireType type)
+  {
+    addRawVarint((static_cast<uint64_t>(field) << 3) | static_cast<uint8_t>(type));
+  }
+
+  void addRawVarint(uint64_t value)
+  {
+    while (value >= 0x80) {
+      d_buffer.append(1, static_cast<char>((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+    d_buffer.append(1, static_cast<char>(value));
+  }
+
+  std::string& d_buffer;
+};
@@ -381,3 +381,227 @@ void DNSProtoBufMessage::copyFrom(const DNSProtoBufMessage& msg)
 }
 
 #endif /* HAVE_PROTOBUF */
+
+/* field numbers, from dnsmessage.proto */
+enum class PBDNSMessageField : uint32_t { type = 1, messageId = 2, serverIdentity = 3, socketFamily = 4, socketProtocol = 5, from = 6, to = 7, inBytes = 8, timeSec = 9, timeUsec = 10, id = 11, question = 12, response = 13, originalRequestorSubnet = 14, requestorId = 15, initialRequestId = 16, deviceId = 17, newlyObservedDomain = 18, deviceName = 19, fromPort = 20, toPort = 21 };
+enum class PBDNSQuestionField : uint32_t { qName = 1, qType = 2, qClass = 3 };
+enum class PBDNSResponseField : uint32_t { rcode = 1, rrs = 2, appliedPolicy = 3, tags = 4, queryTimeSec = 5, queryTimeUsec = 6, appliedPolicyType = 7 };
+enum class PBDNSRRField : uint32_t { name = 1, type = 2, rrClass = 3, ttl = 4, rdata = 5, udr = 6 };
+
+#define PBFIELD(field) static_cast<uint32_t>(field)
+
+void DNSProtoBufEncoder::setType(DNSProtoBufMessage::DNSProtoBufMessageType type)
+{
+  /* the values of the PBDNSMessage::Type enum start at 1 */
+  switch(type) {
+  case DNSProtoBufMessage::DNSProtoBufMessageType::Query:
+  case DNSProtoBufMessage::DNSProtoBufMessageType::Response:
+  case DNSProtoBufMessage::DNSProtoBufMessageType::OutgoingQuery:
+  case DNSProtoBufMessage::DNSProtoBufMessageType::IncomingResponse:
+    d_encoder.addVarint(PBFIELD(PBDNSMessageField::type), static_cast<uint32_t>(type) + 1);
+    break;
+  default:
+    throw std::runtime_error("Unsupported protobuf type: "+std::to_string(type));
+  }
+}
+
+void DNSProtoBufEncoder::setUUID(const boost::uuids::uuid& uuid)
+{
+  d_encoder.addBytes(PBFIELD(PBDNSMessageField::messageId), reinterpret_cast<const char*>(uuid.begin()), uuid.size());
+}
+
+void DNSProtoBufEncoder::setServerIdentity(const std::string& serverId)
+{
+  d_encoder.addBytes(PBFIELD(PBDNSMessageField::serverIdentity), serverId);
+}
+
+void DNSProtoBufEncoder::setSocket(const ComboAddress* requestor, const ComboAddress* responder, bool isTCP)
+{
+  const ComboAddress* addr = requestor ? requestor : responder;
+  if (addr) {
+    /* INET = 1, INET6 = 2 */
+    d_encoder.addVarint(PBFIELD(PBDNSMessageField::socketFamily), addr->sin4.sin_family == AF_INET ? 1 : 2);
+  }
+  /* UDP = 1, TCP = 2 */
+  d_encoder.addVarint(PBFIELD(PBDNSMessageField::socketProtocol), isTCP ? 2 : 1);
+}
+
+void DNSProtoBufEncoder::setRequestor(const ComboAddress& requestor)
+{
+  d_encoder.addAddress(PBFIELD(PBDNSMessageField::from), requestor);
+}
+
+void DNSProtoBufEncoder::setResponder(const ComboAddress& responder)
+{
+  d_encoder.addAddress(PBFIELD(PBDNSMessageField::to), responder);
+}
+
+void DNSProtoBufEncoder::setBytes(size_t bytes)
+{
+  d_encoder.addVarint(PBFIELD(PBDNSMessageField::inBytes), bytes);
+}
+
+void DNSProtoBufEncoder::setTime(time_t sec, uint32_t usec)
+{
+  d_encoder.addVarint(PBFIELD(PBDNSMessageField::timeSec), static_cast<uint32_t>(sec));
+  d_encoder.addVarint(PBFIELD(PBDNSMessageField::timeUsec), usec);
+}
+
+void DNSProtoBufEncoder::setId(uint16_t id)
+{
+  d_encoder.addVarint(PBFIELD(PBDNSMessageField::id), ntohs(id));
+}
+
+void DNSProtoBufEncoder::setQuestion(const DNSName& qname, uint16_t qtype, uint16_t qclass)
+{
+  auto start = d_encoder.startMessage(PBFIELD(PBDNSMessageField::question));
+  if (!qname.empty()) {
+    d_encoder.addName(PBFIELD(PBDNSQuestionField::qName), qname);
+  }
+  d_encoder.addVarint(PBFIELD(PBDNSQuestionField::qType), qtype);
+  d_encoder.addVarint(PBFIELD(PBDNSQuestionField::qClass), qclass);
+  d_encoder.endMessage(start);
+}
+
+void DNSProtoBufEncoder::startResponse()
+{
+  d_responseStart = d_encoder.startMessage(PBFIELD(PBDNSMessageField::response));
+}
+
+void DNSProtoBufEncoder::setResponseCode(uint32_t rcode)
+{
+  d_encoder.addVarint(PBFIELD(PBDNSResponseField::rcode), rcode);
+}
+
+size_t DNSProtoBufEncoder::startRR(const DNSName& qname, uint16_t uType, uint16_t uClass, uint32_t uTTL)
+{
+  auto start = d_encoder.startMessage(PBFIELD(PBDNSResponseField::rrs));
+  d_encoder.addName(PBFIELD(PBDNSRRField::name), qname);
+  d_encoder.addVarint(PBFIELD(PBDNSRRField::type), uType);
+  d_encoder.addVarint(PBFIELD(PBDNSRRField::rrClass), uClass);
+  d_encoder.addVarint(PBFIELD(PBDNSRRField::ttl), uTTL);
+  return start;
+}
+
+void DNSProtoBufEncoder::addRR(const DNSName& qname, uint16_t uType, uint16_t uClass, uint32_t uTTL, const std::string& blob)
+{
+  auto start = startRR(qname, uType, uClass, uTTL);
+  d_encoder.addBytes(PBFIELD(PBDNSRRField::rdata), blob);
+  d_encoder.endMessage(start);
+}
+
+void DNSProtoBufEncoder::addRRsFromPacket(const char* packet, const size_t len, bool includeCNAME)
+{
+  if (len < sizeof(struct dnsheader))
+    return;
+
+  const struct dnsheader* dh = (const struct dnsheader*) packet;
+
+  if (ntohs(dh->ancount) == 0)
+    return;
+
+  if (ntohs(dh->qdcount) == 0)
+    return;
+
+  /* the packet is parsed in place instead of being copied for a PacketReader:
+     the rdata are copied straight from the packet to the buffer, the names are
+     only decoded into a DNSName (short enough names fit in its inline storage) */
+  const unsigned char* raw = reinterpret_cast<const unsigned char*>(packet);
+  const uint16_t qdcount = ntohs(dh->qdcount);
+  const uint16_t ancount = ntohs(dh->ancount);
+  size_t pos = sizeof(struct dnsheader);
+  unsigned int consumed = 0;
+
+  for (size_t idx = 0; idx < qdcount; idx++) {
+    DNSName(packet, len, pos, true, nullptr, nullptr, &consumed);
+    pos += consumed + 4;
+  }
+
+  for (size_t idx = 0; idx < ancount; idx++) {
+    if (pos >= len) {
+      throw std::out_of_range("Trying to read past the end of the packet ("+std::to_string(pos)+" >= "+std::to_string(len)+")");
+    }
+    const DNSName rrname(packet, len, pos, true, nullptr, nullptr, &consumed);
+    pos += consumed;
+    if (pos + 10 > len) {
+      throw std::out_of_range("Trying to read a record header past the end of the packet ("+std::to_string(pos + 10)+" > "+std::to_string(len)+")");
+    }
+    const uint16_t type = raw[pos] * 256 + raw[pos + 1];
+    const uint16_t qclass = raw[pos + 2] * 256 + raw[pos + 3];
+    const uint32_t ttl = (static_cast<uint32_t>(raw[pos + 4]) << 24) + (static_cast<uint32_t>(raw[pos + 5]) << 16) + (static_cast<uint32_t>(raw[pos + 6]) << 8) + raw[pos + 7];
+    const uint16_t rdlen = raw[pos + 8] * 256 + raw[pos + 9];
+    pos += 10;
+    if (pos + rdlen > len) {
+      throw std::out_of_range("Trying to read a record content past the end of the packet ("+std::to_string(pos + rdlen)+" > "+std::to_string(len)+")");
+    }
+
+    if (type == QType::A || type == QType::AAAA) {
+      auto start = startRR(rrname, type, qclass, ttl);
+      d_encoder.addBytes(PBFIELD(PBDNSRRField::rdata), packet + pos, rdlen);
+      d_encoder.endMessage(start);
+    }
+    else if (type == QType::CNAME && includeCNAME) {
+      auto start = startRR(rrname, type, qclass, ttl);
+      d_encoder.addName(PBFIELD(PBDNSRRField::rdata), DNSName(packet, len, pos, true));
+      d_encoder.endMessage(start);
+    }
+    pos += rdlen;
+  }
+}
+
+void DNSProtoBufEncoder::addTag(const std::string& strValue)
+{
+  d_encoder.addBytes(PBFIELD(PBDNSResponseField::tags), strValue);
+}
+
+void DNSProtoBufEncoder::setQueryTime(time_t sec, uint32_t usec)
+{
+  d_encoder.addVarint(PBFIELD(PBDNSResponseField::queryTimeSec), static_cast<uint32_t>(sec));
+  d_encoder.addVarint(PBFIELD(PBDNSResponseField::queryTimeUsec), usec);
+}
+
+void DNSProtoBufEncoder::endResponse()
+{
+  d_encoder.endMessage(d_responseStart);
+}
+
+void DNSProtoBufEncoder::setEDNSSubnet(const Netmask& subnet, uint8_t mask)
+{
+  if (!subnet.empty()) {
+    ComboAddress ca(subnet.getNetwork());
+    ca.truncate(mask);
+    d_encoder.addAddress(PBFIELD(PBDNSMessageField::originalRequestorSubnet), ca);
+  }
+}
+
+void DNSProtoBufEncoder::setRequestorId(const std::string& requestorId)
+{
+  d_encoder.addBytes(PBFIELD(PBDNSMessageField::requestorId), requestorId);
+}
+
+void DNSProtoBufEncoder::setInitialRequestID(const boost::uuids::uuid& uuid)
+{
+  d_encoder.addBytes(PBFIELD(PBDNSMessageField::initialRequestId), reinterpret_cast<const char*>(uuid.begin()), uuid.size());
+}
+
+void DNSProtoBufEncoder::setDeviceId(const std::string& deviceId)
+{
+  d_encoder.addBytes(PBFIELD(PBDNSMessageField::deviceId), deviceId);
+}
+
+void DNSProtoBufEncoder::setDeviceName(const std::string& deviceName)
+{
+  d_encoder.addBytes(PBFIELD(PBDNSMessageField::deviceName), deviceName);
+}
+
+void DNSProtoBufEncoder::setRequestorPort(uint16_t port)
+{
+  d_encoder.addVarint(PBFIELD(PBDNSMessageField::fromPort), port);
+}
+
+void DNSProtoBufEncoder::setResponderPort(uint16_t port)
+{
+  d_encoder.addVarint(PBFIELD(PBDNSMessageField::toPort), port);
+}
+
+#undef PBFIELD
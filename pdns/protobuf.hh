@@ -26,11 +26,13 @@
 
 #include "config.h"
 
+#include <boost/uuid/uuid.hpp>
+
 #include "dnsname.hh"
 #include "iputils.hh"
+#include "protobuf-encoder.hh"
 
 #ifdef HAVE_PROTOBUF
-#include <boost/uuid/uuid.hpp>
 #include "dnsmessage.pb.h"
 #endif /* HAVE_PROTOBUF */
 
@@ -90,3 +92,55 @@ protected:
   PBDNSMessage d_message;
 #endif /* HAVE_PROTOBUF */
 };
+
+/* Serializes a PBDNSMessage straight into a buffer, without building the
+   intermediate libprotobuf object. This is a lot cheaper than DNSProtoBufMessage
+   for the common case where the message is not altered afterwards, and the output
+   is byte-for-byte identical as long as the setters are called in the order they are
+   declared in, which is the field number order. The question, response and ECS setters
+   take care of the embedded messages. */
+class DNSProtoBufEncoder
+{
+public:
+  DNSProtoBufEncoder(std::string& buffer): d_encoder(buffer)
+  {
+  }
+
+  void setType(DNSProtoBufMessage::DNSProtoBufMessageType type);
+  void setUUID(const boost::uuids::uuid& uuid);
+  void setServerIdentity(const std::string& serverId);
+  /* sets the socket family (from the requestor if any, the responder otherwise)
+     and protocol, as DNSProtoBufMessage::update() does */
+  void setSocket(const ComboAddress* requestor, const ComboAddress* responder, bool isTCP);
+  void setRequestor(const ComboAddress& requestor);
+  void setResponder(const ComboAddress& responder);
+  void setBytes(size_t bytes);
+  void setTime(time_t sec, uint32_t usec);
+  /* 'id' is in network byte order, as found in the DNS header */
+  void setId(uint16_t id);
+  void setQuestion(const DNSName& qname, uint16_t qtype, uint16_t qclass);
+
+  /* the content of the response sub-message, between startResponse() and endResponse() */
+  void startResponse();
+  void setResponseCode(uint32_t rcode);
+  void addRR(const DNSName& qname, uint16_t uType, uint16_t uClass, uint32_t uTTL, const std::string& blob);
+  void addRRsFromPacket(const char* packet, const size_t len, bool includeCNAME=false);
+  void addTag(const std::string& strValue);
+  void setQueryTime(time_t sec, uint32_t usec);
+  void endResponse();
+
+  void setEDNSSubnet(const Netmask& subnet, uint8_t mask=128);
+  void setRequestorId(const std::string& requestorId);
+  void setInitialRequestID(const boost::uuids::uuid& uuid);
+  void setDeviceId(const std::string& deviceId);
+  void setDeviceName(const std::string& deviceName);
+  void setRequestorPort(uint16_t port);
+  void setResponderPort(uint16_t port);
+
+private:
+  /* starts a ResourceRecord, the rdata has to be added before ending it */
+  size_t startRR(const DNSName& qname, uint16_t uType, uint16_t uClass, uint32_t uTTL);
+
+  ProtoBufEncoder d_encoder;
+  size_t d_responseStart{0};
+};
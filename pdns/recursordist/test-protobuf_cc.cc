@@ -0,0 +1 @@
+../test-protobuf_cc.cc
\ No newline at end of file
@@ -97,7 +97,9 @@ bool CircularWriteBuffer::flush(int fd)
   return true;
 }
 
-RemoteLogger::RemoteLogger(const ComboAddress& remote, uint16_t timeout, uint64_t maxQueuedBytes, uint8_t reconnectWaitTime, bool asyncConnect): d_writer(maxQueuedBytes), d_remote(remote), d_timeout(timeout), d_reconnectWaitTime(reconnectWaitTime), d_asyncConnect(asyncConnect)
+static std::atomic<uint64_t> s_remoteLoggerIds{0};
+
+RemoteLogger::RemoteLogger(const ComboAddress& remote, uint16_t timeout, uint64_t maxQueuedBytes, uint8_t reconnectWaitTime, bool asyncConnect): d_writer(maxQueuedBytes), d_remote(remote), d_id(s_remoteLoggerIds++), d_maxQueuedBytes(maxQueuedBytes), d_timeout(timeout), d_reconnectWaitTime(reconnectWaitTime), d_asyncConnect(asyncConnect)
 {
   if (!d_asyncConnect) {
     reconnect();
@@ -113,12 +115,8 @@ bool RemoteLogger::reconnect()
     newSock->setNonBlocking();
     newSock->connect(d_remote, d_timeout);
 
-    {
-      /* we are now successfully connected, time to take the lock and update the
-         socket */
-      std::unique_lock<std::mutex> lock(d_mutex);
-      d_socket = std::move(newSock);
-    }
+    /* only the maintenance thread uses the socket */
+    d_socket = std::move(newSock);
   }
   catch (const std::exception& e) {
 #ifdef WE_ARE_RECURSOR
@@ -132,41 +130,123 @@ bool RemoteLogger::reconnect()
   return true;
 }
 
-void RemoteLogger::queueData(const std::string& data)
+namespace {
+/* the queues of the current thread, indexed by the ID of their logger */
+struct ThreadQueues
 {
-  std::unique_lock<std::mutex> lock(d_mutex);
+  struct Entry
+  {
+    /* only dereferenced by a call from the logger itself, which owns the queue */
+    SPSCMessageRing* d_queue;
+    std::weak_ptr<SPSCMessageRing> d_owner;
+  };
 
-  if (!d_writer.hasRoomFor(data)) {
-    /* not connected, queue is full, just drop */
-    if (!d_socket) {
-      ++d_drops;
-      return;
-    }
-    try {
-      /* we try to flush some data */
-      if (!d_writer.flush(d_socket->getHandle())) {
-        /* but failed, let's just drop */
-        ++d_drops;
-        return;
+  ~ThreadQueues()
+  {
+    /* the thread is exiting, let the loggers that still exist know that they
+       can get rid of our queues once they have been drained */
+    for (auto& entry : d_entries) {
+      auto queue = entry.second.d_owner.lock();
+      if (queue) {
+        queue->setOrphaned();
       }
+    }
+  }
 
-      /* see if we freed enough data */
-      if (!d_writer.hasRoomFor(data)) {
-        /* we didn't */
-        ++d_drops;
-        return;
+  /* forget about the queues of the loggers that have been destroyed */
+  void prune()
+  {
+    for (auto it = d_entries.begin(); it != d_entries.end(); ) {
+      if (it->second.d_owner.expired()) {
+        it = d_entries.erase(it);
+      }
+      else {
+        ++it;
       }
     }
-    catch(const std::exception& e) {
-      //      cout << "Got exception writing: "<<e.what()<<endl;
-      ++d_drops;
-      d_socket.reset();
-      return;
-    }
   }
 
-  d_writer.write(data);
+  std::unordered_map<uint64_t, Entry> d_entries;
+};
+}
+
+static thread_local ThreadQueues t_queues;
+
+SPSCMessageRing& RemoteLogger::getQueueForThisThread()
+{
+  const auto& it = t_queues.d_entries.find(d_id);
+  if (it != t_queues.d_entries.end()) {
+    return *it->second.d_queue;
+  }
+
+  /* a new logger, this is a good time to clean up after the ones that are gone */
+  t_queues.prune();
+
+  auto queue = std::make_shared<SPSCMessageRing>(d_maxQueuedBytes);
+  auto result = queue.get();
+  t_queues.d_entries[d_id] = { result, queue };
+  {
+    std::lock_guard<std::mutex> lock(d_queuesMutex);
+    d_queues.push_back(std::move(queue));
+  }
+  return *result;
+}
+
+size_t RemoteLogger::getQueuesCountForThisThread()
+{
+  return t_queues.d_entries.size();
+}
+
+void RemoteLogger::wakeUp()
+{
+  if (d_wakeUpRequested.load(std::memory_order_relaxed) || d_wakeUpRequested.exchange(true)) {
+    /* already requested */
+    return;
+  }
+
+  {
+    /* taking the lock, even for nothing, prevents us from notifying the maintenance
+       thread between the time it checks the condition and the time it actually waits */
+    std::lock_guard<std::mutex> lock(d_wakeUpMutex);
+  }
+  d_wakeUpCond.notify_one();
+}
+
+void RemoteLogger::queueData(const std::string& data)
+{
+  auto& queue = getQueueForThisThread();
+
+  if (!queue.push(data)) {
+    /* queue is full, most likely because we are not connected or can't flush fast enough,
+       just drop. The maintenance thread has already been woken up when it became half full */
+    ++d_drops;
+    return;
+  }
+
   ++d_queued;
+
+  if (queue.size() >= (queue.capacity() / 2)) {
+    wakeUp();
+  }
+}
+
+size_t RemoteLogger::drainQueues()
+{
+  size_t drained = 0;
+  std::lock_guard<std::mutex> lock(d_queuesMutex);
+  for (auto it = d_queues.begin(); it != d_queues.end(); ) {
+    auto& queue = *it;
+    /* checked first, so that we don't miss a message pushed right before the producer exited */
+    const bool orphaned = queue->isOrphaned();
+    drained += queue->drainInto(d_writer);
+    if (orphaned && queue->size() == 0) {
+      it = d_queues.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+  return drained;
 }
 
 void RemoteLogger::maintenanceThread()
@@ -179,44 +259,46 @@ try
 #endif
   setThreadName(threadName);
 
+  time_t lastConnectionAttempt = d_asyncConnect ? 0 : time(nullptr);
+
   for (;;) {
     if (d_exiting) {
       break;
     }
 
-    bool connected = true;
     if (d_socket == nullptr) {
-      // if it was unset, it will remain so, we are the only ones setting it!
-      connected = reconnect();
+      time_t now = time(nullptr);
+      if ((now - lastConnectionAttempt) >= d_reconnectWaitTime) {
+        lastConnectionAttempt = now;
+        reconnect();
+      }
     }
 
-    /* we will just go to sleep if the reconnection just failed */
-    if (connected) {
-      try {
-        /* we don't want to take the lock while trying to reconnect */
-        std::unique_lock<std::mutex> lock(d_mutex);
-        if (d_socket) { // check if it is set
-          /* if flush() returns false, it means that we couldn't flush anything yet
-             either because there is nothing to flush, or because the outgoing TCP
-             buffer is full. That's fine by us */
-          d_writer.flush(d_socket->getHandle());
+    /* move what we can from the per-thread queues, then write it in as few
+       writev() calls as possible. If flush() returns false, it means that we
+       couldn't flush anything yet either because there is nothing to flush,
+       or because the outgoing TCP buffer is full. That's fine by us, messages
+       will accumulate in the queues, then be dropped if they are full */
+    bool moreToDo = true;
+    while (moreToDo && !d_exiting) {
+      size_t drained = drainQueues();
+      moreToDo = false;
+      if (d_socket) {
+        try {
+          moreToDo = d_writer.flush(d_socket->getHandle()) && drained > 0;
         }
-        else {
-          connected = false;
+        catch (const std::exception& e) {
+          d_socket.reset();
+          /* let's try to reconnect right away */
+          lastConnectionAttempt = time(nullptr);
+          moreToDo = reconnect();
         }
       }
-      catch(const std::exception& e) {
-        d_socket.reset();
-        connected = false;
-      }
-
-      if (!connected) {
-        /* let's try to reconnect right away, we are about to sleep anyway */
-        reconnect();
-      }
     }
 
-    sleep(d_reconnectWaitTime);
+    std::unique_lock<std::mutex> lock(d_wakeUpMutex);
+    d_wakeUpCond.wait_for(lock, std::chrono::seconds(d_reconnectWaitTime), [this]() { return d_wakeUpRequested.load() || d_exiting.load(); });
+    d_wakeUpRequested = false;
   }
 }
 catch(const std::exception& e)
@@ -230,6 +312,7 @@ catch(...) {
 RemoteLogger::~RemoteLogger()
 {
   d_exiting = true;
+  wakeUp();
 
   d_thread.join();
 }
@@ -26,8 +26,10 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <limits>
 #include <queue>
 #include <thread>
+#include <unordered_map>
 
 #include "iputils.hh"
 #include "circular_buffer.hh"
@@ -52,11 +54,133 @@ public:
 
   bool hasRoomFor(const std::string& str) const;
   bool write(const std::string& str);
+  /* raw variants, the data is expected to already contain the length prefix */
+  bool hasRoomForBytes(size_t len) const
+  {
+    return d_buffer.size() + len <= d_buffer.capacity();
+  }
+  void writeBytes(const char* data, size_t len)
+  {
+    d_buffer.insert(d_buffer.end(), data, data + len);
+  }
   bool flush(int fd);
+  bool empty() const
+  {
+    return d_buffer.empty();
+  }
 private:
   boost::circular_buffer<char> d_buffer;
 };
 
+/* A single-producer, single-consumer ring of length-prefixed messages.
+   One thread pushes messages while another one moves them to a CircularWriteBuffer,
+   without any lock. Like CircularWriteBuffer, a message is either fully accepted or not at all.
+*/
+class SPSCMessageRing
+{
+public:
+  explicit SPSCMessageRing(size_t capacity) : d_buffer(capacity), d_capacity(capacity)
+  {
+  }
+
+  /* producer side */
+  bool push(const std::string& str)
+  {
+    if (str.size() > std::numeric_limits<uint16_t>::max()) {
+      return false;
+    }
+
+    const size_t needed = 2 + str.size();
+    const uint64_t head = d_head.load(std::memory_order_relaxed);
+    const uint64_t tail = d_tail.load(std::memory_order_acquire);
+    if (d_capacity - (head - tail) < needed) {
+      return false;
+    }
+
+    uint16_t len = htons(str.size());
+    copyIn(head, reinterpret_cast<const char*>(&len), 2);
+    copyIn(head + 2, str.data(), str.size());
+    d_head.store(head + needed, std::memory_order_release);
+    return true;
+  }
+
+  /* consumer side: moves as many whole messages as possible to the writer,
+     and returns how many have been moved */
+  size_t drainInto(CircularWriteBuffer& writer)
+  {
+    uint64_t tail = d_tail.load(std::memory_order_relaxed);
+    const uint64_t head = d_head.load(std::memory_order_acquire);
+    size_t count = 0;
+
+    while (tail != head) {
+      uint16_t len;
+      copyOut(tail, reinterpret_cast<char*>(&len), 2);
+      const size_t needed = 2 + ntohs(len);
+      if (!writer.hasRoomForBytes(needed)) {
+        break;
+      }
+
+      const size_t pos = tail % d_capacity;
+      const size_t first = std::min(needed, d_capacity - pos);
+      writer.writeBytes(&d_buffer.at(pos), first);
+      if (first < needed) {
+        writer.writeBytes(&d_buffer.at(0), needed - first);
+      }
+      tail += needed;
+      ++count;
+    }
+
+    d_tail.store(tail, std::memory_order_release);
+    return count;
+  }
+
+  /* the number of bytes used, can be called from either side */
+  size_t size() const
+  {
+    return d_head.load(std::memory_order_acquire) - d_tail.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const
+  {
+    return d_capacity;
+  }
+
+  /* the producer thread has exited, the ring can be removed once it has been drained */
+  void setOrphaned()
+  {
+    d_orphaned.store(true, std::memory_order_release);
+  }
+
+  bool isOrphaned() const
+  {
+    return d_orphaned.load(std::memory_order_acquire);
+  }
+
+private:
+  void copyIn(uint64_t offset, const char* data, size_t len)
+  {
+    const size_t pos = offset % d_capacity;
+    const size_t first = std::min(len, d_capacity - pos);
+    std::copy(data, data + first, d_buffer.begin() + pos);
+    std::copy(data + first, data + len, d_buffer.begin());
+  }
+
+  void copyOut(uint64_t offset, char* data, size_t len) const
+  {
+    const size_t pos = offset % d_capacity;
+    const size_t first = std::min(len, d_capacity - pos);
+    std::copy(d_buffer.begin() + pos, d_buffer.begin() + pos + first, data);
+    std::copy(d_buffer.begin(), d_buffer.begin() + (len - first), data + first);
+  }
+
+  std::vector<char> d_buffer;
+  const size_t d_capacity;
+  /* both offsets only ever increase, on different cache lines to prevent false sharing */
+  alignas(64) std::atomic<uint64_t> d_head{0};
+  alignas(64) std::atomic<uint64_t> d_tail{0};
+  std::atomic<bool> d_orphaned{false};
+};
+
 class RemoteLoggerInterface
 {
 public:
@@ -75,9 +199,14 @@ private:
 };
 
 /* Thread safe. Will connect asynchronously on request.
-   Runs a reconnection thread that also periodicall flushes.
-   Note that the buffer only runs as long as there is a connection.
-   If there is no connection we don't buffer a thing
+   Runs a reconnection thread that also flushes, periodically or when a queue is half full.
+   Every thread calling queueData() gets its own lock-free queue of maxQueuedBytes,
+   which the maintenance thread drains into the connection buffer before flushing it in
+   batches. A message that does not fit in the queue of the calling thread is dropped
+   and accounted for.
+   Note that the memory usage is therefore up to (number of producer threads + 1) * maxQueuedBytes,
+   the additional one being the connection buffer. The queue of a thread is released when that
+   thread exits, once it has been drained, or when the logger is destroyed.
 */
 class RemoteLogger : public RemoteLoggerInterface
 {
@@ -92,17 +221,44 @@ public:
   {
     return d_remote.toStringWithPort() + " (" + std::to_string(d_queued) + " queued, " + std::to_string(d_drops) + " dropped)";
   }
+  uint64_t getQueuedCount() const
+  {
+    return d_queued;
+  }
+  uint64_t getDropsCount() const
+  {
+    return d_drops;
+  }
+  /* the number of loggers the current thread has a queue for, mostly for the unit tests */
+  static size_t getQueuesCountForThisThread();
   void stop()
   {
     d_exiting = true;
+    wakeUp();
   }
 
 private:
   bool reconnect();
   void maintenanceThread();
+  SPSCMessageRing& getQueueForThisThread();
+  size_t drainQueues();
+  void wakeUp();
 
+  /* only accessed from the maintenance thread, once started */
   CircularWriteBuffer d_writer;
   ComboAddress d_remote;
+  /* one queue per producer thread, protected by d_queuesMutex which is only taken
+     when a new producer shows up and when draining the queues. Shared with the
+     producer thread, which needs to know whether the queue still exists when it exits */
+  std::vector<std::shared_ptr<SPSCMessageRing>> d_queues;
+  std::mutex d_queuesMutex;
+  std::condition_variable d_wakeUpCond;
+  std::mutex d_wakeUpMutex;
+  std::atomic<bool> d_wakeUpRequested{false};
+  /* unique, unlike the address of this object, so it is safe to use it to find
+     the queue of a thread even after another logger has been destroyed */
+  const uint64_t d_id;
+  const uint64_t d_maxQueuedBytes;
   std::atomic<uint64_t> d_drops{0};
   std::atomic<uint64_t> d_queued{0};
   std::unique_ptr<Socket> d_socket{nullptr};
@@ -111,6 +267,5 @@ private:
   std::atomic<bool> d_exiting{false};
   bool d_asyncConnect{false};
 
-  std::mutex d_mutex;
   std::thread d_thread;
 };
@@ -70,6 +70,12 @@ public:
     return *operator->();
   }
 
+  std::shared_ptr<const T> getShared() // same as operator->(), also sharing the ownership of the state
+  {
+    operator->();
+    return d_state;
+  }
+
   void reset()
   {
     d_generation=0;
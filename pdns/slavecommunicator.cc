@@ -46,6 +46,7 @@
 #include "common_startup.hh"
 
 #include "ixfr.hh"
+#include "xfrspool.hh"
 
 void CommunicatorClass::addSuckRequest(const DNSName &domain, const ComboAddress& master)
 {
@@ -62,20 +63,15 @@ void CommunicatorClass::addSuckRequest(const DNSName &domain, const ComboAddress
 
 }
 
-struct ZoneStatus
+/* updates the incoming-xfr-peak-memory-usage metric with the current memory usage */
+static void updateXFRPeakMemoryUsage()
 {
-  bool isDnssecZone{false};
-  bool isPresigned{false};
-  bool isNSEC3 {false};
-  bool optOutFlag {false};
-  NSEC3PARAMRecordContent ns3pr;
-
-  bool isNarrow{false};
-  unsigned int soa_serial{0};
-  set<DNSName> nsset, qnames, secured;
-  uint32_t domain_id;
-  int numDeltas{0};
-};
+  static AtomicCounter* peak = S.getPointer("incoming-xfr-peak-memory-usage");
+  uint64_t current = getRealMemoryUsage(string());
+  if (current > *peak) {
+    peak->store(current);
+  }
+}
 
 
 void CommunicatorClass::ixfrSuck(const DNSName &domain, const TSIGTriplet& tt, const ComboAddress& laddr, const ComboAddress& remote, unique_ptr<AuthLua4>& pdl,
@@ -109,13 +105,13 @@ void CommunicatorClass::ixfrSuck(const DNSName &domain, const TSIGTriplet& tt, c
     zs.numDeltas=deltas.size();
     //    cout<<"Got "<<deltas.size()<<" deltas from serial "<<di.serial<<", applying.."<<endl;
     
-    for(const auto& d : deltas) {
+    for(auto& d : deltas) {
       const auto& remove = d.first;
       const auto& add = d.second;
       //      cout<<"Delta sizes: "<<remove.size()<<", "<<add.size()<<endl;
       
       if(remove.empty()) { // we got passed an AXFR!
-        *axfr = add;
+        *axfr = std::move(d.second);
         return;
       }
         
@@ -187,45 +183,6 @@ void CommunicatorClass::ixfrSuck(const DNSName &domain, const TSIGTriplet& tt, c
 }
 
 
-static bool processRecordForZS(const DNSName& domain, bool& firstNSEC3, DNSResourceRecord& rr, ZoneStatus& zs)
-{
-  switch(rr.qtype.getCode()) {
-  case QType::NSEC3PARAM: 
-    zs.ns3pr = NSEC3PARAMRecordContent(rr.content);
-    zs.isDnssecZone = zs.isNSEC3 = true;
-    zs.isNarrow = false;
-    return false;
-  case QType::NSEC3: {
-    NSEC3RecordContent ns3rc(rr.content);
-    if (firstNSEC3) {
-      zs.isDnssecZone = zs.isPresigned = true;
-      firstNSEC3 = false;
-    } else if (zs.optOutFlag != (ns3rc.d_flags & 1))
-      throw PDNSException("Zones with a mixture of Opt-Out NSEC3 RRs and non-Opt-Out NSEC3 RRs are not supported.");
-    zs.optOutFlag = ns3rc.d_flags & 1;
-    if (ns3rc.isSet(QType::NS) && !(rr.qname==domain)) {
-      DNSName hashPart = rr.qname.makeRelative(domain);
-      zs.secured.insert(hashPart);
-    }
-    return false;
-  }
-  
-  case QType::NSEC: 
-    zs.isDnssecZone = zs.isPresigned = true;
-    return false;
-  
-  case QType::NS: 
-    if(rr.qname!=domain)
-      zs.nsset.insert(rr.qname);
-    break;
-  }
-
-  zs.qnames.insert(rr.qname);
-
-  rr.domain_id=zs.domain_id;
-  return true;
-}
-
 /* So this code does a number of things. 
    1) It will AXFR a domain from a master
       The code can retrieve the current serial number in the database itself.
@@ -237,10 +194,9 @@ static bool processRecordForZS(const DNSName& domain, bool& firstNSEC3, DNSResou
    5) It updates the Empty Non Terminals
 */
 
-static vector<DNSResourceRecord> doAxfr(const ComboAddress& raddr, const DNSName& domain, const TSIGTriplet& tt, const ComboAddress& laddr,  unique_ptr<AuthLua4>& pdl, ZoneStatus& zs)
+static void doAxfr(const ComboAddress& raddr, const DNSName& domain, const TSIGTriplet& tt, const ComboAddress& laddr,  unique_ptr<AuthLua4>& pdl, ZoneStatus& zs, XFRSpool& rrs)
 {
   uint16_t axfr_timeout=::arg().asNum("axfr-fetch-timeout");
-  vector<DNSResourceRecord> rrs;
   AXFRRetriever retriever(raddr, domain, tt, (laddr.sin4.sin_family == 0) ? NULL : &laddr, ((size_t) ::arg().asNum("xfr-max-received-mbytes")) * 1024 * 1024, axfr_timeout);
   Resolver::res_t recs;
   bool first=true;
@@ -283,12 +239,12 @@ static vector<DNSResourceRecord> doAxfr(const ComboAddress& raddr, const DNSName
           soa_received = true;
         }
 
-        rrs.push_back(rr);
+        rrs.push(rr);
 
       }
     }
+    updateXFRPeakMemoryUsage();
   }
-  return rrs;
 }   
 
 
@@ -391,7 +347,7 @@ void CommunicatorClass::suck(const DNSName &domain, const ComboAddress& remote)
     bool hadNarrow=false;
 
 
-    vector<DNSResourceRecord> rrs;
+    XFRSpool rrs;
     if(dk.isSecuredZone(domain)) {
       hadDnssecZone=true;
       hadPresigned=dk.isPresigned(domain);
@@ -410,20 +366,8 @@ void CommunicatorClass::suck(const DNSName &domain, const ComboAddress& remote)
         ixfrSuck(domain, tt, laddr, remote, pdl, zs, &axfr);
         if(!axfr.empty()) {
           g_log<<Logger::Warning<<"IXFR of '"<<domain<<"' from remote '"<<remote<<"' turned into an AXFR"<<endl;
-          bool firstNSEC3=true;
-          rrs.reserve(axfr.size());
-          for(const auto& dr : axfr) {
-            auto rr = DNSResourceRecord::fromWire(dr);
-            (rr.qname += domain).makeUsLowerCase();
-            rr.domain_id = zs.domain_id;
-            if(!processRecordForZS(domain, firstNSEC3, rr, zs))
-              continue;
-            if(dr.d_type == QType::SOA) {
-              auto sd = getRR<SOARecordContent>(dr);
-              zs.soa_serial = sd->d_st.serial;
-            }
-            rrs.push_back(rr);
-          }
+          spoolAXFRFromIXFR(domain, axfr, zs, rrs);
+          updateXFRPeakMemoryUsage();
         }
         else {
           g_log<<Logger::Warning<<"Done with IXFR of '"<<domain<<"' from remote '"<<remote<<"', got "<<zs.numDeltas<<" delta"<<addS(zs.numDeltas)<<", serial now "<<zs.soa_serial<<endl;
@@ -435,8 +379,8 @@ void CommunicatorClass::suck(const DNSName &domain, const ComboAddress& remote)
 
     if(rrs.empty()) {
       g_log<<Logger::Warning<<"Starting AXFR of '"<<domain<<"' from remote "<<remote<<endl;
-      rrs = doAxfr(remote, domain, tt, laddr, pdl, zs);
-      g_log<<Logger::Warning<<"AXFR of '"<<domain<<"' from remote "<<remote<<" done"<<endl;
+      doAxfr(remote, domain, tt, laddr, pdl, zs, rrs);
+      g_log<<Logger::Warning<<"AXFR of '"<<domain<<"' from remote "<<remote<<" done, "<<rrs.size()<<" record"<<addS(rrs.size())<<" received"<<endl;
     }
  
     if(zs.isNSEC3) {
@@ -510,7 +454,13 @@ void CommunicatorClass::suck(const DNSName &domain, const ComboAddress& remote)
     map<DNSName,bool> nonterm;
 
 
-    for(DNSResourceRecord& rr :  rrs) {
+    DNSResourceRecord rr;
+    rr.domain_id=zs.domain_id;
+    rrs.rewind();
+    for(size_t count = 1; rrs.pop(rr); count++) {
+      if(count % 10000 == 0)
+        updateXFRPeakMemoryUsage();
+
       if(!zs.isPresigned) {
         if (rr.qtype.getCode() == QType::RRSIG)
           continue;
@@ -554,6 +504,8 @@ void CommunicatorClass::suck(const DNSName &domain, const ComboAddress& remote)
         if(nonterm.size() > maxent) {
           g_log<<Logger::Error<<"AXFR zone "<<domain<<" has too many empty non terminals."<<endl;
           nonterm.clear();
+          // the names are only needed to find the empty non terminals
+          zs.qnames.clear();
           doent=false;
         }
       }
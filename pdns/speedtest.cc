@@ -6,9 +6,16 @@
 #include "misc.hh"
 #include "dnswriter.hh"
 #include "dnsrecords.hh"
+#include "ednsoptions.hh"
 #include "iputils.hh"
+#include "zoneparser-tng.hh"
 #include <fstream>
 
+#ifdef HAVE_PROTOBUF
+#include "protobuf.hh"
+#include "uuid-utils.hh"
+#endif /* HAVE_PROTOBUF */
+
 #ifndef RECURSOR
 #include "statbag.hh"
 #include "base64.hh"
@@ -319,6 +326,51 @@ struct MakeARecordTestMM
 };
 
 
+/* what a backend returning its records as text costs for each record it serves */
+struct ZoneRecordFromTextTest
+{
+  explicit ZoneRecordFromTextTest(uint16_t qtype, const string& content) : d_qtype(qtype), d_content(content) {}
+
+  string getName() const
+  {
+    return (boost::format("zone record from text (%s)") % QType(d_qtype).getName()).str();
+  }
+
+  void operator()() const
+  {
+    DNSResourceRecord rr;
+    rr.qname = DNSName("outpost.ds9a.nl");
+    rr.qtype = d_qtype;
+    rr.content = d_content;
+    rr.ttl = 3600;
+    DNSRecord dr(rr);
+  }
+  uint16_t d_qtype;
+  string d_content;
+};
+
+/* and what it costs when the content has been parsed when the zone was loaded */
+struct ZoneRecordFromParsedTest
+{
+  explicit ZoneRecordFromParsedTest(uint16_t qtype, const string& content) : d_qtype(qtype), d_drc(DNSRecordContent::mastermake(qtype, QClass::IN, content)) {}
+
+  string getName() const
+  {
+    return (boost::format("zone record from parsed content (%s)") % QType(d_qtype).getName()).str();
+  }
+
+  void operator()() const
+  {
+    DNSRecord dr;
+    dr.d_name = DNSName("outpost.ds9a.nl");
+    dr.d_type = d_qtype;
+    dr.d_ttl = 3600;
+    dr.d_content = d_drc;
+  }
+  uint16_t d_qtype;
+  std::shared_ptr<DNSRecordContent> d_drc;
+};
+
 struct A2RecordTest
 {
   explicit A2RecordTest(int records) : d_records(records) {}
@@ -833,6 +885,214 @@ struct NetmaskTreeTest
   }
 };
 
+/* an answer with an OPT RR, carrying a cookie and padding, followed by a record compressed against what
+   comes after the OPT RR, like a TSIG or an extra additional record would be */
+static vector<uint8_t> makeEDNSAnswerWithRecordsAfterOPT(bool withECS)
+{
+  vector<uint8_t> packet;
+  DNSName name("www.powerdns.com");
+  DNSPacketWriter pw(packet, name, QType::A);
+  pw.getHeader()->qr = 1;
+  pw.startRecord(name, QType::A, 3600, QClass::IN, DNSResourceRecord::ANSWER);
+  pw.xfr32BitInt(0x01020304);
+
+  DNSPacketWriter::optvect_t opts;
+  opts.push_back(make_pair(10 /* COOKIE */, string(16, 'c')));
+  if (withECS) {
+    opts.push_back(make_pair(8 /* ECS */, string("\x00\x01\x18\x00\xc0\x00\x02", 7)));
+  }
+  opts.push_back(make_pair(12 /* PADDING */, string(32, '\0')));
+  pw.addOpt(1232, 0, 0, opts);
+
+  pw.startRecord(DNSName("a.example.net"), QType::A, 3600, QClass::IN, DNSResourceRecord::ADDITIONAL);
+  pw.xfr32BitInt(0x01020304);
+  pw.startRecord(DNSName("b.example.net"), QType::A, 3600, QClass::IN, DNSResourceRecord::ADDITIONAL);
+  pw.xfr32BitInt(0x01020304);
+  pw.commit();
+  return packet;
+}
+
+struct EDNSOptionInPlaceTest
+{
+  enum class Operation { Add, Replace, Remove, RemoveOPT };
+
+  EDNSOptionInPlaceTest(Operation op) : d_op(op), d_packet(makeEDNSAnswerWithRecordsAfterOPT(op != Operation::Add))
+  {
+    /* an IPv6 ECS option, to force the records to move when replacing */
+    generateEDNSOption(8, string("\x00\x02\x38\x00\x20\x01\x0d\xb8\x00\x00\x00", 11), d_option);
+  }
+
+  string getName() const
+  {
+    switch (d_op) {
+    case Operation::Add:
+      return "add EDNS option in place";
+    case Operation::Replace:
+      return "replace EDNS option in place";
+    case Operation::Remove:
+      return "remove EDNS option in place";
+    case Operation::RemoveOPT:
+    default:
+      return "remove OPT RR in place";
+    }
+  }
+
+  void operator()() const
+  {
+    char buffer[1500];
+    memcpy(buffer, d_packet.data(), d_packet.size());
+    uint16_t len = d_packet.size();
+    bool added = false;
+    int res;
+
+    switch (d_op) {
+    case Operation::Add:
+      res = setEDNSOptionInPlace(buffer, sizeof(buffer), &len, d_option, false, added);
+      break;
+    case Operation::Replace:
+      res = setEDNSOptionInPlace(buffer, sizeof(buffer), &len, d_option, true, added);
+      break;
+    case Operation::Remove:
+      res = removeEDNSOptionInPlace(buffer, &len, 8);
+      break;
+    case Operation::RemoveOPT:
+    default:
+      res = removeOPTRRInPlace(buffer, &len);
+      break;
+    }
+    g_ret = res == 0;
+  }
+
+  Operation d_op;
+  vector<uint8_t> d_packet;
+  string d_option;
+};
+
+#ifdef HAVE_PROTOBUF
+/* serializes a response with 'answers' A/AAAA records into a PBDNSMessage,
+   via libprotobuf or via DNSProtoBufEncoder */
+struct ProtoBufResponseTest
+{
+  ProtoBufResponseTest(size_t answers, bool libprotobuf): d_uuid(getUniqueID()), d_qname("www.powerdns.com."), d_requestor("192.0.2.1:4242"), d_responder("192.0.2.2:53"), d_answers(answers), d_libprotobuf(libprotobuf)
+  {
+    vector<uint8_t> packet;
+    DNSPacketWriter pw(packet, d_qname, QType::A);
+    pw.getHeader()->qr = 1;
+    for (size_t idx = 0; idx < answers; idx++) {
+      if (idx % 2) {
+        pw.startRecord(d_qname, QType::A, 60, QClass::IN, DNSResourceRecord::ANSWER);
+        ComboAddress addr("192.0.2." + std::to_string(idx % 256));
+        pw.xfrCAWithoutPort(4, addr);
+      }
+      else {
+        pw.startRecord(d_qname, QType::AAAA, 60, QClass::IN, DNSResourceRecord::ANSWER);
+        ComboAddress addr("2001:db8::" + std::to_string(idx));
+        pw.xfrCAWithoutPort(6, addr);
+      }
+      pw.commit();
+    }
+    d_packet = std::string(reinterpret_cast<const char*>(packet.data()), packet.size());
+    gettimeofday(&d_now, nullptr);
+  }
+
+  string getName() const
+  {
+    return std::string(d_libprotobuf ? "libprotobuf" : "protobuf encoder") + " response with " + std::to_string(d_answers) + " answers";
+  }
+
+  void operator()() const
+  {
+    d_buffer.clear();
+    if (d_libprotobuf) {
+      DNSProtoBufMessage message(DNSProtoBufMessage::Response, d_uuid, &d_requestor, &d_responder, d_qname, QType::A, QClass::IN, 0, false, d_packet.size());
+      message.setTime(d_now.tv_sec, d_now.tv_usec);
+      message.setResponseCode(0);
+      message.addRRsFromPacket(d_packet.data(), d_packet.size());
+      message.setQueryTime(d_now.tv_sec, d_now.tv_usec);
+      message.serialize(d_buffer);
+    }
+    else {
+      DNSProtoBufEncoder encoder(d_buffer);
+      encoder.setType(DNSProtoBufMessage::Response);
+      encoder.setUUID(d_uuid);
+      encoder.setSocket(&d_requestor, &d_responder, false);
+      encoder.setRequestor(d_requestor);
+      encoder.setResponder(d_responder);
+      encoder.setBytes(d_packet.size());
+      encoder.setTime(d_now.tv_sec, d_now.tv_usec);
+      encoder.setId(0);
+      encoder.setQuestion(d_qname, QType::A, QClass::IN);
+      encoder.startResponse();
+      encoder.setResponseCode(0);
+      encoder.addRRsFromPacket(d_packet.data(), d_packet.size());
+      encoder.setQueryTime(d_now.tv_sec, d_now.tv_usec);
+      encoder.endResponse();
+    }
+    g_ret = !d_buffer.empty();
+  }
+
+  const boost::uuids::uuid d_uuid;
+  const DNSName d_qname;
+  const ComboAddress d_requestor;
+  const ComboAddress d_responder;
+  std::string d_packet;
+  /* reused between runs, like the per-thread buffers of the callers */
+  mutable std::string d_buffer;
+  struct timeval d_now;
+  size_t d_answers;
+  bool d_libprotobuf;
+};
+#endif /* HAVE_PROTOBUF */
+
+/* parses a generated zone file of 'lines' lines, mixing the most common record types */
+static void zoneParserBenchmark(size_t lines)
+{
+  char fname[] = "/tmp/speedtest-zone-XXXXXX";
+  int fd = mkstemp(fname);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to create a temporary zone file: " + stringerror());
+  }
+  FILE* fp = fdopen(fd, "w");
+  fprintf(fp, "$TTL 3600\n@ IN SOA ns1 hostmaster ( 2020010101 ; serial\n  3h 1h 1w 1h )\n@ IN NS ns1\n");
+  for (size_t idx = 0; idx < lines; idx++) {
+    switch (idx % 6) {
+    case 0:
+      fprintf(fp, "host%zu IN A 192.0.2.%zu\n", idx, idx % 256);
+      break;
+    case 1:
+      fprintf(fp, "host%zu 300 IN AAAA 2001:db8::%zx\n", idx, idx % 65536);
+      break;
+    case 2:
+      fprintf(fp, "mx%zu IN MX 10 mail%zu\n", idx, idx);
+      break;
+    case 3:
+      fprintf(fp, "txt%zu IN TXT \"v=spf1 include:_spf.example.com ~all\" ; comment\n", idx);
+      break;
+    case 4:
+      fprintf(fp, "alias%zu IN CNAME host%zu.example.com.\n", idx, idx - 4);
+      break;
+    default:
+      fprintf(fp, "\tIN A 198.51.100.%zu\n", idx % 256);
+    }
+  }
+  long size = ftell(fp);
+  fclose(fp);
+
+  CPUTime dt;
+  dt.start();
+  ZoneParserTNG zpt(fname, DNSName("example.com."));
+  DNSResourceRecord rr;
+  size_t records = 0;
+  while (zpt.get(rr)) {
+    records++;
+  }
+  double delta=dt.ndiff()/1000000000.0;
+  unlink(fname);
+
+  boost::format fmt("'zone parser (%d lines)' %.02f seconds: %.1f MB/s, %.0f records/s");
+  cerr<< (fmt % lines % delta % (size / delta / 1000000.0) % (records / delta)) << endl;
+}
+
 int main(int argc, char** argv)
 try
 {
@@ -903,6 +1163,13 @@ try
 
   
 
+  doRun(ZoneRecordFromTextTest(QType::A, "1.2.3.4"));
+  doRun(ZoneRecordFromParsedTest(QType::A, "1.2.3.4"));
+  doRun(ZoneRecordFromTextTest(QType::MX, "10 mx.outpost.ds9a.nl."));
+  doRun(ZoneRecordFromParsedTest(QType::MX, "10 mx.outpost.ds9a.nl."));
+  doRun(ZoneRecordFromTextTest(QType::SOA, "ns1.ds9a.nl. ahu.ds9a.nl. 1000 3600 1800 604800 3600"));
+  doRun(ZoneRecordFromParsedTest(QType::SOA, "ns1.ds9a.nl. ahu.ds9a.nl. 1000 3600 1800 604800 3600"));
+
   doRun(SOARecordTest(1));
   doRun(SOARecordTest(2));
   doRun(SOARecordTest(4));
@@ -918,6 +1185,21 @@ try
 
   doRun(NetmaskTreeTest());
 
+  doRun(EDNSOptionInPlaceTest(EDNSOptionInPlaceTest::Operation::Add));
+  doRun(EDNSOptionInPlaceTest(EDNSOptionInPlaceTest::Operation::Replace));
+  doRun(EDNSOptionInPlaceTest(EDNSOptionInPlaceTest::Operation::Remove));
+  doRun(EDNSOptionInPlaceTest(EDNSOptionInPlaceTest::Operation::RemoveOPT));
+
+#ifdef HAVE_PROTOBUF
+  for (const size_t answers : { 1, 10 }) {
+    doRun(ProtoBufResponseTest(answers, true));
+    doRun(ProtoBufResponseTest(answers, false));
+  }
+#endif /* HAVE_PROTOBUF */
+
+  /* the number of lines can be passed on the command line, 10000000 makes for a big zone */
+  zoneParserBenchmark(argc > 1 ? pdns_stou(argv[1]) : 100000);
+
 #ifndef RECURSOR
   S.doRings();
 
@@ -20,6 +20,7 @@ public:
   virtual std::string getServerNameIndication() const = 0;
   virtual LibsslTLSVersion getTLSVersion() const = 0;
   virtual bool hasSessionBeenResumed() const = 0;
+  virtual bool isUsingKTLS() const = 0;
   virtual void close() = 0;
 
   void setUnknownTicketKey()
@@ -319,6 +320,11 @@ public:
     return d_conn && d_conn->hasSessionBeenResumed();
   }
 
+  bool isUsingKTLS() const
+  {
+    return d_conn && d_conn->isUsingKTLS();
+  }
+
   bool getResumedFromInactiveTicketKey() const
   {
     return d_conn && d_conn->getResumedFromInactiveTicketKey();
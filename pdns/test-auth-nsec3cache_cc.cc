@@ -0,0 +1,142 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "auth-nsec3cache.hh"
+#include "dnssecinfra.hh"
+
+BOOST_AUTO_TEST_SUITE(test_auth_nsec3cache_cc)
+
+static NSEC3PARAMRecordContent makeParams(const std::string& salt, unsigned int iterations)
+{
+  NSEC3PARAMRecordContent ns3prc;
+  ns3prc.d_algorithm = 1;
+  ns3prc.d_salt = salt;
+  ns3prc.d_iterations = iterations;
+  return ns3prc;
+}
+
+BOOST_AUTO_TEST_CASE(test_hashes) {
+  AuthNSEC3Cache cache(1);
+  cache.setMaxEntries(2);
+  const auto ns3prc = makeParams("\xab\xcd", 10);
+  const auto other = makeParams("\xab\xcd", 11);
+
+  const DNSName name("www.powerdns.com.");
+  BOOST_CHECK_EQUAL(cache.getHash(ns3prc, name), hashQNameWithSalt(ns3prc, name));
+  BOOST_CHECK_EQUAL(cache.size(), 1U);
+  /* case does not matter */
+  BOOST_CHECK_EQUAL(cache.getHash(ns3prc, DNSName("WWW.PowerDNS.com.")), hashQNameWithSalt(ns3prc, name));
+  BOOST_CHECK_EQUAL(cache.size(), 1U);
+  /* but the parameters do */
+  BOOST_CHECK_EQUAL(cache.getHash(other, name), hashQNameWithSalt(other, name));
+  BOOST_CHECK_EQUAL(cache.size(), 2U);
+
+  /* the least recently used entry is evicted */
+  cache.getHash(ns3prc, name);
+  cache.getHash(ns3prc, DNSName("powerdns.com."));
+  BOOST_CHECK_EQUAL(cache.size(), 2U);
+  BOOST_CHECK_EQUAL(cache.getHash(ns3prc, name), hashQNameWithSalt(ns3prc, name));
+  BOOST_CHECK_EQUAL(cache.size(), 2U);
+
+  BOOST_CHECK_EQUAL(cache.purge(), 2U);
+  BOOST_CHECK_EQUAL(cache.size(), 0U);
+
+  /* disabled */
+  cache.setMaxEntries(0);
+  BOOST_CHECK_EQUAL(cache.getHash(ns3prc, name), hashQNameWithSalt(ns3prc, name));
+  BOOST_CHECK_EQUAL(cache.size(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_ranges) {
+  AuthNSEC3Cache cache;
+  const auto ns3prc = makeParams("", 0);
+  const DNSName zone("powerdns.com.");
+  const std::string first(20, '\x10'), second(20, '\x80'), last(20, '\xf0');
+  std::string before, after;
+  DNSName unhashed;
+
+  BOOST_CHECK(!cache.getRange(zone, 1, 42, ns3prc, std::string(20, '\x20'), before, after, unhashed));
+
+  cache.insertRange(zone, 1, 42, ns3prc, first, second, DNSName("a.powerdns.com."));
+  cache.insertRange(zone, 1, 42, ns3prc, last, first, DNSName("z.powerdns.com."));
+  BOOST_CHECK_EQUAL(cache.getRangesCount(), 2U);
+
+  /* inside the first range, including its start */
+  for (const auto& hashed : { first, std::string(20, '\x20'), std::string(19, '\x80') + '\x7f' }) {
+    BOOST_REQUIRE(cache.getRange(zone, 1, 42, ns3prc, hashed, before, after, unhashed));
+    BOOST_CHECK(before == first);
+    BOOST_CHECK(after == second);
+    BOOST_CHECK_EQUAL(unhashed, DNSName("a.powerdns.com."));
+  }
+
+  /* the range between the second and the last owners is not known */
+  BOOST_CHECK(!cache.getRange(zone, 1, 42, ns3prc, second, before, after, unhashed));
+  BOOST_CHECK(!cache.getRange(zone, 1, 42, ns3prc, std::string(20, '\x90'), before, after, unhashed));
+
+  /* the last range wraps around */
+  for (const auto& hashed : { last, std::string(20, '\xff'), std::string(20, '\x00'), std::string(20, '\x0f') }) {
+    BOOST_REQUIRE(cache.getRange(zone, 1, 42, ns3prc, hashed, before, after, unhashed));
+    BOOST_CHECK(before == last);
+    BOOST_CHECK(after == first);
+    BOOST_CHECK_EQUAL(unhashed, DNSName("z.powerdns.com."));
+  }
+
+  /* another serial, zone id or set of parameters is a miss */
+  BOOST_CHECK(!cache.getRange(zone, 1, 43, ns3prc, first, before, after, unhashed));
+  BOOST_CHECK(!cache.getRange(zone, 2, 42, ns3prc, first, before, after, unhashed));
+  BOOST_CHECK(!cache.getRange(zone, 1, 42, makeParams("\x01", 0), first, before, after, unhashed));
+  BOOST_CHECK(!cache.getRange(DNSName("powerdns.org."), 1, 42, ns3prc, first, before, after, unhashed));
+
+  /* and inserting for a new serial replaces the existing ranges */
+  cache.insertRange(zone, 1, 43, ns3prc, second, last, DNSName("m.powerdns.com."));
+  BOOST_CHECK_EQUAL(cache.getRangesCount(), 1U);
+  BOOST_CHECK(!cache.getRange(zone, 1, 43, ns3prc, first, before, after, unhashed));
+  BOOST_CHECK(cache.getRange(zone, 1, 43, ns3prc, second, before, after, unhashed));
+
+  /* a zone with a single owner has a single range covering everything */
+  const DNSName single("powerdns.net.");
+  cache.insertRange(single, 3, 1, ns3prc, second, second, single);
+  for (const auto& hashed : { first, second, last }) {
+    BOOST_REQUIRE(cache.getRange(single, 3, 1, ns3prc, hashed, before, after, unhashed));
+    BOOST_CHECK(before == second);
+    BOOST_CHECK(after == second);
+  }
+
+  /* changes to a name inside a zone drop it, and only it */
+  BOOST_CHECK_EQUAL(cache.purgeExact(DNSName("www.powerdns.net.")), 1U);
+  BOOST_CHECK(!cache.getRange(single, 3, 1, ns3prc, first, before, after, unhashed));
+  BOOST_CHECK(cache.getRange(zone, 1, 43, ns3prc, second, before, after, unhashed));
+  BOOST_CHECK_EQUAL(cache.purge("com$"), 1U);
+  BOOST_CHECK_EQUAL(cache.getRangesCount(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_ranges_limits) {
+  AuthNSEC3Cache cache;
+  const auto ns3prc = makeParams("", 0);
+  const DNSName zone("powerdns.com.");
+  std::string before, after;
+  DNSName unhashed;
+
+  /* not a hash, ignored */
+  cache.insertRange(zone, 1, 1, ns3prc, "a", "bc", zone);
+  BOOST_CHECK_EQUAL(cache.getRangesCount(), 0U);
+
+  cache.setMaxEntries(1);
+  cache.insertRange(zone, 1, 1, ns3prc, std::string(20, '\x10'), std::string(20, '\x20'), zone);
+  cache.insertRange(zone, 1, 1, ns3prc, std::string(20, '\x20'), std::string(20, '\x30'), zone);
+  BOOST_CHECK_EQUAL(cache.getRangesCount(), 1U);
+
+  /* disabled */
+  cache.purge();
+  cache.setTTL(0);
+  cache.insertRange(zone, 1, 1, ns3prc, std::string(20, '\x10'), std::string(20, '\x20'), zone);
+  BOOST_CHECK(!cache.getRange(zone, 1, 1, ns3prc, std::string(20, '\x10'), before, after, unhashed));
+  BOOST_CHECK_EQUAL(cache.getRangesCount(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,120 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "auth-zonecache.hh"
+
+BOOST_AUTO_TEST_SUITE(test_auth_zonecache_cc)
+
+static AuthZoneCache::ZoneInfo makeZone(const std::string& name, int zoneId, size_t backendIndex = 0)
+{
+  AuthZoneCache::ZoneInfo zone;
+  zone.zone = DNSName(name);
+  zone.zoneId = zoneId;
+  zone.backendIndex = backendIndex;
+  return zone;
+}
+
+BOOST_AUTO_TEST_CASE(test_replace) {
+  AuthZoneCache cache;
+  AuthZoneCache::ZoneInfo zone;
+
+  /* not enabled until the first load */
+  BOOST_CHECK(!cache.isEnabled());
+  BOOST_CHECK(!cache.getBestMatch(DNSName("www.powerdns.com."), zone));
+
+  AuthZoneCache::zones_t zones;
+  zones.push_back(makeZone("powerdns.com.", 1));
+  zones.push_back(makeZone("sub.powerdns.com.", 2));
+  zones.push_back(makeZone("powerdns.org.", 3));
+  /* the first backend wins */
+  zones.push_back(makeZone("powerdns.com.", 4, 1));
+  cache.replace(zones);
+  BOOST_CHECK(cache.isEnabled());
+  BOOST_CHECK_EQUAL(cache.size(), 3U);
+
+  BOOST_REQUIRE(cache.getBestMatch(DNSName("www.powerdns.com."), zone));
+  BOOST_CHECK_EQUAL(zone.zone, DNSName("powerdns.com."));
+  BOOST_CHECK_EQUAL(zone.zoneId, 1);
+  BOOST_CHECK_EQUAL(zone.backendIndex, 0U);
+
+  BOOST_REQUIRE(cache.getBestMatch(DNSName("a.b.c.Sub.PowerDNS.com."), zone));
+  BOOST_CHECK_EQUAL(zone.zone, DNSName("sub.powerdns.com."));
+  BOOST_CHECK_EQUAL(zone.zoneId, 2);
+
+  BOOST_REQUIRE(cache.getBestMatch(DNSName("powerdns.org."), zone));
+  BOOST_CHECK_EQUAL(zone.zoneId, 3);
+
+  BOOST_CHECK(!cache.getBestMatch(DNSName("com."), zone));
+  BOOST_CHECK(!cache.getBestMatch(DNSName("powerdns.net."), zone));
+
+  zones.clear();
+  zones.push_back(makeZone("powerdns.net.", 5));
+  cache.replace(zones);
+  BOOST_CHECK_EQUAL(cache.size(), 1U);
+  BOOST_CHECK(!cache.getBestMatch(DNSName("www.powerdns.com."), zone));
+  BOOST_REQUIRE(cache.getBestMatch(DNSName("www.powerdns.net."), zone));
+  BOOST_CHECK_EQUAL(zone.zoneId, 5);
+}
+
+BOOST_AUTO_TEST_CASE(test_add_remove) {
+  AuthZoneCache cache;
+  AuthZoneCache::ZoneInfo zone;
+  cache.replace(AuthZoneCache::zones_t());
+  BOOST_CHECK_EQUAL(cache.size(), 0U);
+
+  cache.add(makeZone("powerdns.com.", 1));
+  cache.add(makeZone("sub.powerdns.com.", 2));
+  cache.add(makeZone("sub.powerdns.com.", 2));
+  BOOST_CHECK_EQUAL(cache.size(), 2U);
+  BOOST_REQUIRE(cache.getBestMatch(DNSName("www.sub.powerdns.com."), zone));
+  BOOST_CHECK_EQUAL(zone.zoneId, 2);
+
+  cache.remove(DNSName("sub.powerdns.com."));
+  BOOST_CHECK_EQUAL(cache.size(), 1U);
+  BOOST_REQUIRE(cache.getBestMatch(DNSName("www.sub.powerdns.com."), zone));
+  BOOST_CHECK_EQUAL(zone.zoneId, 1);
+
+  /* removing a zone we don't have does nothing */
+  cache.remove(DNSName("powerdns.org."));
+  BOOST_CHECK_EQUAL(cache.size(), 1U);
+
+  /* the root zone */
+  cache.add(makeZone(".", 0));
+  BOOST_REQUIRE(cache.getBestMatch(DNSName("powerdns.org."), zone));
+  BOOST_CHECK_EQUAL(zone.zone, g_rootdnsname);
+  cache.remove(g_rootdnsname);
+  BOOST_CHECK(!cache.getBestMatch(DNSName("powerdns.org."), zone));
+}
+
+BOOST_AUTO_TEST_CASE(test_pending_changes) {
+  AuthZoneCache cache;
+  AuthZoneCache::ZoneInfo zone;
+  AuthZoneCache::zones_t zones;
+  zones.push_back(makeZone("powerdns.com.", 1));
+  zones.push_back(makeZone("powerdns.org.", 2));
+  cache.replace(zones);
+
+  /* changes made while the list of zones is being retrieved are not lost */
+  cache.setReplacePending();
+  cache.add(makeZone("powerdns.net.", 3));
+  cache.remove(DNSName("powerdns.org."));
+  cache.replace(zones);
+
+  BOOST_CHECK_EQUAL(cache.size(), 2U);
+  BOOST_CHECK(cache.getBestMatch(DNSName("powerdns.com."), zone));
+  BOOST_CHECK(cache.getBestMatch(DNSName("powerdns.net."), zone));
+  BOOST_CHECK(!cache.getBestMatch(DNSName("powerdns.org."), zone));
+
+  /* but only replayed once */
+  cache.replace(zones);
+  BOOST_CHECK_EQUAL(cache.size(), 2U);
+  BOOST_CHECK(!cache.getBestMatch(DNSName("powerdns.net."), zone));
+  BOOST_CHECK(cache.getBestMatch(DNSName("powerdns.org."), zone));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
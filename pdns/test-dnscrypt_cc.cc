@@ -186,6 +186,65 @@ BOOST_AUTO_TEST_CASE(DNSCryptEncryptedQueryValid) {
   BOOST_CHECK(mdp.d_qtype == QType::AAAA);
 }
 
+// valid encrypted queries from the same client, using the shared keys cache
+BOOST_AUTO_TEST_CASE(DNSCryptEncryptedQueriesSharedKeysCache) {
+  DNSCryptPrivateKey resolverPrivateKey;
+  DNSCryptCert resolverCert;
+  unsigned char providerPublicKey[DNSCRYPT_PROVIDER_PUBLIC_KEY_SIZE];
+  unsigned char providerPrivateKey[DNSCRYPT_PROVIDER_PRIVATE_KEY_SIZE];
+  time_t now = time(nullptr);
+  DNSCryptContext::generateProviderKeys(providerPublicKey, providerPrivateKey);
+  DNSCryptContext::generateCertificate(1, now, now + (24 * 60 * 3600), DNSCryptExchangeVersion::VERSION1, providerPrivateKey, resolverPrivateKey, resolverCert);
+  auto ctx = std::make_shared<DNSCryptContext>("2.name", resolverCert, resolverPrivateKey);
+
+  DNSCryptPrivateKey clientPrivateKey;
+  unsigned char clientPublicKey[DNSCRYPT_PUBLIC_KEY_SIZE];
+
+  DNSCryptContext::generateResolverKeyPair(clientPrivateKey, clientPublicKey);
+
+  DNSCryptQuery::setSharedKeysCacheSize(10);
+  const auto hitsBefore = DNSCryptQuery::getSharedKeysCacheHits();
+  const auto missesBefore = DNSCryptQuery::getSharedKeysCacheMisses();
+
+  DNSName name("www.powerdns.com.");
+  for (unsigned char idx = 0; idx < 2; idx++) {
+    unsigned char clientNonce[DNSCRYPT_NONCE_SIZE / 2] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x08, 0x09, 0x0A, idx };
+
+    vector<uint8_t> plainQuery;
+    DNSPacketWriter pw(plainQuery, name, QType::AAAA, QClass::IN, 0);
+    pw.getHeader()->rd = 1;
+    plainQuery.reserve(DNSCryptQuery::s_minUDPLength);
+    uint16_t len = plainQuery.size();
+    uint16_t encryptedResponseLen = 0;
+
+    int res = ctx->encryptQuery((char*) plainQuery.data(), len, plainQuery.capacity(), clientPublicKey, clientPrivateKey, clientNonce, false, &encryptedResponseLen, std::make_shared<DNSCryptCert>(resolverCert));
+    BOOST_CHECK_EQUAL(res, 0);
+
+    std::shared_ptr<DNSCryptQuery> query = std::make_shared<DNSCryptQuery>(ctx);
+    uint16_t decryptedLen = 0;
+
+    query->parsePacket((char*) plainQuery.data(), encryptedResponseLen, false, &decryptedLen, now);
+
+    BOOST_CHECK_EQUAL(query->isValid(), true);
+    BOOST_CHECK_EQUAL(query->isEncrypted(), true);
+
+    MOADNSParser mdp(true, (char*) plainQuery.data(), decryptedLen);
+    BOOST_CHECK_EQUAL(mdp.d_qname, name);
+    BOOST_CHECK(mdp.d_qtype == QType::AAAA);
+  }
+
+#ifdef HAVE_CRYPTO_BOX_EASY_AFTERNM
+  /* the first query computed the shared key, the second one found it in the cache */
+  BOOST_CHECK_EQUAL(DNSCryptQuery::getSharedKeysCacheMisses(), missesBefore + 1);
+  BOOST_CHECK_EQUAL(DNSCryptQuery::getSharedKeysCacheHits(), hitsBefore + 1);
+#else
+  BOOST_CHECK_EQUAL(DNSCryptQuery::getSharedKeysCacheMisses(), missesBefore);
+  BOOST_CHECK_EQUAL(DNSCryptQuery::getSharedKeysCacheHits(), hitsBefore);
+#endif
+
+  DNSCryptQuery::setSharedKeysCacheSize(0);
+}
+
 // valid encrypted query with not enough room
 BOOST_AUTO_TEST_CASE(DNSCryptEncryptedQueryValidButShort) {
   DNSCryptPrivateKey resolverPrivateKey;
@@ -1428,6 +1428,252 @@ BOOST_AUTO_TEST_CASE(rewritingWithoutECSWhenLastOption) {
   validateResponse((const char *) newResponse.data(), newResponse.size(), true, 1);
 }
 
+/* a response with an OPT RR followed by records whose names, including the one in the MX rdata,
+   are compressed using pointers located after the OPT RR */
+static vector<uint8_t> makeResponseWithCompressedRecordsAfterOPT(const DNSName& name, bool withOPT, const DNSPacketWriter::optvect_t& opts)
+{
+  vector<uint8_t> response;
+  DNSPacketWriter pw(response, name, QType::A, QClass::IN, 0);
+  pw.getHeader()->qr = 1;
+  pw.startRecord(name, QType::A, 3600, QClass::IN, DNSResourceRecord::ANSWER, true);
+  pw.xfr32BitInt(0x01020304);
+  if (withOPT) {
+    pw.addOpt(512, 0, 0, opts);
+  }
+  pw.startRecord(DNSName("a.example.net."), QType::A, 3600, QClass::IN, DNSResourceRecord::ADDITIONAL, true);
+  pw.xfr32BitInt(0x01020304);
+  pw.startRecord(DNSName("b.example.net."), QType::MX, 3600, QClass::IN, DNSResourceRecord::ADDITIONAL, true);
+  pw.xfr16BitInt(10);
+  pw.xfrName(DNSName("mail.example.net."), true);
+  pw.commit();
+  return response;
+}
+
+BOOST_AUTO_TEST_CASE(editEDNSOptionsInPlaceBeforeCompressedRecords) {
+  DNSName name("www.powerdns.com.");
+
+  EDNSCookiesOpt cookiesOpt;
+  cookiesOpt.client = string("deadbeef");
+  cookiesOpt.server = string("deadbeef");
+  const string cookiesOptionStr = makeEDNSCookiesOptString(cookiesOpt);
+  EDNSSubnetOpts ecsOpts;
+  ecsOpts.source = Netmask(ComboAddress("127.0.0.1"), ECSSourcePrefixV4);
+  const string ecsV4Str = makeEDNSSubnetOptsString(ecsOpts);
+  ecsOpts.source = Netmask(ComboAddress("2001:db8::1"), ECSSourcePrefixV6);
+  const string ecsV6Str = makeEDNSSubnetOptsString(ecsOpts);
+  string ecsV4Option;
+  generateEDNSOption(EDNSOptionCode::ECS, ecsV4Str, ecsV4Option);
+  string ecsV6Option;
+  generateEDNSOption(EDNSOptionCode::ECS, ecsV6Str, ecsV6Option);
+
+  const auto initial = makeResponseWithCompressedRecordsAfterOPT(name, true, {{EDNSOptionCode::COOKIE, cookiesOptionStr}});
+  const auto withV4 = makeResponseWithCompressedRecordsAfterOPT(name, true, {{EDNSOptionCode::COOKIE, cookiesOptionStr}, {EDNSOptionCode::ECS, ecsV4Str}});
+  const auto withV6 = makeResponseWithCompressedRecordsAfterOPT(name, true, {{EDNSOptionCode::COOKIE, cookiesOptionStr}, {EDNSOptionCode::ECS, ecsV6Str}});
+  const auto withoutOPT = makeResponseWithCompressedRecordsAfterOPT(name, false, {});
+
+  char packet[1500];
+  memcpy(packet, initial.data(), initial.size());
+  uint16_t len = initial.size();
+  bool optionAdded = false;
+
+  /* add */
+  BOOST_CHECK_EQUAL(setEDNSOptionInPlace(packet, sizeof(packet), &len, ecsV4Option, false, optionAdded), 0);
+  BOOST_CHECK(optionAdded);
+  BOOST_REQUIRE_EQUAL(len, withV4.size());
+  BOOST_CHECK(memcmp(packet, withV4.data(), len) == 0);
+  validateResponse(packet, len, true, 2);
+
+  /* already present, not overriding */
+  BOOST_CHECK_EQUAL(setEDNSOptionInPlace(packet, sizeof(packet), &len, ecsV6Option, false, optionAdded), 0);
+  BOOST_CHECK(!optionAdded);
+  BOOST_REQUIRE_EQUAL(len, withV4.size());
+  BOOST_CHECK(memcmp(packet, withV4.data(), len) == 0);
+
+  /* replace with a larger one */
+  BOOST_CHECK_EQUAL(setEDNSOptionInPlace(packet, sizeof(packet), &len, ecsV6Option, true, optionAdded), 0);
+  BOOST_CHECK(!optionAdded);
+  BOOST_REQUIRE_EQUAL(len, withV6.size());
+  BOOST_CHECK(memcmp(packet, withV6.data(), len) == 0);
+
+  /* replace with a smaller one */
+  BOOST_CHECK_EQUAL(setEDNSOptionInPlace(packet, sizeof(packet), &len, ecsV4Option, true, optionAdded), 0);
+  BOOST_CHECK(!optionAdded);
+  BOOST_REQUIRE_EQUAL(len, withV4.size());
+  BOOST_CHECK(memcmp(packet, withV4.data(), len) == 0);
+
+  /* not enough room in the buffer */
+  uint16_t tooSmallLen = len;
+  BOOST_CHECK_EQUAL(setEDNSOptionInPlace(packet, len, &tooSmallLen, ecsV6Option, true, optionAdded), ENOSPC);
+  BOOST_CHECK_EQUAL(tooSmallLen, len);
+  BOOST_CHECK(memcmp(packet, withV4.data(), len) == 0);
+
+  /* remove */
+  BOOST_CHECK_EQUAL(removeEDNSOptionInPlace(packet, &len, EDNSOptionCode::ECS), 0);
+  BOOST_REQUIRE_EQUAL(len, initial.size());
+  BOOST_CHECK(memcmp(packet, initial.data(), len) == 0);
+  BOOST_CHECK_EQUAL(removeEDNSOptionInPlace(packet, &len, EDNSOptionCode::ECS), ENOENT);
+
+  /* remove the whole OPT RR */
+  BOOST_CHECK_EQUAL(removeOPTRRInPlace(packet, &len), 0);
+  BOOST_REQUIRE_EQUAL(len, withoutOPT.size());
+  BOOST_CHECK(memcmp(packet, withoutOPT.data(), len) == 0);
+  validateResponse(packet, len, false, 2);
+
+  BOOST_CHECK_EQUAL(removeOPTRRInPlace(packet, &len), ENOENT);
+  BOOST_CHECK_EQUAL(setEDNSOptionInPlace(packet, sizeof(packet), &len, ecsV4Option, false, optionAdded), ENOENT);
+}
+
+static vector<uint8_t> makeResponseWithCompressedRDataAfterOPT(const DNSName& name, bool withOPT, const DNSPacketWriter::optvect_t& opts)
+{
+  vector<uint8_t> response;
+  DNSPacketWriter pw(response, name, QType::A, QClass::IN, 0);
+  pw.getHeader()->qr = 1;
+  pw.startRecord(name, QType::A, 3600, QClass::IN, DNSResourceRecord::ANSWER, true);
+  pw.xfr32BitInt(0x01020304);
+  if (withOPT) {
+    pw.addOpt(512, 0, 0, opts);
+  }
+  pw.startRecord(DNSName("_sip._udp.example.net."), QType::SRV, 3600, QClass::IN, DNSResourceRecord::ADDITIONAL, true);
+  pw.xfr16BitInt(10);
+  pw.xfr16BitInt(20);
+  pw.xfr16BitInt(5060);
+  pw.xfrName(DNSName("sip.example.net."), true);
+  pw.startRecord(DNSName("example.net."), QType::NAPTR, 3600, QClass::IN, DNSResourceRecord::ADDITIONAL, true);
+  pw.xfr16BitInt(100);
+  pw.xfr16BitInt(10);
+  /* flags, services and regexp */
+  pw.xfr8BitInt(1);
+  pw.xfrBlob("S");
+  pw.xfr8BitInt(7);
+  pw.xfrBlob("SIP+D2U");
+  pw.xfr8BitInt(0);
+  pw.xfrName(DNSName("_sip._udp.example.net."), true);
+  pw.startRecord(DNSName("example.net."), QType::RP, 3600, QClass::IN, DNSResourceRecord::ADDITIONAL, true);
+  pw.xfrName(DNSName("admin.example.net."), true);
+  pw.xfrName(DNSName("sip.example.net."), true);
+  pw.commit();
+  return response;
+}
+
+BOOST_AUTO_TEST_CASE(editEDNSOptionsInPlaceBeforeCompressedRData) {
+  DNSName name("www.powerdns.com.");
+
+  EDNSSubnetOpts ecsOpts;
+  ecsOpts.source = Netmask(ComboAddress("127.0.0.1"), ECSSourcePrefixV4);
+  const string ecsV4Str = makeEDNSSubnetOptsString(ecsOpts);
+  string ecsV4Option;
+  generateEDNSOption(EDNSOptionCode::ECS, ecsV4Str, ecsV4Option);
+
+  /* the names inside the SRV, NAPTR and RP rdata point after the OPT RR, and have to be fixed */
+  const auto initial = makeResponseWithCompressedRDataAfterOPT(name, true, {});
+  const auto withV4 = makeResponseWithCompressedRDataAfterOPT(name, true, {{EDNSOptionCode::ECS, ecsV4Str}});
+  const auto withoutOPT = makeResponseWithCompressedRDataAfterOPT(name, false, {});
+
+  char packet[1500];
+  memcpy(packet, initial.data(), initial.size());
+  uint16_t len = initial.size();
+  bool optionAdded = false;
+
+  BOOST_CHECK_EQUAL(setEDNSOptionInPlace(packet, sizeof(packet), &len, ecsV4Option, false, optionAdded), 0);
+  BOOST_CHECK(optionAdded);
+  BOOST_REQUIRE_EQUAL(len, withV4.size());
+  BOOST_CHECK(memcmp(packet, withV4.data(), len) == 0);
+
+  BOOST_CHECK_EQUAL(removeOPTRRInPlace(packet, &len), 0);
+  BOOST_REQUIRE_EQUAL(len, withoutOPT.size());
+  BOOST_CHECK(memcmp(packet, withoutOPT.data(), len) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(replaceECSInPlaceWithTrailingData) {
+  bool ednsAdded = false;
+  bool ecsAdded = false;
+  ComboAddress remote("192.168.1.25");
+  DNSName name("www.powerdns.com.");
+  string newECSOption;
+  generateECSOption(remote, newECSOption, remote.sin4.sin_family == AF_INET ? ECSSourcePrefixV4 : ECSSourcePrefixV6);
+
+  /* the TSIG record after the OPT RR sends us down the in-place path */
+  vector<uint8_t> query;
+  DNSPacketWriter pw(query, name, QType::A, QClass::IN, 0);
+  pw.getHeader()->rd = 1;
+  EDNSSubnetOpts ecsOpts;
+  ecsOpts.source = Netmask(ComboAddress("127.0.0.1"), 8);
+  DNSPacketWriter::optvect_t opts;
+  opts.push_back(make_pair(EDNSOptionCode::ECS, makeEDNSSubnetOptsString(ecsOpts)));
+  pw.addOpt(512, 0, 0, opts);
+  pw.startRecord(DNSName("tsigname."), QType::TSIG, 0, QClass::ANY, DNSResourceRecord::ADDITIONAL, false);
+  pw.commit();
+
+  char packet[1500];
+  memcpy(packet, query.data(), query.size());
+  uint16_t len = query.size();
+  unsigned int consumed = 0;
+  uint16_t qtype;
+  DNSName qname(packet, len, sizeof(dnsheader), false, &qtype, nullptr, &consumed);
+  BOOST_CHECK(handleEDNSClientSubnet(packet, sizeof packet, consumed, &len, ednsAdded, ecsAdded, true, newECSOption, false));
+  vector<uint8_t> queryWithNewECS(packet, packet + len);
+
+  const size_t trailingDataSize = 10;
+
+  /* packet with trailing data (overriding it) */
+  memcpy(packet, query.data(), query.size());
+  len = query.size();
+  BOOST_REQUIRE(sizeof(packet) > len && (sizeof(packet) - len) > trailingDataSize);
+  for (size_t idx = 0; idx < trailingDataSize; idx++) {
+    packet[len + idx] = 'A';
+  }
+  len += trailingDataSize;
+  BOOST_CHECK(handleEDNSClientSubnet(packet, sizeof packet, consumed, &len, ednsAdded, ecsAdded, true, newECSOption, false));
+  BOOST_REQUIRE_EQUAL(static_cast<size_t>(len), queryWithNewECS.size());
+  BOOST_CHECK_EQUAL(memcmp(queryWithNewECS.data(), packet, queryWithNewECS.size()), 0);
+  BOOST_CHECK_EQUAL(ednsAdded, false);
+  BOOST_CHECK_EQUAL(ecsAdded, false);
+  validateQuery(packet, len, true, false, 1);
+  validateECS(packet, len, remote);
+
+  /* packet with trailing data (preserving trailing data) */
+  memcpy(packet, query.data(), query.size());
+  len = query.size();
+  for (size_t idx = 0; idx < trailingDataSize; idx++) {
+    packet[len + idx] = 'A';
+  }
+  len += trailingDataSize;
+  BOOST_CHECK(handleEDNSClientSubnet(packet, sizeof packet, consumed, &len, ednsAdded, ecsAdded, true, newECSOption, true));
+  BOOST_REQUIRE_EQUAL(static_cast<size_t>(len), queryWithNewECS.size() + trailingDataSize);
+  BOOST_CHECK_EQUAL(memcmp(queryWithNewECS.data(), packet, queryWithNewECS.size()), 0);
+  for (size_t idx = 0; idx < trailingDataSize; idx++) {
+    BOOST_CHECK_EQUAL(packet[queryWithNewECS.size() + idx], 'A');
+  }
+}
+
+BOOST_AUTO_TEST_CASE(editEDNSOptionsInPlaceInvalid) {
+  DNSName name("www.powerdns.com.");
+  string ecsOption;
+  generateECSOption(ComboAddress("192.0.2.1"), ecsOption, ECSSourcePrefixV4);
+  const auto response = makeResponseWithCompressedRecordsAfterOPT(name, true, {});
+  bool optionAdded = false;
+
+  /* truncated */
+  char packet[1500];
+  memcpy(packet, response.data(), response.size());
+  uint16_t len = response.size() - 1;
+  BOOST_CHECK_EQUAL(setEDNSOptionInPlace(packet, sizeof(packet), &len, ecsOption, false, optionAdded), EINVAL);
+  BOOST_CHECK_EQUAL(removeOPTRRInPlace(packet, &len), EINVAL);
+  BOOST_CHECK_EQUAL(len, response.size() - 1);
+
+  /* the name in the MX rdata now points to the OPT RR itself */
+  len = response.size();
+  const size_t optStart = sizeof(dnsheader) + name.wirelength() + DNS_TYPE_SIZE + DNS_CLASS_SIZE + /* compressed answer */ 2 + 10 + 4;
+  BOOST_REQUIRE_EQUAL(packet[optStart], 0);
+  const size_t lastPointer = response.size() - 2;
+  BOOST_REQUIRE_EQUAL(static_cast<uint8_t>(packet[lastPointer]) & 0xC0, 0xC0);
+  packet[lastPointer] = 0xC0 | (optStart / 256);
+  packet[lastPointer + 1] = optStart % 256;
+  BOOST_CHECK_EQUAL(setEDNSOptionInPlace(packet, sizeof(packet), &len, ecsOption, false, optionAdded), EINVAL);
+  BOOST_CHECK_EQUAL(removeOPTRRInPlace(packet, &len), EINVAL);
+  BOOST_CHECK_EQUAL(len, response.size());
+}
+
 static DNSQuestion getDNSQuestion(const DNSName& qname, const uint16_t qtype, const uint16_t qclass, const ComboAddress& lc, const ComboAddress& rem, const struct timespec& realTime, vector<uint8_t>& query, size_t len)
 {
   dnsheader* dh = reinterpret_cast<dnsheader*>(query.data());
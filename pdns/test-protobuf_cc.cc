@@ -0,0 +1,219 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+
+#include "dnswriter.hh"
+#include "gettime.hh"
+#include "misc.hh"
+#include "protobuf.hh"
+#include "uuid-utils.hh"
+
+#ifdef HAVE_FSTRM
+#include "dnstap.hh"
+#include "rec-dnstap.hh"
+#endif /* HAVE_FSTRM */
+
+BOOST_AUTO_TEST_SUITE(protobuf_cc)
+
+BOOST_AUTO_TEST_CASE(test_ProtoBufEncoder)
+{
+  std::string buffer;
+  ProtoBufEncoder encoder(buffer);
+
+  encoder.addVarint(1, 150);
+  BOOST_CHECK_EQUAL(makeHexDump(buffer), makeHexDump(std::string("\x08\x96\x01", 3)));
+
+  buffer.clear();
+  encoder.addFixed32(9, 0x01020304);
+  BOOST_CHECK_EQUAL(makeHexDump(buffer), makeHexDump(std::string("\x4d\x04\x03\x02\x01", 5)));
+
+  buffer.clear();
+  encoder.addAddress(6, ComboAddress("192.0.2.1"));
+  BOOST_CHECK_EQUAL(makeHexDump(buffer), makeHexDump(std::string("\x32\x04\xc0\x00\x02\x01", 6)));
+
+  /* embedded messages larger than 127 bytes need more than one byte for the length */
+  for (const size_t size : { 0, 1, 125, 126, 127, 128, 16383, 16384 }) {
+    buffer.clear();
+    auto start = encoder.startMessage(13);
+    encoder.addBytes(1, std::string(size, 'a'));
+    encoder.endMessage(start);
+
+    std::string expected;
+    ProtoBufEncoder direct(expected);
+    std::string content;
+    ProtoBufEncoder(content).addBytes(1, std::string(size, 'a'));
+    direct.addBytes(13, content);
+    BOOST_CHECK(buffer == expected);
+  }
+}
+
+#ifdef HAVE_PROTOBUF
+
+static std::string makeResponse(const DNSName& qname, size_t answers)
+{
+  vector<uint8_t> packet;
+  DNSPacketWriter pw(packet, qname, QType::A);
+  pw.getHeader()->qr = 1;
+  pw.getHeader()->id = htons(4242);
+  for (size_t idx = 0; idx < answers; idx++) {
+    if (idx == 0) {
+      pw.startRecord(qname, QType::CNAME, 3600, QClass::IN, DNSResourceRecord::ANSWER);
+      pw.xfrName(DNSName("target.powerdns.com."), true);
+    }
+    else if (idx % 2) {
+      pw.startRecord(DNSName("target.powerdns.com."), QType::A, 60, QClass::IN, DNSResourceRecord::ANSWER);
+      ComboAddress addr("192.0.2." + std::to_string(idx % 256));
+      pw.xfrCAWithoutPort(4, addr);
+    }
+    else {
+      pw.startRecord(DNSName("target.powerdns.com."), QType::AAAA, 60, QClass::IN, DNSResourceRecord::ANSWER);
+      ComboAddress addr("2001:db8::" + std::to_string(idx));
+      pw.xfrCAWithoutPort(6, addr);
+    }
+    pw.commit();
+  }
+  return std::string(reinterpret_cast<const char*>(packet.data()), packet.size());
+}
+
+static void encodeResponse(std::string& buffer, const boost::uuids::uuid& uuid, const ComboAddress& requestor, const ComboAddress& responder, const DNSName& qname, const std::string& packet, const struct timeval& now)
+{
+  DNSProtoBufEncoder encoder(buffer);
+  encoder.setType(DNSProtoBufMessage::Response);
+  encoder.setUUID(uuid);
+  encoder.setServerIdentity("server");
+  encoder.setSocket(&requestor, &responder, true);
+  encoder.setRequestor(requestor);
+  encoder.setResponder(responder);
+  encoder.setBytes(packet.size());
+  encoder.setTime(now.tv_sec, now.tv_usec);
+  encoder.setId(htons(4242));
+  encoder.setQuestion(qname, QType::A, QClass::IN);
+  encoder.startResponse();
+  encoder.setResponseCode(0);
+  encoder.addRRsFromPacket(packet.data(), packet.size(), true);
+  encoder.addTag("tag1");
+  encoder.addTag("tag2");
+  encoder.setQueryTime(now.tv_sec - 1, now.tv_usec);
+  encoder.endResponse();
+  encoder.setEDNSSubnet(Netmask("192.0.2.0/24"), 24);
+  encoder.setRequestorId("requestor");
+  encoder.setInitialRequestID(uuid);
+  encoder.setDeviceId("device");
+  encoder.setDeviceName("name");
+  encoder.setRequestorPort(requestor.getPort());
+  encoder.setResponderPort(responder.getPort());
+}
+
+static void buildResponse(std::string& buffer, const boost::uuids::uuid& uuid, const ComboAddress& requestor, const ComboAddress& responder, const DNSName& qname, const std::string& packet, const struct timeval& now)
+{
+  DNSProtoBufMessage message(DNSProtoBufMessage::Response, uuid, &requestor, &responder, qname, QType::A, QClass::IN, htons(4242), true, packet.size());
+  message.setTime(now.tv_sec, now.tv_usec);
+  message.setServerIdentity("server");
+  message.setResponseCode(0);
+  message.addRRsFromPacket(packet.data(), packet.size(), true);
+  message.addTag("tag1");
+  message.addTag("tag2");
+  message.setQueryTime(now.tv_sec - 1, now.tv_usec);
+  message.setEDNSSubnet(Netmask("192.0.2.0/24"), 24);
+  message.setRequestorId("requestor");
+  message.setInitialRequestID(uuid);
+  message.setDeviceId("device");
+  message.setDeviceName("name");
+  message.serialize(buffer);
+}
+
+BOOST_AUTO_TEST_CASE(test_DNSProtoBufEncoder)
+{
+  const auto uuid = getUniqueID();
+  const DNSName qname("www.powerdns.com.");
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+
+  for (const auto& addresses : std::vector<std::pair<std::string, std::string>>{ { "192.0.2.1:4242", "192.0.2.2:53" }, { "[2001:db8::1]:4242", "[2001:db8::2]:53" } }) {
+    const ComboAddress requestor(addresses.first);
+    const ComboAddress responder(addresses.second);
+
+    /* no answer, a few, and enough of them to need a multi-byte length for the response */
+    for (const size_t answers : { 0, 1, 2, 10, 100 }) {
+      const auto packet = makeResponse(qname, answers);
+      std::string expected;
+      buildResponse(expected, uuid, requestor, responder, qname, packet, now);
+      std::string encoded;
+      encodeResponse(encoded, uuid, requestor, responder, qname, packet, now);
+      BOOST_CHECK_EQUAL(makeHexDump(encoded), makeHexDump(expected));
+    }
+  }
+
+  /* the packet is parsed in place, a truncated one should be rejected as PacketReader did */
+  const auto packet = makeResponse(qname, 2);
+  for (const size_t len : { packet.size() - 1, packet.size() - 5, sizeof(struct dnsheader) + 1 }) {
+    std::string encoded;
+    DNSProtoBufEncoder encoder(encoded);
+    BOOST_CHECK_THROW(encoder.addRRsFromPacket(packet.data(), len, true), std::exception);
+  }
+
+  /* a query, with an empty qname, no response content and no address */
+  DNSProtoBufMessage message(DNSProtoBufMessage::OutgoingQuery);
+  message.setQuestion(DNSName(), QType::A, QClass::IN);
+  message.setNetworkErrorResponseCode();
+  std::string expected;
+  message.serialize(expected);
+
+  std::string encoded;
+  DNSProtoBufEncoder encoder(encoded);
+  encoder.setType(DNSProtoBufMessage::OutgoingQuery);
+  encoder.setQuestion(DNSName(), QType::A, QClass::IN);
+  encoder.startResponse();
+  encoder.setResponseCode(65536);
+  encoder.endResponse();
+  BOOST_CHECK_EQUAL(makeHexDump(encoded), makeHexDump(expected));
+}
+
+#endif /* HAVE_PROTOBUF */
+
+#if defined(HAVE_PROTOBUF) && defined(HAVE_FSTRM)
+
+BOOST_AUTO_TEST_CASE(test_DnstapEncoder)
+{
+  const DNSName qname("www.powerdns.com.");
+  const DNSName zone("powerdns.com.");
+  struct timespec queryTime;
+  gettime(&queryTime, true);
+  struct timespec responseTime = queryTime;
+  responseTime.tv_nsec = (responseTime.tv_nsec + 1000) % 1000000000;
+
+  vector<uint8_t> query;
+  DNSPacketWriter pw(query, qname, QType::A);
+  const std::string queryStr(reinterpret_cast<const char*>(query.data()), query.size());
+  const auto response = makeResponse(qname, 100);
+
+  for (const auto& addresses : std::vector<std::pair<std::string, std::string>>{ { "192.0.2.1:4242", "192.0.2.2:53" }, { "[2001:db8::1]:4242", "[2001:db8::2]:53" } }) {
+    const ComboAddress requestor(addresses.first);
+    const ComboAddress responder(addresses.second);
+
+    for (const auto& packet : { queryStr, response }) {
+      std::string expected;
+      DnstapMessage message("identity", &requestor, &responder, false, packet.data(), packet.size(), &queryTime, &responseTime);
+      message.serialize(expected);
+      std::string encoded;
+      encodeDnstapMessage(encoded, "identity", &requestor, &responder, false, packet.data(), packet.size(), &queryTime, &responseTime);
+      BOOST_CHECK_EQUAL(makeHexDump(encoded), makeHexDump(expected));
+
+      /* the recursor flavour, without a requestor */
+      expected.clear();
+      RecDnstapMessage recMessage("identity", nullptr, &responder, true, boost::optional<const DNSName&>(zone), packet.data(), packet.size(), &queryTime, nullptr);
+      recMessage.serialize(expected);
+      encoded.clear();
+      encodeDnstapMessage(encoded, "identity", nullptr, &responder, true, packet.data(), packet.size(), &queryTime, nullptr, true, &zone);
+      BOOST_CHECK_EQUAL(makeHexDump(encoded), makeHexDump(expected));
+    }
+  }
+}
+
+#endif /* HAVE_PROTOBUF && HAVE_FSTRM */
+
+BOOST_AUTO_TEST_SUITE_END()
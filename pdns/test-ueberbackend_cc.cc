@@ -0,0 +1,209 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+#include "arguments.hh"
+#include "dnsbackend.hh"
+#include "ueberbackend.hh"
+
+/* a backend serving a fixed set of records, and counting the queries it gets */
+class PrefetchTestBackend : public DNSBackend
+{
+public:
+  void lookup(const QType& qtype, const DNSName& qdomain, int zoneId, DNSPacket* pkt_p) override
+  {
+    ++s_lookups;
+    d_results.clear();
+    d_pos = 0;
+    for (const auto& rr : s_records) {
+      if (rr.domain_id == zoneId && rr.qname == qdomain && (qtype.getCode() == QType::ANY || rr.qtype == qtype)) {
+        d_results.push_back(rr);
+      }
+    }
+  }
+
+  bool get(DNSResourceRecord& rr) override
+  {
+    if (d_pos >= d_results.size()) {
+      return false;
+    }
+    rr = d_results.at(d_pos++);
+    return true;
+  }
+
+  bool lookupNames(const std::vector<DNSName>& names, int zoneId, std::vector<DNSResourceRecord>& records) override
+  {
+    ++s_lookupNames;
+    if (s_failLookupNames) {
+      throw PDNSException("lookupNames failed on purpose");
+    }
+    for (const auto& rr : s_records) {
+      if (rr.domain_id == zoneId && std::find(names.begin(), names.end(), rr.qname) != names.end()) {
+        records.push_back(rr);
+      }
+    }
+    return true;
+  }
+
+  bool list(const DNSName& target, int domain_id, bool include_disabled) override
+  {
+    return false;
+  }
+
+  static std::vector<DNSResourceRecord> s_records;
+  static size_t s_lookups;
+  static size_t s_lookupNames;
+  static bool s_failLookupNames;
+
+private:
+  std::vector<DNSResourceRecord> d_results;
+  size_t d_pos{0};
+};
+
+std::vector<DNSResourceRecord> PrefetchTestBackend::s_records;
+size_t PrefetchTestBackend::s_lookups{0};
+size_t PrefetchTestBackend::s_lookupNames{0};
+bool PrefetchTestBackend::s_failLookupNames{false};
+
+class PrefetchTestBackendFactory : public BackendFactory
+{
+public:
+  PrefetchTestBackendFactory() : BackendFactory("prefetchtest")
+  {
+  }
+
+  DNSBackend* make(const string& suffix) override
+  {
+    return new PrefetchTestBackend();
+  }
+};
+
+static void addRecord(int zoneId, const std::string& name, uint16_t qtype, const std::string& content)
+{
+  DNSResourceRecord rr;
+  rr.domain_id = zoneId;
+  rr.qname = DNSName(name);
+  rr.qtype = qtype;
+  rr.content = content;
+  rr.ttl = 3600;
+  rr.auth = true;
+  PrefetchTestBackend::s_records.push_back(rr);
+}
+
+static void setup()
+{
+  static bool done = false;
+  if (done) {
+    return;
+  }
+  done = true;
+
+  ::arg().set("query-cache-ttl", "query cache TTL") = "0";
+  ::arg().set("negquery-cache-ttl", "negative query cache TTL") = "0";
+  BackendMakers().report(new PrefetchTestBackendFactory());
+  BackendMakers().launch("prefetchtest");
+  UeberBackend::go();
+
+  addRecord(1, "example.com.", QType::SOA, "ns1.example.com. hostmaster.example.com. 1 3600 600 604800 3600");
+  addRecord(1, "example.com.", QType::NS, "ns1.example.com.");
+  addRecord(1, "*.example.com.", QType::A, "192.0.2.1");
+  addRecord(1, "sub.example.com.", QType::TXT, "\"text\"");
+  addRecord(1, "*.sub.example.com.", QType::AAAA, "2001:db8::1");
+  addRecord(1, "*.sub.example.com.", QType::A, "192.0.2.2");
+  addRecord(1, "b.sub.example.com.", QType::MX, "10 mx.example.com.");
+  addRecord(1, "a.b.sub.example.com.", QType::CNAME, "www.example.com.");
+  /* same names, another zone */
+  addRecord(2, "sub.example.com.", QType::TXT, "\"other zone\"");
+  addRecord(2, "*.sub.example.com.", QType::A, "198.51.100.1");
+}
+
+/* the names PacketHandler::prefetchTarget() asks for */
+static std::vector<DNSName> getNamesToPrefetch(const DNSName& target, const DNSName& apex)
+{
+  std::vector<DNSName> names;
+  DNSName name(target);
+  names.push_back(name);
+  while (name != apex && name.chopOff()) {
+    names.push_back(name);
+    names.push_back(g_wildcarddnsname + name);
+  }
+  return names;
+}
+
+static std::vector<std::string> getAnswers(UeberBackend& ub, const std::vector<DNSName>& names, int zoneId)
+{
+  std::vector<std::string> answers;
+  for (const auto& name : names) {
+    for (const uint16_t qtype : { QType::ANY, QType::A, QType::AAAA, QType::TXT, QType::CNAME, QType::SOA, QType::NS, QType::DS }) {
+      ub.lookup(QType(qtype), name, zoneId);
+      DNSZoneRecord zr;
+      while (ub.get(zr)) {
+        answers.push_back(QType(qtype).getName() + " " + zr.dr.d_name.toString() + " " + std::to_string(zr.dr.d_ttl) + " " + QType(zr.dr.d_type).getName() + " " + zr.dr.d_content->getZoneRepresentation() + " " + std::to_string(zr.auth));
+      }
+    }
+  }
+  return answers;
+}
+
+BOOST_AUTO_TEST_SUITE(ueberbackend_cc)
+
+BOOST_AUTO_TEST_CASE(test_prefetchNames) {
+  setup();
+  UeberBackend ub;
+  const DNSName apex("example.com.");
+
+  for (const auto& target : { "a.b.sub.example.com.", "b.sub.example.com.", "sub.example.com.", "nx.sub.example.com.", "example.com." }) {
+    const auto names = getNamesToPrefetch(DNSName(target), apex);
+    for (const int zoneId : { 1, 2 }) {
+      ub.prefetchNames({}, -1);
+      const auto expected = getAnswers(ub, names, zoneId);
+
+      PrefetchTestBackend::s_lookups = 0;
+      PrefetchTestBackend::s_lookupNames = 0;
+      ub.prefetchNames(names, zoneId);
+      BOOST_CHECK_EQUAL(PrefetchTestBackend::s_lookupNames, 1U);
+      const auto got = getAnswers(ub, names, zoneId);
+      /* every lookup has been answered from the prefetched records */
+      BOOST_CHECK_EQUAL(PrefetchTestBackend::s_lookups, 0U);
+      BOOST_CHECK(got == expected);
+    }
+  }
+
+  /* names that have not been prefetched, and other zones, are still looked up */
+  const auto names = getNamesToPrefetch(DNSName("a.b.sub.example.com."), apex);
+  ub.prefetchNames(names, 1);
+  PrefetchTestBackend::s_lookups = 0;
+  ub.lookup(QType(QType::ANY), DNSName("www.example.com."), 1);
+  DNSZoneRecord zr;
+  while (ub.get(zr)) {
+  }
+  BOOST_CHECK_EQUAL(PrefetchTestBackend::s_lookups, 1U);
+  ub.lookup(QType(QType::ANY), DNSName("sub.example.com."), 2);
+  BOOST_REQUIRE(ub.get(zr));
+  BOOST_CHECK_EQUAL(zr.dr.d_content->getZoneRepresentation(), "\"other zone\"");
+  BOOST_CHECK(!ub.get(zr));
+  BOOST_CHECK_EQUAL(PrefetchTestBackend::s_lookups, 2U);
+}
+
+BOOST_AUTO_TEST_CASE(test_prefetchNames_Failure) {
+  setup();
+  UeberBackend ub;
+  const auto names = getNamesToPrefetch(DNSName("a.b.sub.example.com."), DNSName("example.com."));
+  const auto expected = getAnswers(ub, names, 1);
+
+  /* a failure to prefetch is not fatal, the regular lookups are done instead */
+  PrefetchTestBackend::s_failLookupNames = true;
+  PrefetchTestBackend::s_lookups = 0;
+  ub.prefetchNames(names, 1);
+  const auto got = getAnswers(ub, names, 1);
+  PrefetchTestBackend::s_failLookupNames = false;
+  BOOST_CHECK_GT(PrefetchTestBackend::s_lookups, 0U);
+  BOOST_CHECK(got == expected);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
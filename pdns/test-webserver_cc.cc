@@ -0,0 +1,310 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <poll.h>
+#include <boost/test/unit_test.hpp>
+
+#include "webserver.hh"
+
+static std::vector<std::unique_ptr<HttpRequest>> readRequests(HttpRequestReader& reader, const std::string& data, size_t step)
+{
+  std::vector<std::unique_ptr<HttpRequest>> requests;
+  std::unique_ptr<HttpRequest> req(new HttpRequest());
+  for (size_t pos = 0; pos < data.size(); pos += step) {
+    reader.feed(data.data() + pos, std::min(step, data.size() - pos));
+    while (reader.getRequest(*req)) {
+      requests.push_back(std::move(req));
+      req = std::unique_ptr<HttpRequest>(new HttpRequest());
+    }
+  }
+  return requests;
+}
+
+BOOST_AUTO_TEST_SUITE(webserver_cc)
+
+BOOST_AUTO_TEST_CASE(test_HttpRequestReader_split) {
+  const std::string get("GET /api/v1/servers?foo=bar HTTP/1.1\r\nHost: localhost\r\nAccept: application/json\r\n\r\n");
+  const std::string post("POST /api/v1/servers/localhost/zones HTTP/1.1\r\nHost: localhost\r\nContent-Type: application/json\r\nContent-Length: 13\r\n\r\n{\"name\": \"a\"}");
+
+  for (const auto& data : { get, post }) {
+    /* one byte at a time, the request is only complete once the last byte has been received */
+    HttpRequestReader reader(1024 * 1024);
+    HttpRequest req;
+    for (size_t pos = 0; pos < data.size(); pos++) {
+      BOOST_CHECK(!req.complete);
+      reader.feed(&data.at(pos), 1);
+      bool complete = reader.getRequest(req);
+      BOOST_CHECK_EQUAL(complete, pos == data.size() - 1);
+      BOOST_CHECK_EQUAL(reader.hasPartialRequest(), pos != data.size() - 1);
+    }
+    BOOST_CHECK(req.complete);
+    BOOST_CHECK(reader.canBeReused());
+  }
+
+  HttpRequestReader reader(1024 * 1024);
+  auto requests = readRequests(reader, post, 7);
+  BOOST_REQUIRE_EQUAL(requests.size(), 1U);
+  BOOST_CHECK_EQUAL(requests.at(0)->method, "POST");
+  BOOST_CHECK_EQUAL(requests.at(0)->url.path, "/api/v1/servers/localhost/zones");
+  BOOST_CHECK_EQUAL(requests.at(0)->body, "{\"name\": \"a\"}");
+
+  requests = readRequests(reader, get, 5);
+  BOOST_REQUIRE_EQUAL(requests.size(), 1U);
+  BOOST_CHECK_EQUAL(requests.at(0)->method, "GET");
+  BOOST_CHECK_EQUAL(requests.at(0)->url.path, "/api/v1/servers");
+  BOOST_CHECK_EQUAL(requests.at(0)->getvars["foo"], "bar");
+  BOOST_CHECK_EQUAL(requests.at(0)->headers["accept"], "application/json");
+  BOOST_CHECK(requests.at(0)->body.empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_HttpRequestReader_pipelined) {
+  const std::string data("POST /first HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nfirstGET /second HTTP/1.1\r\nHost: localhost\r\n\r\nPOST /third HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nthird");
+
+  /* all at once, then in pieces that cross the requests boundaries */
+  for (const size_t step : { data.size(), static_cast<size_t>(1), static_cast<size_t>(3), static_cast<size_t>(64) }) {
+    HttpRequestReader reader(1024 * 1024);
+    auto requests = readRequests(reader, data, step);
+    BOOST_REQUIRE_EQUAL(requests.size(), 3U);
+    BOOST_CHECK_EQUAL(requests.at(0)->url.path, "/first");
+    BOOST_CHECK_EQUAL(requests.at(0)->body, "first");
+    BOOST_CHECK_EQUAL(requests.at(1)->url.path, "/second");
+    BOOST_CHECK(requests.at(1)->body.empty());
+    BOOST_CHECK_EQUAL(requests.at(2)->url.path, "/third");
+    BOOST_CHECK_EQUAL(requests.at(2)->body, "third");
+    BOOST_CHECK(!reader.hasPartialRequest());
+    BOOST_CHECK(reader.canBeReused());
+  }
+
+  /* the beginning of the next request is kept */
+  HttpRequestReader reader(1024 * 1024);
+  auto requests = readRequests(reader, "GET /first HTTP/1.1\r\nHost: localhost\r\n\r\nGET /sec", 1024);
+  BOOST_REQUIRE_EQUAL(requests.size(), 1U);
+  BOOST_CHECK(reader.hasPartialRequest());
+  requests = readRequests(reader, "ond HTTP/1.1\r\nHost: localhost\r\n\r\n", 1024);
+  BOOST_REQUIRE_EQUAL(requests.size(), 1U);
+  BOOST_CHECK_EQUAL(requests.at(0)->url.path, "/second");
+  BOOST_CHECK(!reader.hasPartialRequest());
+}
+
+BOOST_AUTO_TEST_CASE(test_HttpRequestReader_limits) {
+  {
+    /* headers that never end */
+    HttpRequestReader reader(1024);
+    HttpRequest req;
+    const std::string data("GET / HTTP/1.1\r\nX-Filler: " + std::string(2048, 'a'));
+    reader.feed(data.data(), data.size());
+    BOOST_CHECK_THROW(reader.getRequest(req), YaHTTP::ParseError);
+  }
+
+  {
+    /* the end of a chunked body can't be told apart from the next request */
+    HttpRequestReader reader(1024 * 1024);
+    HttpRequest req;
+    const std::string data("POST / HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n");
+    reader.feed(data.data(), data.size());
+    BOOST_REQUIRE(reader.getRequest(req));
+    BOOST_CHECK_EQUAL(req.body, "hello");
+    BOOST_CHECK(!reader.canBeReused());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_HttpRequest_wantsKeepAlive) {
+  const std::vector<std::pair<std::string, bool>> cases = {
+    { "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n", true },
+    { "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n", false },
+    { "GET / HTTP/1.0\r\n\r\n", false },
+    { "GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", true },
+  };
+
+  for (const auto& entry : cases) {
+    HttpRequestReader reader(1024 * 1024);
+    auto requests = readRequests(reader, entry.first, 1024);
+    BOOST_REQUIRE_EQUAL(requests.size(), 1U);
+    BOOST_CHECK_EQUAL(requests.at(0)->wantsKeepAlive(), entry.second);
+  }
+}
+
+class WebServerWorkerTest
+{
+public:
+  WebServerWorkerTest(): d_ws(getWebServer()), d_listener(AF_INET, SOCK_STREAM, 0)
+  {
+    ComboAddress local("127.0.0.1", 0);
+    d_listener.bind(local);
+    d_listener.listen();
+    socklen_t len = local.getSocklen();
+    BOOST_REQUIRE_EQUAL(getsockname(d_listener.getHandle(), reinterpret_cast<struct sockaddr*>(&local), &len), 0);
+    d_local = local;
+  }
+
+  /* returns the client side of a connection served by 'worker' */
+  std::unique_ptr<Socket> connect(WebServerWorker& worker)
+  {
+    std::unique_ptr<Socket> client(new Socket(AF_INET, SOCK_STREAM, 0));
+    client->connect(d_local);
+    auto server = std::shared_ptr<Socket>(d_listener.accept());
+    worker.passConnection(server);
+    return client;
+  }
+
+  const WebServer& d_ws;
+
+private:
+  /* the handlers are registered with the global router, so the server has to outlive all the tests */
+  static WebServer& getWebServer()
+  {
+    static WebServer ws("127.0.0.1", 0);
+    static bool registered = false;
+    if (!registered) {
+      ws.registerWebHandler("/echo", [](HttpRequest* req, HttpResponse* resp) {
+          resp->status = 200;
+          resp->body = req->url.path + ":" + req->body;
+        });
+      ws.setLogLevel(WebServer::LogLevel::None);
+      registered = true;
+    }
+    return ws;
+  }
+
+  Socket d_listener;
+  ComboAddress d_local;
+};
+
+/* reads until 'count' complete responses have been received or the connection is closed,
+   and returns their bodies */
+static std::vector<std::string> readResponses(Socket& client, size_t count, bool& closed)
+{
+  std::vector<std::string> bodies;
+  std::string buffer;
+  closed = false;
+
+  while (bodies.size() < count) {
+    auto headersEnd = buffer.find("\r\n\r\n");
+    if (headersEnd != std::string::npos) {
+      const auto headers = toLower(buffer.substr(0, headersEnd));
+      const auto lengthPos = headers.find("content-length: ");
+      BOOST_REQUIRE(lengthPos != std::string::npos);
+      const size_t length = std::stoul(headers.substr(lengthPos + strlen("content-length: ")));
+      if (buffer.size() >= headersEnd + 4 + length) {
+        bodies.push_back(buffer.substr(headersEnd + 4, length));
+        buffer.erase(0, headersEnd + 4 + length);
+        continue;
+      }
+    }
+
+    struct pollfd pfd;
+    pfd.fd = client.getHandle();
+    pfd.events = POLLIN;
+    BOOST_REQUIRE_EQUAL(poll(&pfd, 1, 5000), 1);
+    char buf[4096];
+    ssize_t got = read(client.getHandle(), buf, sizeof(buf));
+    BOOST_REQUIRE(got >= 0);
+    if (got == 0) {
+      closed = true;
+      break;
+    }
+    buffer.append(buf, got);
+  }
+  BOOST_CHECK(buffer.empty());
+  return bodies;
+}
+
+static void sendData(Socket& client, const std::string& data)
+{
+  client.writenWithTimeout(data.data(), data.size(), 5);
+}
+
+/* whether the other side closed the connection within a second */
+static bool isClosed(Socket& client)
+{
+  struct pollfd pfd;
+  pfd.fd = client.getHandle();
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, 1000) != 1) {
+    return false;
+  }
+  char buf[1];
+  return read(client.getHandle(), buf, sizeof(buf)) == 0;
+}
+
+BOOST_AUTO_TEST_CASE(test_WebServerWorker_keepAlive) {
+  WebServerWorkerTest test;
+  WebServerWorker worker(test.d_ws, 1024 * 1024, 5, "");
+  auto client = test.connect(worker);
+  bool closed = false;
+
+  /* several requests, one after the other, on the same connection */
+  for (size_t idx = 0; idx < 3; idx++) {
+    sendData(*client, "GET /echo HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    auto bodies = readResponses(*client, 1, closed);
+    BOOST_REQUIRE_EQUAL(bodies.size(), 1U);
+    BOOST_CHECK_EQUAL(bodies.at(0), "/echo:");
+    BOOST_CHECK(!closed);
+  }
+
+  /* the connection is closed once the response to a request asking for it has been sent */
+  sendData(*client, "POST /echo HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\nContent-Length: 4\r\n\r\nlast");
+  auto bodies = readResponses(*client, 1, closed);
+  BOOST_REQUIRE_EQUAL(bodies.size(), 1U);
+  BOOST_CHECK_EQUAL(bodies.at(0), "/echo:last");
+  BOOST_CHECK(isClosed(*client));
+
+  /* HTTP/1.0 without keep-alive */
+  client = test.connect(worker);
+  sendData(*client, "GET /echo HTTP/1.0\r\n\r\n");
+  bodies = readResponses(*client, 1, closed);
+  BOOST_REQUIRE_EQUAL(bodies.size(), 1U);
+  BOOST_CHECK(isClosed(*client));
+}
+
+BOOST_AUTO_TEST_CASE(test_WebServerWorker_pipelined) {
+  WebServerWorkerTest test;
+  WebServerWorker worker(test.d_ws, 1024 * 1024, 5, "");
+  auto client = test.connect(worker);
+  bool closed = false;
+
+  /* the responses are sent in the order of the requests */
+  sendData(*client, "POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nfirstGET /echo HTTP/1.1\r\nHost: localhost\r\n\r\nPOST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nthird");
+  auto bodies = readResponses(*client, 3, closed);
+  BOOST_REQUIRE_EQUAL(bodies.size(), 3U);
+  BOOST_CHECK_EQUAL(bodies.at(0), "/echo:first");
+  BOOST_CHECK_EQUAL(bodies.at(1), "/echo:");
+  BOOST_CHECK_EQUAL(bodies.at(2), "/echo:third");
+  BOOST_CHECK(!closed);
+
+  /* an unknown route does not close the connection */
+  sendData(*client, "GET /unknown HTTP/1.1\r\nHost: localhost\r\n\r\nGET /echo HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  bodies = readResponses(*client, 2, closed);
+  BOOST_REQUIRE_EQUAL(bodies.size(), 2U);
+  BOOST_CHECK_EQUAL(bodies.at(1), "/echo:");
+  BOOST_CHECK(!closed);
+}
+
+BOOST_AUTO_TEST_CASE(test_WebServerWorker_split) {
+  WebServerWorkerTest test;
+  WebServerWorker worker(test.d_ws, 1024 * 1024, 5, "");
+  auto client = test.connect(worker);
+  bool closed = false;
+
+  /* a request received in several reads */
+  const std::string request("POST /echo HTTP/1.1\r\nHost: localhost\r\nContent-Length: 10\r\n\r\n0123456789");
+  for (size_t pos = 0; pos < request.size(); pos += 8) {
+    sendData(*client, request.substr(pos, 8));
+    usleep(1000);
+  }
+  auto bodies = readResponses(*client, 1, closed);
+  BOOST_REQUIRE_EQUAL(bodies.size(), 1U);
+  BOOST_CHECK_EQUAL(bodies.at(0), "/echo:0123456789");
+  BOOST_CHECK(!closed);
+
+  /* an invalid request gets an answer, then the connection is closed */
+  sendData(*client, "NOT HTTP\r\n\r\n");
+  bodies = readResponses(*client, 1, closed);
+  BOOST_CHECK_EQUAL(bodies.size(), 1U);
+  BOOST_CHECK(isClosed(*client));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
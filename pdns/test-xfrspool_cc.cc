@@ -0,0 +1,119 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+#include "ixfr.hh"
+#include "test-common.hh"
+#include "xfrspool.hh"
+
+static DNSResourceRecord makeRecord(const DNSName& qname, uint16_t qtype, uint32_t ttl, const std::string& content)
+{
+  DNSResourceRecord rr;
+  rr.qname = qname;
+  rr.qtype = qtype;
+  rr.ttl = ttl;
+  rr.content = content;
+  return rr;
+}
+
+static void checkSameRecords(XFRSpool& spool, const std::vector<DNSResourceRecord>& expected)
+{
+  BOOST_CHECK_EQUAL(spool.size(), expected.size());
+  spool.rewind();
+  DNSResourceRecord rr;
+  for (const auto& exp : expected) {
+    BOOST_REQUIRE(spool.pop(rr));
+    BOOST_CHECK_EQUAL(rr.qname, exp.qname);
+    BOOST_CHECK_EQUAL(rr.qtype.getCode(), exp.qtype.getCode());
+    BOOST_CHECK_EQUAL(rr.qclass, exp.qclass);
+    BOOST_CHECK_EQUAL(rr.ttl, exp.ttl);
+    BOOST_CHECK_EQUAL(rr.content, exp.content);
+  }
+  BOOST_CHECK(!spool.pop(rr));
+}
+
+BOOST_AUTO_TEST_SUITE(test_xfrspool_cc)
+
+BOOST_AUTO_TEST_CASE(test_xfrspool_roundtrip) {
+  std::vector<DNSResourceRecord> records;
+  records.push_back(makeRecord(DNSName("example.com."), QType::SOA, 3600, "ns1.example.com. hostmaster.example.com. 1 3600 600 604800 3600"));
+  records.push_back(makeRecord(DNSName("example.com."), QType::NS, 3600, "ns1.example.com."));
+  records.push_back(makeRecord(DNSName("."), QType::NS, 0, "a.root-servers.net."));
+  /* empty content, as an empty non-terminal */
+  records.push_back(makeRecord(DNSName("ent.example.com."), 0, 0, ""));
+  records.push_back(makeRecord(DNSName("txt.example.com."), QType::TXT, 60, "\"" + std::string(65000, 'a') + "\""));
+  /* enough records to need several writes to the file */
+  for (size_t idx = 0; idx < 50000; idx++) {
+    records.push_back(makeRecord(DNSName("host" + std::to_string(idx) + ".example.com."), QType::A, idx, "192.0.2." + std::to_string(idx % 256)));
+  }
+
+  for (const bool useFile : { true, false }) {
+    XFRSpool spool(useFile);
+    BOOST_CHECK_EQUAL(spool.isInMemory(), !useFile);
+    BOOST_CHECK(spool.empty());
+    for (const auto& rr : records) {
+      spool.push(rr);
+    }
+    BOOST_CHECK(!spool.empty());
+    checkSameRecords(spool, records);
+    /* and it can be read again */
+    checkSameRecords(spool, records);
+  }
+
+  XFRSpool empty;
+  empty.rewind();
+  DNSResourceRecord rr;
+  BOOST_CHECK(!empty.pop(rr));
+}
+
+BOOST_AUTO_TEST_CASE(test_xfrspool_ixfr_fallback) {
+  /* an IXFR answered with the full zone, as CommunicatorClass::suck() spools it */
+  const ComboAddress master("[2001:DB8::1]:53");
+  const DNSName zone("JAIN.AD.JP.");
+
+  auto masterSOA = DNSRecordContent::mastermake(QType::SOA, QClass::IN, "NS.JAIN.AD.JP. mohta.jain.ad.jp. 3 600 600 3600000 604800");
+  vector<DNSRecord> records;
+  addRecordToList(records, DNSName("JAIN.AD.JP."), QType::SOA, "ns.jain.ad.jp. mohta.jain.ad.jp. 3 600 600 3600000 604800");
+  addRecordToList(records, DNSName("JAIN.AD.JP."), QType::NS, "NS.JAIN.AD.JP.");
+  addRecordToList(records, DNSName("NS.JAIN.AD.JP."), QType::A, "133.69.136.1");
+  addRecordToList(records, DNSName("JAIN-BB.JAIN.AD.JP."), QType::A, "133.69.136.3");
+  addRecordToList(records, DNSName("JAIN-BB.JAIN.AD.JP."), QType::A, "192.41.197.2");
+  addRecordToList(records, DNSName("JAIN.AD.JP."), QType::SOA, "ns.jain.ad.jp. mohta.jain.ad.jp. 3 600 600 3600000 604800");
+
+  auto deltas = processIXFRRecords(master, zone, records, std::dynamic_pointer_cast<SOARecordContent>(masterSOA));
+  BOOST_REQUIRE_EQUAL(deltas.size(), 1U);
+  BOOST_REQUIRE(deltas.at(0).first.empty());
+  auto axfr = std::move(deltas.at(0).second);
+  /* getIXFRDeltas() returns names relative to the zone */
+  for (auto& dr : axfr) {
+    dr.d_name.makeUsRelative(zone);
+  }
+
+  ZoneStatus zs;
+  zs.domain_id = 42;
+  XFRSpool spool;
+  spoolAXFRFromIXFR(zone, axfr, zs, spool);
+  BOOST_CHECK(axfr.empty());
+  BOOST_CHECK_EQUAL(zs.soa_serial, 3U);
+  BOOST_CHECK_EQUAL(zs.qnames.size(), 3U);
+  BOOST_CHECK(zs.nsset.empty());
+  BOOST_CHECK(!zs.isDnssecZone);
+
+  BOOST_REQUIRE_EQUAL(spool.size(), records.size());
+  spool.rewind();
+  DNSResourceRecord rr;
+  for (const auto& record : records) {
+    BOOST_REQUIRE(spool.pop(rr));
+    BOOST_CHECK_EQUAL(rr.qname, record.d_name.makeLowerCase());
+    BOOST_CHECK_EQUAL(rr.qtype.getCode(), record.d_type);
+    BOOST_CHECK_EQUAL(rr.content, record.d_content->getZoneRepresentation(true));
+  }
+  BOOST_CHECK(!spool.pop(rr));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -14,6 +14,28 @@
 #include "dnsname.hh"
 #include <fstream>
 #include <cstdlib>
+#include <unistd.h>
+
+/* writes this content to a new temporary file, returning its name */
+static std::string writeZoneFile(const std::string& content)
+{
+  char path[] = "/tmp/test-zoneparser-tng.XXXXXX";
+  int fd = mkstemp(path);
+  BOOST_REQUIRE(fd >= 0);
+  BOOST_REQUIRE_EQUAL(write(fd, content.data(), content.size()), static_cast<ssize_t>(content.size()));
+  close(fd);
+  return path;
+}
+
+static std::vector<std::string> getRecords(ZoneParserTNG& zp)
+{
+  std::vector<std::string> records;
+  DNSResourceRecord rr;
+  while(zp.get(rr)) {
+    records.push_back(rr.qname.toString() + " " + std::to_string(rr.ttl) + " " + rr.qtype.getName() + " " + rr.content);
+  }
+  return records;
+}
 
 BOOST_AUTO_TEST_SUITE(test_zoneparser_tng_cc)
 
@@ -95,4 +117,84 @@ BOOST_AUTO_TEST_CASE(test_tng_record_generate) {
 
 }
 
+BOOST_AUTO_TEST_CASE(test_tng_file_reading) {
+  reportAllTypes();
+
+  /* enough lines to need several reads, and a record larger than a read */
+  std::vector<std::string> lines = { "$ORIGIN example.com.", "$TTL 3600", "@ IN SOA ns1 hostmaster 1 3600 600 604800 3600" };
+  for(size_t idx = 0; idx < 10000; idx++) {
+    lines.push_back("host" + std::to_string(idx) + " IN A 192.0.2." + std::to_string(idx % 256));
+  }
+  std::string big = "big 60 IN TXT";
+  while(big.size() < 3 * 65536) {
+    big += " \"" + std::string(250, 'a') + "\"";
+  }
+  lines.push_back(big);
+  lines.push_back("last IN AAAA 2001:db8::1");
+
+  std::string content;
+  for(const auto& line : lines) {
+    content += line + "\n";
+  }
+
+  ZoneParserTNG fromData(lines, DNSName("example.com."));
+  const auto expected = getRecords(fromData);
+  BOOST_REQUIRE_EQUAL(expected.size(), lines.size() - 2);
+
+  auto path = writeZoneFile(content);
+  {
+    ZoneParserTNG zp(path, DNSName("example.com."));
+    BOOST_CHECK(getRecords(zp) == expected);
+  }
+  unlink(path.c_str());
+
+  /* the last line does not have to end with a newline */
+  content.pop_back();
+  path = writeZoneFile(content);
+  {
+    ZoneParserTNG zp(path, DNSName("example.com."));
+    BOOST_CHECK(getRecords(zp) == expected);
+  }
+  unlink(path.c_str());
+
+  /* nor does a single line, and an empty file has no record */
+  for(const auto& single : { std::string("@ 60 IN A 192.0.2.1"), std::string("@ 60 IN A 192.0.2.1\n"), std::string() }) {
+    path = writeZoneFile(single);
+    ZoneParserTNG zp(path, DNSName("example.com."));
+    const auto records = getRecords(zp);
+    if(single.empty()) {
+      BOOST_CHECK(records.empty());
+    }
+    else {
+      BOOST_REQUIRE_EQUAL(records.size(), 1U);
+      BOOST_CHECK_EQUAL(records.at(0), "example.com. 60 A 192.0.2.1");
+    }
+    unlink(path.c_str());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_tng_file_truncated) {
+  reportAllTypes();
+
+  std::string content = "$ORIGIN example.com.\n";
+  const size_t count = 50000;
+  for(size_t idx = 0; idx < count; idx++) {
+    content += "host" + std::to_string(idx) + " 60 IN A 192.0.2." + std::to_string(idx % 256) + "\n";
+  }
+  const auto path = writeZoneFile(content);
+
+  /* the file shrinking while we are reading it should not be fatal */
+  ZoneParserTNG zp(path, DNSName("example.com."));
+  DNSResourceRecord rr;
+  BOOST_REQUIRE(zp.get(rr));
+  BOOST_CHECK_EQUAL(rr.qname.toString(), "host0.example.com.");
+  BOOST_REQUIRE_EQUAL(truncate(path.c_str(), content.find('\n', content.size() / 2) + 1), 0);
+  size_t records = 1;
+  while(zp.get(rr)) {
+    records++;
+  }
+  BOOST_CHECK_LT(records, count);
+  unlink(path.c_str());
+}
+
 BOOST_AUTO_TEST_SUITE_END();
@@ -7,10 +7,14 @@
 #include "arguments.hh"
 #include "auth-packetcache.hh"
 #include "auth-querycache.hh"
+#include "auth-zonecache.hh"
+#include "auth-nsec3cache.hh"
 #include "statbag.hh"
 StatBag S;
 AuthPacketCache PC;
 AuthQueryCache QC;
+AuthZoneCache g_zoneCache;
+AuthNSEC3Cache g_nsec3Cache;
 
 ArgvMap &arg()
 {
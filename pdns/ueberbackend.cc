@@ -26,6 +26,7 @@
 #include <boost/archive/binary_oarchive.hpp>
 
 #include "auth-querycache.hh"
+#include "auth-zonecache.hh"
 #include "utility.hh"
 
 
@@ -112,6 +113,7 @@ bool UeberBackend::createDomain(const DNSName &domain)
 {
   for(DNSBackend* mydb :  backends) {
     if(mydb->createDomain(domain)) {
+      addToZoneCache(domain);
       return true;
     }
   }
@@ -303,6 +305,10 @@ bool UeberBackend::getAuth(const DNSName &target, const QType& qtype, SOAData* s
   // backend again for b.c.example.com., c.example.com. and example.com.
   // If a backend has no match it may respond with an empty qname.
 
+  if(g_zoneCache.isEnabled()) {
+    return getAuthFromZoneCache(target, qtype, sd, cachedOk);
+  }
+
   bool found = false;
   int cstat;
   DNSName shorter(target);
@@ -401,6 +407,120 @@ found:
   return found;
 }
 
+// the zone cache knows the closest enclosing zone, so we only have to retrieve its SOA
+bool UeberBackend::getAuthFromZoneCache(const DNSName &target, const QType& qtype, SOAData* sd, bool cachedOk)
+{
+  bool found = false;
+  DNSName shorter(target);
+  AuthZoneCache::ZoneInfo zone;
+  SOAData zoneSD;
+
+  while(g_zoneCache.getBestMatch(shorter, zone)) {
+    if(getZoneSOA(zone.zone, zone.backendIndex, zoneSD, cachedOk)) {
+      *sd = zoneSD;
+      if(found == (qtype == QType::DS) || target != zone.zone) {
+        DLOG(g_log<<Logger::Error<<"found in zone cache: "<<sd->qname<<endl);
+        return true;
+      }
+      // DS at the apex, we want the parent zone if we have it
+      DLOG(g_log<<Logger::Error<<"chasing next from zone cache: "<<sd->qname<<endl);
+      found = true;
+    }
+    else {
+      DLOG(g_log<<Logger::Error<<"no SOA for zone cache entry: "<<zone.zone<<endl);
+    }
+
+    shorter = zone.zone;
+    if(!shorter.chopOff()) {
+      break;
+    }
+  }
+
+  return found;
+}
+
+bool UeberBackend::getZoneSOA(const DNSName &zone, size_t backendIndex, SOAData &sd, bool cachedOk)
+{
+  d_question.qtype = QType::SOA;
+  d_question.qname = zone;
+  d_question.zoneId = -1;
+
+  if(cachedOk && (d_cache_ttl || d_negcache_ttl)) {
+    int cstat = cacheHas(d_question,d_answers);
+    if(cstat == 1 && !d_answers.empty() && d_cache_ttl) {
+      fillSOAData(d_answers[0], sd);
+      sd.db = 0;
+      sd.qname = zone;
+      return true;
+    }
+    else if(cstat == 0 && d_negcache_ttl) {
+      return false;
+    }
+  }
+
+  if(backendIndex >= backends.size() || !backends[backendIndex]->getSOA(zone, sd)) {
+    if(d_negcache_ttl) {
+      addNegCache(d_question);
+    }
+    return false;
+  }
+
+  if(sd.qname != zone) {
+    throw PDNSException("getSOA() returned an SOA for the wrong zone. Question: '"+zone.toLogString()+"', answer: '"+sd.qname.toLogString()+"'");
+  }
+
+  if(d_cache_ttl) {
+    DNSZoneRecord rr;
+    rr.dr.d_name = sd.qname;
+    rr.dr.d_type = QType::SOA;
+    rr.dr.d_content = makeSOAContent(sd);
+    rr.dr.d_ttl = sd.ttl;
+    rr.domain_id = sd.domain_id;
+
+    addCache(d_question, {rr});
+  }
+  return true;
+}
+
+void UeberBackend::updateZoneCache()
+{
+  AuthZoneCache::zones_t zones;
+
+  g_zoneCache.setReplacePending();
+  for(size_t idx = 0; idx < backends.size(); idx++) {
+    vector<DomainInfo> domains;
+    backends[idx]->getAllDomains(&domains, false);
+    zones.reserve(zones.size() + domains.size());
+    for(const auto& di : domains) {
+      AuthZoneCache::ZoneInfo zone;
+      zone.zone = di.zone;
+      zone.zoneId = di.id;
+      zone.backendIndex = idx;
+      zones.push_back(std::move(zone));
+    }
+  }
+  g_zoneCache.replace(zones);
+}
+
+void UeberBackend::addToZoneCache(const DNSName &zone)
+{
+  if(!g_zoneCache.isEnabled()) {
+    return;
+  }
+
+  for(size_t idx = 0; idx < backends.size(); idx++) {
+    DomainInfo di;
+    if(backends[idx]->getDomainInfo(zone, di, false)) {
+      AuthZoneCache::ZoneInfo zi;
+      zi.zone = zone;
+      zi.zoneId = di.id;
+      zi.backendIndex = idx;
+      g_zoneCache.add(zi);
+      return;
+    }
+  }
+}
+
 bool UeberBackend::getSOA(const DNSName &domain, SOAData &sd)
 {
   d_question.qtype=QType::SOA;
@@ -594,6 +714,25 @@ void UeberBackend::lookup(const QType &qtype,const DNSName &qname, int zoneId, D
     d_question.qtype=qtype;
     d_question.qname=qname;
     d_question.zoneId=zoneId;
+
+    if(zoneId >= 0 && zoneId == d_prefetchedZoneId) {
+      const auto& it = d_prefetched.find(qname);
+      if(it != d_prefetched.end()) {
+        d_answers.clear();
+        for(const auto& zr : it->second) {
+          if(qtype.getCode() == QType::ANY || zr.dr.d_type == qtype.getCode()) {
+            d_answers.push_back(zr);
+            d_answers.back().dr.d_name = qname;
+          }
+        }
+        d_negcached=false;
+        d_cached=true;
+        d_cachehandleiter = d_answers.begin();
+        d_handle.parent=this;
+        return;
+      }
+    }
+
     int cstat=cacheHas(d_question, d_answers);
     if(cstat<0) { // nothing
       //      cout<<"UeberBackend::lookup("<<qname<<"|"<<DNSRecordContent::NumberToType(qtype.getCode())<<"): uncached"<<endl;
@@ -618,6 +757,53 @@ void UeberBackend::lookup(const QType &qtype,const DNSName &qname, int zoneId, D
   d_handle.parent=this;
 }
 
+void UeberBackend::prefetchNames(const std::vector<DNSName>& names, int zoneId)
+{
+  clearPrefetched();
+  if(backends.size() != 1 || zoneId < 0 || names.empty()) {
+    return;
+  }
+
+  vector<DNSResourceRecord> records;
+  try {
+    if(!backends[0]->lookupNames(names, zoneId, records)) {
+      return;
+    }
+
+    /* every name we asked for is known now, even the ones without any record */
+    for(const auto& name : names) {
+      d_prefetched[name];
+    }
+    DNSZoneRecord zr;
+    for(auto& rr : records) {
+      DNSBackend::toZoneRecord(rr, zr);
+      zr.dr.d_place=DNSResourceRecord::ANSWER;
+      const auto& it = d_prefetched.find(zr.dr.d_name);
+      if(it != d_prefetched.end()) {
+        it->second.push_back(zr);
+      }
+    }
+  }
+  catch(const PDNSException& e) {
+    g_log<<Logger::Warning<<"Unable to prefetch "<<names.size()<<" names in zone with id "<<zoneId<<", falling back to regular lookups: "<<e.reason<<endl;
+    clearPrefetched();
+    return;
+  }
+  catch(const std::exception& e) {
+    g_log<<Logger::Warning<<"Unable to prefetch "<<names.size()<<" names in zone with id "<<zoneId<<", falling back to regular lookups: "<<e.what()<<endl;
+    clearPrefetched();
+    return;
+  }
+
+  d_prefetchedZoneId=zoneId;
+}
+
+void UeberBackend::clearPrefetched()
+{
+  d_prefetched.clear();
+  d_prefetchedZoneId=-1;
+}
+
 void UeberBackend::getAllDomains(vector<DomainInfo> *domains, bool include_disabled) {
   for (vector<DNSBackend*>::iterator i = backends.begin(); i != backends.end(); ++i )
   {
@@ -656,7 +842,10 @@ bool UeberBackend::get(DNSZoneRecord &rr)
   rr.dr.d_place=DNSResourceRecord::ANSWER;
 
   d_ancount++;
-  d_answers.push_back(rr);
+  if(d_cache_ttl) {
+    // the content is shared with the record we return, only the name and metadata are copied
+    d_answers.push_back(rr);
+  }
   return true;
 }
 
@@ -22,6 +22,7 @@
 #pragma once
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <string>
 #include <algorithm>
 #include <pthread.h>
@@ -97,8 +98,18 @@ public:
 
   void lookup(const QType &, const DNSName &qdomain, int zoneId, DNSPacket *pkt_p=nullptr);
 
+  /** Retrieves all the records of these names in one go, if the backend supports it, so that
+      subsequent lookups for them in the same zone are answered without a round trip.
+      Only done when there is a single backend, since the answer would otherwise depend on the order. */
+  void prefetchNames(const std::vector<DNSName>& names, int zoneId);
+  void clearPrefetched();
+
   /** Determines if we are authoritative for a zone, and at what level */
   bool getAuth(const DNSName &target, const QType &qtype, SOAData* sd, bool cachedOk=true);
+  /** Loads the list of all zones from the backends into the zone cache */
+  void updateZoneCache();
+  /** Adds a zone that has just been created to the zone cache, if it is enabled */
+  void addToZoneCache(const DNSName &zone);
   bool getSOA(const DNSName &domain, SOAData &sd);
   /** Load SOA info from backends, ignoring the cache.*/
   bool getSOAUncached(const DNSName &domain, SOAData &sd);
@@ -138,6 +149,8 @@ private:
   handle d_handle;
   vector<DNSZoneRecord> d_answers;
   vector<DNSZoneRecord>::const_iterator d_cachehandleiter;
+  std::unordered_map<DNSName, vector<DNSZoneRecord>> d_prefetched;
+  int d_prefetchedZoneId{-1};
 
   static pthread_mutex_t d_mut;
   static pthread_cond_t d_cond;
@@ -158,6 +171,9 @@ private:
   static bool d_go;
   bool d_stale;
 
+  bool getAuthFromZoneCache(const DNSName &target, const QType &qtype, SOAData* sd, bool cachedOk);
+  bool getZoneSOA(const DNSName &zone, size_t backendIndex, SOAData &sd, bool cachedOk);
+
   int cacheHas(const Question &q, vector<DNSZoneRecord> &rrs);
   void addNegCache(const Question &q);
   void addCache(const Question &q, vector<DNSZoneRecord>&& rrs);
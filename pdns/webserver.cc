@@ -34,6 +34,7 @@
 #include "base64.hh"
 #include "json.hh"
 #include "uuid-utils.hh"
+#include "mplexer.hh"
 #include <yahttp/router.hpp>
 
 json11::Json HttpRequest::json()
@@ -82,6 +83,109 @@ bool HttpRequest::compareHeader(const string &header_name, const string &expecte
 }
 
 
+bool HttpRequest::wantsKeepAlive() const
+{
+  const auto header = headers.find("connection");
+  if (header != headers.end()) {
+    if (pdns_iequals(header->second, "close")) {
+      return false;
+    }
+    if (pdns_iequals(header->second, "keep-alive")) {
+      return true;
+    }
+  }
+  // persistent connections are the default since HTTP/1.1
+  return version >= 11;
+}
+
+bool HttpRequestReader::getRequest(HttpRequest& req)
+{
+  if (!d_started) {
+    d_yarl.initialize(&req);
+    req.max_request_size = d_maxSize;
+    d_started = true;
+    d_headersDone = false;
+    d_chunked = false;
+    d_bodyLeft = 0;
+  }
+
+  bool complete = false;
+  if (!d_headersDone) {
+    // only hand the headers to the parser, it would swallow whatever follows a body otherwise
+    auto end = d_buffer.find("\n\n");
+    auto crlfEnd = d_buffer.find("\n\r\n");
+    if (end == string::npos || (crlfEnd != string::npos && crlfEnd < end)) {
+      end = crlfEnd == string::npos ? crlfEnd : crlfEnd + 1;
+    }
+    if (end == string::npos) {
+      if (d_maxSize > 0 && d_buffer.size() > static_cast<size_t>(d_maxSize)) {
+        throw YaHTTP::ParseError("Max request headers size exceeded");
+      }
+      return false;
+    }
+    end += 2;
+    complete = d_yarl.feed(d_buffer.substr(0, end));
+    d_buffer.erase(0, end);
+    d_headersDone = true;
+    d_chunked = d_yarl.chunked;
+    d_bodyLeft = d_yarl.minbody;
+  }
+
+  if (!complete) {
+    if (d_chunked) {
+      // we can't tell where the body ends, so the connection will not be reused
+      complete = d_yarl.feed(d_buffer);
+      d_buffer.clear();
+    }
+    else {
+      size_t len = std::min(d_bodyLeft, d_buffer.size());
+      complete = d_yarl.feed(d_buffer.substr(0, len));
+      d_buffer.erase(0, len);
+      d_bodyLeft -= len;
+    }
+  }
+
+  if (!complete) {
+    return false;
+  }
+
+  d_yarl.finalize();
+  req.complete = true;
+  d_started = false;
+  d_headersDone = false;
+  return true;
+}
+
+const std::array<uint64_t, WebServerLatencyHistogram::s_boundsCount> WebServerLatencyHistogram::s_bounds = { 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000 };
+
+void WebServerLatencyHistogram::account(uint64_t usec)
+{
+  size_t idx = 0;
+  while (idx < s_bounds.size() && usec > s_bounds.at(idx)) {
+    idx++;
+  }
+  d_buckets.at(idx)++;
+  d_sum += usec;
+}
+
+void WebServerLatencyHistogram::toPrometheus(std::ostringstream& out, const std::string& name, const std::string& labels) const
+{
+  uint64_t count = 0;
+  for (size_t idx = 0; idx < d_buckets.size(); idx++) {
+    count += d_buckets.at(idx);
+    out << name << "_bucket{" << labels << ",le=\"";
+    if (idx < s_bounds.size()) {
+      out << s_bounds.at(idx) / 1000000.0;
+    }
+    else {
+      out << "+Inf";
+    }
+    out << "\"} " << count << "\n";
+  }
+  out << name << "_sum{" << labels << "} " << d_sum / 1000000.0 << "\n";
+  out << name << "_count{" << labels << "} " << count << "\n";
+}
+
 void HttpResponse::setBody(const json11::Json& document)
 {
   document.dump(this->body);
@@ -108,7 +212,8 @@ static void bareHandlerWrapper(WebServer::HandlerFunction handler, YaHTTP::Reque
 void WebServer::registerBareHandler(const string& url, HandlerFunction handler)
 {
   YaHTTP::THandlerFunction f = boost::bind(&bareHandlerWrapper, handler, _1, _2);
-  YaHTTP::Router::Any(url, f);
+  YaHTTP::Router::Any(url, f, url);
+  d_latencies[url] = std::unique_ptr<WebServerLatencyHistogram>(new WebServerLatencyHistogram());
 }
 
 static bool optionsHandler(HttpRequest* req, HttpResponse* resp) {
@@ -200,25 +305,11 @@ void WebServer::registerWebHandler(const string& url, HandlerFunction handler) {
   registerBareHandler(url, f);
 }
 
-static void *WebServerConnectionThreadStart(const WebServer* webServer, std::shared_ptr<Socket> client) {
-  setThreadName("pdns-r/webhndlr");
-  try {
-    webServer->serveConnection(client);
-  }
-  catch(PDNSException &e) {
-    g_log<<Logger::Error<<"PDNSException while serving a connection in main webserver thread: "<<e.reason<<endl;
-  }
-  catch(std::exception &e) {
-    g_log<<Logger::Error<<"STL Exception while serving a connection in main webserver thread: "<<e.what()<<endl;
-  }
-  catch(...) {
-    g_log<<Logger::Error<<"Unknown exception while serving a connection in main webserver thread"<<endl;
-  }
-  return nullptr;
-}
-
 void WebServer::handleRequest(HttpRequest& req, HttpResponse& resp) const
 {
+  DTime dt;
+  dt.set();
+
   // set default headers
   resp.headers["Content-Type"] = "text/html; charset=utf-8";
 
@@ -295,6 +386,21 @@ void WebServer::handleRequest(HttpRequest& req, HttpResponse& resp) const
   } else {
     resp.headers["Content-Length"] = std::to_string(resp.body.size());
   }
+
+  const auto histogram = d_latencies.find(req.routeName);
+  if (histogram != d_latencies.end()) {
+    histogram->second->account(dt.udiff());
+  }
+}
+
+void WebServer::getLatencyMetrics(std::ostringstream& out, const std::string& prefix) const
+{
+  const std::string name = prefix + "webserver_request_duration_seconds";
+  out << "# HELP " << name << " Time spent handling HTTP requests, per endpoint" << "\n";
+  out << "# TYPE " << name << " histogram" << "\n";
+  for (const auto& entry : d_latencies) {
+    entry.second->toPrometheus(out, name, "endpoint=\"" + entry.first + "\"");
+  }
 }
 
 void WebServer::logRequest(const HttpRequest& req, const ComboAddress& remote) const {
@@ -358,70 +464,256 @@ void WebServer::logResponse(const HttpResponse& resp, const ComboAddress& remote
   }
 }
 
-void WebServer::serveConnection(std::shared_ptr<Socket> client) const {
-  const string logprefix = d_logprefix + to_string(getUniqueID()) + " ";
-
-  HttpRequest req(logprefix);
+string WebServer::serveRequest(HttpRequest& req, const ComboAddress& remote, bool& keepAlive) const
+{
   HttpResponse resp;
   resp.max_response_size=d_maxbodysize;
-  ComboAddress remote;
   string reply;
 
   try {
-    YaHTTP::AsyncRequestLoader yarl;
-    yarl.initialize(&req);
-    req.max_request_size=d_maxbodysize;
-    int timeout = 5;
-    client->setNonBlocking();
-
-    try {
-      while(!req.complete) {
-        int bytes;
-        char buf[16000];
-        bytes = client->readWithTimeout(buf, sizeof(buf), timeout);
-        if (bytes > 0) {
-          string data = string(buf, bytes);
-          req.complete = yarl.feed(data);
-        } else {
-          // read error OR EOF
-          break;
-        }
-      }
-      yarl.finalize();
-    } catch (YaHTTP::ParseError &e) {
-      // request stays incomplete
-      g_log<<Logger::Warning<<logprefix<<"Unable to parse request: "<<e.what()<<endl;
-    }
-
-    if (d_loglevel >= WebServer::LogLevel::None) {
-      client->getRemote(remote);
-    }
-
     logRequest(req, remote);
 
     WebServer::handleRequest(req, resp);
+    keepAlive = keepAlive && req.complete && req.wantsKeepAlive();
+    if (keepAlive) {
+      resp.headers["Connection"] = "keep-alive";
+    }
+
     ostringstream ss;
     resp.write(ss);
     reply = ss.str();
 
-    logResponse(resp, remote, logprefix);
-
-    client->writenWithTimeout(reply.c_str(), reply.size(), timeout);
+    logResponse(resp, remote, req.logprefix);
   }
   catch(PDNSException &e) {
-    g_log<<Logger::Error<<logprefix<<"HTTP Exception: "<<e.reason<<endl;
+    g_log<<Logger::Error<<req.logprefix<<"HTTP Exception: "<<e.reason<<endl;
+    keepAlive = false;
   }
   catch(std::exception &e) {
-    if(strstr(e.what(), "timeout")==0)
-      g_log<<Logger::Error<<logprefix<<"HTTP STL Exception: "<<e.what()<<endl;
+    g_log<<Logger::Error<<req.logprefix<<"HTTP STL Exception: "<<e.what()<<endl;
+    keepAlive = false;
   }
   catch(...) {
-    g_log<<Logger::Error<<logprefix<<"Unknown exception"<<endl;
+    g_log<<Logger::Error<<req.logprefix<<"Unknown exception"<<endl;
+    keepAlive = false;
   }
 
   if (d_loglevel >= WebServer::LogLevel::Normal) {
-    g_log<<Logger::Notice<<logprefix<<remote<<" \""<<req.method<<" "<<req.url.path<<" HTTP/"<<req.versionStr(req.version)<<"\" "<<resp.status<<" "<<reply.size()<<endl;
+    g_log<<Logger::Notice<<req.logprefix<<remote<<" \""<<req.method<<" "<<req.url.path<<" HTTP/"<<req.versionStr(req.version)<<"\" "<<resp.status<<" "<<reply.size()<<endl;
+  }
+
+  return reply;
+}
+
+WebServerWorker::WebServerWorker(const WebServer& ws, ssize_t maxBodySize, unsigned int idleTimeout, const string& logprefix): d_ws(ws), d_mplexer(FDMultiplexer::getMultiplexerSilent()), d_logprefix(logprefix), d_maxBodySize(maxBodySize), d_idleTimeout(idleTimeout)
+{
+  if (pipe(d_pipe) < 0) {
+    throw std::runtime_error("Error creating the webserver worker pipe: " + stringerror());
+  }
+  if (!setNonBlocking(d_pipe[0])) {
+    int err = errno;
+    close(d_pipe[0]);
+    close(d_pipe[1]);
+    throw std::runtime_error("Error setting the webserver worker pipe non-blocking: " + stringerror(err));
+  }
+  d_mplexer->addReadFD(d_pipe[0], boost::bind(&WebServerWorker::handleNewConnections, this, _1, _2));
+  d_thread = std::thread(&WebServerWorker::run, this);
+}
+
+WebServerWorker::~WebServerWorker()
+{
+  d_stop = true;
+  // wake the worker up, a null pointer is not a connection
+  std::shared_ptr<Socket>* ptr = nullptr;
+  if (write(d_pipe[1], &ptr, sizeof(ptr)) != sizeof(ptr)) {
+    g_log<<Logger::Error<<d_logprefix<<"Error waking up a webserver worker thread: "<<stringerror()<<endl;
+  }
+  d_thread.join();
+  d_connections.clear();
+  close(d_pipe[0]);
+  close(d_pipe[1]);
+}
+
+void WebServerWorker::passConnection(std::shared_ptr<Socket>& client)
+{
+  auto ptr = new std::shared_ptr<Socket>(client);
+  if (write(d_pipe[1], &ptr, sizeof(ptr)) != sizeof(ptr)) {
+    delete ptr;
+    g_log<<Logger::Error<<d_logprefix<<"Error passing a connection to a worker thread: "<<stringerror()<<endl;
+  }
+}
+
+void WebServerWorker::run()
+{
+  setThreadName("pdns/webworker");
+  struct timeval now;
+  time_t lastExpiration = 0;
+
+  while (!d_stop) {
+    try {
+      d_mplexer->run(&now, 1000);
+      if (now.tv_sec != lastExpiration) {
+        expireConnections(now.tv_sec);
+        lastExpiration = now.tv_sec;
+      }
+    }
+    catch(const PDNSException& e) {
+      g_log<<Logger::Error<<d_logprefix<<"PDNSException in a webserver worker thread: "<<e.reason<<endl;
+    }
+    catch(const std::exception& e) {
+      g_log<<Logger::Error<<d_logprefix<<"STL Exception in a webserver worker thread: "<<e.what()<<endl;
+    }
+    catch(...) {
+      g_log<<Logger::Error<<d_logprefix<<"Unknown exception in a webserver worker thread"<<endl;
+    }
+  }
+}
+
+void WebServerWorker::handleNewConnections(int fd, FDMultiplexer::funcparam_t&)
+{
+  std::shared_ptr<Socket>* ptr = nullptr;
+  while (read(fd, &ptr, sizeof(ptr)) == sizeof(ptr)) {
+    if (ptr == nullptr) {
+      continue;
+    }
+    std::shared_ptr<Socket> client(std::move(*ptr));
+    delete ptr;
+
+    auto conn = std::make_shared<Connection>(client, d_maxBodySize);
+    client->setNonBlocking();
+    client->getRemote(conn->remote);
+    conn->ttd = time(nullptr) + d_idleTimeout;
+    d_connections[client->getHandle()] = conn;
+    d_mplexer->addReadFD(client->getHandle(), boost::bind(&WebServerWorker::handleReadable, this, _1, _2));
+  }
+}
+
+void WebServerWorker::handleReadable(int fd, FDMultiplexer::funcparam_t&)
+{
+  auto it = d_connections.find(fd);
+  if (it == d_connections.end()) {
+    return;
+  }
+  auto conn = it->second;
+
+  char buf[16000];
+  ssize_t got = read(fd, buf, sizeof(buf));
+  if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return;
+  }
+  if (got <= 0) {
+    // EOF or read error, nothing can be sent back
+    closeConnection(fd, *conn);
+    return;
+  }
+
+  conn->reader.feed(buf, got);
+  conn->ttd = time(nullptr) + d_idleTimeout;
+  handleRequests(fd, *conn);
+}
+
+void WebServerWorker::handleRequests(int fd, Connection& conn)
+{
+  while (!conn.closeAfterWrite) {
+    if (!conn.request) {
+      conn.request = std::unique_ptr<HttpRequest>(new HttpRequest(d_logprefix + to_string(getUniqueID()) + " "));
+    }
+
+    bool keepAlive = true;
+    try {
+      if (!conn.reader.getRequest(*conn.request)) {
+        break;
+      }
+      keepAlive = conn.reader.canBeReused();
+    }
+    catch (const YaHTTP::ParseError& e) {
+      // the request stays incomplete, we will answer with an error then close the connection
+      g_log<<Logger::Warning<<conn.request->logprefix<<"Unable to parse request: "<<e.what()<<endl;
+      keepAlive = false;
+    }
+
+    conn.output += d_ws.serveRequest(*conn.request, conn.remote, keepAlive);
+    conn.request.reset();
+    if (!keepAlive) {
+      conn.closeAfterWrite = true;
+    }
+  }
+
+  if (conn.outputPos < conn.output.size()) {
+    sendResponses(fd, conn);
+  }
+}
+
+void WebServerWorker::handleWritable(int fd, FDMultiplexer::funcparam_t&)
+{
+  auto it = d_connections.find(fd);
+  if (it == d_connections.end()) {
+    return;
   }
+  auto conn = it->second;
+  conn->ttd = time(nullptr) + d_idleTimeout;
+  sendResponses(fd, *conn);
+}
+
+void WebServerWorker::sendResponses(int fd, Connection& conn)
+{
+  while (conn.outputPos < conn.output.size()) {
+    ssize_t sent = write(fd, conn.output.data() + conn.outputPos, conn.output.size() - conn.outputPos);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        break;
+      }
+      closeConnection(fd, conn);
+      return;
+    }
+    conn.outputPos += sent;
+  }
+
+  if (conn.outputPos < conn.output.size()) {
+    if (!conn.writing) {
+      d_mplexer->removeReadFD(fd);
+      d_mplexer->addWriteFD(fd, boost::bind(&WebServerWorker::handleWritable, this, _1, _2));
+      conn.writing = true;
+    }
+    return;
+  }
+
+  conn.output.clear();
+  conn.outputPos = 0;
+  if (conn.closeAfterWrite) {
+    closeConnection(fd, conn);
+    return;
+  }
+
+  if (conn.writing) {
+    d_mplexer->removeWriteFD(fd);
+    d_mplexer->addReadFD(fd, boost::bind(&WebServerWorker::handleReadable, this, _1, _2));
+    conn.writing = false;
+  }
+}
+
+void WebServerWorker::expireConnections(time_t now)
+{
+  for (auto it = d_connections.begin(); it != d_connections.end(); ) {
+    auto conn = it->second;
+    int fd = it->first;
+    ++it;
+    if (conn->ttd < now) {
+      closeConnection(fd, *conn);
+    }
+  }
+}
+
+void WebServerWorker::closeConnection(int fd, Connection& conn)
+{
+  if (conn.writing) {
+    d_mplexer->removeWriteFD(fd);
+  }
+  else {
+    d_mplexer->removeReadFD(fd);
+  }
+  // the socket is closed when the last reference goes away
+  d_connections.erase(fd);
 }
 
 WebServer::WebServer(const string &listenaddress, int port) :
@@ -449,6 +741,12 @@ void WebServer::go()
   if(!d_server)
     return;
   try {
+    std::vector<std::unique_ptr<WebServerWorker>> workers;
+    for (unsigned int idx = 0; idx < std::max(d_workerThreads, 1U); idx++) {
+      workers.push_back(std::unique_ptr<WebServerWorker>(new WebServerWorker(*this, d_maxbodysize, d_idleTimeout, d_logprefix)));
+    }
+    size_t nextWorker = 0;
+
     while(true) {
       try {
         auto client = d_server->accept();
@@ -456,8 +754,7 @@ void WebServer::go()
           continue;
         }
         if (client->acl(d_acl)) {
-          std::thread webHandler(WebServerConnectionThreadStart, this, client);
-          webHandler.detach();
+          workers.at(nextWorker++ % workers.size())->passConnection(client);
         } else {
           ComboAddress remote;
           if (client->getRemote(remote))
@@ -20,12 +20,18 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #pragma once
+#include <array>
+#include <atomic>
 #include <map>
+#include <memory>
 #include <string>
 #include <list>
+#include <thread>
 #include <boost/utility.hpp>
 #include <yahttp/yahttp.hpp>
 #include "json11.hpp"
+#include "misc.hh"
+#include "mplexer.hh"
 #include "namespaces.hh"
 #include "sstuff.hh"
 
@@ -42,6 +48,64 @@ public:
   // checks password _only_.
   bool compareAuthorization(const string &expected_password);
   bool compareHeader(const string &header_name, const string &expected_value);
+  // whether the client would like to keep the connection open after this request
+  bool wantsKeepAlive() const;
+};
+
+/* Splits the data read from a connection into HTTP requests. The data following
+   the current request is kept for the next one, so that requests pipelined on a
+   kept-alive connection are not lost. */
+class HttpRequestReader
+{
+public:
+  HttpRequestReader(ssize_t maxSize) : d_maxSize(maxSize)
+  {
+  }
+
+  void feed(const char* data, size_t len)
+  {
+    d_buffer.append(data, len);
+  }
+
+  // returns true once 'req' is complete, the same request has to be passed until then. Throws YaHTTP::ParseError
+  bool getRequest(HttpRequest& req);
+
+  // whether the connection can be used for another request after the one that just completed
+  bool canBeReused() const
+  {
+    return !d_chunked;
+  }
+
+  // whether some data of a request that is not complete yet has been received
+  bool hasPartialRequest() const
+  {
+    return !d_buffer.empty() || d_headersDone;
+  }
+
+private:
+  YaHTTP::AsyncRequestLoader d_yarl;
+  std::string d_buffer;
+  ssize_t d_maxSize;
+  size_t d_bodyLeft{0};
+  bool d_started{false};
+  bool d_headersDone{false};
+  bool d_chunked{false};
+};
+
+/* Time spent handling the requests of a given endpoint */
+class WebServerLatencyHistogram
+{
+public:
+  static constexpr size_t s_boundsCount = 8;
+  // upper bounds of the buckets, in microseconds
+  static const std::array<uint64_t, s_boundsCount> s_bounds;
+
+  void account(uint64_t usec);
+  void toPrometheus(std::ostringstream& out, const std::string& name, const std::string& labels) const;
+
+private:
+  std::array<AtomicCounter, s_boundsCount + 1> d_buckets{};
+  AtomicCounter d_sum{0};
 };
 
 class HttpResponse: public YaHTTP::Response {
@@ -170,11 +234,30 @@ public:
     d_acl = nmg;
   }
 
+  // number of threads serving the connections, each of them handling several connections
+  void setWorkerThreads(unsigned int workers) {
+    d_workerThreads = workers;
+  }
+
+  // seconds a connection can stay idle between two requests, or while sending a request
+  void setIdleTimeout(unsigned int timeout) {
+    d_idleTimeout = timeout;
+  }
+
+  unsigned int getIdleTimeout() const {
+    return d_idleTimeout;
+  }
+
   void bind();
   void go();
 
-  void serveConnection(std::shared_ptr<Socket> client) const;
   void handleRequest(HttpRequest& request, HttpResponse& resp) const;
+  // handles a complete (or invalid) request, logs it and returns the serialized response.
+  // keepAlive is set to false if the connection should be closed once the response has been sent
+  string serveRequest(HttpRequest& req, const ComboAddress& remote, bool& keepAlive) const;
+
+  // appends the per-endpoint latency histograms, in the Prometheus text format
+  void getLatencyMetrics(std::ostringstream& out, const std::string& prefix) const;
 
   typedef boost::function<void(HttpRequest* req, HttpResponse* resp)> HandlerFunction;
   void registerApiHandler(const string& url, HandlerFunction handler, bool allowPassword=false);
@@ -236,8 +319,66 @@ protected:
 
   NetmaskGroup d_acl;
 
+  // keyed by the URL the handler has been registered for, filled before the server starts
+  std::map<std::string, std::unique_ptr<WebServerLatencyHistogram>> d_latencies;
+  unsigned int d_workerThreads{2};
+  unsigned int d_idleTimeout{5};
+
   const string d_logprefix = "[webserver] ";
 
   // Describes the amount of logging the webserver does
   WebServer::LogLevel d_loglevel{WebServer::LogLevel::Detailed};
 };
+
+/* Serves the connections handed over by the accepting thread, from a single thread.
+   Requests are handled as soon as they are complete, in the order they were received,
+   and connections are kept open between requests until they have been idle for too long.
+   The handlers are called from that thread, so a slow handler delays every other
+   connection served by the same worker until it returns. */
+class WebServerWorker : public boost::noncopyable
+{
+public:
+  WebServerWorker(const WebServer& ws, ssize_t maxBodySize, unsigned int idleTimeout, const string& logprefix);
+  // stops the thread and closes the connections it was serving
+  ~WebServerWorker();
+
+  // called from the accepting thread
+  void passConnection(std::shared_ptr<Socket>& client);
+
+private:
+  struct Connection
+  {
+    Connection(std::shared_ptr<Socket>& socket_, ssize_t maxBodySize): socket(socket_), reader(maxBodySize)
+    {
+    }
+
+    std::shared_ptr<Socket> socket;
+    ComboAddress remote;
+    HttpRequestReader reader;
+    std::unique_ptr<HttpRequest> request{nullptr};
+    string output;
+    size_t outputPos{0};
+    time_t ttd{0};
+    bool writing{false};
+    bool closeAfterWrite{false};
+  };
+
+  void run();
+  void handleNewConnections(int fd, FDMultiplexer::funcparam_t&);
+  void handleReadable(int fd, FDMultiplexer::funcparam_t&);
+  void handleRequests(int fd, Connection& conn);
+  void handleWritable(int fd, FDMultiplexer::funcparam_t&);
+  void sendResponses(int fd, Connection& conn);
+  void expireConnections(time_t now);
+  void closeConnection(int fd, Connection& conn);
+
+  const WebServer& d_ws;
+  std::unique_ptr<FDMultiplexer> d_mplexer;
+  std::map<int, std::shared_ptr<Connection>> d_connections;
+  const string d_logprefix;
+  const ssize_t d_maxBodySize;
+  const unsigned int d_idleTimeout;
+  std::thread d_thread;
+  std::atomic<bool> d_stop{false};
+  int d_pipe[2];
+};
@@ -79,6 +79,8 @@ AuthWebServer::AuthWebServer() :
     d_ws->setACL(acl);
 
     d_ws->setMaxBodySize(::arg().asNum("webserver-max-bodysize"));
+    d_ws->setWorkerThreads(::arg().asNum("webserver-threads"));
+    d_ws->setIdleTimeout(::arg().asNum("webserver-idle-timeout"));
 
     d_ws->bind();
   }
@@ -1768,6 +1770,7 @@ static void apiServerZoneDetail(HttpRequest* req, HttpResponse* resp) {
     // clear caches
     DNSSECKeeper::clearCaches(zonename);
     purgeAuthCaches(zonename.toString() + "$");
+    g_zoneCache.remove(zonename);
 
     // empty body on success
     resp->body = "";
@@ -2302,6 +2305,28 @@ void AuthWebServer::cssfunction(HttpRequest* req, HttpResponse* resp)
   resp->status = 200;
 }
 
+void AuthWebServer::prometheusMetrics(HttpRequest* req, HttpResponse* resp)
+{
+  if (req->method != "GET")
+    throw HttpMethodNotAllowedException();
+
+  std::ostringstream output;
+  for (const auto& name : S.getEntries()) {
+    std::string metricName = name;
+    std::replace(metricName.begin(), metricName.end(), '-', '_');
+    metricName = "pdns_auth_" + metricName;
+
+    output << "# HELP " << metricName << " " << S.getDescrip(name) << "\n";
+    output << "# TYPE " << metricName << " untyped" << "\n";
+    output << metricName << " " << S.read(name) << "\n";
+  }
+  d_ws->getLatencyMetrics(output, "pdns_auth_");
+
+  resp->body = output.str();
+  resp->headers["Content-Type"] = "text/plain";
+  resp->status = 200;
+}
+
 void AuthWebServer::webThread()
 {
   try {
@@ -2329,6 +2354,7 @@ void AuthWebServer::webThread()
     }
     if (::arg().mustDo("webserver")) {
       d_ws->registerWebHandler("/style.css", boost::bind(&AuthWebServer::cssfunction, this, _1, _2));
+      d_ws->registerWebHandler("/metrics", boost::bind(&AuthWebServer::prometheusMetrics, this, _1, _2));
       d_ws->registerWebHandler("/", boost::bind(&AuthWebServer::indexfunction, this, _1, _2));
     }
     d_ws->go();
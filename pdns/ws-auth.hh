@@ -82,6 +82,7 @@ private:
   static void *statThreadHelper(void *p);
   void indexfunction(HttpRequest* req, HttpResponse* resp);
   void cssfunction(HttpRequest* req, HttpResponse* resp);
+  void prometheusMetrics(HttpRequest* req, HttpResponse* resp);
   void jsonstat(HttpRequest* req, HttpResponse* resp);
   void registerApiHandler(const string& url, boost::function<void(HttpRequest*, HttpResponse*)> handler);
   void printvars(ostringstream &ret);
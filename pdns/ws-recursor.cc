@@ -422,7 +422,7 @@ static void apiServerRPZStats(HttpRequest* req, HttpResponse* resp) {
 }
 
 
-static void prometheusMetrics(HttpRequest *req, HttpResponse *resp) {
+static void prometheusMetrics(const WebServer* ws, HttpRequest *req, HttpResponse *resp) {
     static MetricDefinitionStorage s_metricDefinitions;
 
     if (req->method != "GET")
@@ -457,6 +457,7 @@ static void prometheusMetrics(HttpRequest *req, HttpResponse *resp) {
         }
         output << prometheusMetricName << " " << tup.second << "\n";
     }
+    ws->getLatencyMetrics(output, "pdns_recursor_");
 
     resp->body = output.str();
     resp->headers["Content-Type"] = "text/plain";
@@ -528,7 +529,7 @@ RecursorWebServer::RecursorWebServer(FDMultiplexer* fdm)
   for(const auto& u : g_urlmap) 
     d_ws->registerWebHandler("/"+u.first, serveStuff);
   d_ws->registerWebHandler("/", serveStuff);
-  d_ws->registerWebHandler("/metrics", prometheusMetrics);
+  d_ws->registerWebHandler("/metrics", boost::bind(&prometheusMetrics, d_ws.get(), _1, _2));
   d_ws->go();
 }
 
@@ -674,66 +675,62 @@ void AsyncServer::newConnection()
 
 // This is an entry point from FDM, so it needs to catch everything.
 void AsyncWebServer::serveConnection(std::shared_ptr<Socket> client) const {
-  const string logprefix = d_logprefix + to_string(getUniqueID()) + " ";
-
-  HttpRequest req(logprefix);
-  HttpResponse resp;
   ComboAddress remote;
-  string reply;
+  HttpRequestReader reader(d_maxbodysize);
+  bool keepAlive = true;
 
   try {
-    YaHTTP::AsyncRequestLoader yarl;
-    yarl.initialize(&req);
     client->setNonBlocking();
-
-    string data;
-    try {
-      while(!req.complete) {
-        int bytes = arecvtcp(data, 16384, client.get(), true);
-        if (bytes > 0) {
-          req.complete = yarl.feed(data);
-        } else {
-          // read error OR EOF
-          break;
-        }
-      }
-      yarl.finalize();
-    } catch (YaHTTP::ParseError &e) {
-      // request stays incomplete
-      g_log<<Logger::Warning<<logprefix<<"Unable to parse request: "<<e.what()<<endl;
-    }
-
     if (d_loglevel >= WebServer::LogLevel::None) {
       client->getRemote(remote);
     }
 
-    logRequest(req, remote);
+    // requests are answered in order, for as long as the client keeps the connection open
+    while (keepAlive) {
+      HttpRequest req(d_logprefix + to_string(getUniqueID()) + " ");
+      bool complete = false;
+      bool parseError = false;
 
-    WebServer::handleRequest(req, resp);
-    ostringstream ss;
-    resp.write(ss);
-    reply = ss.str();
+      try {
+        string data;
+        while (!(complete = reader.getRequest(req))) {
+          int bytes = arecvtcp(data, 16384, client.get(), true);
+          if (bytes <= 0) {
+            // read error OR EOF
+            break;
+          }
+          reader.feed(data.c_str(), data.size());
+        }
+      } catch (YaHTTP::ParseError &e) {
+        // request stays incomplete
+        g_log<<Logger::Warning<<req.logprefix<<"Unable to parse request: "<<e.what()<<endl;
+        parseError = true;
+      }
+
+      if (!complete && !parseError && !reader.hasPartialRequest()) {
+        // the client closed the connection, or went idle, between two requests
+        break;
+      }
 
-    logResponse(resp, remote, logprefix);
+      keepAlive = complete && reader.canBeReused();
+      string reply = serveRequest(req, remote, keepAlive);
 
-    // now send the reply
-    if (asendtcp(reply, client.get()) == -1 || reply.empty()) {
-      g_log<<Logger::Error<<logprefix<<"Failed sending reply to HTTP client"<<endl;
+      // now send the reply
+      if (asendtcp(reply, client.get()) == -1 || reply.empty()) {
+        g_log<<Logger::Error<<req.logprefix<<"Failed sending reply to HTTP client"<<endl;
+        break;
+      }
     }
   }
   catch(PDNSException &e) {
-    g_log<<Logger::Error<<logprefix<<"Exception: "<<e.reason<<endl;
+    g_log<<Logger::Error<<d_logprefix<<"Exception: "<<e.reason<<endl;
   }
   catch(std::exception &e) {
     if(strstr(e.what(), "timeout")==0)
-      g_log<<Logger::Error<<logprefix<<"STL Exception: "<<e.what()<<endl;
+      g_log<<Logger::Error<<d_logprefix<<"STL Exception: "<<e.what()<<endl;
   }
   catch(...) {
-    g_log<<Logger::Error<<logprefix<<"Unknown exception"<<endl;
-  }
-
-  if (d_loglevel >= WebServer::LogLevel::Normal) {
-    g_log<<Logger::Notice<<logprefix<<remote<<" \""<<req.method<<" "<<req.url.path<<" HTTP/"<<req.versionStr(req.version)<<"\" "<<resp.status<<" "<<reply.size()<<endl;
+    g_log<<Logger::Error<<d_logprefix<<"Unknown exception"<<endl;
   }
 }
 
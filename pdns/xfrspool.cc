@@ -0,0 +1,186 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "logger.hh"
+#include "misc.hh"
+#include "xfrspool.hh"
+
+XFRSpool::XFRSpool(bool useFile)
+{
+  if (!useFile) {
+    return;
+  }
+  d_fp = tmpfile();
+  if (!d_fp) {
+    g_log<<Logger::Warning<<"Unable to create a temporary file to store an incoming zone transfer, keeping it in memory instead: "<<stringerror()<<endl;
+  }
+}
+
+XFRSpool::~XFRSpool()
+{
+  if (d_fp) {
+    fclose(d_fp);
+  }
+}
+
+void XFRSpool::push(const DNSResourceRecord& rr)
+{
+  const auto& qname = rr.qname.getStorage();
+  append(static_cast<uint16_t>(qname.size()));
+  d_buffer.append(qname.data(), qname.size());
+  append(rr.qtype.getCode());
+  append(rr.qclass);
+  append(rr.ttl);
+  append(static_cast<uint32_t>(rr.content.size()));
+  d_buffer.append(rr.content);
+  d_count++;
+
+  if (d_fp && d_buffer.size() >= s_flushSize) {
+    flush();
+  }
+}
+
+void XFRSpool::rewind()
+{
+  if (d_fp) {
+    flush();
+    if (fseek(d_fp, 0, SEEK_SET) != 0) {
+      throw PDNSException("Unable to rewind the temporary file holding an incoming zone transfer: "+stringerror());
+    }
+  }
+  d_pos = 0;
+}
+
+bool XFRSpool::pop(DNSResourceRecord& rr)
+{
+  uint16_t qnameLen;
+  if (!read(&qnameLen, sizeof(qnameLen))) {
+    return false;
+  }
+  d_name.resize(qnameLen);
+  readOrThrow(&d_name.at(0), qnameLen);
+  rr.qname = DNSName(d_name.data(), d_name.size(), 0, false);
+
+  uint16_t qtype;
+  readOrThrow(&qtype, sizeof(qtype));
+  rr.qtype = qtype;
+  readOrThrow(&rr.qclass, sizeof(rr.qclass));
+  readOrThrow(&rr.ttl, sizeof(rr.ttl));
+  uint32_t contentLen;
+  readOrThrow(&contentLen, sizeof(contentLen));
+  rr.content.resize(contentLen);
+  if (contentLen > 0) {
+    readOrThrow(&rr.content.at(0), contentLen);
+  }
+  return true;
+}
+
+void XFRSpool::flush()
+{
+  if (!d_buffer.empty() && fwrite(d_buffer.data(), d_buffer.size(), 1, d_fp) != 1) {
+    throw PDNSException("Unable to write an incoming zone transfer to a temporary file: "+stringerror());
+  }
+  d_buffer.clear();
+}
+
+bool XFRSpool::read(void* dest, size_t len)
+{
+  if (d_fp) {
+    return len == 0 || fread(dest, len, 1, d_fp) == 1;
+  }
+  if (d_buffer.size() - d_pos < len) {
+    return false;
+  }
+  memcpy(dest, d_buffer.data() + d_pos, len);
+  d_pos += len;
+  return true;
+}
+
+void XFRSpool::readOrThrow(void* dest, size_t len)
+{
+  if (!read(dest, len)) {
+    throw PDNSException("Truncated record while reading back an incoming zone transfer");
+  }
+}
+
+bool processRecordForZS(const DNSName& domain, bool& firstNSEC3, DNSResourceRecord& rr, ZoneStatus& zs)
+{
+  switch(rr.qtype.getCode()) {
+  case QType::NSEC3PARAM: 
+    zs.ns3pr = NSEC3PARAMRecordContent(rr.content);
+    zs.isDnssecZone = zs.isNSEC3 = true;
+    zs.isNarrow = false;
+    return false;
+  case QType::NSEC3: {
+    NSEC3RecordContent ns3rc(rr.content);
+    if (firstNSEC3) {
+      zs.isDnssecZone = zs.isPresigned = true;
+      firstNSEC3 = false;
+    } else if (zs.optOutFlag != (ns3rc.d_flags & 1))
+      throw PDNSException("Zones with a mixture of Opt-Out NSEC3 RRs and non-Opt-Out NSEC3 RRs are not supported.");
+    zs.optOutFlag = ns3rc.d_flags & 1;
+    if (ns3rc.isSet(QType::NS) && !(rr.qname==domain)) {
+      DNSName hashPart = rr.qname.makeRelative(domain);
+      zs.secured.insert(hashPart);
+    }
+    return false;
+  }
+  
+  case QType::NSEC: 
+    zs.isDnssecZone = zs.isPresigned = true;
+    return false;
+  
+  case QType::NS: 
+    if(rr.qname!=domain)
+      zs.nsset.insert(rr.qname);
+    break;
+  }
+
+  zs.qnames.insert(rr.qname);
+
+  rr.domain_id=zs.domain_id;
+  return true;
+}
+
+void spoolAXFRFromIXFR(const DNSName& domain, std::vector<DNSRecord>& axfr, ZoneStatus& zs, XFRSpool& rrs)
+{
+  bool firstNSEC3{true};
+  for (auto& dr : axfr) {
+    auto rr = DNSResourceRecord::fromWire(dr);
+    (rr.qname += domain).makeUsLowerCase();
+    rr.domain_id = zs.domain_id;
+    if (dr.d_type == QType::SOA) {
+      auto sd = getRR<SOARecordContent>(dr);
+      zs.soa_serial = sd->d_st.serial;
+    }
+    // the parsed content is not needed anymore once the record has been spooled
+    dr.d_content.reset();
+    if (!processRecordForZS(domain, firstNSEC3, rr, zs)) {
+      continue;
+    }
+    rrs.push(rr);
+  }
+  std::vector<DNSRecord>().swap(axfr);
+}
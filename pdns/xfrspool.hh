@@ -0,0 +1,102 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+#include <cstdio>
+#include <set>
+#include <string>
+#include <vector>
+#include <boost/utility.hpp>
+
+#include "dnsbackend.hh"
+#include "dnsrecords.hh"
+
+/* What we learn about a zone while receiving it, needed to compute 'auth' and
+   'ordername' once the transfer is complete */
+struct ZoneStatus
+{
+  bool isDnssecZone{false};
+  bool isPresigned{false};
+  bool isNSEC3 {false};
+  bool optOutFlag {false};
+  NSEC3PARAMRecordContent ns3pr;
+
+  bool isNarrow{false};
+  unsigned int soa_serial{0};
+  std::set<DNSName> nsset, qnames, secured;
+  uint32_t domain_id;
+  int numDeltas{0};
+};
+
+/* Holds the records of an incoming transfer until the whole zone has been
+   received, and we know enough about it to compute 'auth' and 'ordername'.
+   Records are serialized in a compact form into an anonymous temporary file,
+   so that the memory used by the records themselves does not depend on the
+   size of the zone. If no such file can be created, in a chroot without /tmp
+   for example, the serialized records are kept in memory instead. */
+class XFRSpool : public boost::noncopyable
+{
+public:
+  XFRSpool(bool useFile=true);
+  ~XFRSpool();
+
+  void push(const DNSResourceRecord& rr);
+  /* done writing, records can now be read back in the order they were pushed */
+  void rewind();
+  bool pop(DNSResourceRecord& rr);
+
+  size_t size() const
+  {
+    return d_count;
+  }
+
+  bool empty() const
+  {
+    return d_count == 0;
+  }
+
+  bool isInMemory() const
+  {
+    return d_fp == nullptr;
+  }
+
+private:
+  template<typename T> void append(T value)
+  {
+    d_buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void flush();
+  bool read(void* dest, size_t len);
+  void readOrThrow(void* dest, size_t len);
+
+  static const size_t s_flushSize = 1024*1024;
+  std::string d_buffer;
+  std::string d_name;
+  FILE* d_fp{nullptr};
+  size_t d_pos{0};
+  size_t d_count{0};
+};
+
+/* updates 'zs' with what 'rr' tells us about the zone, returning false if the record should not be stored */
+bool processRecordForZS(const DNSName& domain, bool& firstNSEC3, DNSResourceRecord& rr, ZoneStatus& zs);
+/* spools the records of an IXFR answered with the full zone, as returned by getIXFRDeltas(), emptying 'axfr' */
+void spoolAXFRFromIXFR(const DNSName& domain, std::vector<DNSRecord>& axfr, ZoneStatus& zs, XFRSpool& rrs);
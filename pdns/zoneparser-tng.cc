@@ -35,6 +35,7 @@
 #include <deque>
 #include <boost/algorithm/string.hpp>
 #include <system_error>
+#include <sys/stat.h>
 
 static string g_INstr("IN");
 
@@ -61,19 +62,113 @@ void ZoneParserTNG::stackFile(const std::string& fname)
     throw std::system_error(ec, "Unable to open file '"+fname+"': "+stringerror());
   }
 
-  filestate fs(fp, fname);
-  d_filestates.push(fs);
+  d_filestates.push(filestate(fp, fname));
   d_fromfile = true;
 }
 
+void ZoneParserTNG::filestate::close()
+{
+  fclose(d_fp);
+}
+
+/* Reads the file in large chunks with read() and looks for the end of lines with memchr(),
+   instead of going through stdio. Unlike a mapping, this is safe if the file is truncated
+   while we are parsing it: we will just see a shorter file. */
+bool ZoneParserTNG::filestate::getLine(string& line)
+{
+  for(;;) {
+    const char* start = d_buffer.data() + d_bufferPos;
+    size_t avail = d_buffer.size() - d_bufferPos;
+    const char* eol = static_cast<const char*>(memchr(start, '\n', avail));
+    if(eol) {
+      size_t len = eol - start + 1;
+      line.assign(start, len);
+      d_bufferPos += len;
+      return true;
+    }
+    if(d_eof) {
+      if(avail == 0) {
+        return false;
+      }
+      // last line, without a trailing newline
+      line.assign(start, avail);
+      d_bufferPos += avail;
+      return true;
+    }
+
+    // keep the beginning of the current line, then read more
+    d_buffer.erase(0, d_bufferPos);
+    d_bufferPos = 0;
+    size_t used = d_buffer.size();
+    d_buffer.resize(used + s_readSize);
+    ssize_t got;
+    do {
+      got = read(fileno(d_fp), &d_buffer.at(used), s_readSize);
+    }
+    while(got < 0 && errno == EINTR);
+    if(got < 0) {
+      std::error_code ec (errno,std::generic_category());
+      throw std::system_error(ec, "Error reading from file '"+d_filename+"': "+stringerror());
+    }
+    d_buffer.resize(used + got);
+    if(got == 0) {
+      d_eof = true;
+    }
+  }
+}
+
 ZoneParserTNG::~ZoneParserTNG()
 {
   while(!d_filestates.empty()) {
-    fclose(d_filestates.top().d_fp);
+    d_filestates.top().close();
     d_filestates.pop();
   }
 }
 
+static inline bool isZoneSpace(char c)
+{
+  return c==' ' || c=='\t' || c=='\r' || c=='\n' || c=='\x1a';
+}
+
+static void trimRight(string& str)
+{
+  string::size_type len = str.size();
+  while(len > 0 && isZoneSpace(str[len-1]))
+    len--;
+  str.resize(len);
+}
+
+/* splits a line on the same delimiters as vstringtok(), without searching
+   the list of delimiters for every character */
+static void tokenizeLine(ZoneParserTNG::parts_t& parts, const string& line)
+{
+  const char* data = line.data();
+  const string::size_type len = line.size();
+  string::size_type pos = 0;
+
+  while(pos < len) {
+    while(pos < len && (data[pos]==' ' || data[pos]=='\t' || data[pos]=='\n'))
+      pos++;
+    if(pos == len)
+      return;
+
+    string::size_type start = pos;
+    while(pos < len && data[pos]!=' ' && data[pos]!='\t' && data[pos]!='\n')
+      pos++;
+    parts.push_back(make_pair(start, pos));
+    pos++;
+  }
+}
+
+static void trimBoth(string& str)
+{
+  trimRight(str);
+  string::size_type pos = 0;
+  while(pos < str.size() && isZoneSpace(str[pos]))
+    pos++;
+  str.erase(0, pos);
+}
+
 static string makeString(const string& line, const pair<string::size_type, string::size_type>& range)
 {
   return string(line.c_str() + range.first, range.second - range.first);
@@ -242,6 +337,8 @@ static void chopComment(string& line)
 
 static bool findAndElide(string& line, char c)
 {
+  if(line.find(c)==string::npos)
+    return false;
   string::size_type pos, len = line.length();
   bool inQuote=false;
   for(pos = 0 ; pos < len; ++pos) {
@@ -289,14 +386,14 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
   if(!getTemplateLine() && !getLine())
     return false;
 
-  boost::trim_right_if(d_line, is_any_of(" \t\r\n\x1a"));
+  trimRight(d_line);
   if(comment)
     comment->clear();
   if(comment && d_line.find(';') != string::npos)
     *comment = d_line.substr(d_line.find(';'));
 
   d_parts.clear();
-  vstringtok(d_parts, d_line);
+  tokenizeLine(d_parts, d_line);
 
   if(d_parts.empty())
     goto retry;
@@ -379,7 +476,7 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
   while(!d_parts.empty()) {
     range=d_parts.front();
     d_parts.pop_front();
-    nextpart=makeString(d_line, range);
+    nextpart.assign(d_line, range.first, range.second - range.first);
     if(nextpart.empty())
       break;
 
@@ -422,7 +519,7 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
   //  rr.content=d_line.substr(range.first);
   rr.content.assign(d_line, range.first, string::npos);
   chopComment(rr.content);
-  trim_if(rr.content, is_any_of(" \r\n\t\x1a"));
+  trimBoth(rr.content);
 
   if(rr.content.size()==1 && rr.content[0]=='@')
     rr.content=d_zonename.toString();
@@ -441,7 +538,7 @@ bool ZoneParserTNG::get(DNSResourceRecord& rr, std::string* comment)
       }
     }
   }
-  trim_if(rr.content, is_any_of(" \r\n\t\x1a"));
+  trimBoth(rr.content);
 
   vector<string> recparts;
   switch(rr.qtype.getCode()) {
@@ -552,11 +649,12 @@ bool ZoneParserTNG::getLine()
     return false;
   }
   while(!d_filestates.empty()) {
-    if(stringfgets(d_filestates.top().d_fp, d_line)) {
-      d_filestates.top().d_lineno++;
+    filestate& fs = d_filestates.top();
+    if(fs.getLine(d_line)) {
+      fs.d_lineno++;
       return true;
     }
-    fclose(d_filestates.top().d_fp);
+    fs.close();
     d_filestates.pop();
   }
   return false;
@@ -56,8 +56,14 @@ private:
 
   struct filestate {
     filestate(FILE* fp, string filename) : d_fp(fp), d_filename(filename), d_lineno(0){}
+    bool getLine(string& line);
+    void close();
     FILE *d_fp;
     string d_filename;
+    string d_buffer;
+    size_t d_bufferPos{0};
+    bool d_eof{false};
+    static const size_t s_readSize{65536};
     int d_lineno;
   };
 
@@ -1,5 +1,6 @@
 #!/usr/bin/env python
 import base64
+import threading
 import time
 import dns
 from dnsdisttests import DNSDistTest
@@ -175,3 +176,102 @@ class TestHealthCheckCustomFunction(HealthCheckTest):
         time.sleep(1.5)
         self.assertGreater(TestHealthCheckCustomFunction._healthCheckCounter, before)
         self.assertEquals(self.getBackendStatus(), 'up')
+
+backoffChecks = []
+
+def backoffCallback(request):
+    # record when each check is received, the counter alone can't tell the intervals apart
+    backoffChecks.append(time.time())
+    response = dns.message.make_response(request)
+    return response.to_wire()
+
+class TestHealthCheckBackoff(HealthCheckTest):
+    # this test suite uses a different responder port
+    # because we need fresh counters
+    _testServerPort = 5386
+
+    _config_template = """
+    setKey("%s")
+    controlSocket("127.0.0.1:%d")
+    newServer{address="127.0.0.1:%d", checkInterval=1, maxCheckInterval=4}
+    """
+
+    @classmethod
+    def startResponders(cls):
+        print("Launching responders..")
+
+        cls._UDPResponder = threading.Thread(name='UDP Responder', target=cls.UDPResponder, args=[cls._testServerPort, cls._toResponderQueue, cls._fromResponderQueue, False, backoffCallback])
+        cls._UDPResponder.setDaemon(True)
+        cls._UDPResponder.start()
+
+    def testBackoff(self):
+        """
+        HealthChecks: Back off for a healthy backend
+        """
+        # the initial check, then the scheduled ones
+        expectedChecks = 5
+        deadline = time.time() + 20
+        while len(backoffChecks) < expectedChecks and time.time() < deadline:
+            time.sleep(0.1)
+
+        self.assertGreaterEqual(len(backoffChecks), expectedChecks)
+        self.assertEquals(self.getBackendStatus(), 'up')
+
+        # skip the initial check, sent at startup regardless of the schedule
+        scheduled = backoffChecks[1:expectedChecks]
+        intervals = [later - earlier for earlier, later in zip(scheduled, scheduled[1:])]
+        # the interval is doubled after every successful check: 2, then capped to maxCheckInterval
+        self.assertGreater(intervals[0], 1.5)
+        self.assertLess(intervals[0], 2.5)
+        for interval in intervals[1:]:
+            self.assertGreater(interval, 3.5)
+            self.assertLess(interval, 4.5)
+
+tcpChecks = []
+udpChecks = []
+
+def tcpCheckCallback(request):
+    tcpChecks.append(request.id)
+    response = dns.message.make_response(request)
+    return response.to_wire()
+
+def udpCheckCallback(request):
+    # the checks are supposed to use TCP, so don't answer
+    udpChecks.append(request.id)
+    return None
+
+class TestHealthCheckTCP(HealthCheckTest):
+    # this test suite uses a different responder port
+    # because we need fresh counters
+    _testServerPort = 5387
+
+    _config_template = """
+    setKey("%s")
+    controlSocket("127.0.0.1:%d")
+    newServer{address="127.0.0.1:%d", checkTCP=true}
+    """
+
+    @classmethod
+    def startResponders(cls):
+        print("Launching responders..")
+
+        cls._UDPResponder = threading.Thread(name='UDP Responder', target=cls.UDPResponder, args=[cls._testServerPort, cls._toResponderQueue, cls._fromResponderQueue, False, udpCheckCallback])
+        cls._UDPResponder.setDaemon(True)
+        cls._UDPResponder.start()
+        cls._TCPResponder = threading.Thread(name='TCP Responder', target=cls.TCPResponder, args=[cls._testServerPort, cls._toResponderQueue, cls._fromResponderQueue, False, False, tcpCheckCallback])
+        cls._TCPResponder.setDaemon(True)
+        cls._TCPResponder.start()
+
+    def testTCP(self):
+        """
+        HealthChecks: Over TCP
+        """
+        # the responder closes the connection after every answer, so this also covers reconnecting
+        expectedChecks = 3
+        deadline = time.time() + 10
+        while len(tcpChecks) < expectedChecks and time.time() < deadline:
+            time.sleep(0.1)
+
+        self.assertGreaterEqual(len(tcpChecks), expectedChecks)
+        self.assertEquals(len(udpChecks), 0)
+        self.assertEquals(self.getBackendStatus(), 'up')
@@ -0,0 +1,234 @@
+#!/usr/bin/env python
+import socket
+import struct
+import threading
+import time
+import dns
+import requests
+from dnsdisttests import DNSDistTest
+
+def handleBackendConnection(conn):
+    conn.settimeout(5.0)
+    while True:
+        data = conn.recv(2)
+        if not data:
+            break
+        (datalen,) = struct.unpack("!H", data)
+        data = conn.recv(datalen)
+        request = dns.message.from_wire(data)
+        response = dns.message.make_response(request)
+        name = str(request.question[0].name)
+        if name.startswith('slow.'):
+            time.sleep(1)
+        elif name.startswith('veryslow.'):
+            time.sleep(3)
+        rrset = dns.rrset.from_text(request.question[0].name,
+                                    3600,
+                                    dns.rdataclass.IN,
+                                    dns.rdatatype.A,
+                                    '192.0.2.1')
+        response.answer.append(rrset)
+        wire = response.to_wire()
+        conn.send(struct.pack("!H", len(wire)))
+        conn.send(wire)
+    conn.close()
+
+def pipeliningTCPResponder(port):
+    # contrary to the default responder, every connection is handled
+    # in its own thread so that a slow query does not delay the other ones
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+    sock.bind(("127.0.0.1", port))
+    sock.listen(100)
+    while True:
+        (conn, _) = sock.accept()
+        thread = threading.Thread(name='Connection Handler', target=handleBackendConnection, args=[conn])
+        thread.setDaemon(True)
+        thread.start()
+
+    sock.close()
+
+class TestTCPPipelining(DNSDistTest):
+
+    _testServerPort = 5420
+    _serverKey = 'server.key'
+    _serverCert = 'server.chain'
+    _serverName = 'tls.tests.dnsdist.org'
+    _caCert = 'ca.pem'
+    _tlsServerPort = 8463
+    _config_template = """
+    newServer{address="127.0.0.1:%s"}
+    addTLSLocal("127.0.0.1:%s", "%s", "%s", { maxInFlight=10 })
+    addAction("spoofed.pipelining.tests.powerdns.com.", SpoofAction("192.0.2.2"))
+    """
+    _config_params = ['_testServerPort', '_tlsServerPort', '_serverCert', '_serverKey']
+
+    @classmethod
+    def startResponders(cls):
+        print("Launching responders..")
+
+        cls._UDPResponder = threading.Thread(name='UDP Responder', target=cls.UDPResponder, args=[cls._testServerPort, cls._toResponderQueue, cls._fromResponderQueue])
+        cls._UDPResponder.setDaemon(True)
+        cls._UDPResponder.start()
+
+        cls._TCPResponder = threading.Thread(name='TCP Responder', target=pipeliningTCPResponder, args=[cls._testServerPort])
+        cls._TCPResponder.setDaemon(True)
+        cls._TCPResponder.start()
+
+    def testOutOfOrderResponses(self):
+        """
+        TCP Pipelining: Responses are sent as soon as they are available
+        """
+        conn = self.openTLSConnection(self._tlsServerPort, self._serverName, self._caCert)
+
+        slowQuery = dns.message.make_query('slow.pipelining.tests.powerdns.com.', 'A', 'IN', use_edns=False)
+        self.sendTCPQueryOverConnection(conn, slowQuery)
+        fastQueries = {}
+        for idx in range(5):
+            query = dns.message.make_query('fast-%d.pipelining.tests.powerdns.com.' % (idx), 'A', 'IN', use_edns=False)
+            fastQueries[query.id] = query
+            self.sendTCPQueryOverConnection(conn, query)
+
+        for idx in range(5):
+            response = self.recvTCPResponseOverConnection(conn, timeout=5.0)
+            self.assertTrue(response)
+            self.assertIn(response.id, fastQueries)
+            self.assertEquals(response.question, fastQueries[response.id].question)
+            del fastQueries[response.id]
+
+        response = self.recvTCPResponseOverConnection(conn, timeout=5.0)
+        self.assertTrue(response)
+        self.assertEquals(response.id, slowQuery.id)
+        self.assertEquals(response.question, slowQuery.question)
+
+        conn.close()
+
+    def testSelfGeneratedResponseNotDelayed(self):
+        """
+        TCP Pipelining: A self-generated response does not wait for a slow backend
+        """
+        conn = self.openTLSConnection(self._tlsServerPort, self._serverName, self._caCert)
+
+        slowQuery = dns.message.make_query('slow.pipelining.tests.powerdns.com.', 'A', 'IN', use_edns=False)
+        self.sendTCPQueryOverConnection(conn, slowQuery)
+        spoofedQuery = dns.message.make_query('spoofed.pipelining.tests.powerdns.com.', 'A', 'IN', use_edns=False)
+        self.sendTCPQueryOverConnection(conn, spoofedQuery)
+
+        response = self.recvTCPResponseOverConnection(conn, timeout=5.0)
+        self.assertTrue(response)
+        self.assertEquals(response.id, spoofedQuery.id)
+
+        response = self.recvTCPResponseOverConnection(conn, timeout=5.0)
+        self.assertTrue(response)
+        self.assertEquals(response.id, slowQuery.id)
+
+        conn.close()
+
+class TestTCPPipeliningInFlightLimit(DNSDistTest):
+
+    _testServerPort = 5421
+    _serverKey = 'server.key'
+    _serverCert = 'server.chain'
+    _serverName = 'tls.tests.dnsdist.org'
+    _caCert = 'ca.pem'
+    _tlsServerPort = 8464
+    _webTimeout = 2.0
+    _webServerPort = 8083
+    _webServerBasicAuthPassword = 'secret'
+    _webServerAPIKey = 'apisecret'
+    _tcpRecvTimeout = 1
+    _config_template = """
+    newServer{address="127.0.0.1:%s"}
+    addTLSLocal("127.0.0.1:%s", "%s", "%s", { maxInFlight=2 })
+    setTCPRecvTimeout(%s)
+    webserver("127.0.0.1:%s", "%s", "%s")
+    """
+    _config_params = ['_testServerPort', '_tlsServerPort', '_serverCert', '_serverKey', '_tcpRecvTimeout', '_webServerPort', '_webServerBasicAuthPassword', '_webServerAPIKey']
+
+    @classmethod
+    def startResponders(cls):
+        print("Launching responders..")
+
+        cls._UDPResponder = threading.Thread(name='UDP Responder', target=cls.UDPResponder, args=[cls._testServerPort, cls._toResponderQueue, cls._fromResponderQueue])
+        cls._UDPResponder.setDaemon(True)
+        cls._UDPResponder.start()
+
+        cls._TCPResponder = threading.Thread(name='TCP Responder', target=pipeliningTCPResponder, args=[cls._testServerPort])
+        cls._TCPResponder.setDaemon(True)
+        cls._TCPResponder.start()
+
+    def getTLSFrontend(self):
+        headers = {'x-api-key': self._webServerAPIKey}
+        url = 'http://127.0.0.1:' + str(self._webServerPort) + '/api/v1/servers/localhost'
+        r = requests.get(url, headers=headers, timeout=self._webTimeout)
+        self.assertTrue(r)
+        self.assertEquals(r.status_code, 200)
+        content = r.json()
+        for frontend in content['frontends']:
+            if frontend['type'] == 'TCP (DNS over TLS)':
+                return frontend
+        self.fail('No DNS over TLS frontend found')
+
+    def testInFlightLimit(self):
+        """
+        TCP Pipelining: No new query is read while the maximum number of queries are in flight
+        """
+        before = self.getTLSFrontend()
+        conn = self.openTLSConnection(self._tlsServerPort, self._serverName, self._caCert)
+
+        slowQueries = {}
+        for idx in range(2):
+            query = dns.message.make_query('slow.%d.inflight.pipelining.tests.powerdns.com.' % (idx), 'A', 'IN', use_edns=False)
+            slowQueries[query.id] = query
+            self.sendTCPQueryOverConnection(conn, query)
+        fastQuery = dns.message.make_query('fast.inflight.pipelining.tests.powerdns.com.', 'A', 'IN', use_edns=False)
+        self.sendTCPQueryOverConnection(conn, fastQuery)
+
+        # the fast query is only read once one of the slow ones has been answered
+        response = self.recvTCPResponseOverConnection(conn, timeout=5.0)
+        self.assertTrue(response)
+        self.assertIn(response.id, slowQueries)
+        del slowQueries[response.id]
+
+        responses = {}
+        for idx in range(2):
+            response = self.recvTCPResponseOverConnection(conn, timeout=5.0)
+            self.assertTrue(response)
+            responses[response.id] = response
+        self.assertIn(fastQuery.id, responses)
+        for queryID in slowQueries:
+            self.assertIn(queryID, responses)
+
+        conn.close()
+
+        after = self.getTLSFrontend()
+        # the second slow query and the fast one were read while other queries were in flight
+        self.assertGreaterEqual(after['tcpPipelinedQueries'] - before['tcpPipelinedQueries'], 2)
+        self.assertGreaterEqual(after['tcpInFlightLimitReached'] - before['tcpInFlightLimitReached'], 1)
+
+    def testNoClientTimeoutWhileQueriesInFlight(self):
+        """
+        TCP Pipelining: The client is not timed out while waiting for a slow backend
+        """
+        before = self.getTLSFrontend()
+        conn = self.openTLSConnection(self._tlsServerPort, self._serverName, self._caCert)
+
+        # the backend takes longer than the TCP receive timeout to answer
+        query = dns.message.make_query('veryslow.timeout.pipelining.tests.powerdns.com.', 'A', 'IN', use_edns=False)
+        self.sendTCPQueryOverConnection(conn, query)
+        response = self.recvTCPResponseOverConnection(conn, timeout=5.0)
+        self.assertTrue(response)
+        self.assertEquals(response.id, query.id)
+
+        # and the connection is still usable afterwards
+        query = dns.message.make_query('fast.timeout.pipelining.tests.powerdns.com.', 'A', 'IN', use_edns=False)
+        self.sendTCPQueryOverConnection(conn, query)
+        response = self.recvTCPResponseOverConnection(conn, timeout=5.0)
+        self.assertTrue(response)
+        self.assertEquals(response.id, query.id)
+
+        conn.close()
+
+        after = self.getTLSFrontend()
+        self.assertEquals(after['tcpClientTimeouts'], before['tcpClientTimeouts'])
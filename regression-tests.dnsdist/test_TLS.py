@@ -1,5 +1,6 @@
 #!/usr/bin/env python
 import dns
+import requests
 from dnsdisttests import DNSDistTest
 
 class TestTLS(DNSDistTest):
@@ -195,3 +196,69 @@ class TestDOTWithCache(DNSDistTest):
             self.sendTCPQueryOverConnection(conn, query, response=None)
             receivedResponse = self.recvTCPResponseOverConnection(conn, useQueue=False)
             self.assertEquals(receivedResponse, response)
+
+class TestDOTKTLS(DNSDistTest):
+
+    _serverKey = 'server.key'
+    _serverCert = 'server.chain'
+    _serverName = 'tls.tests.dnsdist.org'
+    _caCert = 'ca.pem'
+    _tlsServerPort = 8453
+    _webTimeout = 2.0
+    _webServerPort = 8083
+    _webServerBasicAuthPassword = 'secret'
+    _webServerAPIKey = 'apisecret'
+    _config_template = """
+    newServer{address="127.0.0.1:%s"}
+
+    addTLSLocal("127.0.0.1:%s", "%s", "%s", {ktls=true})
+
+    webserver("127.0.0.1:%s", "%s", "%s")
+    """
+    _config_params = ['_testServerPort', '_tlsServerPort', '_serverCert', '_serverKey', '_webServerPort', '_webServerBasicAuthPassword', '_webServerAPIKey']
+
+    def testDOTKTLS(self):
+        """
+        DOT with kTLS: Check that queries are answered, whether the kernel supports kTLS or not
+        """
+        name = 'ktls.dot.tests.powerdns.com.'
+        query = dns.message.make_query(name, 'A', 'IN', use_edns=False)
+        response = dns.message.make_response(query)
+        rrset = dns.rrset.from_text(name,
+                                    3600,
+                                    dns.rdataclass.IN,
+                                    dns.rdatatype.A,
+                                    '127.0.0.1')
+        response.answer.append(rrset)
+
+        for _ in range(2):
+            conn = self.openTLSConnection(self._tlsServerPort, self._serverName, self._caCert)
+            self.sendTCPQueryOverConnection(conn, query, response=response)
+            (receivedQuery, receivedResponse) = self.recvTCPResponseOverConnection(conn, useQueue=True)
+            conn.close()
+            self.assertTrue(receivedQuery)
+            self.assertTrue(receivedResponse)
+            receivedQuery.id = query.id
+            self.assertEquals(query, receivedQuery)
+            self.assertEquals(response, receivedResponse)
+
+    def testDOTKTLSMetrics(self):
+        """
+        DOT with kTLS: Check that the kTLS sessions counter is exported
+        """
+        url = 'http://127.0.0.1:' + str(self._webServerPort) + '/metrics'
+        r = requests.get(url, auth=('whatever', self._webServerBasicAuthPassword), timeout=self._webTimeout)
+        self.assertTrue(r)
+        self.assertEquals(r.status_code, 200)
+        self.assertIn('dnsdist_frontend_tlsktlssessions{', r.text)
+
+        headers = {'x-api-key': self._webServerAPIKey}
+        url = 'http://127.0.0.1:' + str(self._webServerPort) + '/api/v1/servers/localhost'
+        r = requests.get(url, headers=headers, timeout=self._webTimeout)
+        self.assertTrue(r)
+        self.assertEquals(r.status_code, 200)
+        content = r.json()
+        tlsFrontends = [frontend for frontend in content['frontends'] if frontend['type'] == 'TCP (DNS over TLS)']
+        self.assertEquals(len(tlsFrontends), 1)
+        self.assertIn('tlsKTLSSessions', tlsFrontends[0])
+        self.assertTrue(tlsFrontends[0]['tlsKTLSSessions'] >= 0)